@@ -0,0 +1,28 @@
+/*!
+ * @brief Simple Brainf**k Compiler for all targets
+ *
+ * 出力形式は --target オプションで選ぶ．
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include "driver.hpp"
+
+
+/*!
+ * @brief このプログラムのエントリポイント
+ *
+ * @param [in] argc  コマンドライン引数の数
+ * @param [in] argv  コマンドライン引数
+ * @return  終了ステータス
+ */
+int
+main(int argc, char* argv[])
+{
+#ifdef _WIN32
+  return bfc::runCompiler(argc, argv, bfc::Target::PeX64);
+#else
+  return bfc::runCompiler(argc, argv, bfc::Target::ElfX64);
+#endif  // _WIN32
+}
@@ -0,0 +1,361 @@
+/*!
+ * @brief Simple Brainf**k Compiler のコンパイルサーバに要求を送るクライアント
+ *
+ * 多数の小さなソースを続けてコンパイルする際の起動コストを抑えるため，
+ * iostream やコンパイラ本体は用いず，ソースの送信と応答の受信のみを行う．
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "bfcompiler.hpp"
+#include "protocol.hpp"
+
+
+namespace
+{
+//! ソースコードと生成したバイナリを転送する単位
+constexpr std::size_t kChunkSize = 64 * 1024;
+
+
+/*!
+ * @brief コマンドラインで指定された設定
+ */
+struct ClientConfig
+{
+  //! 出力形式
+  bfc::Target target = bfc::Target::ElfX64;
+  //! 再配置可能オブジェクトファイルを出力するかどうか
+  bool isObject = false;
+  //! セクションヘッダ等を省いた最小限の実行ファイルを出力するかどうか
+  bool isTiny = false;
+  //! Brainf**kのソースファイルのパス ("-" のときは標準入力)
+  std::string srcFilePath{};
+  //! 出力ファイルのパス (空のときは出力形式に応じた既定値，"-" のときは標準出力)
+  std::string dstFilePath{};
+  //! ソケットファイルのパス (空のときは既定値を用いる)
+  std::string socketPath{};
+};
+
+
+/*!
+ * @brief 使い方を表示する
+ *
+ * @param [in] progName  プログラム名
+ */
+inline void
+showUsage(const char* progName)
+{
+  std::printf(
+    "Usage: %s [OPTIONS] SOURCE\n"
+    "Compile Brainf**k SOURCE (\"-\" for stdin) on a running compile server (bfc --serve).\n"
+    "\n"
+    "Options:\n"
+    "  -o FILE     Write the output to FILE (default: ./a.out, ./a.o or ./a.exe);\n"
+    "              \"-\" writes it to stdout\n"
+    "  -t TARGET   Output format: elf64 (default), elf32, pe64 or pe32\n"
+    "  -c          Emit a relocatable object exposing bf_run() instead of an executable\n"
+    "              (x64 ELF only)\n"
+    "  --tiny      Emit a minimal executable without section headers or symbols\n"
+    "              (ELF only)\n"
+    "  -s, --socket PATH\n"
+    "              Connect to PATH (default: $XDG_RUNTIME_DIR/bfcompiler.sock\n"
+    "              or /tmp/bfcompiler-UID.sock)\n"
+    "  -h, --help  Show this help and exit\n",
+    progName);
+}
+
+
+/*!
+ * @brief コマンドライン引数を解析する
+ *
+ * @param [in] argc  コマンドライン引数の数
+ * @param [in] argv  コマンドライン引数
+ * @param [out] config  解析結果
+ * @return 処理を続行する場合は -1，そうでなければ終了ステータス
+ */
+inline int
+parseArguments(int argc, char* argv[], ClientConfig& config)
+{
+  for (int i = 1; i < argc; i++) {
+    const std::string_view arg{argv[i]};
+    if (arg == "-h" || arg == "--help") {
+      showUsage(argv[0]);
+      return 0;
+    } else if (arg == "-o" || arg == "-t" || arg == "-s" || arg == "--socket") {
+      if (++i >= argc) {
+        std::fprintf(stderr, "Option %s requires an argument\n", argv[i - 1]);
+        return 1;
+      }
+      if (arg == "-o") {
+        config.dstFilePath = argv[i];
+      } else if (arg == "-t") {
+        if (!bfc::parseTarget(argv[i], config.target)) {
+          std::fprintf(stderr, "Unknown target: %s\n", argv[i]);
+          return 1;
+        }
+      } else {
+        config.socketPath = argv[i];
+      }
+    } else if (arg == "-c") {
+      config.isObject = true;
+    } else if (arg == "--tiny") {
+      config.isTiny = true;
+    } else if (arg.size() > 1 && arg[0] == '-') {
+      std::fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      showUsage(argv[0]);
+      return 1;
+    } else {
+      config.srcFilePath = arg;
+    }
+  }
+
+  if (config.srcFilePath.empty()) {
+    std::fputs("No source file specified\n", stderr);
+    return 1;
+  }
+  if (config.dstFilePath.empty()) {
+    config.dstFilePath = config.isObject ? "a.o"
+      : config.target == bfc::Target::PeX64 || config.target == bfc::Target::PeX86 ? "a.exe"
+      : "a.out";
+  }
+  if (config.socketPath.empty()) {
+    config.socketPath = bfc::getDefaultSocketPath();
+  }
+  return -1;
+}
+
+
+/*!
+ * @brief サーバが書き込めるように出力ファイルのパスを絶対パスに変換する
+ *
+ * @param [in] path  出力ファイルのパス
+ * @return 絶対パス (カレントディレクトリを取得できない場合は空文字列)
+ */
+inline std::string
+toAbsolutePath(const std::string& path)
+{
+  if (!path.empty() && path[0] == '/') {
+    return path;
+  }
+  std::vector<char> cwd(256);
+  while (::getcwd(cwd.data(), cwd.size()) == nullptr) {
+    if (errno != ERANGE) {
+      return "";
+    }
+    cwd.resize(cwd.size() * 2);
+  }
+  return std::string{cwd.data()} + "/" + path;
+}
+
+
+/*!
+ * @brief コンパイルサーバに接続する
+ *
+ * @param [in] socketPath  ソケットファイルのパス
+ * @return 接続したソケットのファイルディスクリプタ (失敗した場合は -1)
+ */
+inline int
+connectServer(const std::string& socketPath)
+{
+  sockaddr_un addr{};
+  if (socketPath.size() >= sizeof(addr.sun_path)) {
+    std::fprintf(stderr, "Invalid socket path: %s\n", socketPath.c_str());
+    return -1;
+  }
+  addr.sun_family = AF_UNIX;
+  socketPath.copy(addr.sun_path, socketPath.size());
+
+  const auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1 || ::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == -1) {
+    std::fprintf(stderr, "Failed to connect to %s: %s\n", socketPath.c_str(), std::strerror(errno));
+    if (fd != -1) {
+      ::close(fd);
+    }
+    return -1;
+  }
+  return fd;
+}
+
+
+/*!
+ * @brief 要求を送信する
+ *
+ * 通常のファイルはサイズが分かるので，全体を読み込まずに一定の大きさずつ転送する．
+ * 標準入力などサイズが分からない場合のみ，全体を読み込んでから送信する．
+ *
+ * @param [in] fd  接続のファイルディスクリプタ
+ * @param [in] config  コマンドラインで指定された設定
+ * @param [in] dstFilePath  サーバに書き込ませる出力ファイルの絶対パス (空のときは生成したバイナリを受け取る)
+ * @return 送信できた場合は true
+ */
+inline bool
+sendRequest(int fd, const ClientConfig& config, const std::string& dstFilePath)
+{
+  const auto isStdin = config.srcFilePath == "-";
+  const auto srcFd = isStdin ? STDIN_FILENO : ::open(config.srcFilePath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (srcFd == -1) {
+    std::fprintf(stderr, "Failed to open %s\n", config.srcFilePath.c_str());
+    return false;
+  }
+
+  std::vector<char> buffer(kChunkSize);
+  std::vector<char> whole;
+  struct stat st;
+  const auto isRegular = ::fstat(srcFd, &st) == 0 && S_ISREG(st.st_mode);
+  if (!isRegular) {
+    for (;;) {
+      const auto n = ::read(srcFd, buffer.data(), buffer.size());
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      whole.insert(whole.end(), buffer.data(), buffer.data() + n);
+    }
+  }
+
+  bfc::RequestHeader header{};
+  header.magic = bfc::kProtocolMagic;
+  header.target = static_cast<std::uint8_t>(config.target);
+  header.isObject = static_cast<std::uint8_t>(config.isObject);
+  header.isTiny = static_cast<std::uint8_t>(config.isTiny);
+  header.isReturnImage = static_cast<std::uint8_t>(dstFilePath.empty());
+  header.dstPathSize = static_cast<std::uint32_t>(dstFilePath.size());
+  header.sourceSize = isRegular ? static_cast<std::uint64_t>(st.st_size) : whole.size();
+  auto isSucceeded = bfc::writeFully(fd, &header, sizeof(header))
+    && bfc::writeFully(fd, dstFilePath.data(), dstFilePath.size());
+  if (!isRegular) {
+    isSucceeded = isSucceeded && bfc::writeFully(fd, whole.data(), whole.size());
+  } else {
+    for (auto rest = header.sourceSize; isSucceeded && rest > 0;) {
+      const auto size = static_cast<std::size_t>(std::min<std::uint64_t>(rest, buffer.size()));
+      // 送信中にファイルが縮んだ場合は要求を完結できないので失敗とする
+      isSucceeded = bfc::readFully(srcFd, buffer.data(), size) && bfc::writeFully(fd, buffer.data(), size);
+      rest -= size;
+    }
+  }
+  if (!isStdin) {
+    ::close(srcFd);
+  }
+  if (!isSucceeded) {
+    std::fprintf(stderr, "Failed to send %s to the server\n", config.srcFilePath.c_str());
+  }
+  return isSucceeded;
+}
+
+
+/*!
+ * @brief 応答を受信し，生成したバイナリを標準出力に，診断メッセージと警告メッセージを標準エラー出力に書き込む
+ *
+ * @param [in] fd  接続のファイルディスクリプタ
+ * @param [in] config  コマンドラインで指定された設定
+ * @return 終了ステータス
+ */
+inline int
+receiveResponse(int fd, const ClientConfig& config)
+{
+  bfc::ResponseHeader header;
+  if (!bfc::readFully(fd, &header, sizeof(header))) {
+    std::fputs("The server closed the connection\n", stderr);
+    return 1;
+  }
+  const auto isSucceeded = header.status == static_cast<std::uint8_t>(bfc::ResponseStatus::Succeeded);
+  std::vector<char> buffer(kChunkSize);
+  for (auto rest = header.payloadSize; rest > 0;) {
+    const auto size = static_cast<std::size_t>(std::min<std::uint64_t>(rest, buffer.size()));
+    if (!bfc::readFully(fd, buffer.data(), size)) {
+      std::fputs("The server closed the connection\n", stderr);
+      return 1;
+    }
+    if (isSucceeded) {
+      if (!bfc::writeFully(STDOUT_FILENO, buffer.data(), size)) {
+        std::fputs("Failed to write to stdout\n", stderr);
+        return 1;
+      }
+    } else {
+      if (rest == header.payloadSize) {
+        std::fprintf(stderr, "%s: ", config.srcFilePath.c_str());
+      }
+      std::fwrite(buffer.data(), 1, size, stderr);
+    }
+    rest -= size;
+  }
+  if (!isSucceeded) {
+    std::fputc('\n', stderr);
+    return 1;
+  }
+
+  // 警告メッセージは改行区切りで送られてくるので，1行ずつソースファイルの名前を付けて表示する
+  std::string warnings(header.warningsSize, '\0');
+  if (!bfc::readFully(fd, warnings.data(), warnings.size())) {
+    std::fputs("The server closed the connection\n", stderr);
+    return 1;
+  }
+  for (std::string::size_type pos = 0; pos < warnings.size();) {
+    auto end = warnings.find('\n', pos);
+    if (end == std::string::npos) {
+      end = warnings.size();
+    }
+    std::fprintf(stderr, "%s: warning: %.*s\n", config.srcFilePath.c_str(), static_cast<int>(end - pos), warnings.data() + pos);
+    pos = end + 1;
+  }
+  return 0;
+}
+}  // namespace
+
+
+/*!
+ * @brief このプログラムのエントリポイント
+ *
+ * @param [in] argc  コマンドライン引数の数
+ * @param [in] argv  コマンドライン引数
+ * @return  終了ステータス
+ */
+int
+main(int argc, char* argv[])
+{
+  ClientConfig config;
+  const auto status = parseArguments(argc, argv, config);
+  if (status != -1) {
+    return status;
+  }
+
+  // 標準出力以外への出力はサーバが直接書き込む
+  std::string dstFilePath;
+  if (config.dstFilePath != "-") {
+    dstFilePath = toAbsolutePath(config.dstFilePath);
+    if (dstFilePath.empty()) {
+      std::fputs("Failed to get the current directory\n", stderr);
+      return 1;
+    }
+  }
+
+  // サーバが切断した場合もシグナルで終了せずに診断メッセージを表示する
+  std::signal(SIGPIPE, SIG_IGN);
+  const auto fd = connectServer(config.socketPath);
+  if (fd == -1) {
+    return 1;
+  }
+  const auto exitStatus = sendRequest(fd, config, dstFilePath) ? receiveResponse(fd, config) : 1;
+  ::close(fd);
+  return exitStatus;
+}
@@ -0,0 +1,242 @@
+/*!
+ * @brief 多数のソースファイルの並列コンパイル
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "batch.hpp"
+#include "bfcompiler.hpp"
+#include "fileutil.hpp"
+
+
+namespace bfc
+{
+namespace
+{
+/*!
+ * @brief スレッドごとの仕事のキュー
+ *
+ * 所有スレッドは末尾から，他のスレッドは先頭から仕事を取り出す．
+ */
+class WorkQueue
+{
+public:
+  /*!
+   * @brief 仕事を追加する
+   *
+   * @param [in] index  仕事 (入出力の組のインデックス)
+   */
+  void
+  push(std::size_t index)
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    queue_.push_back(index);
+  }
+
+  /*!
+   * @brief 所有スレッドが仕事を取り出す
+   *
+   * @param [out] index  取り出した仕事
+   * @return 仕事を取り出せた場合は true
+   */
+  bool
+  pop(std::size_t& index)
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (queue_.empty()) {
+      return false;
+    }
+    index = queue_.back();
+    queue_.pop_back();
+    return true;
+  }
+
+  /*!
+   * @brief 他のスレッドが仕事を奪う
+   *
+   * @param [out] index  奪った仕事
+   * @return 仕事を奪えた場合は true
+   */
+  bool
+  steal(std::size_t& index)
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (queue_.empty()) {
+      return false;
+    }
+    index = queue_.front();
+    queue_.pop_front();
+    return true;
+  }
+
+private:
+  //! キューを保護するミューテックス
+  std::mutex mutex_{};
+  //! 仕事のキュー
+  std::deque<std::size_t> queue_{};
+};
+
+}  // namespace
+
+
+std::size_t
+readBatchList(std::istream& is, std::vector<BatchEntry>& entries)
+{
+  std::string line;
+  for (std::size_t lineNumber = 1; std::getline(is, line); lineNumber++) {
+    std::istringstream iss{line};
+    BatchEntry entry;
+    if (!(iss >> entry.srcFilePath) || entry.srcFilePath[0] == '#') {
+      continue;
+    }
+    std::string rest;
+    if (!(iss >> entry.dstFilePath) || (iss >> rest)) {
+      return lineNumber;
+    }
+    entries.push_back(std::move(entry));
+  }
+  return 0;
+}
+
+
+BatchResult
+compileFile(
+  const BatchEntry& entry,
+  const Options& options,
+  const CompileCache* cache,
+  NormalizedSource& source,
+  std::vector<std::uint8_t>& image)
+{
+  if (!readSourceFile(entry.srcFilePath, source)) {
+    BatchResult result;
+    result.message = "Failed to open " + entry.srcFilePath;
+    return result;
+  }
+  return compileSource(source, entry.dstFilePath, options, cache, image);
+}
+
+
+BatchResult
+compileSource(
+  const NormalizedSource& source,
+  const std::string& dstFilePath,
+  const Options& options,
+  const CompileCache* cache,
+  std::vector<std::uint8_t>& image)
+{
+  BatchResult result;
+  const auto isExecutable = !options.isObject && (options.target == Target::ElfX64 || options.target == Target::ElfX86);
+  std::string key;
+  if (cache != nullptr) {
+    key = cache->makeKey(source, options);
+    if (cache->restore(key, dstFilePath, isExecutable, result.warnings)) {
+      result.isSucceeded = true;
+      result.isCacheHit = true;
+      return result;
+    }
+  }
+  // キャッシュから配置した場合にも同じ警告を返せるように，呼び出し元には直接渡さずに溜めておく
+  auto fileOptions = options;
+  fileOptions.warningHandler = [&warnings = result.warnings](const std::string& message) {
+    warnings.push_back(message);
+  };
+  try {
+    compile(source, fileOptions, image);
+  } catch (const CompileError& e) {
+    result.message = e.what();
+    return result;
+  } catch (const std::exception& e) {
+    // メモリ不足等で失敗しても，他のファイルやサーバの他の要求の処理は続けられるようにする
+    result.message = std::string{"Internal error: "} + e.what();
+    return result;
+  }
+  if (!writeImageFile(dstFilePath, image, isExecutable)) {
+    result.message = "Failed to write " + dstFilePath;
+    return result;
+  }
+  // キャッシュへの保存に失敗してもコンパイル自体は成功しているので無視する
+  if (cache != nullptr) {
+    cache->store(key, image, isExecutable, result.warnings);
+  }
+  result.isSucceeded = true;
+  return result;
+}
+
+
+std::vector<BatchResult>
+compileBatch(
+  const std::vector<BatchEntry>& entries,
+  const Options& options,
+  const CompileCache* cache,
+  unsigned int nThreads)
+{
+  if (nThreads == 0) {
+    nThreads = std::max(std::thread::hardware_concurrency(), 1U);
+  }
+  nThreads = static_cast<unsigned int>(std::min<std::size_t>(nThreads, std::max<std::size_t>(entries.size(), 1)));
+
+  // 連続する区間ごとに各スレッドへ割り当てる
+  std::vector<std::unique_ptr<WorkQueue>> queues;
+  queues.reserve(nThreads);
+  for (unsigned int i = 0; i < nThreads; i++) {
+    queues.push_back(std::make_unique<WorkQueue>());
+    const auto first = entries.size() * i / nThreads;
+    const auto last = entries.size() * (i + 1) / nThreads;
+    // 所有スレッドは末尾から取り出すので，逆順に積んでおくと先頭から順に処理される
+    for (auto j = last; j > first; j--) {
+      queues.back()->push(j - 1);
+    }
+  }
+
+  // ファイル単位で並列化しているので，各ファイルのコード生成は1スレッドで行う
+  auto fileOptions = options;
+  if (nThreads > 1) {
+    fileOptions.nThreads = 1;
+  }
+
+  std::vector<BatchResult> results(entries.size());
+  const auto worker = [&](unsigned int id) {
+    // スレッドごとのバッファ (仕事をまたいで使い回す)
+    NormalizedSource source;
+    std::vector<std::uint8_t> image;
+    for (;;) {
+      std::size_t index;
+      auto isFound = queues[id]->pop(index);
+      for (unsigned int i = 1; !isFound && i < nThreads; i++) {
+        isFound = queues[(id + i) % nThreads]->steal(index);
+      }
+      // 仕事は途中で増えないので，全てのキューが空なら終了してよい
+      if (!isFound) {
+        break;
+      }
+      results[index] = compileFile(entries[index], fileOptions, cache, source, image);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(nThreads - 1);
+  for (unsigned int i = 1; i < nThreads; i++) {
+    threads.emplace_back(worker, i);
+  }
+  worker(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return results;
+}
+}  // namespace bfc
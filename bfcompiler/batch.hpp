@@ -0,0 +1,129 @@
+/*!
+ * @brief 多数のソースファイルの並列コンパイル
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <cstddef>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "bfcompiler.hpp"
+#include "cache.hpp"
+
+
+namespace bfc
+{
+/*!
+ * @brief バッチコンパイルの1件分の入出力
+ */
+struct BatchEntry
+{
+  //! Brainf**kのソースファイルのパス
+  std::string srcFilePath{};
+  //! 出力ファイルのパス
+  std::string dstFilePath{};
+};
+
+
+/*!
+ * @brief バッチコンパイルの1件分の結果
+ */
+struct BatchResult
+{
+  //! コンパイルと書き込みに成功したかどうか
+  bool isSucceeded = false;
+  //! キャッシュから出力ファイルを配置したかどうか
+  bool isCacheHit = false;
+  //! 失敗した場合の診断メッセージ
+  std::string message{};
+  //! 警告メッセージ (キャッシュから配置した場合はコンパイル時のもの)
+  std::vector<std::string> warnings{};
+};
+
+
+/*!
+ * @brief 入出力の組の一覧を読み込む
+ *
+ * 1行に入力ファイルと出力ファイルのパスを空白区切りで記述する．
+ * 空行と '#' で始まる行は無視する．
+ *
+ * @param [in] is  読み込み元ストリーム
+ * @param [out] entries  読み込んだ入出力の組
+ * @return 書式に誤りがあった行の行番号 (誤りが無ければ0)
+ */
+std::size_t
+readBatchList(std::istream& is, std::vector<BatchEntry>& entries);
+
+
+/*!
+ * @brief 1つのソースファイルをコンパイルし，出力ファイルに書き込む
+ *
+ * キャッシュが指定された場合，キャッシュに存在すればコード生成を行わずに出力ファイルを配置し，
+ * 存在しなければ生成したバイナリをキャッシュに保存する．
+ * 警告メッセージは options.warningHandler には渡さず，キャッシュから配置した場合も含めて結果に格納する．
+ *
+ * @param [in] entry  入出力の組
+ * @param [in] options  コンパイルオプション
+ * @param [in] cache  キャッシュ (nullptr のときはキャッシュを用いない)
+ * @param [in,out] source  ソースの読み込みに用いるバッファ
+ * @param [in,out] image  生成コードの書き込みに用いるバッファ
+ * @return 結果
+ */
+BatchResult
+compileFile(
+  const BatchEntry& entry,
+  const Options& options,
+  const CompileCache* cache,
+  NormalizedSource& source,
+  std::vector<std::uint8_t>& image);
+
+
+/*!
+ * @brief 読み込み済みのソースをコンパイルし，出力ファイルに書き込む
+ *
+ * キャッシュの扱いは compileFile() と同じである．
+ *
+ * @param [in] source  正規化したソースコード
+ * @param [in] dstFilePath  出力ファイルのパス
+ * @param [in] options  コンパイルオプション
+ * @param [in] cache  キャッシュ (nullptr のときはキャッシュを用いない)
+ * @param [in,out] image  生成コードの書き込みに用いるバッファ
+ * @return 結果
+ */
+BatchResult
+compileSource(
+  const NormalizedSource& source,
+  const std::string& dstFilePath,
+  const Options& options,
+  const CompileCache* cache,
+  std::vector<std::uint8_t>& image);
+
+
+/*!
+ * @brief 複数のソースファイルを並列にコンパイルする
+ *
+ * 各スレッドはソースと生成コードのバッファを使い回し，
+ * 自身の担当分が無くなると他のスレッドのキューから仕事を奪う (work stealing)．
+ *
+ * @param [in] entries  入出力の組
+ * @param [in] options  コンパイルオプション
+ * @param [in] cache  キャッシュ (nullptr のときはキャッシュを用いない)
+ * @param [in] nThreads  スレッド数 (0のときはハードウェアのスレッド数)
+ * @return entries の各要素に対応する結果
+ */
+std::vector<BatchResult>
+compileBatch(
+  const std::vector<BatchEntry>& entries,
+  const Options& options,
+  const CompileCache* cache,
+  unsigned int nThreads);
+}  // namespace bfc
+
+
+#endif  // BATCH_HPP
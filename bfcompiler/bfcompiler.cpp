@@ -0,0 +1,120 @@
+/*!
+ * @brief Simple Brainf**k Compiler library
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "bfcompiler.hpp"
+
+
+namespace bfc
+{
+bool
+isTargetSupported(Target target) noexcept
+{
+  switch (target) {
+    case Target::ElfX64:
+    case Target::ElfX86:
+      return true;
+    case Target::PeX64:
+    case Target::PeX86:
+#ifdef BFCOMPILER_ENABLE_PE
+      return true;
+#else
+      return false;
+#endif  // BFCOMPILER_ENABLE_PE
+    default:
+      return false;
+  }
+}
+
+
+bool
+parseTarget(std::string_view name, Target& target) noexcept
+{
+  if (name == "elf64" || name == "elf-x64") {
+    target = Target::ElfX64;
+  } else if (name == "elf32" || name == "elf-x86") {
+    target = Target::ElfX86;
+  } else if (name == "pe64" || name == "pe-x64") {
+    target = Target::PeX64;
+  } else if (name == "pe32" || name == "pe-x86") {
+    target = Target::PeX86;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+
+std::string_view
+getTargetName(Target target) noexcept
+{
+  switch (target) {
+    case Target::ElfX64:
+      return "elf64";
+    case Target::ElfX86:
+      return "elf32";
+    case Target::PeX64:
+      return "pe64";
+    case Target::PeX86:
+      return "pe32";
+    default:
+      return "unknown";
+  }
+}
+
+
+void
+compile(
+  const NormalizedSource& source,
+  const Options& options,
+  std::vector<std::uint8_t>& image,
+  FragmentCache* fragmentCache)
+{
+  if (!isTargetSupported(options.target)) {
+    throw CompileError{"The specified target is not supported in this build."};
+  }
+  switch (options.target) {
+    case Target::ElfX64:
+      compileElfX64(source, options, image, fragmentCache);
+      break;
+    case Target::ElfX86:
+      compileElfX86(source, options, image);
+      break;
+    case Target::PeX64:
+#ifdef BFCOMPILER_ENABLE_PE
+      compilePeX64(source, options, image);
+#endif  // BFCOMPILER_ENABLE_PE
+      break;
+    case Target::PeX86:
+#ifdef BFCOMPILER_ENABLE_PE
+      compilePeX86(source, options, image);
+#endif  // BFCOMPILER_ENABLE_PE
+      break;
+    default:
+      break;
+  }
+}
+
+
+void
+compile(std::string_view source, const Options& options, std::vector<std::uint8_t>& image)
+{
+  compile(normalizeSource(source), options, image);
+}
+
+
+std::vector<std::uint8_t>
+compile(std::string_view source, const Options& options)
+{
+  std::vector<std::uint8_t> image;
+  compile(source, options, image);
+  return image;
+}
+}  // namespace bfc
@@ -0,0 +1,291 @@
+/*!
+ * @brief Simple Brainf**k Compiler library
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#ifndef BFCOMPILER_HPP
+#define BFCOMPILER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "source.hpp"
+
+
+//! 戻り値が引数の値のみで決まり，副作用もない関数に付ける属性
+#if defined(__GNUC__)
+#  define BFC_ATTRIBUTE_CONST  __attribute__((const))
+#else
+#  define BFC_ATTRIBUTE_CONST
+#endif  // defined(__GNUC__)
+
+//! 副作用がなく，戻り値が引数の値と参照先のメモリのみで決まる関数に付ける属性
+#if defined(__GNUC__)
+#  define BFC_ATTRIBUTE_PURE  __attribute__((pure))
+#else
+#  define BFC_ATTRIBUTE_PURE
+#endif  // defined(__GNUC__)
+
+
+namespace bfc
+{
+/*!
+ * @brief 出力形式
+ */
+enum class Target
+{
+  //! x64 ELF
+  ElfX64,
+  //! x86 ELF
+  ElfX86,
+  //! x64 PE
+  PeX64,
+  //! x86 PE
+  PeX86
+};
+
+
+/*!
+ * @brief コード生成で想定するマイクロアーキテクチャ
+ */
+enum class Tune
+{
+  //! 特定のマイクロアーキテクチャを想定しない (コードサイズを優先する)
+  Generic,
+  //! Intel のコア (Skylake 以降)
+  Intel,
+  //! AMD のコア (Zen 以降)
+  Amd
+};
+
+
+/*!
+ * @brief コンパイルオプション
+ */
+struct Options
+{
+  //! 出力形式
+  Target target = Target::ElfX64;
+  //! 実行ファイルの代わりに再配置可能オブジェクトファイルを出力するかどうか (x64 ELF のみ)
+  bool isObject = false;
+  //! 実行ファイルをセクションヘッダやシンボルを省いた最小限の構成で出力するかどうか (ELF の実行ファイルのみ)
+  bool isTiny = false;
+  //! コード生成に用いるスレッド数 (0のときはソースの大きさに応じて決める．現在は x64 ELF のみ)
+  unsigned int nThreads = 0;
+  //! 警告メッセージを受け取る関数 (空のときは警告を報告しない．現在は x64 ELF のみ)
+  std::function<void(const std::string&)> warningHandler{};
+  //! 各ループの '[' のソースファイル上の位置から，実行時にその '[' に到達した回数への対応
+  //! (空のときはプロファイルを用いない．現在は x64 ELF のみ)
+  std::map<std::string::size_type, std::uint64_t> loopProfile{};
+  //! コード生成で想定するマイクロアーキテクチャ (現在は x64 ELF のみ)
+  Tune tune = Tune::Generic;
+};
+
+
+/*!
+ * @brief コンパイルエラー
+ */
+class CompileError : public std::runtime_error
+{
+public:
+  using std::runtime_error::runtime_error;
+};
+
+
+/*!
+ * @brief 差分コンパイルのために生成コードの断片を保持するキャッシュ
+ *
+ * 同じキャッシュを渡して繰り返しコンパイルすると，前回と命令列が変わっていない
+ * トップレベルの領域のコードを再利用し，変更された領域のみを生成し直して連結する．
+ * 現在は x64 ELF のみが利用し，他の出力形式では無視される．スレッドセーフではない．
+ */
+class FragmentCache
+{
+public:
+  /*!
+   * @brief 空のキャッシュを構築する
+   */
+  FragmentCache();
+
+  /*!
+   * @brief キャッシュを破棄する
+   */
+  ~FragmentCache();
+
+  FragmentCache(const FragmentCache&) = delete;
+  FragmentCache&
+  operator=(const FragmentCache&) = delete;
+
+  /*!
+   * @brief 直前のコンパイルの断片数を返す
+   *
+   * @return 直前のコンパイルの断片数
+   */
+  BFC_ATTRIBUTE_PURE std::size_t
+  getFragmentCount() const noexcept;
+
+  /*!
+   * @brief 直前のコンパイルで再利用した断片数を返す
+   *
+   * @return 直前のコンパイルで再利用した断片数
+   */
+  BFC_ATTRIBUTE_PURE std::size_t
+  getReusedCount() const noexcept;
+
+private:
+  struct Impl;
+  //! 実装
+  std::unique_ptr<Impl> impl_;
+
+  friend void
+  compileElfX64(
+    const NormalizedSource& source,
+    const Options& options,
+    std::vector<std::uint8_t>& image,
+    FragmentCache* fragmentCache);
+};
+
+
+/*!
+ * @brief 指定した出力形式がこのビルドで利用可能かどうかを返す
+ *
+ * @param [in] target  出力形式
+ * @return 利用可能であれば true
+ */
+BFC_ATTRIBUTE_CONST bool
+isTargetSupported(Target target) noexcept;
+
+
+/*!
+ * @brief 出力形式の名前を解析する
+ *
+ * "elf64", "elf32", "pe64", "pe32" のほか，"elf-x64" のように ISA を明示した名前も受け付ける．
+ *
+ * @param [in] name  出力形式の名前
+ * @param [out] target  出力形式 (解析できなかった場合は変更しない)
+ * @return 解析できた場合は true
+ */
+bool
+parseTarget(std::string_view name, Target& target) noexcept;
+
+
+/*!
+ * @brief 出力形式の名前を返す
+ *
+ * @param [in] target  出力形式
+ * @return 出力形式の名前 (parseTarget() で解析できる)
+ */
+BFC_ATTRIBUTE_CONST std::string_view
+getTargetName(Target target) noexcept;
+
+
+/*!
+ * @brief x64 ELF にコンパイルする
+ *
+ * @param [in] source  正規化したBrainf**kのソースコード
+ * @param [in] options  コンパイルオプション (target は参照しない)
+ * @param [out] image  生成したバイナリの書き込み先 (元の内容は破棄される)
+ * @param [in,out] fragmentCache  差分コンパイルに用いるキャッシュ (nullptr のときは用いない)
+ * @throw CompileError  ソースコードに誤りがある場合
+ */
+void
+compileElfX64(
+  const NormalizedSource& source,
+  const Options& options,
+  std::vector<std::uint8_t>& image,
+  FragmentCache* fragmentCache = nullptr);
+
+
+/*!
+ * @brief x86 ELF にコンパイルする
+ *
+ * 入出力は .bss 上のバッファを介してまとめて行う．出力は入力を待つ前と終了時に書き出すので，
+ * 異常終了したり終了しなかったりした場合はバッファに残った出力が失われる．
+ *
+ * @param [in] source  正規化したBrainf**kのソースコード
+ * @param [in] options  コンパイルオプション (target は参照しない)
+ * @param [out] image  生成したバイナリの書き込み先 (元の内容は破棄される)
+ * @throw CompileError  ソースコードに誤りがある場合
+ */
+void
+compileElfX86(const NormalizedSource& source, const Options& options, std::vector<std::uint8_t>& image);
+
+
+/*!
+ * @brief x64 PE にコンパイルする
+ *
+ * @param [in] source  正規化したBrainf**kのソースコード
+ * @param [in] options  コンパイルオプション (target は参照しない)
+ * @param [out] image  生成したバイナリの書き込み先 (元の内容は破棄される)
+ * @throw CompileError  ソースコードに誤りがある場合
+ */
+void
+compilePeX64(const NormalizedSource& source, const Options& options, std::vector<std::uint8_t>& image);
+
+
+/*!
+ * @brief x86 PE にコンパイルする
+ *
+ * @param [in] source  正規化したBrainf**kのソースコード
+ * @param [in] options  コンパイルオプション (target は参照しない)
+ * @param [out] image  生成したバイナリの書き込み先 (元の内容は破棄される)
+ * @throw CompileError  ソースコードに誤りがある場合
+ */
+void
+compilePeX86(const NormalizedSource& source, const Options& options, std::vector<std::uint8_t>& image);
+
+
+/*!
+ * @brief options.target で指定した出力形式にコンパイルする
+ *
+ * 生成したバイナリを既存のバッファに書き込むので，バッファを使い回すことで
+ * 多数のソースをコンパイルする際のメモリ確保を抑えられる．
+ *
+ * @param [in] source  正規化したBrainf**kのソースコード
+ * @param [in] options  コンパイルオプション
+ * @param [out] image  生成したバイナリの書き込み先 (元の内容は破棄される)
+ * @param [in,out] fragmentCache  差分コンパイルに用いるキャッシュ (nullptr のときは用いない)
+ * @throw CompileError  ソースコードに誤りがある場合，または出力形式が利用できない場合
+ */
+void
+compile(
+  const NormalizedSource& source,
+  const Options& options,
+  std::vector<std::uint8_t>& image,
+  FragmentCache* fragmentCache = nullptr);
+
+
+/*!
+ * @brief options.target で指定した出力形式にコンパイルする
+ *
+ * @param [in] source  Brainf**kのソースコード
+ * @param [in] options  コンパイルオプション
+ * @param [out] image  生成したバイナリの書き込み先 (元の内容は破棄される)
+ * @throw CompileError  ソースコードに誤りがある場合，または出力形式が利用できない場合
+ */
+void
+compile(std::string_view source, const Options& options, std::vector<std::uint8_t>& image);
+
+
+/*!
+ * @brief options.target で指定した出力形式にコンパイルする
+ *
+ * @param [in] source  Brainf**kのソースコード
+ * @param [in] options  コンパイルオプション
+ * @return 生成したバイナリ
+ * @throw CompileError  ソースコードに誤りがある場合，または出力形式が利用できない場合
+ */
+std::vector<std::uint8_t>
+compile(std::string_view source, const Options& options);
+}  // namespace bfc
+
+
+#endif  // BFCOMPILER_HPP
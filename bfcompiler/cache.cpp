@@ -0,0 +1,279 @@
+/*!
+ * @brief 生成したバイナリの内容アドレス方式のキャッシュ
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <linux/fs.h>
+#  include <sys/ioctl.h>
+#  include <unistd.h>
+#endif  // __linux__
+
+#include "bfcompiler.hpp"
+#include "cache.hpp"
+#include "fileutil.hpp"
+#include "sha256.hpp"
+
+
+namespace bfc
+{
+namespace
+{
+//! キャッシュの形式のバージョン (キーの構成やキャッシュファイルの配置を変えたら更新する)
+constexpr char kCacheFormat[] = "bfcompiler-cache-1";
+//! 警告メッセージを保存するファイルの，キャッシュファイルのパスに付ける接尾辞
+constexpr char kWarningsSuffix[] = ".warnings";
+
+
+/*!
+ * @brief コンパイラ自身を識別する文字列を返す
+ *
+ * コンパイラを再ビルドした際に古い生成コードを使わないように，実行ファイルのサイズと更新日時を用いる．
+ *
+ * @return コンパイラ自身を識別する文字列 (取得できない場合は空文字列)
+ */
+inline std::string
+getCompilerId()
+{
+#ifdef __linux__
+  std::error_code ec;
+  const std::filesystem::path exePath{"/proc/self/exe"};
+  const auto size = std::filesystem::file_size(exePath, ec);
+  if (ec) {
+    return "";
+  }
+  const auto mtime = std::filesystem::last_write_time(exePath, ec);
+  if (ec) {
+    return "";
+  }
+  return std::to_string(size) + ":" + std::to_string(mtime.time_since_epoch().count());
+#else
+  return "";
+#endif  // __linux__
+}
+
+
+/*!
+ * @brief ファイルを reflink (CoW による複製) する
+ *
+ * @param [in] srcFilePath  複製元のファイルのパス
+ * @param [in] dstFilePath  複製先のファイルのパス (存在してはならない)
+ * @param [in] isExecutable  実行可能属性を付与するかどうか
+ * @return 成功した場合は true (ファイルシステムが対応していない場合は false)
+ */
+inline bool
+cloneFile(const std::string& srcFilePath, const std::string& dstFilePath, bool isExecutable)
+{
+#if defined(__linux__) && defined(FICLONE)
+  const auto srcFd = ::open(srcFilePath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (srcFd == -1) {
+    return false;
+  }
+  const auto dstFd = ::open(dstFilePath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, isExecutable ? 0755 : 0644);
+  if (dstFd == -1) {
+    ::close(srcFd);
+    return false;
+  }
+  const auto isSucceeded = ::ioctl(dstFd, FICLONE, srcFd) == 0;
+  ::close(dstFd);
+  ::close(srcFd);
+  if (!isSucceeded) {
+    ::unlink(dstFilePath.c_str());
+  }
+  return isSucceeded;
+#else
+  static_cast<void>(srcFilePath);
+  static_cast<void>(dstFilePath);
+  static_cast<void>(isExecutable);
+  return false;
+#endif  // defined(__linux__) && defined(FICLONE)
+}
+
+
+/*!
+ * @brief ファイルをコピーし，所有者の書き込み権限を付与する
+ *
+ * @param [in] srcFilePath  コピー元のファイルのパス
+ * @param [in] dstFilePath  コピー先のファイルのパス (存在してはならない)
+ * @return 成功した場合は true
+ */
+inline bool
+copyFile(const std::string& srcFilePath, const std::string& dstFilePath)
+{
+  std::error_code ec;
+  if (!std::filesystem::copy_file(srcFilePath, dstFilePath, ec)) {
+    return false;
+  }
+  // キャッシュファイルは読み込み専用なので，コピーには書き込み権限を戻しておく
+  std::filesystem::permissions(
+    dstFilePath,
+    std::filesystem::perms::owner_write,
+    std::filesystem::perm_options::add,
+    ec);
+  return true;
+}
+}  // namespace
+
+
+CompileCache::CompileCache(std::string cacheDir)
+  : cacheDir_{std::move(cacheDir)}
+  , compilerId_{getCompilerId()}
+{}
+
+
+std::string
+CompileCache::makeKey(const NormalizedSource& source, const Options& options) const
+{
+  Sha256 sha256;
+  sha256.update(kCacheFormat, sizeof(kCacheFormat));
+  sha256.update(compilerId_.c_str(), compilerId_.size() + 1);
+
+  // nThreads は生成結果に影響しないのでキーに含めない
+  const std::uint8_t optionBytes[] = {
+    static_cast<std::uint8_t>(options.target),
+    static_cast<std::uint8_t>(options.isObject),
+    static_cast<std::uint8_t>(options.isTiny),
+    static_cast<std::uint8_t>(options.tune)
+  };
+  sha256.update(optionBytes, sizeof(optionBytes));
+
+  if (options.target == Target::ElfX64) {
+    // x64 ELF はループのシンボル名に取り除く前のソース上での '[' の位置を含むので，それもキーに含める
+    const auto& loopSrcOffsets = source.loopSrcOffsets;
+    sha256.update(loopSrcOffsets.data(), loopSrcOffsets.size() * sizeof(loopSrcOffsets[0]));
+    // プロファイルはどのループをサブルーチンにまとめるかに影響する
+    const std::uint64_t nProfileEntries = options.loopProfile.size();
+    sha256.update(&nProfileEntries, sizeof(nProfileEntries));
+    for (const auto& [offset, count] : options.loopProfile) {
+      const std::uint64_t entry[] = {offset, count};
+      sha256.update(entry, sizeof(entry));
+    }
+  }
+  sha256.update(source.commands.data(), source.commands.size());
+  return Sha256::toHexString(sha256.finish());
+}
+
+
+bool
+CompileCache::restore(
+  const std::string& key,
+  const std::string& dstFilePath,
+  bool isExecutable,
+  std::vector<std::string>& warnings) const
+{
+  const auto entryPath = getEntryPath(key);
+  std::error_code ec;
+  if (!std::filesystem::is_regular_file(entryPath, ec)) {
+    return false;
+  }
+  // 警告メッセージは1行に1つずつ保存してある (警告が無ければファイルも無い)
+  warnings.clear();
+  if (std::ifstream ifs{entryPath + kWarningsSuffix}; ifs) {
+    for (std::string line; std::getline(ifs, line);) {
+      warnings.push_back(std::move(line));
+    }
+  }
+  // 出力先を直接書き換えずに一時ファイルを作ってから置き換える
+  const auto tmpFilePath = makeTemporaryPath(dstFilePath);
+  auto isPlaced = cloneFile(entryPath, tmpFilePath, isExecutable);
+  if (!isPlaced) {
+    std::filesystem::create_hard_link(entryPath, tmpFilePath, ec);
+    isPlaced = !ec || copyFile(entryPath, tmpFilePath);
+  }
+  return isPlaced && replaceFile(tmpFilePath, dstFilePath);
+}
+
+
+bool
+CompileCache::store(
+  const std::string& key,
+  const std::vector<std::uint8_t>& image,
+  bool isExecutable,
+  const std::vector<std::string>& warnings) const
+{
+  const auto entryPath = getEntryPath(key);
+  std::error_code ec;
+  std::filesystem::create_directories(std::filesystem::path{entryPath}.parent_path(), ec);
+  if (ec) {
+    return false;
+  }
+
+  // キャッシュファイルが存在すれば警告メッセージも揃っているように，先に保存する
+  if (!warnings.empty()) {
+    const auto warningsPath = entryPath + kWarningsSuffix;
+    const auto tmpFilePath = makeTemporaryPath(warningsPath);
+    std::ofstream ofs{tmpFilePath};
+    for (const auto& warning : warnings) {
+      ofs << warning << '\n';
+    }
+    ofs.close();
+    if (!ofs || !replaceFile(tmpFilePath, warningsPath)) {
+      std::remove(tmpFilePath.c_str());
+      return false;
+    }
+  }
+
+  const auto tmpFilePath = makeTemporaryPath(entryPath);
+  std::ofstream ofs{tmpFilePath, std::ios::binary};
+  if (!ofs) {
+    return false;
+  }
+  ofs.write(reinterpret_cast<const char*>(image.data()), static_cast<std::streamsize>(image.size()));
+  ofs.close();
+  if (!ofs) {
+    std::remove(tmpFilePath.c_str());
+    return false;
+  }
+  // ハードリンクした出力ファイルを経由して書き換えられないように，読み込み専用にしておく
+  using std::filesystem::perms;
+  std::filesystem::permissions(
+    tmpFilePath,
+    isExecutable
+      ? perms::owner_read | perms::owner_exec | perms::group_read | perms::group_exec | perms::others_read | perms::others_exec
+      : perms::owner_read | perms::group_read | perms::others_read,
+    ec);
+  return replaceFile(tmpFilePath, entryPath);
+}
+
+
+std::string
+CompileCache::getDefaultDirectory()
+{
+  if (const auto dir = std::getenv("BFC_CACHE_DIR"); dir != nullptr && *dir != '\0') {
+    return dir;
+  }
+#ifdef _WIN32
+  if (const auto dir = std::getenv("LOCALAPPDATA"); dir != nullptr && *dir != '\0') {
+    return std::string{dir} + "/bfcompiler";
+  }
+#else
+  if (const auto dir = std::getenv("XDG_CACHE_HOME"); dir != nullptr && *dir != '\0') {
+    return std::string{dir} + "/bfcompiler";
+  }
+  if (const auto dir = std::getenv("HOME"); dir != nullptr && *dir != '\0') {
+    return std::string{dir} + "/.cache/bfcompiler";
+  }
+#endif  // _WIN32
+  return "";
+}
+
+
+std::string
+CompileCache::getEntryPath(const std::string& key) const
+{
+  // 1つのディレクトリにファイルが集中しないように，先頭2文字でディレクトリを分ける
+  return cacheDir_ + "/" + key.substr(0, 2) + "/" + key.substr(2);
+}
+}  // namespace bfc
@@ -0,0 +1,110 @@
+/*!
+ * @brief 生成したバイナリの内容アドレス方式のキャッシュ
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bfcompiler.hpp"
+
+
+namespace bfc
+{
+/*!
+ * @brief 生成したバイナリの内容アドレス方式のキャッシュ
+ *
+ * コメントを取り除いた命令列と出力形式，コンパイルオプションの SHA-256 をキーとして，
+ * キャッシュディレクトリに生成したバイナリを保存しておく．
+ * キャッシュに存在する場合は，reflink，ハードリンク，コピーの順に試して出力先に配置する．
+ * コンパイル時の警告メッセージも保存しておき，配置した際に返す．
+ *
+ * 状態を持たないので，複数のスレッドから同時に利用してよい．
+ */
+class CompileCache
+{
+public:
+  /*!
+   * @brief キャッシュディレクトリを指定して構築する
+   *
+   * @param [in] cacheDir  キャッシュディレクトリのパス (存在しない場合は保存時に作成する)
+   */
+  explicit CompileCache(std::string cacheDir);
+
+  /*!
+   * @brief ソースコードとコンパイルオプションに対応するキーを求める
+   *
+   * @param [in] source  正規化したBrainf**kのソースコード
+   * @param [in] options  コンパイルオプション
+   * @return キー (SHA-256 の16進数表記)
+   */
+  std::string
+  makeKey(const NormalizedSource& source, const Options& options) const;
+
+  /*!
+   * @brief キャッシュに存在すれば出力先に配置する
+   *
+   * @param [in] key  キー
+   * @param [in] dstFilePath  出力ファイルのパス
+   * @param [in] isExecutable  実行可能属性を付与するかどうか
+   * @param [out] warnings  コンパイル時の警告メッセージ
+   * @return 配置できた場合は true
+   */
+  bool
+  restore(
+    const std::string& key,
+    const std::string& dstFilePath,
+    bool isExecutable,
+    std::vector<std::string>& warnings) const;
+
+  /*!
+   * @brief 生成したバイナリをキャッシュに保存する
+   *
+   * @param [in] key  キー
+   * @param [in] image  生成したバイナリ
+   * @param [in] isExecutable  実行可能属性を付与するかどうか
+   * @param [in] warnings  コンパイル時の警告メッセージ
+   * @return 保存できた場合は true
+   */
+  bool
+  store(
+    const std::string& key,
+    const std::vector<std::uint8_t>& image,
+    bool isExecutable,
+    const std::vector<std::string>& warnings) const;
+
+  /*!
+   * @brief 既定のキャッシュディレクトリのパスを返す
+   *
+   * 環境変数 BFC_CACHE_DIR，XDG_CACHE_HOME，HOME (Windows では LOCALAPPDATA) の順に参照する．
+   *
+   * @return 既定のキャッシュディレクトリのパス (決められない場合は空文字列)
+   */
+  static std::string
+  getDefaultDirectory();
+
+private:
+  /*!
+   * @brief キーに対応するキャッシュファイルのパスを返す
+   *
+   * @param [in] key  キー
+   * @return キャッシュファイルのパス
+   */
+  std::string
+  getEntryPath(const std::string& key) const;
+
+  //! キャッシュディレクトリのパス
+  std::string cacheDir_;
+  //! キーに含めるコンパイラ自身の識別情報
+  std::string compilerId_;
+};
+}  // namespace bfc
+
+
+#endif  // CACHE_HPP
@@ -0,0 +1,159 @@
+/*!
+ * @brief 生成するバイナリを書き込むバッファ
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#ifndef CODEBUFFER_HPP
+#define CODEBUFFER_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+
+namespace bfc
+{
+/*!
+ * @brief 生成するバイナリを書き込むバッファ
+ *
+ * std::ofstream の seekp() / tellp() と同じ要領で書き込み位置を移動できる．
+ * 現在のサイズより後ろに移動して書き込んだ場合，間はゼロで埋められる．
+ */
+class CodeBuffer
+{
+public:
+  /*!
+   * @brief 書き込み先のバッファを指定して構築する
+   *
+   * @param [out] data  書き込み先のバッファ (元の内容は破棄される)
+   */
+  explicit CodeBuffer(std::vector<std::uint8_t>& data) noexcept
+    : data_{data}
+    , pos_{0}
+  {
+    data_.clear();
+  }
+
+  /*!
+   * @brief 現在の書き込み位置を返す
+   *
+   * @return 現在の書き込み位置
+   */
+  std::size_t
+  tell() const noexcept
+  {
+    return pos_;
+  }
+
+  /*!
+   * @brief 書き込み位置を移動する
+   *
+   * @param [in] pos  新しい書き込み位置
+   */
+  void
+  seek(std::size_t pos) noexcept
+  {
+    pos_ = pos;
+  }
+
+  /*!
+   * @brief 現在の書き込み位置にデータを書き込む
+   *
+   * @param [in] src  書き込むデータ
+   * @param [in] size  書き込むデータのサイズ (byte単位)
+   */
+  void
+  write(const void* src, std::size_t size)
+  {
+    if (pos_ + size > data_.size()) {
+      data_.resize(pos_ + size);
+    }
+    std::memcpy(data_.data() + pos_, src, size);
+    pos_ += size;
+  }
+
+private:
+  //! 書き込み先のバッファ
+  std::vector<std::uint8_t>& data_;
+  //! 現在の書き込み位置
+  std::size_t pos_;
+};
+
+
+/*!
+ * @brief 複数のバイト列をバッファに書き込む
+ *
+ * @param [in] buf  書き込み先バッファ
+ * @param [in] data  バイト列
+ */
+inline void
+writeBytes(CodeBuffer& buf, const std::initializer_list<std::uint8_t>& data)
+{
+  buf.write(data.begin(), data.size());
+}
+
+
+/*!
+ * @brief 指定したデータをバッファに書き込む
+ *
+ * @param [in] buf  書き込み先バッファ
+ * @param [in] data  書き込むデータ
+ */
+template <typename T>
+inline void
+writeAs(CodeBuffer& buf, const T& data)
+{
+  buf.write(&data, sizeof(data));
+}
+
+
+/*!
+ * @brief 文字列の指定したオフセットから指定文字が何個連続するか数える
+ *
+ * @param [in] str  対象文字列
+ * @param [in] ch  連え対象の文字列
+ * @param [in] offset  数え始めるオフセット
+ * @return 連続する文字数
+ */
+inline int
+countSuccChars(const std::string& str, char ch, std::string::size_type offset)
+{
+  int cnt = 0;
+  for (auto i = offset; i < str.size() && str[i] == ch; i++) {
+    cnt++;
+  }
+  return cnt;
+}
+
+
+/*!
+ * @brief 文字列の指定したオフセットから2種類の文字が任意の順に何個連続するか数え，正味の個数を求める
+ *
+ * +-+-++ や >><<<> のような連続を1命令にまとめるために用いる．
+ *
+ * @param [in] str  対象文字列
+ * @param [in] inc  正に数える文字
+ * @param [in] dec  負に数える文字
+ * @param [in] offset  数え始めるオフセット
+ * @param [out] length  連続する文字数
+ * @return inc の個数から dec の個数を引いた値
+ */
+inline int
+countNetChars(const std::string& str, char inc, char dec, std::string::size_type offset, std::string::size_type& length)
+{
+  int cnt = 0;
+  auto i = offset;
+  for (; i < str.size() && (str[i] == inc || str[i] == dec); i++) {
+    cnt += str[i] == inc ? 1 : -1;
+  }
+  length = i - offset;
+  return cnt;
+}
+}  // namespace bfc
+
+
+#endif  // CODEBUFFER_HPP
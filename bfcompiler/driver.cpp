@@ -0,0 +1,553 @@
+/*!
+ * @brief Simple Brainf**k Compiler のコマンドラインインタフェース
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <cstdint>
+#include <cstdlib>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "batch.hpp"
+#include "bfcompiler.hpp"
+#include "cache.hpp"
+#include "driver.hpp"
+#include "fileutil.hpp"
+#include "process.hpp"
+#ifndef _WIN32
+#  include "protocol.hpp"
+#  include "server.hpp"
+#endif  // _WIN32
+
+
+namespace bfc
+{
+namespace
+{
+#ifdef _MSC_VER
+//! Brainf**kのソースファイルのパスの既定値
+constexpr auto kDefaultSrcFilePath = "source.bf";
+#else
+//! Brainf**kのソースファイルのパスの既定値 (出力ファイルに合わせて"./"を付与したが無くてもいい)
+constexpr auto kDefaultSrcFilePath = "./source.bf";
+#endif
+//! 監視モードでソースファイルの更新を確認する間隔
+constexpr std::chrono::milliseconds kWatchInterval{100};
+
+
+/*!
+ * @brief コマンドラインで指定された設定
+ */
+struct CliConfig
+{
+  //! コンパイルオプション
+  Options options{};
+  //! Brainf**kのソースファイルのパス
+  std::string srcFilePath{kDefaultSrcFilePath};
+  //! 出力ファイルのパス (空のときは出力形式に応じた既定値を用いる)
+  std::string dstFilePath{};
+  //! 生成した実行ファイルを実行するかどうか
+  bool isRun = true;
+  //! 出力ファイルを書き出さずにメモリ上で実行するかどうか
+  bool isExec = false;
+  //! バッチコンパイルの入出力の一覧のファイルパス (空のときはバッチコンパイルを行わない)
+  std::string batchListPath{};
+  //! バッチコンパイルのスレッド数 (0のときはハードウェアのスレッド数)
+  unsigned int nThreads = 0;
+  //! キャッシュを用いるかどうか
+  bool isCacheEnabled = true;
+  //! キャッシュディレクトリのパス (空のときは既定値を用いる)
+  std::string cacheDir{};
+  //! ソースファイルを監視し，更新されるたびにコンパイルし直すかどうか
+  bool isWatch = false;
+  //! コンパイルサーバとして起動するかどうか
+  bool isServe = false;
+  //! コンパイルサーバのソケットファイルのパス (空のときは既定値を用いる)
+  std::string socketPath{};
+  //! ループの到達回数のプロファイルのパス (空のときはプロファイルを用いない)
+  std::string profilePath{};
+};
+
+
+/*!
+ * @brief 出力ファイルのパスの既定値を返す
+ *
+ * @param [in] options  コンパイルオプション
+ * @return 出力ファイルのパスの既定値
+ */
+inline std::string
+getDefaultDstFilePath(const Options& options)
+{
+  if (options.isObject) {
+    return "./a.o";
+  }
+  switch (options.target) {
+    case Target::PeX64:
+    case Target::PeX86:
+#ifdef _MSC_VER
+      return "a.exe";
+#else
+      return "./a.exe";
+#endif
+    case Target::ElfX64:
+    case Target::ElfX86:
+    default:
+      return "./a.out";
+  }
+}
+
+
+/*!
+ * @brief 使い方を表示する
+ *
+ * @param [in] progName  プログラム名
+ * @param [in] defaultTarget  出力形式の既定値
+ */
+inline void
+showUsage(const char* progName, Target defaultTarget)
+{
+  std::cout << "Usage: " << progName << " [OPTIONS] [SOURCE]\n"
+            << "Compile Brainf**k SOURCE (default: " << kDefaultSrcFilePath << ") and run it.\n"
+            << "\n"
+            << "Options:\n"
+            << "  -o FILE     Write the output to FILE (default: ./a.out, ./a.o or ./a.exe)\n"
+            << "  --target=FORMAT\n"
+            << "              Output format: elf64 (x64 ELF), elf32 (x86 ELF), pe64 (x64 PE) or\n"
+            << "              pe32 (x86 PE; PE needs a build with windows.h) (default: "
+            << getTargetName(defaultTarget) << ")\n"
+            << "  -c          Emit a relocatable object exposing bf_run() instead of an executable\n"
+            << "              (x64 ELF only; implies --no-run)\n"
+            << "  --tiny      Emit a minimal executable without section headers or symbols to\n"
+            << "              make it smaller and faster to load (ELF only; not with -c)\n"
+            << "  --no-run    Do not run the generated executable\n"
+            << "  --exec      Run the generated executable from memory without writing an output\n"
+            << "              file and exit with its status (ELF only)\n"
+            << "  --batch LIST\n"
+            << "              Compile every \"SOURCE OUTPUT\" pair listed in LIST (one per line,\n"
+            << "              \"-\" for stdin) in parallel instead of a single SOURCE; implies --no-run\n"
+            << "  -j N        Number of threads: files compiled in parallel with --batch,\n"
+            << "              code generation threads otherwise (default: number of CPUs\n"
+            << "              for --batch, automatic for a single SOURCE)\n"
+            << "  --watch     Keep running and recompile SOURCE (and rerun it unless --no-run)\n"
+            << "              whenever it changes, regenerating only the changed top-level loops\n"
+            << "  --profile FILE\n"
+            << "              Read how many times each loop was reached from FILE (\"OFFSET COUNT\"\n"
+            << "              per line, OFFSET being the byte offset of the '[' in SOURCE) to decide\n"
+            << "              which repeated loops to share as subroutines (x64 ELF only)\n"
+            << "  --tune=CPU  Lay out code for CPU: generic (smallest code, default), intel or amd\n"
+            << "              (aligns loops and moves non-terminating paths out of line; x64 ELF only)\n"
+#ifndef _WIN32
+            << "  --serve     Run as a compile server accepting requests from bfclient on a Unix\n"
+            << "              domain socket; -j sets the number of worker threads\n"
+            << "  --socket PATH\n"
+            << "              Listen on PATH with --serve (default: $XDG_RUNTIME_DIR/bfcompiler.sock\n"
+            << "              or /tmp/bfcompiler-UID.sock)\n"
+#endif  // _WIN32
+            << "  --no-cache  Do not look up or store generated binaries in the compilation cache\n"
+            << "  --cache-dir DIR\n"
+            << "              Use DIR as the compilation cache (default: $BFC_CACHE_DIR,\n"
+            << "              $XDG_CACHE_HOME/bfcompiler or ~/.cache/bfcompiler)\n"
+            << "  -h, --help  Show this help and exit\n";
+}
+
+
+/*!
+ * @brief コマンドライン引数を解析する
+ *
+ * @param [in] argc  コマンドライン引数の数
+ * @param [in] argv  コマンドライン引数
+ * @param [out] config  解析結果
+ * @return 処理を続行する場合は -1，そうでなければ終了ステータス
+ */
+inline int
+parseArguments(int argc, char* argv[], CliConfig& config)
+{
+  const auto defaultTarget = config.options.target;
+  for (int i = 1; i < argc; i++) {
+    const std::string_view arg{argv[i]};
+    if (arg == "-h" || arg == "--help") {
+      showUsage(argv[0], defaultTarget);
+      return 0;
+    } else if (arg == "-o") {
+      if (++i >= argc) {
+        std::cerr << "Option -o requires an argument" << std::endl;
+        return 1;
+      }
+      config.dstFilePath = argv[i];
+    } else if (arg.substr(0, 9) == "--target=") {
+      const auto name = arg.substr(9);
+      if (!parseTarget(name, config.options.target)) {
+        std::cerr << "Unknown output format for --target: " << name << std::endl;
+        return 1;
+      }
+      if (!isTargetSupported(config.options.target)) {
+        std::cerr << "Output format " << name << " is not supported in this build" << std::endl;
+        return 1;
+      }
+    } else if (arg == "-c") {
+      config.options.isObject = true;
+    } else if (arg == "--tiny") {
+      config.options.isTiny = true;
+    } else if (arg == "--no-run") {
+      config.isRun = false;
+    } else if (arg == "--exec") {
+      config.isExec = true;
+    } else if (arg == "--batch") {
+      if (++i >= argc) {
+        std::cerr << "Option --batch requires an argument" << std::endl;
+        return 1;
+      }
+      config.batchListPath = argv[i];
+      config.isRun = false;
+    } else if (arg == "-j") {
+      if (++i >= argc) {
+        std::cerr << "Option -j requires an argument" << std::endl;
+        return 1;
+      }
+      const auto n = std::atoi(argv[i]);
+      if (n <= 0) {
+        std::cerr << "Invalid number of threads: " << argv[i] << std::endl;
+        return 1;
+      }
+      config.nThreads = static_cast<unsigned int>(n);
+      config.options.nThreads = config.nThreads;
+    } else if (arg == "--watch") {
+      config.isWatch = true;
+    } else if (arg == "--profile") {
+      if (++i >= argc) {
+        std::cerr << "Option --profile requires an argument" << std::endl;
+        return 1;
+      }
+      config.profilePath = argv[i];
+    } else if (arg.substr(0, 7) == "--tune=") {
+      const auto name = arg.substr(7);
+      if (name == "generic") {
+        config.options.tune = Tune::Generic;
+      } else if (name == "intel") {
+        config.options.tune = Tune::Intel;
+      } else if (name == "amd") {
+        config.options.tune = Tune::Amd;
+      } else {
+        std::cerr << "Unknown CPU for --tune: " << name << std::endl;
+        return 1;
+      }
+#ifndef _WIN32
+    } else if (arg == "--serve") {
+      config.isServe = true;
+    } else if (arg == "--socket") {
+      if (++i >= argc) {
+        std::cerr << "Option --socket requires an argument" << std::endl;
+        return 1;
+      }
+      config.socketPath = argv[i];
+#endif  // _WIN32
+    } else if (arg == "--no-cache") {
+      config.isCacheEnabled = false;
+    } else if (arg == "--cache-dir") {
+      if (++i >= argc) {
+        std::cerr << "Option --cache-dir requires an argument" << std::endl;
+        return 1;
+      }
+      config.cacheDir = argv[i];
+    } else if (arg.size() > 1 && arg[0] == '-') {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      showUsage(argv[0], defaultTarget);
+      return 1;
+    } else {
+      config.srcFilePath = arg;
+    }
+  }
+
+  if (config.options.isObject) {
+    if (config.options.target != Target::ElfX64) {
+      std::cerr << "Option -c is supported only for x64 ELF" << std::endl;
+      return 1;
+    }
+    config.isRun = false;
+  }
+  if (config.isExec) {
+    if (!config.isRun) {
+      std::cerr << "Option --exec cannot be used with --no-run, -c or --batch" << std::endl;
+      return 1;
+    }
+    if (config.options.target != Target::ElfX64 && config.options.target != Target::ElfX86) {
+      std::cerr << "Option --exec is supported only for ELF" << std::endl;
+      return 1;
+    }
+  }
+  if (config.isWatch && !config.batchListPath.empty()) {
+    std::cerr << "Option --watch cannot be used with --batch" << std::endl;
+    return 1;
+  }
+  if (config.isServe && (config.isWatch || !config.batchListPath.empty() || config.isExec)) {
+    std::cerr << "Option --serve cannot be used with --watch, --batch or --exec" << std::endl;
+    return 1;
+  }
+  if (config.options.isTiny) {
+    if (config.options.isObject) {
+      std::cerr << "Option --tiny cannot be used with -c" << std::endl;
+      return 1;
+    }
+    if (config.options.target != Target::ElfX64 && config.options.target != Target::ElfX86) {
+      std::cerr << "Option --tiny is supported only for ELF" << std::endl;
+      return 1;
+    }
+  }
+  if (config.options.tune != Tune::Generic && config.options.target != Target::ElfX64) {
+    std::cerr << "Option --tune is supported only for x64 ELF" << std::endl;
+    return 1;
+  }
+  if (!config.profilePath.empty()) {
+    // プロファイルはソースファイル上の位置で指定するので，複数のソースには使えない
+    if (config.isServe || !config.batchListPath.empty()) {
+      std::cerr << "Option --profile cannot be used with --serve or --batch" << std::endl;
+      return 1;
+    }
+    if (config.options.target != Target::ElfX64) {
+      std::cerr << "Option --profile is supported only for x64 ELF" << std::endl;
+      return 1;
+    }
+    std::ifstream ifs{config.profilePath};
+    if (!ifs) {
+      std::cerr << "Failed to open " << config.profilePath << std::endl;
+      return 1;
+    }
+    if (const auto errorLine = readLoopProfile(ifs, config.options.loopProfile); errorLine != 0) {
+      std::cerr << config.profilePath << ":" << errorLine << ": Expected \"OFFSET COUNT\"" << std::endl;
+      return 1;
+    }
+  }
+  if (config.dstFilePath.empty()) {
+    config.dstFilePath = getDefaultDstFilePath(config.options);
+  }
+  if (config.isCacheEnabled && config.cacheDir.empty()) {
+    config.cacheDir = CompileCache::getDefaultDirectory();
+    config.isCacheEnabled = !config.cacheDir.empty();
+  }
+  return -1;
+}
+
+
+/*!
+ * @brief 生成した実行ファイルの実行結果を終了ステータスに変換する
+ *
+ * @param [in] status  runExecutable() または runImage() の戻り値
+ * @param [in] name  診断メッセージに用いる名前
+ * @return 終了ステータス (起動できなかった場合は診断メッセージを表示して1を返す)
+ */
+inline int
+toExitStatus(int status, const std::string& name)
+{
+  if (status == -1) {
+    std::cerr << "Failed to run " << name << std::endl;
+    return 1;
+  }
+  return status;
+}
+
+
+/*!
+ * @brief 警告メッセージを表示する
+ *
+ * @param [in] srcFilePath  警告の対象のソースファイルのパス
+ * @param [in] message  警告メッセージ
+ */
+inline void
+printWarning(const std::string& srcFilePath, const std::string& message)
+{
+  std::cerr << srcFilePath << ": warning: " << message << std::endl;
+}
+
+
+/*!
+ * @brief バッチコンパイルを行い，ファイルごとの診断メッセージと集計を表示する
+ *
+ * @param [in] config  コマンドラインで指定された設定
+ * @param [in] cache  キャッシュ (nullptr のときはキャッシュを用いない)
+ * @return 終了ステータス
+ */
+inline int
+runBatch(const CliConfig& config, const CompileCache* cache)
+{
+  std::vector<BatchEntry> entries;
+  std::size_t errorLine;
+  if (config.batchListPath == "-") {
+    errorLine = readBatchList(std::cin, entries);
+  } else {
+    std::ifstream ifs{config.batchListPath};
+    if (!ifs) {
+      std::cerr << "Failed to open " << config.batchListPath << std::endl;
+      return 1;
+    }
+    errorLine = readBatchList(ifs, entries);
+  }
+  if (errorLine != 0) {
+    std::cerr << config.batchListPath << ":" << errorLine << ": Expected \"SOURCE OUTPUT\"" << std::endl;
+    return 1;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  const auto results = compileBatch(entries, config.options, cache, config.nThreads);
+  const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::size_t nFailed = 0;
+  std::size_t nCacheHits = 0;
+  for (decltype(results)::size_type i = 0; i < results.size(); i++) {
+    for (const auto& warning : results[i].warnings) {
+      printWarning(entries[i].srcFilePath, warning);
+    }
+    if (!results[i].isSucceeded) {
+      std::cerr << entries[i].srcFilePath << ": " << results[i].message << "\n";
+      nFailed++;
+    } else if (results[i].isCacheHit) {
+      nCacheHits++;
+    }
+  }
+  std::cerr << results.size() << " files: " << (results.size() - nFailed) << " succeeded ("
+            << nCacheHits << " cached), " << nFailed << " failed (" << elapsed << " s)" << std::endl;
+  return nFailed == 0 ? 0 : 1;
+}
+
+
+/*!
+ * @brief ソースファイルを監視し，更新されるたびにコンパイルし直す
+ *
+ * 生成コードの断片をメモリ上に保持しておき，変更されたトップレベルの領域のみを生成し直す．
+ * 更新は一定間隔で更新日時を確認して検知する．終了するにはシグナルで停止させる．
+ *
+ * @param [in] config  コマンドラインで指定された設定
+ */
+[[noreturn]] inline void
+runWatch(const CliConfig& config)
+{
+  FragmentCache fragmentCache;
+  NormalizedSource source;
+  std::vector<std::uint8_t> image;
+  const auto isExecutable = !config.options.isObject
+    && (config.options.target == Target::ElfX64 || config.options.target == Target::ElfX86);
+
+  std::filesystem::file_time_type lastWriteTime{};
+  for (auto isFirst = true;; std::this_thread::sleep_for(kWatchInterval)) {
+    std::error_code ec;
+    const auto writeTime = std::filesystem::last_write_time(config.srcFilePath, ec);
+    if (ec || (!isFirst && writeTime == lastWriteTime)) {
+      continue;
+    }
+    isFirst = false;
+    lastWriteTime = writeTime;
+
+    const auto start = std::chrono::steady_clock::now();
+    if (!readSourceFile(config.srcFilePath, source)) {
+      std::cerr << "Failed to open " << config.srcFilePath << std::endl;
+      continue;
+    }
+    try {
+      compile(source, config.options, image, &fragmentCache);
+    } catch (const CompileError& e) {
+      std::cerr << config.srcFilePath << ": " << e.what() << std::endl;
+      continue;
+    }
+    if (!config.isExec && !writeImageFile(config.dstFilePath, image, isExecutable)) {
+      std::cerr << "Failed to write " << config.dstFilePath << std::endl;
+      continue;
+    }
+    const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "Built " << (config.isExec ? config.srcFilePath : config.dstFilePath) << " in " << elapsed << " ms";
+    if (fragmentCache.getFragmentCount() != 0) {
+      std::cerr << " (reused " << fragmentCache.getReusedCount() << " of " << fragmentCache.getFragmentCount()
+                << " fragments)";
+    }
+    std::cerr << std::endl;
+
+    if (config.isExec) {
+      toExitStatus(runImage(image), config.srcFilePath);
+    } else if (config.isRun) {
+      toExitStatus(runExecutable(config.dstFilePath), config.dstFilePath);
+    }
+  }
+}
+
+
+/*!
+ * @brief ソースファイルをコンパイルし，出力ファイルを書き出さずに実行する
+ *
+ * @param [in] config  コマンドラインで指定された設定
+ * @return 生成した実行ファイルの終了ステータス (コンパイルに失敗した場合は1)
+ */
+inline int
+runExec(const CliConfig& config)
+{
+  NormalizedSource source;
+  std::vector<std::uint8_t> image;
+  if (!readSourceFile(config.srcFilePath, source)) {
+    std::cerr << "Failed to open " << config.srcFilePath << std::endl;
+    return 1;
+  }
+  try {
+    compile(source, config.options, image);
+  } catch (const CompileError& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return toExitStatus(runImage(image), config.srcFilePath);
+}
+}  // namespace
+
+
+int
+runCompiler(int argc, char* argv[], Target target)
+{
+  CliConfig config;
+  config.options.target = target;
+  const auto status = parseArguments(argc, argv, config);
+  if (status != -1) {
+    return status;
+  }
+  // compile() を直接呼ぶ --watch と --exec で用いる (compileFile() は警告を結果に含めて返す)
+  config.options.warningHandler = [srcFilePath = config.srcFilePath](const std::string& message) {
+    printWarning(srcFilePath, message);
+  };
+
+  if (config.isWatch) {
+    runWatch(config);
+  }
+  if (config.isExec) {
+    return runExec(config);
+  }
+
+  std::optional<CompileCache> cache;
+  if (config.isCacheEnabled) {
+    cache.emplace(config.cacheDir);
+  }
+#ifndef _WIN32
+  if (config.isServe) {
+    return runServer(config.socketPath.empty() ? getDefaultSocketPath() : config.socketPath, cache ? &*cache : nullptr, config.nThreads);
+  }
+#endif  // _WIN32
+  if (!config.batchListPath.empty()) {
+    return runBatch(config, cache ? &*cache : nullptr);
+  }
+
+  NormalizedSource source;
+  std::vector<std::uint8_t> image;
+  const auto result = compileFile({config.srcFilePath, config.dstFilePath}, config.options, cache ? &*cache : nullptr, source, image);
+  for (const auto& warning : result.warnings) {
+    printWarning(config.srcFilePath, warning);
+  }
+  if (!result.isSucceeded) {
+    std::cerr << result.message << std::endl;
+    return 1;
+  }
+
+  return config.isRun ? toExitStatus(runExecutable(config.dstFilePath), config.dstFilePath) : 0;
+}
+}  // namespace bfc
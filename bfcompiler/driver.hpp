@@ -0,0 +1,31 @@
+/*!
+ * @brief Simple Brainf**k Compiler のコマンドラインインタフェース
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#ifndef DRIVER_HPP
+#define DRIVER_HPP
+
+#include "bfcompiler.hpp"
+
+
+namespace bfc
+{
+/*!
+ * @brief コマンドライン引数に従ってコンパイルを行う
+ *
+ * 各コンパイラの main() から呼び出す．出力形式は --target オプションで変更できる．
+ *
+ * @param [in] argc  コマンドライン引数の数
+ * @param [in] argv  コマンドライン引数
+ * @param [in] target  出力形式の既定値
+ * @return 終了ステータス
+ */
+int
+runCompiler(int argc, char* argv[], Target target);
+}  // namespace bfc
+
+
+#endif  // DRIVER_HPP
@@ -0,0 +1,317 @@
+/*!
+ * @brief ELF のヘッダを書き込む関数群
+ *
+ * ELF32 と ELF64 は構造体の型とメンバの並びが異なるだけなので，
+ * ElfTraits で違いを与えて同じ関数で書き込む．
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#ifndef ELFWRITER_HPP
+#define ELFWRITER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+
+#include <elf.h>
+
+#include "codebuffer.hpp"
+#include "x86encoder.hpp"
+
+
+namespace bfc
+{
+/*!
+ * @brief 命令を実行するモードごとの ELF の型と定数
+ *
+ * @tparam kMode  命令を実行するモード
+ */
+template <x86::Mode kMode>
+struct ElfTraits;
+
+
+/*!
+ * @brief ELF64 (x64) の型と定数
+ */
+template <>
+struct ElfTraits<x86::Mode::Bits64>
+{
+  using Ehdr = ::Elf64_Ehdr;
+  using Phdr = ::Elf64_Phdr;
+  using Shdr = ::Elf64_Shdr;
+  using Sym = ::Elf64_Sym;
+  using Addr = ::Elf64_Addr;
+  using Off = ::Elf64_Off;
+  using Half = ::Elf64_Half;
+  using Word = ::Elf64_Word;
+  //! サイズを表す型 (p_filesz, sh_size 等)
+  using Size = ::Elf64_Xword;
+
+  //! EI_CLASS の値
+  static constexpr unsigned char kClass = ELFCLASS64;
+  //! e_machine の値
+  static constexpr Half kMachine = EM_X86_64;
+
+  /*!
+   * @brief シンボルの st_info の値を返す
+   *
+   * @param [in] bind  シンボルの結合 (STB_*)
+   * @param [in] type  シンボルの種類 (STT_*)
+   * @return st_info の値
+   */
+  static constexpr unsigned char
+  makeSymbolInfo(unsigned char bind, unsigned char type) noexcept
+  {
+    return static_cast<unsigned char>(ELF64_ST_INFO(bind, type));
+  }
+};
+
+
+/*!
+ * @brief ELF32 (x86) の型と定数
+ */
+template <>
+struct ElfTraits<x86::Mode::Bits32>
+{
+  using Ehdr = ::Elf32_Ehdr;
+  using Phdr = ::Elf32_Phdr;
+  using Shdr = ::Elf32_Shdr;
+  using Sym = ::Elf32_Sym;
+  using Addr = ::Elf32_Addr;
+  using Off = ::Elf32_Off;
+  using Half = ::Elf32_Half;
+  using Word = ::Elf32_Word;
+  //! サイズを表す型 (p_filesz, sh_size 等)
+  using Size = ::Elf32_Word;
+
+  //! EI_CLASS の値
+  static constexpr unsigned char kClass = ELFCLASS32;
+  //! e_machine の値
+  static constexpr Half kMachine = EM_386;
+
+  /*!
+   * @brief シンボルの st_info の値を返す
+   *
+   * @param [in] bind  シンボルの結合 (STB_*)
+   * @param [in] type  シンボルの種類 (STT_*)
+   * @return st_info の値
+   */
+  static constexpr unsigned char
+  makeSymbolInfo(unsigned char bind, unsigned char type) noexcept
+  {
+    return static_cast<unsigned char>(ELF32_ST_INFO(bind, type));
+  }
+};
+
+
+/*!
+ * @brief ELF ヘッダを書き込む
+ *
+ * プログラムヘッダは ELF ヘッダの直後に置き，セクション名の文字列テーブルは1番目のセクションとする．
+ * セクションヘッダが無い場合は shoff に0を指定する．
+ *
+ * @tparam kMode  命令を実行するモード
+ * @param [in] buf  書き込み先バッファ
+ * @param [in] type  ファイルの種類 (ET_EXEC または ET_REL)
+ * @param [in] osAbi  対象の OS の ABI (ELFOSABI_*)
+ * @param [in] entry  エントリポイントのアドレス (無ければ0)
+ * @param [in] nProgramHeaders  プログラムヘッダ数
+ * @param [in] shoff  セクションヘッダのファイル上のオフセット
+ * @param [in] nSectionHeaders  セクションヘッダ数
+ */
+template <x86::Mode kMode>
+inline void
+writeElfHeader(
+  CodeBuffer& buf,
+  typename ElfTraits<kMode>::Half type,
+  unsigned char osAbi,
+  typename ElfTraits<kMode>::Addr entry,
+  typename ElfTraits<kMode>::Half nProgramHeaders,
+  std::size_t shoff,
+  typename ElfTraits<kMode>::Half nSectionHeaders)
+{
+  using Traits = ElfTraits<kMode>;
+
+  typename Traits::Ehdr ehdr;
+  std::fill(std::begin(ehdr.e_ident), std::end(ehdr.e_ident), 0x00);
+  ehdr.e_ident[EI_MAG0] = ELFMAG0;
+  ehdr.e_ident[EI_MAG1] = ELFMAG1;
+  ehdr.e_ident[EI_MAG2] = ELFMAG2;
+  ehdr.e_ident[EI_MAG3] = ELFMAG3;
+  ehdr.e_ident[EI_CLASS] = Traits::kClass;
+  ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr.e_ident[EI_OSABI] = osAbi;
+  ehdr.e_ident[EI_ABIVERSION] = 0x00;
+  ehdr.e_ident[EI_PAD] = 0x00;
+  ehdr.e_type = type;
+  ehdr.e_machine = Traits::kMachine;
+  ehdr.e_version = EV_CURRENT;
+  ehdr.e_entry = entry;
+  ehdr.e_phoff = nProgramHeaders == 0 ? 0 : sizeof(typename Traits::Ehdr);
+  ehdr.e_shoff = static_cast<typename Traits::Off>(shoff);
+  ehdr.e_flags = 0x00000000;
+  ehdr.e_ehsize = sizeof(typename Traits::Ehdr);
+  ehdr.e_phentsize = nProgramHeaders == 0 ? 0 : sizeof(typename Traits::Phdr);
+  ehdr.e_phnum = nProgramHeaders;
+  ehdr.e_shentsize = nSectionHeaders == 0 ? 0 : sizeof(typename Traits::Shdr);
+  ehdr.e_shnum = nSectionHeaders;
+  ehdr.e_shstrndx = nSectionHeaders == 0 ? SHN_UNDEF : 1;
+  writeAs(buf, ehdr);
+}
+
+
+/*!
+ * @brief ロード可能セグメントのプログラムヘッダを書き込む
+ *
+ * セグメントはファイルの先頭 (ファイルに内容を持たない場合も含む) からページ単位で配置する．
+ *
+ * @tparam kMode  命令を実行するモード
+ * @param [in] buf  書き込み先バッファ
+ * @param [in] flags  セグメントの属性 (PF_*)
+ * @param [in] vaddr  配置するアドレス
+ * @param [in] fileSize  ファイル上のサイズ (byte単位)
+ * @param [in] memSize  メモリ上のサイズ (byte単位)
+ */
+template <x86::Mode kMode>
+inline void
+writeLoadSegmentHeader(
+  CodeBuffer& buf,
+  typename ElfTraits<kMode>::Word flags,
+  typename ElfTraits<kMode>::Addr vaddr,
+  std::size_t fileSize,
+  std::size_t memSize)
+{
+  using Traits = ElfTraits<kMode>;
+
+  typename Traits::Phdr phdr;
+  phdr.p_type = PT_LOAD;
+  phdr.p_flags = flags;
+  phdr.p_offset = 0x00000000;
+  phdr.p_vaddr = vaddr;
+  phdr.p_paddr = vaddr;
+  phdr.p_filesz = static_cast<typename Traits::Size>(fileSize);
+  phdr.p_memsz = static_cast<typename Traits::Size>(memSize);
+  phdr.p_align = 0x00001000;
+  writeAs(buf, phdr);
+}
+
+
+/*!
+ * @brief 最小構成の実行ファイルのヘッダを書き込む
+ *
+ * ローダはセクションヘッダを参照しないので，セクションヘッダと文字列テーブルを持たず，
+ * ファイル全体 (ヘッダ，コード，定数データ) を読み込み・実行可能なセグメント，
+ * テープを読み書き可能なセグメントとする．ヘッダはコードと同じページに載るので，
+ * セグメントから外してもマップするページ数は変わらない．
+ *
+ * @tparam kMode  命令を実行するモード
+ * @param [in] buf  書き込み先バッファ
+ * @param [in] baseAddr  ファイルの先頭を配置するアドレス
+ * @param [in] entry  エントリポイントのアドレス
+ * @param [in] imageSize  ファイル全体のサイズ (byte単位)
+ * @param [in] bssAddr  テープを配置するアドレス
+ * @param [in] bssSize  テープのサイズ (byte単位)
+ */
+template <x86::Mode kMode>
+inline void
+writeTinyExecutableHeader(
+  CodeBuffer& buf,
+  typename ElfTraits<kMode>::Addr baseAddr,
+  typename ElfTraits<kMode>::Addr entry,
+  std::size_t imageSize,
+  typename ElfTraits<kMode>::Addr bssAddr,
+  std::size_t bssSize)
+{
+  writeElfHeader<kMode>(buf, ET_EXEC, ELFOSABI_LINUX, entry, 2, 0, 0);
+  writeLoadSegmentHeader<kMode>(buf, PF_R | PF_X, baseAddr, imageSize, imageSize);
+  writeLoadSegmentHeader<kMode>(buf, PF_R | PF_W, bssAddr, 0, bssSize);
+}
+
+
+/*!
+ * @brief セクションヘッダを書き込む
+ *
+ * @tparam kMode  命令を実行するモード
+ * @param [in] buf  書き込み先バッファ
+ * @param [in] name  セクション名の文字列テーブル上のオフセット
+ * @param [in] type  セクションの種類 (SHT_*)
+ * @param [in] flags  セクションの属性 (SHF_*)
+ * @param [in] addr  配置するアドレス (配置しなければ0)
+ * @param [in] offset  ファイル上のオフセット
+ * @param [in] size  サイズ (byte単位)
+ * @param [in] link  関連するセクションのインデックス
+ * @param [in] info  セクションの種類ごとの付加情報
+ * @param [in] addralign  配置境界
+ * @param [in] entsize  要素のサイズ (表でなければ0)
+ */
+template <x86::Mode kMode>
+inline void
+writeSectionHeader(
+  CodeBuffer& buf,
+  typename ElfTraits<kMode>::Word name,
+  typename ElfTraits<kMode>::Word type,
+  std::uint64_t flags,
+  typename ElfTraits<kMode>::Addr addr,
+  std::size_t offset,
+  std::size_t size,
+  typename ElfTraits<kMode>::Word link,
+  typename ElfTraits<kMode>::Word info,
+  std::size_t addralign,
+  std::size_t entsize)
+{
+  using Traits = ElfTraits<kMode>;
+
+  typename Traits::Shdr shdr;
+  shdr.sh_name = name;
+  shdr.sh_type = type;
+  shdr.sh_flags = static_cast<typename Traits::Size>(flags);
+  shdr.sh_addr = addr;
+  shdr.sh_offset = static_cast<typename Traits::Off>(offset);
+  shdr.sh_size = static_cast<typename Traits::Size>(size);
+  shdr.sh_link = link;
+  shdr.sh_info = info;
+  shdr.sh_addralign = static_cast<typename Traits::Size>(addralign);
+  shdr.sh_entsize = static_cast<typename Traits::Size>(entsize);
+  writeAs(buf, shdr);
+}
+
+
+/*!
+ * @brief シンボルテーブルの要素を構築する
+ *
+ * @tparam kMode  命令を実行するモード
+ * @param [in] name  シンボル名の文字列テーブル上のオフセット
+ * @param [in] info  シンボルの結合と種類 (ElfTraits::makeSymbolInfo() の戻り値)
+ * @param [in] shndx  シンボルが属するセクションのインデックス
+ * @param [in] value  シンボルの値 (アドレス)
+ * @param [in] size  シンボルのサイズ (byte単位)
+ * @return シンボルテーブルの要素
+ */
+template <x86::Mode kMode>
+inline typename ElfTraits<kMode>::Sym
+makeSymbol(
+  typename ElfTraits<kMode>::Word name,
+  unsigned char info,
+  typename ElfTraits<kMode>::Half shndx,
+  typename ElfTraits<kMode>::Addr value,
+  std::size_t size) noexcept
+{
+  using Traits = ElfTraits<kMode>;
+
+  typename Traits::Sym sym;
+  sym.st_name = name;
+  sym.st_info = info;
+  sym.st_other = STV_DEFAULT;
+  sym.st_shndx = shndx;
+  sym.st_value = value;
+  sym.st_size = static_cast<typename Traits::Size>(size);
+  return sym;
+}
+}  // namespace bfc
+
+
+#endif  // ELFWRITER_HPP
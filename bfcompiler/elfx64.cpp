@@ -0,0 +1,1712 @@
+/*!
+ * @brief Simple Brainf**k Compiler for x64 ELF
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <exception>
+#include <iterator>
+#include <limits>
+#include <stack>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <elf.h>
+
+#include "bfcompiler.hpp"
+#include "codebuffer.hpp"
+#include "elfwriter.hpp"
+#include "ir.hpp"
+#include "optimizer.hpp"
+#include "x86encoder.hpp"
+
+
+namespace bfc
+{
+namespace
+{
+//! .textセクションのアドレス
+constexpr ::Elf64_Addr kBaseAddr = 0x04048000;
+//! .bssセクションのアドレス
+constexpr ::Elf64_Addr kBssAddr = 0x04248000;
+//! プログラムヘッダ数
+constexpr ::Elf64_Half kNProgramHeaders = 2;
+//! セクションヘッダ数
+constexpr ::Elf64_Half kNSectionHeaders = 7;
+//! ヘッダ部分のサイズ
+constexpr ::Elf64_Off kHeaderSize = sizeof(::Elf64_Ehdr) + sizeof(::Elf64_Phdr) * kNProgramHeaders;
+//! フッタ部分のサイズ
+constexpr ::Elf64_Off kFooterSize = sizeof(::Elf64_Shdr) * kNSectionHeaders;
+//! 文字列テーブル
+constexpr char kShStrTab[] = "\0.text\0.shstrtab\0.bss\0.symtab\0.strtab\0.rodata";
+//! .textセクションのセクションヘッダのインデックス
+constexpr ::Elf64_Half kTextSectionIndex = 2;
+//! .strtabセクションのセクションヘッダのインデックス
+constexpr ::Elf64_Half kStrTabSectionIndex = 5;
+//! オブジェクトファイルのセクションヘッダ数
+constexpr ::Elf64_Half kNObjectSectionHeaders = 6;
+//! オブジェクトファイルのヘッダ部分のサイズ
+constexpr ::Elf64_Off kObjectHeaderSize = sizeof(::Elf64_Ehdr);
+//! オブジェクトファイルの文字列テーブル
+constexpr char kObjectShStrTab[] = "\0.text\0.shstrtab\0.symtab\0.strtab\0.note.GNU-stack";
+//! オブジェクトファイルの.strtabセクションのセクションヘッダのインデックス
+constexpr ::Elf64_Half kObjectStrTabSectionIndex = 4;
+//! オブジェクトファイルが公開する関数のシンボル名
+constexpr char kObjectEntryName[] = "bf_run";
+//! スレッド数が指定されていないときに並列にコード生成を行う，正規化したソースのサイズの下限
+constexpr std::string::size_type kParallelThreshold = 1 << 20;
+//! 各スレッドに割り当てる断片数の目安 (断片ごとの生成時間のばらつきを均すため，複数にしておく)
+constexpr std::size_t kFragmentsPerThread = 4;
+//! 定数データの配置境界
+constexpr std::size_t kDataAlignment = 16;
+//! 0の代入を rep stosb で行うセルの数の下限
+constexpr std::size_t kMinRepStosSize = 256;
+//! JCC erratum の影響を受ける分岐命令の境界 (分岐命令がこの境界をまたぐか，境界で終わると uop キャッシュに載らない)
+constexpr std::size_t kBranchBoundary = 32;
+//! 命令を実行するモード
+constexpr auto kMode = x86::Mode::Bits64;
+//! 命令のエンコーダ
+using Encoder = x86::Encoder<kMode>;
+
+
+/*!
+ * @brief マイクロアーキテクチャごとのコード生成の方針
+ */
+struct TuneParams
+{
+  //! ループの先頭を揃える境界 (1のときは揃えない)
+  std::size_t loopAlignment;
+  //! 最も内側のループの先頭を揃えるために入れる詰め物の上限 (byte単位)
+  std::size_t maxLoopPadding;
+  //! ループの分岐命令が kBranchBoundary をまたがないようにするかどうか
+  bool isBranchAligned;
+  //! 1の加減算に inc / dec を用いるかどうか (false のときは add / sub を用いる)
+  bool isIncDecUsed;
+  //! 停止しない経路をコードの末尾に追い出すかどうか
+  bool isColdOutOfLine;
+};
+
+
+/*!
+ * @brief 指定したマイクロアーキテクチャ向けのコード生成の方針を返す
+ *
+ * Generic はコードサイズを優先し，詰め物を入れない．
+ * Intel のコアは uop キャッシュが32byte単位であり，Skylake 以降は JCC erratum の対策のマイクロコードにより
+ * 32byte境界をまたぐ分岐が uop キャッシュに載らない．また，inc / dec はフラグの部分更新となるので add / sub を用いる．
+ * AMD のコアは32byte単位で命令をフェッチするので，ループの先頭のみを揃える．
+ *
+ * @param [in] tune  コード生成で想定するマイクロアーキテクチャ
+ * @return コード生成の方針
+ */
+constexpr TuneParams
+getTuneParams(Tune tune) noexcept
+{
+  switch (tune) {
+    case Tune::Intel:
+      return {32, 15, true, false, true};
+    case Tune::Amd:
+      return {32, 15, false, true, true};
+    case Tune::Generic:
+    default:
+      return {1, 0, false, true, false};
+  }
+}
+
+
+/*!
+ * @brief シンボルとして出力するコード領域
+ *
+ * perf 等のプロファイラで実行時間をループ単位で集計できるように，
+ * 生成コードをループの境界で区切った領域ごとにシンボルを付与する．
+ * 各領域は互いに重ならず，最も内側のループの名前を持つ．
+ */
+struct CodeRegion
+{
+  //! 最も内側のループの '[' のソース上での位置 (トップレベルでは0)
+  std::size_t srcOffset;
+  //! ループのネストの深さ (トップレベルは0)
+  std::size_t depth;
+  //! .text先頭からのオフセット
+  std::size_t offset;
+  //! 領域のサイズ (byte単位)
+  std::size_t size;
+};
+
+
+/*!
+ * @brief 領域のシンボル名を文字列の末尾に追加する
+ *
+ * 領域が多いと .strtab の構築に時間がかかるので，一時的な文字列を作らずに直接書き込む．
+ *
+ * @param [in,out] str  追加先の文字列
+ * @param [in] srcOffset  ループ開始の '[' のソースファイル上のオフセット
+ * @param [in] depth  ループのネストの深さ (トップレベルは0)
+ */
+inline void
+appendRegionName(std::string& str, std::string::size_type srcOffset, std::size_t depth)
+{
+  if (depth == 0) {
+    str += "bf_toplevel";
+    return;
+  }
+  char digits[std::numeric_limits<std::size_t>::digits10 + 1];
+  str += "bf_loop_o";
+  str.append(digits, std::to_chars(std::begin(digits), std::end(digits), srcOffset).ptr);
+  str += "_d";
+  str.append(digits, std::to_chars(std::begin(digits), std::end(digits), depth).ptr);
+}
+
+
+/*!
+ * @brief .strtab と .symtab の内容を構築する
+ *
+ * @param [in] regions  シンボルとして出力するコード領域
+ * @param [in] textAddr  .textセクションの先頭アドレス
+ * @param [out] strTab  .strtab の内容
+ * @param [out] symTab  .symtab の内容
+ */
+inline void
+buildSymbolTable(
+  const std::vector<CodeRegion>& regions,
+  ::Elf64_Addr textAddr,
+  std::string& strTab,
+  std::vector<::Elf64_Sym>& symTab)
+{
+  strTab.assign(1, '\0');
+  symTab.clear();
+  symTab.reserve(regions.size() + 1);
+
+  symTab.push_back(makeSymbol<kMode>(0, 0, SHN_UNDEF, 0x0000000000000000, 0));
+  for (const auto& region : regions) {
+    symTab.push_back(makeSymbol<kMode>(
+      static_cast<::Elf64_Word>(strTab.size()),
+      ElfTraits<kMode>::makeSymbolInfo(STB_LOCAL, STT_FUNC),
+      kTextSectionIndex,
+      textAddr + region.offset,
+      region.size));
+    appendRegionName(strTab, region.srcOffset, region.depth);
+    strTab += '\0';
+  }
+}
+
+
+/*!
+ * @brief ヘッダ部分の書き込みを行う
+ *
+ * @param [in] buf  書き込み先バッファ
+ * @param [in] codeSize  コード部分のサイズ (byte単位)
+ * @param [in] dataSize  .rodata のサイズ (byte単位)
+ * @param [in] symSize  .strtab と .symtab のサイズ (パディング含む，byte単位)
+ */
+inline void
+writeHeader(CodeBuffer& buf, std::size_t codeSize, std::size_t dataSize, std::size_t symSize)
+{
+  const auto fileSize = kHeaderSize + sizeof(kShStrTab) + kFooterSize + codeSize + dataSize + symSize;
+
+  // ELF header
+  writeElfHeader<kMode>(
+    buf,
+    ET_EXEC,
+    ELFOSABI_LINUX,
+    kBaseAddr + kHeaderSize,
+    kNProgramHeaders,
+    kHeaderSize + sizeof(kShStrTab) + codeSize + dataSize + symSize,
+    kNSectionHeaders);
+  // Program header
+  writeLoadSegmentHeader<kMode>(buf, PF_R | PF_X, kBaseAddr, fileSize, fileSize);
+  // Program header for .bss
+  writeLoadSegmentHeader<kMode>(buf, PF_R | PF_W, kBssAddr, 0x0000000000000000, 0x0000000000010000);
+}
+
+
+/*!
+ * @brief フッタ部分の書き込みを行う
+ *
+ * .rodata はコード部分の直後に書き込み済みであるものとする．
+ *
+ * @param [in] buf  書き込み先バッファ
+ * @param [in] codeSize  コード部分のサイズ (byte単位)
+ * @param [in] dataSize  .rodata のサイズ (byte単位)
+ * @param [in] regions  シンボルとして出力するコード領域
+ * @return .strtab と .symtab のサイズ (パディング含む，byte単位)
+ */
+inline std::size_t
+writeFooter(CodeBuffer& buf, std::size_t codeSize, std::size_t dataSize, const std::vector<CodeRegion>& regions)
+{
+  std::string strTab;
+  std::vector<::Elf64_Sym> symTab;
+  buildSymbolTable(regions, kBaseAddr + kHeaderSize, strTab, symTab);
+
+  writeAs(buf, kShStrTab);
+  const auto strTabOffset = kHeaderSize + codeSize + dataSize + sizeof(kShStrTab);
+  buf.write(strTab.data(), static_cast<std::streamsize>(strTab.size()));
+  // .symtab は8byte境界に配置する
+  const auto symTabOffset = (strTabOffset + strTab.size() + 7) & ~static_cast<std::size_t>(7);
+  for (auto i = strTabOffset + strTab.size(); i < symTabOffset; i++) {
+    writeAs<std::uint8_t>(buf, 0x00);
+  }
+  const auto symTabSize = sizeof(::Elf64_Sym) * symTab.size();
+  buf.write(reinterpret_cast<const char*>(symTab.data()), static_cast<std::streamsize>(symTabSize));
+
+  // First section header
+  writeSectionHeader<kMode>(buf, 0, SHT_NULL, 0, 0, 0, 0, 0, 0, 0, 0);
+  // Second section header (.shstrtab)
+  writeSectionHeader<kMode>(
+    buf, 7, SHT_STRTAB, 0, 0, kHeaderSize + codeSize + dataSize, sizeof(kShStrTab), 0, 0, 1, 0);
+  // Third section header (.text)
+  writeSectionHeader<kMode>(
+    buf, 1, SHT_PROGBITS, SHF_EXECINSTR | SHF_ALLOC, kBaseAddr + kHeaderSize, kHeaderSize, codeSize, 0, 0, 4, 0);
+  // Fourth section header (.bss)
+  writeSectionHeader<kMode>(
+    buf, 17, SHT_NOBITS, SHF_ALLOC | SHF_WRITE, kBssAddr, 0x1000, 0x10000 /* 65536 cells */, 0, 0, 16, 0);
+  // Fifth section header (.symtab)
+  // 全シンボルがローカルなので，最初の非ローカルシンボルのインデックスはシンボル数に等しい
+  writeSectionHeader<kMode>(
+    buf,
+    22,
+    SHT_SYMTAB,
+    0,
+    0,
+    symTabOffset,
+    symTabSize,
+    kStrTabSectionIndex,
+    static_cast<::Elf64_Word>(symTab.size()),
+    8,
+    sizeof(::Elf64_Sym));
+  // Sixth section header (.strtab)
+  writeSectionHeader<kMode>(buf, 30, SHT_STRTAB, 0, 0, strTabOffset, strTab.size(), 0, 0, 1, 0);
+  // Seventh section header (.rodata)
+  writeSectionHeader<kMode>(
+    buf, 38, SHT_PROGBITS, SHF_ALLOC, kBaseAddr + kHeaderSize + codeSize, kHeaderSize + codeSize, dataSize, 0, 0, kDataAlignment, 0);
+
+  return symTabOffset + symTabSize - strTabOffset;
+}
+
+
+/*!
+ * @brief オブジェクトファイルのヘッダ部分の書き込みを行う
+ *
+ * @param [in] buf  書き込み先バッファ
+ * @param [in] codeSize  コード部分のサイズ (コードの直後に置いた定数データを含む，byte単位)
+ * @param [in] symSize  .strtab と .symtab のサイズ (パディング含む，byte単位)
+ */
+inline void
+writeObjectHeader(CodeBuffer& buf, std::size_t codeSize, std::size_t symSize)
+{
+  writeElfHeader<kMode>(
+    buf,
+    ET_REL,
+    ELFOSABI_SYSV,
+    0x0000000000000000,
+    0,
+    kObjectHeaderSize + sizeof(kObjectShStrTab) + codeSize + symSize,
+    kNObjectSectionHeaders);
+}
+
+
+/*!
+ * @brief オブジェクトファイルのフッタ部分の書き込みを行う
+ *
+ * .textセクションの先頭に大域シンボル bf_run を定義する．
+ * 生成コードは位置独立であり，外部シンボルも参照しないので再配置情報は不要である．
+ * 定数データはコードの直後に .text の一部として書き込み済みであるものとする．
+ *
+ * @param [in] buf  書き込み先バッファ
+ * @param [in] codeSize  コード部分のサイズ (byte単位)
+ * @param [in] dataSize  コードの直後に置いた定数データのサイズ (byte単位)
+ * @param [in] regions  シンボルとして出力するコード領域
+ * @param [in] textAlignment  .textセクションの配置境界
+ * @return .strtab と .symtab のサイズ (パディング含む，byte単位)
+ */
+inline std::size_t
+writeObjectFooter(
+  CodeBuffer& buf,
+  std::size_t codeSize,
+  std::size_t dataSize,
+  const std::vector<CodeRegion>& regions,
+  std::size_t textAlignment)
+{
+  const auto textSize = codeSize + dataSize;
+  std::string strTab;
+  std::vector<::Elf64_Sym> symTab;
+  buildSymbolTable(regions, 0x0000000000000000, strTab, symTab);
+  // ローカルシンボルの後ろに大域シンボルを置く
+  const auto nLocalSymbols = symTab.size();
+  symTab.push_back(makeSymbol<kMode>(
+    static_cast<::Elf64_Word>(strTab.size()),
+    ElfTraits<kMode>::makeSymbolInfo(STB_GLOBAL, STT_FUNC),
+    kTextSectionIndex,
+    0x0000000000000000,
+    codeSize));
+  strTab.append(kObjectEntryName, sizeof(kObjectEntryName));
+
+  writeAs(buf, kObjectShStrTab);
+  const auto strTabOffset = kObjectHeaderSize + textSize + sizeof(kObjectShStrTab);
+  buf.write(strTab.data(), static_cast<std::streamsize>(strTab.size()));
+  const auto symTabOffset = (strTabOffset + strTab.size() + 7) & ~static_cast<std::size_t>(7);
+  for (auto i = strTabOffset + strTab.size(); i < symTabOffset; i++) {
+    writeAs<std::uint8_t>(buf, 0x00);
+  }
+  const auto symTabSize = sizeof(::Elf64_Sym) * symTab.size();
+  buf.write(reinterpret_cast<const char*>(symTab.data()), static_cast<std::streamsize>(symTabSize));
+
+  // First section header
+  writeSectionHeader<kMode>(buf, 0, SHT_NULL, 0, 0, 0, 0, 0, 0, 0, 0);
+  // Second section header (.shstrtab)
+  writeSectionHeader<kMode>(buf, 7, SHT_STRTAB, 0, 0, kObjectHeaderSize + textSize, sizeof(kObjectShStrTab), 0, 0, 1, 0);
+  // Third section header (.text)
+  writeSectionHeader<kMode>(
+    buf, 1, SHT_PROGBITS, SHF_EXECINSTR | SHF_ALLOC, 0, kObjectHeaderSize, textSize, 0, 0, textAlignment, 0);
+  // Fourth section header (.symtab)
+  writeSectionHeader<kMode>(
+    buf,
+    17,
+    SHT_SYMTAB,
+    0,
+    0,
+    symTabOffset,
+    symTabSize,
+    kObjectStrTabSectionIndex,
+    static_cast<::Elf64_Word>(nLocalSymbols),
+    8,
+    sizeof(::Elf64_Sym));
+  // Fifth section header (.strtab)
+  writeSectionHeader<kMode>(buf, 25, SHT_STRTAB, 0, 0, strTabOffset, strTab.size(), 0, 0, 1, 0);
+  // Sixth section header (.note.GNU-stack)
+  // このセクションが無いとリンカが実行可能スタックを要求されたものとみなす
+  writeSectionHeader<kMode>(buf, 33, SHT_PROGBITS, 0, 0, kObjectHeaderSize + textSize, 0, 0, 0, 1, 0);
+
+  return symTabOffset + symTabSize - strTabOffset;
+}
+
+
+/*!
+ * @brief 生成コードの断片に対応する命令列上の範囲
+ *
+ * 断片の境界はトップレベルのループの直前に置くので，ジャンプが断片をまたぐことはない．
+ * サブルーチンはそれぞれ1つの断片とする．
+ */
+struct FragmentRange
+{
+  //! 命令列上での開始位置
+  std::size_t first;
+  //! 命令列上での終了位置 (この位置を含まない)
+  std::size_t last;
+  //! ループの通し番号の基準 (範囲がループで始まる場合はそのループの通し番号，先頭の範囲では0)
+  std::size_t loopIndex;
+  //! サブルーチンの本体かどうか
+  bool isSubroutine;
+};
+
+
+/*!
+ * @brief 生成コードの断片内のコード領域
+ *
+ * ループは断片内での通し番号で表し，シンボル名は連結時に決める．
+ * これにより，断片の生成結果は断片の命令列のみで決まり，前方の編集でソース上の位置がずれても再利用できる．
+ */
+struct FragmentRegion
+{
+  //! 最も内側のループの断片内での通し番号 (トップレベルでは0)
+  std::size_t loopIndex;
+  //! ループのネストの深さ (トップレベルは0)
+  std::size_t depth;
+  //! 断片の先頭からのオフセット
+  std::size_t offset;
+  //! 領域のサイズ (byte単位)
+  std::size_t size;
+};
+
+
+/*!
+ * @brief 断片のコードから定数データへの参照
+ *
+ * 定数データの配置は連結時に決まるので，RIP相対の変位は連結時に書き込む．
+ */
+struct DataFixup
+{
+  //! 変位 (rel32) を書き込む断片のコード上の位置
+  std::size_t codeOffset;
+  //! 参照先の断片の定数データ上の位置
+  std::size_t dataOffset;
+};
+
+
+/*!
+ * @brief 断片のコードからサブルーチンの呼び出し
+ *
+ * サブルーチンの配置は連結時に決まるので，call 命令の変位は連結時に書き込む．
+ */
+struct CallFixup
+{
+  //! 変位 (rel32) を書き込む断片のコード上の位置
+  std::size_t codeOffset;
+  //! 呼び出すサブルーチンの番号
+  std::size_t subroutine;
+};
+
+
+/*!
+ * @brief 生成コードの断片
+ *
+ * 断片内のジャンプは全て相対ジャンプなので，断片は任意の位置に配置できる．
+ */
+struct CodeFragment
+{
+  //! 生成したコード
+  std::vector<std::uint8_t> code{};
+  //! 断片内のコード領域
+  std::vector<FragmentRegion> regions{};
+  //! 断片が参照する定数データ (詰めて並べる)
+  std::vector<std::uint8_t> data{};
+  //! 定数データのうち kDataAlignment の境界に配置する部分の開始位置 (昇順)
+  std::vector<std::size_t> alignedData{};
+  //! 定数データへの参照
+  std::vector<DataFixup> fixups{};
+  //! サブルーチンの呼び出し
+  std::vector<CallFixup> calls{};
+  //! 停止しない経路へのジャンプの変位 (rel32) を書き込む断片のコード上の位置
+  std::vector<std::size_t> hangJumps{};
+};
+
+
+/*!
+ * @brief コード領域を追加する
+ *
+ * 直前の領域と同じ名前で連続している場合は，断片の境界で分かれた同じ領域とみなして結合する．
+ *
+ * @param [in,out] regions  コード領域のリスト
+ * @param [in] region  追加するコード領域
+ */
+inline void
+appendRegion(std::vector<CodeRegion>& regions, CodeRegion region)
+{
+  if (region.size == 0) {
+    return;
+  }
+  if (!regions.empty()) {
+    auto& last = regions.back();
+    if (last.offset + last.size == region.offset && last.srcOffset == region.srcOffset && last.depth == region.depth) {
+      last.size += region.size;
+      return;
+    }
+  }
+  regions.push_back(region);
+}
+
+
+/*!
+ * @brief 使用するスレッド数を決める
+ *
+ * @param [in] nThreads  指定されたスレッド数 (0のときは自動で決める)
+ * @param [in] sourceSize  正規化したソースのサイズ
+ * @return 使用するスレッド数
+ */
+inline unsigned int
+decideThreadCount(unsigned int nThreads, std::string::size_type sourceSize)
+{
+  if (nThreads != 0) {
+    return nThreads;
+  }
+  // 小さいソースではスレッドの生成の方が高くつく
+  if (sourceSize < kParallelThreshold) {
+    return 1;
+  }
+  return std::max(std::thread::hardware_concurrency(), 1U);
+}
+
+
+/*!
+ * @brief 命令列をトップレベルのループの直前で断片に分割する
+ *
+ * メインの命令列を分割した断片の後ろに，各サブルーチンの断片を番号順に並べる．
+ *
+ * @param [in] program  中間表現
+ * @param [in] nFragments  メインの命令列の断片数の目安 (各断片の命令数がおよそ等しくなるように分割する)
+ * @return 各断片の範囲
+ */
+inline std::vector<FragmentRange>
+splitProgram(const Program& program, std::size_t nFragments)
+{
+  const auto& ops = program.ops;
+  const auto& subroutines = program.subroutines;
+  const auto mainEnd = subroutines.empty() ? ops.size() : subroutines.front();
+  std::vector<FragmentRange> ranges{{0, mainEnd, 0, false}};
+  std::size_t depth = 0;
+  auto nextTarget = mainEnd / nFragments;
+  for (std::size_t i = 0; i < mainEnd; i++) {
+    if (ops[i].code == OpCode::LoopEnd) {
+      depth--;
+    } else if (ops[i].code == OpCode::LoopBegin) {
+      if (depth == 0 && i >= nextTarget && i > ranges.back().first) {
+        ranges.back().last = i;
+        ranges.push_back({i, mainEnd, ops[i].index, false});
+        nextTarget = mainEnd * ranges.size() / nFragments;
+      }
+      depth++;
+    }
+  }
+  for (decltype(program.subroutines)::size_type i = 0; i < subroutines.size(); i++) {
+    const auto first = subroutines[i];
+    ranges.push_back({first, i + 1 < subroutines.size() ? subroutines[i + 1] : ops.size(), ops[first].index, true});
+  }
+  return ranges;
+}
+
+
+/*!
+ * @brief セル [rsi + offset] を指すメモリオペランドを返す
+ *
+ * @param [in] offset  ポインタからの相対位置
+ * @return メモリオペランド
+ */
+constexpr x86::Mem
+cellPtr(std::int32_t offset) noexcept
+{
+  return x86::bytePtr(x86::kRsi, offset);
+}
+
+
+/*!
+ * @brief 指定した境界に揃えるための詰め物のサイズを返す
+ *
+ * @param [in] pos  現在の位置
+ * @param [in] alignment  境界
+ * @return 詰め物のサイズ (byte単位)
+ */
+constexpr std::size_t
+getPaddingSize(std::size_t pos, std::size_t alignment) noexcept
+{
+  return (alignment - pos % alignment) % alignment;
+}
+
+
+/*!
+ * @brief 分岐命令が kBranchBoundary をまたぐか境界で終わらないようにするための詰め物のサイズを返す
+ *
+ * @param [in] pos  分岐命令 (マクロフュージョンする比較命令を含む) の位置
+ * @param [in] size  分岐命令のサイズ (byte単位)
+ * @return 詰め物のサイズ (byte単位)
+ */
+constexpr std::size_t
+getBranchPaddingSize(std::size_t pos, std::size_t size) noexcept
+{
+  return pos % kBranchBoundary + size >= kBranchBoundary ? getPaddingSize(pos, kBranchBoundary) : 0;
+}
+
+
+/*!
+ * @brief ポインタを移動するコードを書き込む
+ *
+ * @param [in] enc  書き込み先のエンコーダ
+ * @param [in] delta  移動量
+ * @param [in] isIncDecUsed  1の移動に inc / dec を用いるかどうか
+ */
+inline void
+emitMove(Encoder& enc, std::int32_t delta, bool isIncDecUsed = true)
+{
+  if (delta == 0) {
+    return;
+  }
+  if (delta == 1 && isIncDecUsed) {
+    // inc rsi
+    enc.inc(x86::kRsi);
+  } else if (delta == -1 && isIncDecUsed) {
+    // dec rsi
+    enc.dec(x86::kRsi);
+  } else if (delta > 0) {
+    // add rsi, {delta}
+    enc.add(x86::kRsi, delta);
+  } else {
+    // sub rsi, {-delta}
+    enc.sub(x86::kRsi, static_cast<std::int32_t>(0U - static_cast<std::uint32_t>(delta)));
+  }
+}
+
+
+/*!
+ * @brief セルに加算するコードを書き込む
+ *
+ * @param [in] enc  書き込み先のエンコーダ
+ * @param [in] offset  ポインタからの相対位置
+ * @param [in] value  加算する値
+ * @param [in] isIncDecUsed  1の加減算に inc / dec を用いるかどうか
+ */
+inline void
+emitAdd(Encoder& enc, std::int32_t offset, std::int32_t value, bool isIncDecUsed = true)
+{
+  const auto cnt = static_cast<std::uint8_t>(value);
+  if (cnt == 0) {
+    return;
+  }
+  if (cnt == 0x01 && isIncDecUsed) {
+    // inc byte ptr [rsi + {offset}]
+    enc.inc(cellPtr(offset));
+  } else if (cnt == 0xff && isIncDecUsed) {
+    // dec byte ptr [rsi + {offset}]
+    enc.dec(cellPtr(offset));
+  } else if (value > 0 && cnt != 0xff) {
+    // add byte ptr [rsi + {offset}], {cnt}
+    enc.add(cellPtr(offset), cnt);
+  } else {
+    // sub byte ptr [rsi + {offset}], {-cnt}
+    enc.sub(cellPtr(offset), static_cast<std::uint8_t>(-cnt));
+  }
+}
+
+
+/*!
+ * @brief 条件が成り立たなければその場で停止しなくなるコードを書き込む
+ *
+ * @param [in] enc  書き込み先のエンコーダ
+ * @param [in] cond  先へ進む条件
+ */
+inline void
+emitHang(Encoder& enc, x86::Cond cond)
+{
+  // je {skip} など
+  const auto skip = enc.jccShort(cond);
+  // jmp $
+  enc.jmp(enc.tell());
+  enc.patchRel8(skip, enc.tell());
+}
+
+
+/*!
+ * @brief 0のセルまでポインタを進めるコードを書き込む
+ *
+ * 16バイト境界に揃うまで1セルずつ進み，以降は0を含まない16バイトのブロックをまとめて飛ばす．
+ * 0を含むブロックに達したら，1セルずつの処理に戻って0のセルで止まる (揃ったブロックの読み込みはページをまたがない)．
+ * xmm0, xmm1, eax を破壊する．
+ *
+ * @param [in] buf  書き込み先バッファ
+ * @param [in] isForward  アドレスの大きい方へ進むかどうか
+ * @param [in] isClearing  通過したセルを0にするかどうか
+ */
+inline void
+emitZeroScan(Encoder& enc, bool isForward, bool isClearing)
+{
+  // pxor xmm1, xmm1
+  enc.sse(x86::kPxor, x86::kXmm1, x86::kXmm1);
+  const auto scalarLoop = enc.tell();
+  // cmp byte ptr [rsi], dh
+  enc.cmp(cellPtr(0), x86::kDh);
+  // je {end}
+  const auto jumpToEnd = enc.jccShort(x86::Cond::E);
+  if (isClearing) {
+    // mov byte ptr [rsi], dh
+    enc.mov(cellPtr(0), x86::kDh);
+  }
+  if (isForward) {
+    // inc rsi
+    enc.inc(x86::kRsi);
+    // test sil, 0x0f
+    enc.test(x86::kSil, 0x0f);
+  } else {
+    // dec rsi
+    enc.dec(x86::kRsi);
+    // lea eax, [rsi + 1]
+    enc.lea(x86::kEax, cellPtr(1));
+    // test al, 0x0f
+    enc.test(x86::kAl, 0x0f);
+  }
+  // jne {scalarLoop}
+  enc.jcc(x86::Cond::Ne, scalarLoop);
+  const auto vectorLoop = enc.tell();
+  // movdqa xmm0, xmmword ptr [rsi] / movdqa xmm0, xmmword ptr [rsi - 15]
+  enc.sse(x86::kMovdqaLoad, x86::kXmm0, cellPtr(isForward ? 0 : -15));
+  // pcmpeqb xmm0, xmm1
+  enc.sse(x86::kPcmpeqb, x86::kXmm0, x86::kXmm1);
+  // pmovmskb eax, xmm0
+  enc.pmovmskb(x86::kEax, x86::kXmm0);
+  // test eax, eax
+  enc.test(x86::kEax, x86::kEax);
+  // jne {scalarLoop}
+  enc.jcc(x86::Cond::Ne, scalarLoop);
+  if (isClearing) {
+    // movdqa xmmword ptr [rsi], xmm1 / movdqa xmmword ptr [rsi - 15], xmm1
+    enc.sse(x86::kMovdqaStore, x86::kXmm1, cellPtr(isForward ? 0 : -15));
+  }
+  // add rsi, 0x10 / sub rsi, 0x10
+  emitMove(enc, isForward ? 16 : -16);
+  // jmp {vectorLoop}
+  enc.jmp(vectorLoop);
+  enc.patchRel8(jumpToEnd, enc.tell());
+}
+
+
+/*!
+ * @brief 0のセルまでの範囲を移動するコード (MoveScan 命令) を書き込む
+ *
+ * 開始位置 p から進行方向に k 個の0でないセルが続くとき，移動先が範囲外になる先頭の min(d, k) 個は移動先に加算し，
+ * 残りは memmove と同様に重なりを考慮して移動し，移動元のみになった末尾の min(d, k) 個を0にする．
+ * rdi に開始位置，r8 に移動元，r9 に各段階の終了位置を置き，xmm0, xmm1, eax を破壊する．
+ *
+ * @param [in] buf  書き込み先バッファ
+ * @param [in] offset  移動先の相対位置 (進行方向と逆向きで，絶対値は127以下)
+ * @param [in] isForward  アドレスの大きい方へ進むかどうか
+ */
+inline void
+emitMoveScan(Encoder& enc, std::int32_t offset, bool isForward)
+{
+  // 進行方向に応じて，ループの終了条件 (jae / jbe)，ポインタの増減 (inc / dec)，範囲の制限 (cmova / cmovb) を選ぶ
+  const auto jumpIfDone = isForward ? x86::Cond::Ae : x86::Cond::Be;
+  const auto cmovToward = isForward ? x86::Cond::A : x86::Cond::B;
+  const auto cmovBackward = isForward ? x86::Cond::B : x86::Cond::A;
+  const auto step = [&enc, isForward](x86::Reg reg) {
+    if (isForward) {
+      enc.inc(reg);
+    } else {
+      enc.dec(reg);
+    }
+  };
+  // 後方へのループの終わりに jmp を書き込む
+  const auto closeLoop = [&enc](std::size_t loopStart, std::size_t exitJump) {
+    // jmp {loopStart}
+    enc.jmp(loopStart);
+    enc.patchRel8(exitJump, enc.tell());
+  };
+
+  // mov rdi, rsi
+  enc.mov(x86::kRdi, x86::kRsi);
+  emitZeroScan(enc, isForward, false);
+
+  // 先頭の min(d, k) 個を移動先に加算する
+  // mov r8, rdi
+  enc.mov(x86::kR8, x86::kRdi);
+  // lea r9, [rdi + {-offset}]
+  enc.lea(x86::kR9, x86::bytePtr(x86::kRdi, -offset));
+  // cmp r9, rsi
+  enc.cmp(x86::kR9, x86::kRsi);
+  // cmova r9, rsi / cmovb r9, rsi
+  enc.cmov(cmovToward, x86::kR9, x86::kRsi);
+  const auto addLoop = enc.tell();
+  // cmp r8, r9
+  enc.cmp(x86::kR8, x86::kR9);
+  // jae {copy} / jbe {copy}
+  const auto addExit = enc.jccShort(jumpIfDone);
+  // mov al, byte ptr [r8]
+  enc.mov(x86::kAl, x86::bytePtr(x86::kR8));
+  // add byte ptr [r8 + {offset}], al
+  enc.add(x86::bytePtr(x86::kR8, offset), x86::kAl);
+  // inc r8 / dec r8
+  step(x86::kR8);
+  closeLoop(addLoop, addExit);
+
+  // 残りを16バイトずつ移動する (移動先は移動元より後ろにあるので，読み込み前に上書きすることはない)
+  const auto vectorLoop = enc.tell();
+  if (isForward) {
+    // mov r9, rsi
+    enc.mov(x86::kR9, x86::kRsi);
+    // sub r9, r8
+    enc.sub(x86::kR9, x86::kR8);
+  } else {
+    // mov r9, r8
+    enc.mov(x86::kR9, x86::kR8);
+    // sub r9, rsi
+    enc.sub(x86::kR9, x86::kRsi);
+  }
+  // cmp r9, 0x10
+  enc.cmp(x86::kR9, 0x10);
+  // jb {byteLoop}
+  const auto vectorExit = enc.jccShort(x86::Cond::B);
+  // movdqu xmm0, xmmword ptr [r8] / movdqu xmm0, xmmword ptr [r8 - 15]
+  enc.sse(x86::kMovdquLoad, x86::kXmm0, x86::bytePtr(x86::kR8, isForward ? 0 : -15));
+  // movdqu xmmword ptr [r8 + {offset}], xmm0 / movdqu xmmword ptr [r8 + {offset} - 15], xmm0
+  enc.sse(x86::kMovdquStore, x86::kXmm0, x86::bytePtr(x86::kR8, isForward ? offset : offset - 15));
+  // add r8, 0x10 / sub r8, 0x10
+  if (isForward) {
+    enc.add(x86::kR8, 0x10);
+  } else {
+    enc.sub(x86::kR8, 0x10);
+  }
+  closeLoop(vectorLoop, vectorExit);
+
+  // 端数を1バイトずつ移動する
+  const auto byteLoop = enc.tell();
+  // cmp r8, rsi
+  enc.cmp(x86::kR8, x86::kRsi);
+  // jae {clear} / jbe {clear}
+  const auto byteExit = enc.jccShort(jumpIfDone);
+  // mov al, byte ptr [r8]
+  enc.mov(x86::kAl, x86::bytePtr(x86::kR8));
+  // mov byte ptr [r8 + {offset}], al
+  enc.mov(x86::bytePtr(x86::kR8, offset), x86::kAl);
+  // inc r8 / dec r8
+  step(x86::kR8);
+  closeLoop(byteLoop, byteExit);
+
+  // 末尾の min(d, k) 個を0にする
+  // lea r9, [rsi + {offset}]
+  enc.lea(x86::kR9, cellPtr(offset));
+  // cmp r9, rdi
+  enc.cmp(x86::kR9, x86::kRdi);
+  // cmovb r9, rdi / cmova r9, rdi
+  enc.cmov(cmovBackward, x86::kR9, x86::kRdi);
+  const auto clearLoop = enc.tell();
+  // cmp r9, rsi
+  enc.cmp(x86::kR9, x86::kRsi);
+  // jae {end} / jbe {end}
+  const auto clearExit = enc.jccShort(jumpIfDone);
+  // mov byte ptr [r9], 0x00  # REX 接頭辞があると dh を指定できない
+  enc.mov(x86::bytePtr(x86::kR9), 0x00);
+  // inc r9 / dec r9
+  step(x86::kR9);
+  closeLoop(clearLoop, clearExit);
+}
+
+
+/*!
+ * @brief 命令列の一部から生成コードの断片を生成する
+ *
+ * @param [in] program  中間表現
+ * @param [in] range  コードを生成する範囲 (トップレベルで始まる)
+ * @param [in] isObjectMode  オブジェクトファイルを出力するかどうか
+ * @param [in] isOutputOnly  プログラムに入力命令が含まれないかどうか
+ * @param [in] tune  コード生成の方針 (断片の先頭は tune.loopAlignment の境界に配置されるものとする)
+ * @param [out] fragment  生成した断片
+ */
+inline void
+emitFragment(
+  const Program& program,
+  const FragmentRange& range,
+  bool isObjectMode,
+  bool isOutputOnly,
+  const TuneParams& tune,
+  CodeFragment& fragment)
+{
+  const auto& ops = program.ops;
+  CodeBuffer buf{fragment.code};
+  Encoder enc{buf};
+  fragment.regions.clear();
+  fragment.data.clear();
+  fragment.alignedData.clear();
+  fragment.fixups.clear();
+  fragment.calls.clear();
+  fragment.hangJumps.clear();
+
+  // ネスト中のループの断片内での通し番号
+  std::vector<std::size_t> regionStack;
+  std::size_t regionStart = 0;
+  // 現在の領域を閉じ，領域のリストに追加する
+  const auto closeRegion = [&]() {
+    const auto regionEnd = buf.tell();
+    if (regionEnd > regionStart) {
+      fragment.regions.push_back({
+        regionStack.empty() ? 0 : regionStack.back(),
+        regionStack.size(),
+        regionStart,
+        regionEnd - regionStart});
+    }
+    regionStart = regionEnd;
+  };
+
+  if (range.isSubroutine && isObjectMode) {
+    // sub rsp, 0x08  # コールバックを呼び出すときに rsp が16byte境界に揃うようにする
+    enc.sub(x86::kRsp, 0x08);
+  }
+
+  // ループの先頭と je の変位の位置
+  std::stack<std::pair<std::size_t, std::size_t>> loopStack;
+  for (auto i = range.first; i < range.last; i++) {
+    const auto& op = ops[i];
+    switch (op.code) {
+      case OpCode::Move:
+        emitMove(enc, op.value, tune.isIncDecUsed);
+        break;
+      case OpCode::Add:
+        emitAdd(enc, op.offset, op.value, tune.isIncDecUsed);
+        break;
+      case OpCode::Set:
+        if (op.value == 0) {
+          // mov byte ptr [rsi + {offset}], dh
+          enc.mov(cellPtr(op.offset), x86::kDh);
+        } else {
+          // mov byte ptr [rsi + {offset}], {value}
+          enc.mov(cellPtr(op.offset), op.value);
+        }
+        break;
+      case OpCode::Output:
+        emitMove(enc, op.offset);
+        if (isObjectMode) {
+          // mov rbx, rsi
+          enc.mov(x86::kRbx, x86::kRsi);
+          // movzx edi, byte ptr [rsi]
+          enc.movzx(x86::kEdi, cellPtr(0));
+          // call r13
+          enc.call(x86::kR13);
+          // mov rsi, rbx
+          enc.mov(x86::kRsi, x86::kRbx);
+          // mov edx, 0x01
+          enc.mov(x86::kEdx, 0x01);
+        } else {
+          if (!isOutputOnly) {
+            // mov eax, edx
+            enc.mov(x86::kEax, x86::kEdx);
+            // mov edi, edx
+            enc.mov(x86::kEdi, x86::kEdx);
+          }
+          // syscall
+          enc.syscall();
+        }
+        emitMove(enc, -op.offset);
+        break;
+      case OpCode::Input:
+        emitMove(enc, op.offset);
+        if (isObjectMode) {
+          // mov rbx, rsi
+          enc.mov(x86::kRbx, x86::kRsi);
+          // call r12
+          enc.call(x86::kR12);
+          // mov rsi, rbx
+          enc.mov(x86::kRsi, x86::kRbx);
+          // mov edx, 0x01
+          enc.mov(x86::kEdx, 0x01);
+          // test eax, eax
+          enc.test(x86::kEax, x86::kEax);
+          // js {skip}  # EOF
+          const auto skip = enc.jccShort(x86::Cond::S);
+          // mov byte ptr [rsi], al
+          enc.mov(cellPtr(0), x86::kAl);
+          enc.patchRel8(skip, enc.tell());
+        } else {
+          // xor eax, eax
+          enc.alu(x86::AluOp::Xor, x86::kEax, x86::kEax);
+          // xor edi, edi
+          enc.alu(x86::AluOp::Xor, x86::kEdi, x86::kEdi);
+          // syscall
+          enc.syscall();
+        }
+        emitMove(enc, -op.offset);
+        break;
+      case OpCode::Write:
+        {
+          const auto literal = reinterpret_cast<const std::uint8_t*>(program.literals.data()) + op.index;
+          // mov rbx, rsi
+          enc.mov(x86::kRbx, x86::kRsi);
+          if (isObjectMode) {
+            // オブジェクトファイルでは1文字ずつコールバックを呼び出すので，文字は即値で渡す
+            for (auto p = literal; p != literal + op.value; p++) {
+              // mov edi, {c}
+              enc.mov(x86::kEdi, *p);
+              // call r13
+              enc.call(x86::kR13);
+            }
+          } else {
+            // lea rsi, [rip + {data}]
+            enc.lea(x86::kRsi, x86::ripPtr(x86::Size::Byte));
+            fragment.fixups.push_back({buf.tell() - sizeof(std::uint32_t), fragment.data.size()});
+            fragment.data.insert(fragment.data.end(), literal, literal + op.value);
+            // mov edx, {length}
+            enc.mov(x86::kEdx, op.value);
+            // mov eax, 0x01
+            enc.mov(x86::kEax, 0x01);
+            // mov edi, eax
+            enc.mov(x86::kEdi, x86::kEax);
+            // syscall
+            enc.syscall();
+          }
+          // mov rsi, rbx
+          enc.mov(x86::kRsi, x86::kRbx);
+          // mov edx, 0x01
+          enc.mov(x86::kEdx, 0x01);
+          if (isOutputOnly) {
+            // mov eax, edx
+            enc.mov(x86::kEax, x86::kEdx);
+          }
+        }
+        break;
+      case OpCode::TripCount:
+        if (op.value == 0) {
+          // cmp byte ptr [rsi], dh
+          enc.cmp(cellPtr(0), x86::kDh);
+          if (tune.isColdOutOfLine) {
+            // jne {hang}  # 元のループと同様に停止しない
+            fragment.hangJumps.push_back(enc.jccNear(x86::Cond::Ne));
+            break;
+          }
+          emitHang(enc, x86::Cond::E);
+          break;
+        }
+        {
+          // step = 2^k * m (m は奇数) のとき，反復回数は (セルの値 / 2^k) * (-m)^-1 mod 2^(8 - k)
+          int k = 0;
+          while ((op.value >> k & 1) == 0) {
+            k++;
+          }
+          const auto inv = invertOdd(static_cast<std::uint8_t>(0U - (static_cast<std::uint32_t>(op.value) >> k)));
+          // movzx ecx, byte ptr [rsi]
+          enc.movzx(x86::kEcx, cellPtr(0));
+          if (k > 0) {
+            // test cl, {2^k - 1}
+            enc.test(x86::kCl, static_cast<std::int32_t>((1U << k) - 1));
+            // 2^k で割り切れなければ元のループと同様に停止しない
+            if (tune.isColdOutOfLine) {
+              // jne {hang}
+              fragment.hangJumps.push_back(enc.jccNear(x86::Cond::Ne));
+            } else {
+              emitHang(enc, x86::Cond::E);
+            }
+            // shr ecx, {k}
+            enc.shift(x86::ShiftOp::Shr, x86::kEcx, static_cast<std::uint8_t>(k));
+          }
+          if (inv != 1) {
+            // imul ecx, ecx, {inv}  # 下位8bitのみ必要なので，符号拡張される imm8 で足りる
+            enc.imul(x86::kEcx, x86::kEcx, static_cast<std::int8_t>(inv));
+          }
+          if (k > 0) {
+            // and ecx, {2^(8 - k) - 1}
+            enc.alu(x86::AluOp::And, x86::kEcx, static_cast<std::int32_t>((1U << (8 - k)) - 1));
+          }
+        }
+        break;
+      case OpCode::MulAdd:
+        // 反復回数は ecx に保持されている (セルの値に必要なのは下位8bitのみ)
+        if (op.value == 1) {
+          // add byte ptr [rsi + {offset}], cl
+          enc.add(cellPtr(op.offset), x86::kCl);
+        } else if (op.value == -1) {
+          // sub byte ptr [rsi + {offset}], cl
+          enc.sub(cellPtr(op.offset), x86::kCl);
+        } else {
+          // imul r8d, ecx, {value}
+          enc.imul(x86::kR8d, x86::kEcx, static_cast<std::int8_t>(op.value));
+          // add byte ptr [rsi + {offset}], r8b
+          enc.add(cellPtr(op.offset), x86::kR8b);
+        }
+        break;
+      case OpCode::AddVector:
+        {
+          const auto literal = reinterpret_cast<const std::uint8_t*>(program.literals.data()) + op.index;
+          const auto size = static_cast<std::size_t>(op.value);
+          // SSE2 で16バイト (短い場合は8バイト) ずつ加算し，端数は直前の範囲と重ねて加算する (重なる部分の加算値は0とする)
+          const std::size_t chunkSize = size >= 16 ? 16 : 8;
+          if (size < chunkSize) {
+            for (std::size_t j = 0; j < size; j++) {
+              emitAdd(enc, op.offset + static_cast<std::int32_t>(j), literal[j], tune.isIncDecUsed);
+            }
+            break;
+          }
+          for (std::size_t pos = 0, done = 0; done < size; pos = std::min(pos + chunkSize, size - chunkSize)) {
+            const auto offset = op.offset + static_cast<std::int32_t>(pos);
+            // movdqu xmm0, xmmword ptr [rsi + {offset}] / movq xmm0, qword ptr [rsi + {offset}]
+            enc.sse(chunkSize == 16 ? x86::kMovdquLoad : x86::kMovqLoad, x86::kXmm0, cellPtr(offset));
+            // paddb xmm0, xmmword ptr [rip + {data}]
+            enc.sse(x86::kPaddb, x86::kXmm0, x86::ripPtr(x86::Size::Byte));
+            fragment.alignedData.push_back(fragment.data.size());
+            fragment.fixups.push_back({buf.tell() - sizeof(std::uint32_t), fragment.data.size()});
+            for (std::size_t j = 0; j < 16; j++) {
+              fragment.data.push_back(pos + j >= done && j < chunkSize ? literal[pos + j] : std::uint8_t{0x00});
+            }
+            // movdqu xmmword ptr [rsi + {offset}], xmm0 / movq qword ptr [rsi + {offset}], xmm0
+            enc.sse(chunkSize == 16 ? x86::kMovdquStore : x86::kMovqStore, x86::kXmm0, cellPtr(offset));
+            done = pos + chunkSize;
+          }
+        }
+        break;
+      case OpCode::SetVector:
+        {
+          const auto literal = reinterpret_cast<const std::uint8_t*>(program.literals.data()) + op.index;
+          const auto size = static_cast<std::size_t>(op.value);
+          const auto isZero = std::all_of(literal, literal + size, [](std::uint8_t c) { return c == 0; });
+          if (isZero && size >= kMinRepStosSize) {
+            // lea rdi, [rsi + {offset}]
+            enc.lea(x86::kRdi, cellPtr(op.offset));
+            // mov r8d, ecx  # TripCount の反復回数を退避する
+            enc.mov(x86::kR8d, x86::kEcx);
+            // mov ecx, {size}
+            enc.mov(x86::kEcx, static_cast<std::int64_t>(size));
+            // xor eax, eax
+            enc.alu(x86::AluOp::Xor, x86::kEax, x86::kEax);
+            // rep stosb
+            enc.repStosb();
+            // mov ecx, r8d
+            enc.mov(x86::kEcx, x86::kR8d);
+            if (isOutputOnly) {
+              // mov eax, edx
+              enc.mov(x86::kEax, x86::kEdx);
+              // mov edi, edx
+              enc.mov(x86::kEdi, x86::kEdx);
+            }
+            break;
+          }
+          // 16バイト (短い場合は8バイト) ずつ代入し，端数は直前の範囲と重ねて代入する
+          const std::size_t chunkSize = size >= 16 ? 16 : 8;
+          if (size < chunkSize) {
+            for (std::size_t j = 0; j < size; j++) {
+              // mov byte ptr [rsi + {offset}], {value}
+              enc.mov(cellPtr(op.offset + static_cast<std::int32_t>(j)), literal[j]);
+            }
+            break;
+          }
+          if (isZero) {
+            // pxor xmm0, xmm0
+            enc.sse(x86::kPxor, x86::kXmm0, x86::kXmm0);
+          }
+          for (std::size_t pos = 0; ; pos = std::min(pos + chunkSize, size - chunkSize)) {
+            if (!isZero) {
+              // movdqu xmm0, xmmword ptr [rip + {data}] / movq xmm0, qword ptr [rip + {data}]
+              enc.sse(chunkSize == 16 ? x86::kMovdquLoad : x86::kMovqLoad, x86::kXmm0, x86::ripPtr(x86::Size::Byte));
+              fragment.alignedData.push_back(fragment.data.size());
+              fragment.fixups.push_back({buf.tell() - sizeof(std::uint32_t), fragment.data.size()});
+              fragment.data.insert(fragment.data.end(), literal + pos, literal + pos + chunkSize);
+            }
+            // movdqu xmmword ptr [rsi + {offset}], xmm0 / movq qword ptr [rsi + {offset}], xmm0
+            enc.sse(chunkSize == 16 ? x86::kMovdquStore : x86::kMovqStore, x86::kXmm0, cellPtr(op.offset + static_cast<std::int32_t>(pos)));
+            if (pos + chunkSize == size) {
+              break;
+            }
+          }
+        }
+        break;
+      case OpCode::ClearScan:
+        emitZeroScan(enc, op.value > 0, true);
+        if (isOutputOnly) {
+          // mov eax, edx
+          enc.mov(x86::kEax, x86::kEdx);
+        }
+        break;
+      case OpCode::MoveScan:
+        emitMoveScan(enc, op.offset, op.value > 0);
+        if (isOutputOnly) {
+          // mov eax, edx
+          enc.mov(x86::kEax, x86::kEdx);
+          // mov edi, edx
+          enc.mov(x86::kEdi, x86::kEdx);
+        }
+        break;
+      case OpCode::AddProduct:
+      case OpCode::MulAddProduct:
+        {
+          // 積は r8d に求める (ecx の反復回数は後続の命令のために残す)
+          const auto* factors = program.operands.data() + op.index;
+          const auto nFactors = *factors++;
+          auto isFirst = true;
+          if (op.code == OpCode::MulAddProduct) {
+            // mov r8d, ecx
+            enc.mov(x86::kR8d, x86::kEcx);
+            isFirst = false;
+          }
+          for (std::int32_t j = 0; j < nFactors; j++) {
+            if (isFirst) {
+              // movzx r8d, byte ptr [rsi + {factor}]
+              enc.movzx(x86::kR8d, cellPtr(factors[j]));
+              isFirst = false;
+            } else {
+              // movzx r9d, byte ptr [rsi + {factor}]
+              enc.movzx(x86::kR9d, cellPtr(factors[j]));
+              // imul r8d, r9d
+              enc.imul(x86::kR8d, x86::kR9d);
+            }
+          }
+          if (op.value != 1 && op.value != -1) {
+            // imul r8d, r8d, {value}
+            enc.imul(x86::kR8d, x86::kR8d, static_cast<std::int8_t>(op.value));
+          }
+          // add/sub byte ptr [rsi + {offset}], r8b
+          enc.alu(op.value == -1 ? x86::AluOp::Sub : x86::AluOp::Add, cellPtr(op.offset), x86::kR8b);
+        }
+        break;
+      case OpCode::LoopBegin:
+        if (tune.loopAlignment > 1) {
+          // 断片の先頭になり得るループは断片の分割の仕方によらず同じコードになるように常に揃え，
+          // 最も内側のループは詰め物が小さければ揃える
+          auto padding = getPaddingSize(buf.tell(), tune.loopAlignment);
+          if (!loopStack.empty()) {
+            auto j = i + 1;
+            while (ops[j].code != OpCode::LoopBegin && ops[j].code != OpCode::LoopEnd) {
+              j++;
+            }
+            if (ops[j].code == OpCode::LoopBegin || padding > tune.maxLoopPadding) {
+              // cmp と je の8byte
+              padding = tune.isBranchAligned ? getBranchPaddingSize(buf.tell(), 8) : 0;
+            }
+          }
+          enc.nop(padding);
+        }
+        closeRegion();
+        regionStack.push_back(op.index - range.loopIndex);
+        {
+          const auto pos = buf.tell();
+          // cmp byte ptr [rsi], dh
+          enc.cmp(cellPtr(0), x86::kDh);
+          // je 0x********
+          // ジャンプ先が決定していないので，ジャンプオフセットは後で書き込む
+          // ここをジャンプオフセットの大きさに応じてshort jumpかnear jump命令を生成しようと思うと
+          // 命令長が変わり実装が少し面倒になる
+          loopStack.emplace(pos, enc.jccNear(x86::Cond::E));
+        }
+        break;
+      case OpCode::LoopEnd:
+        {
+          const auto [pos, jumpPos] = loopStack.top();
+          if (tune.isBranchAligned && op.value == 0) {
+            // 詰め物を入れた後に short jump が届くかどうかで命令長が決まる
+            auto padding = getBranchPaddingSize(buf.tell(), 2);
+            // pos は現在位置より前にあるので，符号なしのまま後方への距離を比べる
+            if (buf.tell() + padding + 2 - pos > 128) {
+              padding = getBranchPaddingSize(buf.tell(), 5);
+            }
+            enc.nop(padding);
+          }
+          // 一律near jumpでもいいけど，一応short jumpも生成するようにしてある
+          if (op.value == 0) {
+            // jmp {pos}
+            enc.jmp(pos);
+          }
+          // op.value != 0 なら本体は高々1回しか実行されないので，条件付きで飛ばすだけにする
+          // fill loop start
+          enc.patchRel32(jumpPos, buf.tell());
+          loopStack.pop();
+          closeRegion();
+          regionStack.pop_back();
+        }
+        break;
+      case OpCode::Call:
+        // call 0x********
+        // サブルーチンの位置は連結時に決まるので，変位は後で書き込む
+        fragment.calls.push_back({enc.callNear(), op.index});
+        break;
+      case OpCode::Return:
+        if (isObjectMode) {
+          // add rsp, 0x08
+          enc.add(x86::kRsp, 0x08);
+        }
+        // ret
+        enc.ret();
+        break;
+      default:
+        break;
+    }
+  }
+
+  closeRegion();
+}
+
+
+/*!
+ * @brief 各断片を生成する (複数のスレッドを指定した場合は並列に生成する)
+ *
+ * @param [in] program  中間表現
+ * @param [in] ranges  各断片の範囲
+ * @param [in] isObjectMode  オブジェクトファイルを出力するかどうか
+ * @param [in] isOutputOnly  プログラムに入力命令が含まれないかどうか
+ * @param [in] tune  コード生成の方針
+ * @param [in] nThreads  スレッド数
+ * @param [out] fragments  生成した断片の格納先 (ranges と同じ要素数であること)
+ */
+inline void
+emitFragments(
+  const Program& program,
+  const std::vector<FragmentRange>& ranges,
+  bool isObjectMode,
+  bool isOutputOnly,
+  const TuneParams& tune,
+  unsigned int nThreads,
+  const std::vector<CodeFragment*>& fragments)
+{
+  nThreads = static_cast<unsigned int>(std::min<std::size_t>(nThreads, ranges.size()));
+  std::atomic<std::size_t> nextIndex{0};
+  std::vector<std::exception_ptr> errors(std::max(nThreads, 1U));
+  const auto worker = [&](unsigned int id) {
+    try {
+      for (auto index = nextIndex++; index < ranges.size(); index = nextIndex++) {
+        emitFragment(program, ranges[index], isObjectMode, isOutputOnly, tune, *fragments[index]);
+      }
+    } catch (...) {
+      errors[id] = std::current_exception();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < nThreads; i++) {
+    threads.emplace_back(worker, i);
+  }
+  worker(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+}
+
+
+/*!
+ * @brief 断片を連結する
+ *
+ * 断片内のジャンプは相対ジャンプのみなので，コードはそのまま書き込み，
+ * コード領域のオフセットの補正とループのソース上での位置の解決のみを行う．
+ * 定数データへの参照は，定数データの配置が決まった後に linkFragmentData() で解決する．
+ * 断片の先頭は alignment の境界まで nop で詰める (詰め物はトップレベルの領域に含める)．
+ *
+ * @param [in,out] buf  書き込み先バッファ
+ * @param [in] codeOffset  コード部分の開始位置
+ * @param [in] fragment  連結する断片
+ * @param [in] loopSrcOffsets  断片内の最初のループ以降の各 '[' のソース上での位置
+ * @param [in] alignment  断片の配置境界
+ * @param [in,out] regions  コード領域のリスト
+ * @return 断片を書き込んだ位置
+ */
+inline std::size_t
+linkFragment(
+  CodeBuffer& buf,
+  std::size_t codeOffset,
+  const CodeFragment& fragment,
+  const std::size_t* loopSrcOffsets,
+  std::size_t alignment,
+  std::vector<CodeRegion>& regions)
+{
+  const auto padding = getPaddingSize(buf.tell(), alignment);
+  appendRegion(regions, {0, 0, buf.tell() - codeOffset, padding});
+  Encoder{buf}.nop(padding);
+  const auto fragmentPos = buf.tell();
+  const auto fragmentOffset = fragmentPos - codeOffset;
+  buf.write(fragment.code.data(), fragment.code.size());
+  for (const auto& region : fragment.regions) {
+    appendRegion(regions, {
+      region.depth == 0 ? 0 : loopSrcOffsets[region.loopIndex],
+      region.depth,
+      fragmentOffset + region.offset,
+      region.size});
+  }
+  return fragmentPos;
+}
+
+
+/*!
+ * @brief 断片の定数データを書き込み，コードからの参照を解決する
+ *
+ * 定数データは直前の断片の定数データに続けて詰めて書き込み，CodeFragment::alignedData の部分の前にのみ
+ * kDataAlignment の境界まで詰め物を入れる．
+ * これにより，定数データの配置は断片の分割の仕方によらず同じになる．
+ * コード部分と定数データは同じ距離を保ってロードされるので，RIP相対の変位はファイル上の位置から求まる．
+ *
+ * @param [in,out] buf  書き込み先バッファ (定数データ全体の開始位置は kDataAlignment の境界であること)
+ * @param [in] fragmentPos  断片のコードを書き込んだ位置
+ * @param [in] fragment  断片
+ */
+inline void
+linkFragmentData(CodeBuffer& buf, std::size_t fragmentPos, const CodeFragment& fragment)
+{
+  const auto& data = fragment.data;
+  // 詰め物で区切った各部分の，断片の定数データ上の開始位置と書き込んだ位置
+  std::vector<std::pair<std::size_t, std::size_t>> parts{{0, buf.tell()}};
+  for (const auto first : fragment.alignedData) {
+    buf.write(data.data() + parts.back().first, first - parts.back().first);
+    while (buf.tell() % kDataAlignment != 0) {
+      writeAs<std::uint8_t>(buf, 0x00);
+    }
+    parts.emplace_back(first, buf.tell());
+  }
+  buf.write(data.data() + parts.back().first, data.size() - parts.back().first);
+  const auto dataEnd = buf.tell();
+  for (const auto& fixup : fragment.fixups) {
+    const auto part = std::prev(std::upper_bound(
+      parts.begin(),
+      parts.end(),
+      fixup.dataOffset,
+      [](std::size_t offset, const std::pair<std::size_t, std::size_t>& p) { return offset < p.first; }));
+    const auto pos = fragmentPos + fixup.codeOffset;
+    buf.seek(pos);
+    writeAs<std::int32_t>(buf, static_cast<std::int32_t>(
+      static_cast<std::int64_t>(part->second + fixup.dataOffset - part->first)
+        - static_cast<std::int64_t>(pos + sizeof(std::int32_t))));
+  }
+  buf.seek(dataEnd);
+}
+}  // namespace
+
+
+/*!
+ * @brief FragmentCache の実装
+ */
+struct FragmentCache::Impl
+{
+  //! キャッシュした断片を生成したときにオブジェクトファイルを出力したかどうか
+  bool isObjectMode = false;
+  //! キャッシュした断片を生成したときにプログラムに入力命令が含まれなかったかどうか
+  bool isOutputOnly = false;
+  //! キャッシュした断片を生成したときに想定したマイクロアーキテクチャ
+  Tune tune = Tune::Generic;
+  //! 断片の命令列から生成した断片への対応
+  std::unordered_map<std::string, CodeFragment> fragments{};
+  //! 直前のコンパイルの断片数
+  std::size_t nFragments = 0;
+  //! 直前のコンパイルで再利用した断片数
+  std::size_t nReused = 0;
+};
+
+
+FragmentCache::FragmentCache()
+  : impl_{std::make_unique<Impl>()}
+{}
+
+
+FragmentCache::~FragmentCache() = default;
+
+
+std::size_t
+FragmentCache::getFragmentCount() const noexcept
+{
+  return impl_->nFragments;
+}
+
+
+std::size_t
+FragmentCache::getReusedCount() const noexcept
+{
+  return impl_->nReused;
+}
+
+
+/*!
+ * options.isObject が true のとき，実行ファイルの代わりに C/C++ からリンクして呼び出せる
+ * 再配置可能オブジェクトファイル (ET_REL) を出力する．
+ * オブジェクトファイルは次の System V ABI の関数 bf_run を公開する．
+ *
+ *   void bf_run(uint8_t* tape, int (*read_cb)(void), int (*write_cb)(int));
+ *
+ * read_cb と write_cb はそれぞれ getchar() と putchar() と同じ規約とし，
+ * read_cb が負の値 (EOF) を返したときはセルの値を変更しない．
+ *
+ * ソースは中間表現に変換して最適化した後，トップレベルのループの境界で断片に分割し，
+ * options.nThreads のスレッドで並列に生成する．
+ * 値がコンパイル時に分かる連続した出力は1回の write システムコールにまとめ，その文字列は .rodata に置く．
+ * 生成結果はスレッド数によらず同一である．
+ * 同じ命令列のループはサブルーチンにまとめてエピローグの後ろに配置し，各箇所から call 命令で呼び出す．
+ * options.tune を指定した場合，ループの先頭を nop で揃え，停止しない経路をエピローグの後ろに追い出し，
+ * inc / dec と add / sub をマイクロアーキテクチャに応じて使い分ける．
+ *
+ * fragmentCache を指定した場合，トップレベルのループごとに断片に分割し，
+ * 前回のコンパイルと命令列が同じ断片は生成し直さずに再利用する．
+ */
+void
+compileElfX64(
+  const NormalizedSource& normalized,
+  const Options& options,
+  std::vector<std::uint8_t>& image,
+  FragmentCache* fragmentCache)
+{
+  // オブジェクトファイルを出力するかどうか
+  const auto isObjectMode = options.isObject;
+  // コード部分の開始位置
+  const auto codeOffset = isObjectMode ? kObjectHeaderSize : kHeaderSize;
+  // コード生成の方針 (断片の境界はファイル上の位置で揃える．オブジェクトファイルの .text の開始位置は境界に揃っている)
+  const auto tune = getTuneParams(options.tune);
+
+  // 最適化はプログラム全体を見て行うので，断片に分割する前に済ませておく
+  Program program;
+  buildProgram(normalized, program);
+  optimizeProgram(program, normalized, options);
+  const auto& ops = program.ops;
+  // オブジェクトファイルの場合，出力のたびにコールバックを呼び出すので出力専用の最適化は行わない
+  const auto isOutputOnly = !isObjectMode
+    && std::none_of(ops.begin(), ops.end(), [](const Op& op) { return op.code == OpCode::Input; });
+
+  CodeBuffer buf{image};
+  Encoder enc{buf};
+  // ヘッダ部分は一旦飛ばす（後に書き込む）
+  buf.seek(codeOffset);
+
+  if (isObjectMode) {
+    // push rbx
+    // push r12
+    // push r13
+    // (戻りアドレスと合わせて rsp が16byte境界に揃う)
+    enc.push(x86::kRbx);
+    enc.push(x86::kR12);
+    enc.push(x86::kR13);
+    // mov r12, rsi  # read_cb
+    enc.mov(x86::kR12, x86::kRsi);
+    // mov r13, rdx  # write_cb
+    enc.mov(x86::kR13, x86::kRdx);
+    // mov rsi, rdi  # tape
+    enc.mov(x86::kRsi, x86::kRdi);
+  } else {
+    // mov esi, {kBssAddr}  # 上位32bitは0になる
+    enc.mov(x86::kRsi, static_cast<std::int64_t>(kBssAddr));
+  }
+  // mov edx, 0x01
+  enc.mov(x86::kEdx, 0x01);
+  if (isOutputOnly) {
+    // mov eax, edx
+    enc.mov(x86::kEax, x86::kEdx);
+    // mov edi, edx
+    enc.mov(x86::kEdi, x86::kEdx);
+  }
+
+  // シンボルとして出力するコード領域
+  std::vector<CodeRegion> regions;
+  appendRegion(regions, {0, 0, 0, buf.tell() - codeOffset});
+
+  // トップレベルのループの境界で分割した断片ごとにコードを生成し，順に連結する
+  const auto nThreads = decideThreadCount(options.nThreads, normalized.commands.size());
+  std::vector<FragmentRange> ranges;
+  if (fragmentCache != nullptr) {
+    ranges = splitProgram(program, std::max<std::size_t>(ops.size(), 1));
+  } else if (nThreads > 1) {
+    ranges = splitProgram(program, nThreads * kFragmentsPerThread);
+  } else {
+    ranges = splitProgram(program, 1);
+  }
+  // サブルーチンの断片はメインの断片の後ろにある
+  const auto nMainRanges = ranges.size() - program.subroutines.size();
+
+  // 連結する断片と，そのうち生成が必要な断片
+  std::vector<const CodeFragment*> linkedFragments(ranges.size());
+  std::vector<FragmentRange> emitRanges;
+  std::vector<CodeFragment*> emitFragmentPtrs;
+  std::vector<CodeFragment> ownedFragments;
+  if (fragmentCache != nullptr) {
+    auto& impl = *fragmentCache->impl_;
+    if (impl.isObjectMode != isObjectMode || impl.isOutputOnly != isOutputOnly || impl.tune != options.tune) {
+      impl.fragments.clear();
+      impl.isObjectMode = isObjectMode;
+      impl.isOutputOnly = isOutputOnly;
+      impl.tune = options.tune;
+    }
+    // 今回使用する断片のみを残す
+    decltype(impl.fragments) nextFragments;
+    impl.nReused = 0;
+    for (decltype(ranges)::size_type i = 0; i < ranges.size(); i++) {
+      std::string key;
+      serializeOps(program, ranges[i].first, ranges[i].last, ranges[i].loopIndex, key);
+      if (const auto it = nextFragments.find(key); it != nextFragments.end()) {
+        linkedFragments[i] = &it->second;
+        impl.nReused++;
+      } else if (auto node = impl.fragments.extract(key); !node.empty()) {
+        linkedFragments[i] = &nextFragments.insert(std::move(node)).position->second;
+        impl.nReused++;
+      } else {
+        auto& fragment = nextFragments.emplace(std::move(key), CodeFragment{}).first->second;
+        linkedFragments[i] = &fragment;
+        emitRanges.push_back(ranges[i]);
+        emitFragmentPtrs.push_back(&fragment);
+      }
+    }
+    impl.fragments = std::move(nextFragments);
+    impl.nFragments = ranges.size();
+  } else {
+    ownedFragments.resize(ranges.size());
+    for (decltype(ranges)::size_type i = 0; i < ranges.size(); i++) {
+      linkedFragments[i] = &ownedFragments[i];
+      emitFragmentPtrs.push_back(&ownedFragments[i]);
+    }
+    emitRanges = ranges;
+  }
+  emitFragments(program, emitRanges, isObjectMode, isOutputOnly, tune, nThreads, emitFragmentPtrs);
+
+  std::vector<std::size_t> fragmentPositions(ranges.size());
+  const auto linkFragments = [&](std::size_t first, std::size_t last) {
+    for (auto i = first; i < last; i++) {
+      fragmentPositions[i] = linkFragment(
+        buf,
+        codeOffset,
+        *linkedFragments[i],
+        normalized.loopSrcOffsets.data() + ranges[i].loopIndex,
+        tune.loopAlignment,
+        regions);
+    }
+  };
+  linkFragments(0, nMainRanges);
+  // 定数データをコードの直後に配置し，断片からの参照を解決する
+  const auto linkData = [&]() {
+    const auto hasData = std::any_of(
+      linkedFragments.begin(),
+      linkedFragments.end(),
+      [](const CodeFragment* fragment) { return !fragment->data.empty(); });
+    if (hasData) {
+      while (buf.tell() % kDataAlignment != 0) {
+        // int3
+        enc.int3();
+      }
+    }
+    const auto dataPos = buf.tell();
+    for (decltype(ranges)::size_type i = 0; i < ranges.size(); i++) {
+      linkFragmentData(buf, fragmentPositions[i], *linkedFragments[i]);
+    }
+    return std::make_pair(dataPos - codeOffset, buf.tell() - dataPos);
+  };
+  // 停止しない経路とサブルーチンをエピローグの後ろに配置し，ジャンプと呼び出しを解決する
+  const auto linkSubroutines = [&]() {
+    const auto hasHangJumps = std::any_of(
+      linkedFragments.begin(),
+      linkedFragments.end(),
+      [](const CodeFragment* fragment) { return !fragment->hangJumps.empty(); });
+    const auto hangPos = buf.tell();
+    if (hasHangJumps) {
+      // jmp $
+      enc.jmp(hangPos);
+      appendRegion(regions, {0, 0, hangPos - codeOffset, buf.tell() - hangPos});
+    }
+    linkFragments(nMainRanges, ranges.size());
+    for (decltype(ranges)::size_type i = 0; i < ranges.size(); i++) {
+      for (const auto& call : linkedFragments[i]->calls) {
+        enc.patchRel32(fragmentPositions[i] + call.codeOffset, fragmentPositions[nMainRanges + call.subroutine]);
+      }
+      for (const auto jumpOffset : linkedFragments[i]->hangJumps) {
+        enc.patchRel32(fragmentPositions[i] + jumpOffset, hangPos);
+      }
+    }
+  };
+
+  const auto epilogueOffset = buf.tell() - codeOffset;
+  if (isObjectMode) {
+    // pop r13
+    // pop r12
+    // pop rbx
+    enc.pop(x86::kR13);
+    enc.pop(x86::kR12);
+    enc.pop(x86::kRbx);
+    // ret
+    enc.ret();
+    appendRegion(regions, {0, 0, epilogueOffset, buf.tell() - codeOffset - epilogueOffset});
+    linkSubroutines();
+
+    const auto [codeSize, dataSize] = linkData();
+    const auto symSize = writeObjectFooter(buf, codeSize, dataSize, regions, std::max(tune.loopAlignment, kDataAlignment));
+    buf.seek(0);
+    writeObjectHeader(buf, codeSize + dataSize, symSize);
+    return;
+  }
+
+  // mov eax, 0x3c
+  enc.mov(x86::kEax, 0x3c);
+  // xor edi, edi
+  enc.alu(x86::AluOp::Xor, x86::kEdi, x86::kEdi);
+  // syscall
+  enc.syscall();
+  appendRegion(regions, {0, 0, epilogueOffset, buf.tell() - codeOffset - epilogueOffset});
+  linkSubroutines();
+
+  // Write .rodata
+  const auto [codeSize, dataSize] = linkData();
+
+  if (options.isTiny) {
+    // セクションヘッダとシンボルを省き，ファイルを .rodata の末尾で終える
+    const auto imageSize = buf.tell();
+    buf.seek(0);
+    writeTinyExecutableHeader<kMode>(buf, kBaseAddr, kBaseAddr + kHeaderSize, imageSize, kBssAddr, 0x10000);
+    return;
+  }
+
+  // Write footer
+  const auto symSize = writeFooter(buf, codeSize, dataSize, regions);
+
+  // Write header
+  buf.seek(0);
+  writeHeader(buf, codeSize, dataSize, symSize);
+}
+}  // namespace bfc
@@ -0,0 +1,486 @@
+/*!
+ * @brief Simple Brainf**k Compiler for x86 ELF
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <cstdint>
+#include <stack>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <elf.h>
+
+#include "bfcompiler.hpp"
+#include "codebuffer.hpp"
+#include "elfwriter.hpp"
+#include "x86encoder.hpp"
+
+
+namespace bfc
+{
+namespace
+{
+//! .textセクションのアドレス
+constexpr ::Elf32_Addr kBaseAddr = 0x04048000;
+//! .bssセクションのアドレス (先頭はテープ)
+constexpr ::Elf32_Addr kBssAddr = 0x04248000;
+//! テープのサイズ (byte単位)
+constexpr ::Elf32_Word kTapeSize = 0x00010000;
+//! 入出力バッファそれぞれのサイズ (byte単位)
+constexpr ::Elf32_Word kIoBufferSize = 0x00001000;
+//! 出力バッファのアドレス (テープの直後)
+constexpr ::Elf32_Addr kOutputBufferAddr = kBssAddr + kTapeSize;
+//! 入力バッファのアドレス
+constexpr ::Elf32_Addr kInputBufferAddr = kOutputBufferAddr + kIoBufferSize;
+//! システムコールの呼び出し先 (__kernel_vsyscall または int 0x80 のサブルーチン) のアドレスを置く場所
+constexpr ::Elf32_Addr kSysEntryAddr = kInputBufferAddr + kIoBufferSize;
+//! .bssセクションのサイズ (byte単位)
+constexpr ::Elf32_Word kBssSize = kSysEntryAddr + sizeof(::Elf32_Addr) - kBssAddr;
+//! プログラムヘッダ数
+constexpr ::Elf32_Half kNProgramHeaders = 2;
+//! セクションヘッダ数
+constexpr ::Elf32_Half kNSectionHeaders = 4;
+//! ヘッダ部分のサイズ
+constexpr ::Elf32_Off kHeaderSize = sizeof(::Elf32_Ehdr) + sizeof(::Elf32_Phdr) * kNProgramHeaders;
+//! フッタ部分のサイズ
+constexpr ::Elf32_Off kFooterSize = sizeof(::Elf32_Shdr) * kNSectionHeaders;
+//! 文字列テーブル
+constexpr char kShStrTab[] = "\0.text\0.shstrtab\0.bss";
+//! 命令のエンコーダ
+using Encoder = x86::Encoder<x86::Mode::Bits32>;
+
+
+/*!
+ * @brief ヘッダ部分の書き込みを行う
+ *
+ * @param [in] buf  書き込み先バッファ
+ * @param [in] codeSize  コード部分のサイズ (byte単位)
+ */
+inline void
+writeHeader(CodeBuffer& buf, std::size_t codeSize)
+{
+  constexpr auto kMode = x86::Mode::Bits32;
+  const auto fileSize = kHeaderSize + sizeof(kShStrTab) + kFooterSize + codeSize;
+
+  // ELF header
+  writeElfHeader<kMode>(
+    buf,
+    ET_EXEC,
+    ELFOSABI_LINUX,
+    kBaseAddr + kHeaderSize,
+    kNProgramHeaders,
+    kHeaderSize + sizeof(kShStrTab) + codeSize,
+    kNSectionHeaders);
+  // Program header
+  writeLoadSegmentHeader<kMode>(buf, PF_R | PF_X, kBaseAddr, fileSize, fileSize);
+  // Program header for .bss
+  writeLoadSegmentHeader<kMode>(buf, PF_R | PF_W, kBssAddr, 0x00000000, kBssSize);
+}
+
+
+/*!
+ * @brief フッタ部分の書き込みを行う
+ *
+ * @param [in] buf  書き込み先バッファ
+ * @param [in] codeSize  コード部分のサイズ (byte単位)
+ */
+inline void
+writeFooter(CodeBuffer& buf, std::size_t codeSize)
+{
+  constexpr auto kMode = x86::Mode::Bits32;
+
+  writeAs(buf, kShStrTab);
+
+  // First section header
+  writeSectionHeader<kMode>(buf, 0, SHT_NULL, 0, 0, 0, 0, 0, 0, 0, 0);
+  // Second section header (.shstrtab)
+  writeSectionHeader<kMode>(buf, 7, SHT_STRTAB, 0, 0, kHeaderSize + codeSize, sizeof(kShStrTab), 0, 0, 1, 0);
+  // Third section header (.text)
+  writeSectionHeader<kMode>(
+    buf, 1, SHT_PROGBITS, SHF_EXECINSTR | SHF_ALLOC, kBaseAddr + kHeaderSize, kHeaderSize, codeSize, 0, 0, 4, 0);
+  // Fourth section header (.bss)
+  writeSectionHeader<kMode>(
+    buf, 17, SHT_NOBITS, SHF_ALLOC | SHF_WRITE, kBssAddr, 0x00001000, kBssSize, 0, 0, 16, 0);
+}
+
+
+/*!
+ * @brief __kernel_vsyscall のアドレスを探してシステムコールの呼び出し先とするコードを書き込む
+ *
+ * 起動時のスタックには argc, argv[], NULL, envp[], NULL, 補助ベクタの順に並んでいるので，
+ * 補助ベクタの AT_SYSINFO を探す．見つからなければ呼び出し先は変更しない．
+ * eax と ebx を破壊する．
+ *
+ * @param [in,out] enc  エンコーダ
+ */
+inline void
+emitFindKernelVsyscall(Encoder& enc)
+{
+  // mov eax, esp
+  enc.mov(x86::kEax, x86::kEsp);
+  // argv[] と envp[] を読み飛ばし，それぞれの終端の NULL を指す
+  for (int i = 0; i < 2; i++) {
+    const auto pos = enc.tell();
+    // add eax, 0x04
+    enc.add(x86::kEax, 0x04);
+    // cmp dword ptr [eax], 0x00
+    enc.cmp(x86::ptr(x86::Size::Dword, x86::kEax), 0x00);
+    // jne {pos}
+    enc.jcc(x86::Cond::Ne, pos);
+  }
+  // add eax, 0x04
+  enc.add(x86::kEax, 0x04);
+  const auto loopPos = enc.tell();
+  // mov ebx, dword ptr [eax]
+  enc.mov(x86::kEbx, x86::ptr(x86::Size::Dword, x86::kEax));
+  // test ebx, ebx
+  enc.test(x86::kEbx, x86::kEbx);
+  // je {end}  # AT_NULL
+  const auto endJumpPos = enc.jccShort(x86::Cond::E);
+  // add eax, 0x08
+  enc.add(x86::kEax, 0x08);
+  // cmp ebx, {AT_SYSINFO}
+  enc.cmp(x86::kEbx, AT_SYSINFO);
+  // jne {loopPos}
+  enc.jcc(x86::Cond::Ne, loopPos);
+  // mov ebx, dword ptr [eax - 4]
+  enc.mov(x86::kEbx, x86::ptr(x86::Size::Dword, x86::kEax, -4));
+  // mov dword ptr [{kSysEntryAddr}], ebx
+  enc.mov(x86::absolutePtr(x86::Size::Dword, kSysEntryAddr), x86::kEbx);
+  enc.patchRel8(endJumpPos, enc.tell());
+}
+
+
+/*!
+ * @brief 出力バッファの内容を書き出すサブルーチンを書き込む
+ *
+ * edi が指す位置までを標準出力に書き出し，edi を出力バッファの先頭に戻す．
+ * eax と ebx を破壊する．
+ *
+ * @param [in,out] enc  エンコーダ
+ */
+inline void
+emitFlushSubroutine(Encoder& enc)
+{
+  // push ecx
+  enc.push(x86::kEcx);
+  // push edx
+  enc.push(x86::kEdx);
+  // mov ecx, {kOutputBufferAddr}
+  enc.mov(x86::kEcx, kOutputBufferAddr);
+  // mov edx, edi
+  enc.mov(x86::kEdx, x86::kEdi);
+  // sub edx, ecx
+  enc.sub(x86::kEdx, x86::kEcx);
+  // je {end}
+  const auto emptyJumpPos = enc.jccShort(x86::Cond::E);
+  // mov ebx, 0x01
+  enc.mov(x86::kEbx, 0x01);
+  // 書き込めなかった残りがあれば繰り返す
+  const auto loopPos = enc.tell();
+  // mov eax, 0x04
+  enc.mov(x86::kEax, 0x04);
+  // call dword ptr [{kSysEntryAddr}]
+  enc.call(x86::absolutePtr(x86::Size::Dword, kSysEntryAddr));
+  // test eax, eax
+  enc.test(x86::kEax, x86::kEax);
+  // jle {end}  # 失敗したら残りは捨てる
+  const auto errorJumpPos = enc.jccShort(x86::Cond::Le);
+  // add ecx, eax
+  enc.add(x86::kEcx, x86::kEax);
+  // sub edx, eax
+  enc.sub(x86::kEdx, x86::kEax);
+  // jne {loopPos}
+  enc.jcc(x86::Cond::Ne, loopPos);
+  enc.patchRel8(emptyJumpPos, enc.tell());
+  enc.patchRel8(errorJumpPos, enc.tell());
+  // mov edi, {kOutputBufferAddr}
+  enc.mov(x86::kEdi, kOutputBufferAddr);
+  // pop edx
+  enc.pop(x86::kEdx);
+  // pop ecx
+  enc.pop(x86::kEcx);
+  // ret
+  enc.ret();
+}
+
+
+/*!
+ * @brief 入力バッファから1文字をセルに読み込むサブルーチンを書き込む
+ *
+ * esi が ebp に達していれば，出力バッファを書き出してから標準入力を入力バッファに読み込む．
+ * EOF またはエラーのときはセルを変更しない．eax と ebx を破壊する．
+ *
+ * @param [in,out] enc  エンコーダ
+ * @param [in] hasOutput  出力バッファを書き出す必要があるかどうか
+ * @return 出力バッファを書き出すサブルーチンの呼び出しの変位の位置 (hasOutput が false なら0)
+ */
+inline std::size_t
+emitReadSubroutine(Encoder& enc, bool hasOutput)
+{
+  // cmp esi, ebp
+  enc.cmp(x86::kEsi, x86::kEbp);
+  // jne {load}
+  const auto loadJumpPos = enc.jccShort(x86::Cond::Ne);
+  std::size_t flushCallPos = 0;
+  if (hasOutput) {
+    // call {flush}  # 入力を待つ前にプロンプト等を表示する
+    flushCallPos = enc.callNear();
+  }
+  // push ecx
+  enc.push(x86::kEcx);
+  // push edx
+  enc.push(x86::kEdx);
+  // mov eax, 0x03
+  enc.mov(x86::kEax, 0x03);
+  // xor ebx, ebx
+  enc.alu(x86::AluOp::Xor, x86::kEbx, x86::kEbx);
+  // mov ecx, {kInputBufferAddr}
+  enc.mov(x86::kEcx, kInputBufferAddr);
+  // mov edx, {kIoBufferSize}
+  enc.mov(x86::kEdx, kIoBufferSize);
+  // call dword ptr [{kSysEntryAddr}]
+  enc.call(x86::absolutePtr(x86::Size::Dword, kSysEntryAddr));
+  // pop edx
+  enc.pop(x86::kEdx);
+  // pop ecx
+  enc.pop(x86::kEcx);
+  // test eax, eax
+  enc.test(x86::kEax, x86::kEax);
+  // jle {end}
+  const auto eofJumpPos = enc.jccShort(x86::Cond::Le);
+  // mov esi, {kInputBufferAddr}
+  enc.mov(x86::kEsi, kInputBufferAddr);
+  // mov ebp, esi
+  enc.mov(x86::kEbp, x86::kEsi);
+  // add ebp, eax
+  enc.add(x86::kEbp, x86::kEax);
+  enc.patchRel8(loadJumpPos, enc.tell());
+  // mov al, byte ptr [esi]
+  enc.mov(x86::kAl, x86::bytePtr(x86::kEsi));
+  // inc esi
+  enc.inc(x86::kEsi);
+  // mov byte ptr [ecx], al
+  enc.mov(x86::bytePtr(x86::kEcx), x86::kAl);
+  enc.patchRel8(eofJumpPos, enc.tell());
+  // ret
+  enc.ret();
+  return flushCallPos;
+}
+
+}  // namespace
+
+
+void
+compileElfX86(const NormalizedSource& normalized, const Options& options, std::vector<std::uint8_t>& image)
+{
+  // 連続文字等のカウントを楽にするために予めBrainfuckに関係しない文字を取り除いてある
+  const auto& source = normalized.commands;
+  const auto hasOutput = source.find('.') != std::string::npos;
+  const auto hasInput = source.find(',') != std::string::npos;
+
+  CodeBuffer buf{image};
+  Encoder enc{buf};
+
+  // ヘッダ部分は一旦飛ばす（後に書き込む）
+  buf.seek(kHeaderSize);
+
+  // mov ecx, {kBssAddr}
+  enc.mov(x86::kEcx, kBssAddr);
+  // mov edx, 0x01
+  enc.mov(x86::kEdx, 0x01);
+
+  // 入出力は .bss 上のバッファを介してまとめて行い，int 0x80 より速い __kernel_vsyscall があればそれを用いる
+  std::size_t sysEntryPos = 0;
+  if (hasOutput) {
+    // mov edi, {kOutputBufferAddr}
+    enc.mov(x86::kEdi, kOutputBufferAddr);
+  }
+  if (hasInput) {
+    // xor esi, esi
+    enc.alu(x86::AluOp::Xor, x86::kEsi, x86::kEsi);
+    // mov ebp, esi
+    enc.mov(x86::kEbp, x86::kEsi);
+  }
+  if (hasOutput || hasInput) {
+    // mov dword ptr [{kSysEntryAddr}], {intSubroutine}
+    // int 0x80 のサブルーチンの位置は決まっていないので，後で書き込む
+    enc.mov(x86::absolutePtr(x86::Size::Dword, kSysEntryAddr), 0);
+    sysEntryPos = buf.tell() - sizeof(::Elf32_Addr);
+    emitFindKernelVsyscall(enc);
+  }
+
+  // 出力バッファを書き出すサブルーチンと1文字読み込むサブルーチンの呼び出しの変位の位置
+  std::vector<std::size_t> flushCallPositions;
+  std::vector<std::size_t> readCallPositions;
+
+  // ループの先頭と je の変位の位置
+  std::stack<std::pair<std::size_t, std::size_t>> loopStack;
+  for (std::string::size_type i = 0; i < source.size(); i++) {
+    switch (source[i]) {
+      case '>':
+      case '<':
+        {
+          std::string::size_type length;
+          const auto delta = countNetChars(source, '>', '<', i, length);
+          i += length - 1;
+          if (delta == 1) {
+            // inc ecx
+            enc.inc(x86::kEcx);
+          } else if (delta == -1) {
+            // dec ecx
+            enc.dec(x86::kEcx);
+          } else if (delta > 0) {
+            // add ecx, {delta}
+            enc.add(x86::kEcx, delta);
+          } else if (delta < 0) {
+            // sub ecx, {-delta}
+            enc.sub(x86::kEcx, -delta);
+          }
+        }
+        break;
+      case '+':
+      case '-':
+        {
+          std::string::size_type length;
+          const auto delta = countNetChars(source, '+', '-', i, length);
+          i += length - 1;
+          // 256を法とした正味の増分 (0なら何もしない)
+          const auto cnt = static_cast<std::uint8_t>(delta);
+          if (cnt == 1) {
+            // inc byte ptr [ecx]
+            enc.inc(x86::bytePtr(x86::kEcx));
+          } else if (cnt == 0xff) {
+            // dec byte ptr [ecx]
+            enc.dec(x86::bytePtr(x86::kEcx));
+          } else if (cnt != 0) {
+            // add byte ptr [ecx], {cnt}
+            enc.add(x86::bytePtr(x86::kEcx), cnt);
+          }
+        }
+        break;
+      case '.':
+        {
+          // mov al, byte ptr [ecx]
+          enc.mov(x86::kAl, x86::bytePtr(x86::kEcx));
+          // mov byte ptr [edi], al
+          enc.mov(x86::bytePtr(x86::kEdi), x86::kAl);
+          // inc edi
+          enc.inc(x86::kEdi);
+          // cmp edi, {kOutputBufferAddr + kIoBufferSize}
+          enc.cmp(x86::kEdi, kOutputBufferAddr + kIoBufferSize);
+          // jne {next}
+          const auto jumpPos = enc.jccShort(x86::Cond::Ne);
+          // call {flush}
+          flushCallPositions.push_back(enc.callNear());
+          enc.patchRel8(jumpPos, buf.tell());
+        }
+        break;
+      case ',':
+        // call {read}
+        readCallPositions.push_back(enc.callNear());
+        break;
+      case '[':
+        // [-] または [+] はゼロ代入にする
+        if (i + 2 < source.size()
+            && (source[i + 1] == '+' || source[i + 1] == '-')
+            && source[i + 2] == ']') {
+          // mov byte ptr [ecx], dh
+          enc.mov(x86::bytePtr(x86::kEcx), x86::kDh);
+          i += 2;
+        } else {
+          const auto pos = buf.tell();
+          // cmp byte ptr [ecx], dh
+          enc.cmp(x86::bytePtr(x86::kEcx), x86::kDh);
+          // je 0x********
+          // ジャンプ先が決定していないので，ジャンプオフセットは後で書き込む
+          // ここをジャンプオフセットの大きさに応じてshort jumpかnear jump命令を生成しようと思うと
+          // 命令長が変わり実装が少し面倒になる
+          loopStack.emplace(pos, enc.jccNear(x86::Cond::E));
+        }
+        break;
+      case ']':
+        if (loopStack.empty()) {
+          throw CompileError{"'[' corresponding to ']' is not found."};
+        }
+        {
+          const auto [pos, jumpPos] = loopStack.top();
+          // jmp {pos}  # 届くなら short jump にする
+          enc.jmp(pos);
+          // fill loop start
+          enc.patchRel32(jumpPos, buf.tell());
+          loopStack.pop();
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  if (!loopStack.empty()) {
+    throw CompileError{"']' corresponding to '[' is not found."};
+  }
+
+  if (hasOutput) {
+    // call {flush}
+    flushCallPositions.push_back(enc.callNear());
+  }
+  // mov eax, edx
+  enc.mov(x86::kEax, x86::kEdx);
+  // xor ebx, ebx
+  enc.alu(x86::AluOp::Xor, x86::kEbx, x86::kEbx);
+  // int 0x80
+  enc.interrupt(0x80);
+
+  // Write subroutines
+  if (hasOutput || hasInput) {
+    // __kernel_vsyscall が見つからなかったときの呼び出し先
+    const auto intSubroutinePos = buf.tell();
+    // int 0x80
+    enc.interrupt(0x80);
+    // ret
+    enc.ret();
+    const auto end = buf.tell();
+    buf.seek(sysEntryPos);
+    writeAs(buf, static_cast<::Elf32_Addr>(kBaseAddr + intSubroutinePos));
+    buf.seek(end);
+  }
+  std::size_t flushPos = 0;
+  if (hasOutput) {
+    flushPos = buf.tell();
+    emitFlushSubroutine(enc);
+  }
+  if (hasInput) {
+    const auto readPos = buf.tell();
+    const auto flushCallPos = emitReadSubroutine(enc, hasOutput);
+    if (hasOutput) {
+      flushCallPositions.push_back(flushCallPos);
+    }
+    for (const auto pos : readCallPositions) {
+      enc.patchRel32(pos, readPos);
+    }
+  }
+  for (const auto pos : flushCallPositions) {
+    enc.patchRel32(pos, flushPos);
+  }
+
+  const auto codeSize = buf.tell() - kHeaderSize;
+  if (options.isTiny) {
+    // セクションヘッダを省き，ファイルをコードの末尾で終える
+    buf.seek(0);
+    writeTinyExecutableHeader<x86::Mode::Bits32>(buf, kBaseAddr, kBaseAddr + kHeaderSize, kHeaderSize + codeSize, kBssAddr, kBssSize);
+    return;
+  }
+
+  // Write footer
+  writeFooter(buf, codeSize);
+
+  // Write header
+  buf.seek(0);
+  writeHeader(buf, codeSize);
+}
+}  // namespace bfc
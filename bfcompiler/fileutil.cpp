@@ -0,0 +1,176 @@
+/*!
+ * @brief ソースファイルの読み込みと生成したバイナリの書き込み
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#if __cplusplus >= 201703L && defined(__has_include) && __has_include(<filesystem>)
+#  define HAS_HEADER_FILESYSTEM 1
+#endif
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#ifdef HAS_HEADER_FILESYSTEM
+#  include <filesystem>
+#endif
+#include <fstream>
+#include <istream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef HAS_HEADER_FILESYSTEM
+#  include <sys/stat.h>
+#endif
+#ifdef _WIN32
+#  include <process.h>
+#else
+#  include <unistd.h>
+#endif  // _WIN32
+
+#include "fileutil.hpp"
+#include "source.hpp"
+
+
+namespace bfc
+{
+namespace
+{
+//! ソースファイルを読み込む単位 (byte単位)
+constexpr std::size_t kChunkSize = 64 * 1024;
+
+
+/*!
+ * @brief プロセスIDを返す
+ *
+ * @return プロセスID
+ */
+inline long
+getProcessId() noexcept
+{
+#ifdef _WIN32
+  return static_cast<long>(::_getpid());
+#else
+  return static_cast<long>(::getpid());
+#endif  // _WIN32
+}
+
+
+/*!
+ * @brief ファイルに実行可能属性を付与する
+ *
+ * @param [in] filePath  対象のファイルのパス
+ * @return 成功した場合は true
+ */
+inline bool
+setExecutable(const std::string& filePath)
+{
+#ifdef HAS_HEADER_FILESYSTEM
+  std::error_code ec;
+  std::filesystem::permissions(
+    filePath,
+    std::filesystem::perms::owner_all
+      | std::filesystem::perms::group_read | std::filesystem::perms::group_exec
+      | std::filesystem::perms::others_read | std::filesystem::perms::others_exec,
+    ec);
+  return !ec;
+#else
+  return ::chmod(filePath.c_str(), 0755) == 0;
+#endif  // HAS_HEADER_FILESYSTEM
+}
+}  // namespace
+
+
+std::string
+makeTemporaryPath(const std::string& filePath)
+{
+  static std::atomic<unsigned long> counter{0};
+  return filePath + ".tmp" + std::to_string(getProcessId()) + "_" + std::to_string(counter++);
+}
+
+
+bool
+replaceFile(const std::string& srcFilePath, const std::string& dstFilePath)
+{
+#ifdef HAS_HEADER_FILESYSTEM
+  std::error_code ec;
+  std::filesystem::rename(srcFilePath, dstFilePath, ec);
+  if (ec) {
+    std::filesystem::remove(srcFilePath, ec);
+    return false;
+  }
+  return true;
+#else
+  if (std::rename(srcFilePath.c_str(), dstFilePath.c_str()) != 0) {
+    std::remove(srcFilePath.c_str());
+    return false;
+  }
+  return true;
+#endif  // HAS_HEADER_FILESYSTEM
+}
+
+
+bool
+readSourceFile(const std::string& filePath, NormalizedSource& source)
+{
+  std::ifstream ifs{filePath, std::ios::binary};
+  if (!ifs) {
+    return false;
+  }
+  SourceNormalizer normalizer{source};
+  std::vector<char> chunk(kChunkSize);
+  while (ifs.read(chunk.data(), static_cast<std::streamsize>(chunk.size())) || ifs.gcount() > 0) {
+    normalizer.feed(chunk.data(), static_cast<std::size_t>(ifs.gcount()));
+  }
+  return ifs.eof() && !ifs.bad();
+}
+
+
+bool
+writeImageFile(const std::string& filePath, const std::vector<std::uint8_t>& image, bool isExecutable)
+{
+  // 既存のファイルを直接書き換えると，キャッシュからハードリンクしたファイルの場合に
+  // キャッシュの内容まで書き換わってしまうので，一時ファイルに書き込んでから置き換える
+  const auto tmpFilePath = makeTemporaryPath(filePath);
+  std::ofstream ofs{tmpFilePath, std::ios::binary};
+  if (!ofs) {
+    return false;
+  }
+  ofs.write(reinterpret_cast<const char*>(image.data()), static_cast<std::streamsize>(image.size()));
+  ofs.close();
+  // 生成した実行ファイルに実行可能属性を付与する
+  if (!ofs || (isExecutable && !setExecutable(tmpFilePath))) {
+    std::remove(tmpFilePath.c_str());
+    return false;
+  }
+  return replaceFile(tmpFilePath, filePath);
+}
+
+
+std::size_t
+readLoopProfile(std::istream& is, std::map<std::string::size_type, std::uint64_t>& profile)
+{
+  std::string line;
+  for (std::size_t lineNumber = 1; std::getline(is, line); lineNumber++) {
+    std::istringstream iss{line};
+    std::string first;
+    if (!(iss >> first) || first[0] == '#') {
+      continue;
+    }
+    std::istringstream offsetStream{first};
+    std::string::size_type offset;
+    std::uint64_t count;
+    std::string rest;
+    if (!(offsetStream >> offset) || !offsetStream.eof() || !(iss >> count) || (iss >> rest)) {
+      return lineNumber;
+    }
+    profile[offset] += count;
+  }
+  return 0;
+}
+}  // namespace bfc
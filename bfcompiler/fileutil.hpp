@@ -0,0 +1,90 @@
+/*!
+ * @brief ソースファイルの読み込みと生成したバイナリの書き込み
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#ifndef FILEUTIL_HPP
+#define FILEUTIL_HPP
+
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "source.hpp"
+
+
+namespace bfc
+{
+/*!
+ * @brief 指定したファイルと同じディレクトリに作成する一時ファイルのパスを返す
+ *
+ * プロセス内とプロセス間のいずれでも重複しないパスを返す．
+ *
+ * @param [in] filePath  元にするファイルのパス
+ * @return 一時ファイルのパス
+ */
+std::string
+makeTemporaryPath(const std::string& filePath);
+
+
+/*!
+ * @brief ファイルを移動し，移動先に既存のファイルがあれば置き換える
+ *
+ * 失敗した場合は移動元のファイルを削除する．
+ *
+ * @param [in] srcFilePath  移動元のファイルのパス
+ * @param [in] dstFilePath  移動先のファイルのパス
+ * @return 成功した場合は true
+ */
+bool
+replaceFile(const std::string& srcFilePath, const std::string& dstFilePath);
+
+
+/*!
+ * @brief ソースファイルを一定サイズずつ読み込みながら正規化する
+ *
+ * ファイル全体を一度にメモリに載せないので，使用するメモリは命令文字の数にのみ比例する．
+ * 既存の領域を再利用するので，繰り返し呼び出してもメモリ確保が少なく済む．
+ *
+ * @param [in] filePath  読み込むファイルのパス
+ * @param [out] source  正規化したソースコードの格納先
+ * @return 読み込みに成功した場合は true
+ */
+bool
+readSourceFile(const std::string& filePath, NormalizedSource& source);
+
+
+/*!
+ * @brief 生成したバイナリをファイルに書き込む
+ *
+ * 一時ファイルに書き込んでから置き換えるので，既存のファイルの内容が直接書き換えられることはない．
+ *
+ * @param [in] filePath  書き込むファイルのパス
+ * @param [in] image  生成したバイナリ
+ * @param [in] isExecutable  実行可能属性を付与するかどうか
+ * @return 書き込みに成功した場合は true
+ */
+bool
+writeImageFile(const std::string& filePath, const std::vector<std::uint8_t>& image, bool isExecutable);
+
+
+/*!
+ * @brief ループの到達回数のプロファイルを読み込む
+ *
+ * 1行にループ開始の '[' のソースファイル上のオフセットとその '[' に到達した回数を空白区切りで記述する．
+ * 空行と '#' で始まる行は無視し，同じオフセットが複数回現れた場合は回数を合計する．
+ *
+ * @param [in] is  読み込み元ストリーム
+ * @param [out] profile  読み込んだオフセットから到達回数への対応
+ * @return 書式に誤りがあった行の行番号 (誤りが無ければ0)
+ */
+std::size_t
+readLoopProfile(std::istream& is, std::map<std::string::size_type, std::uint64_t>& profile);
+}  // namespace bfc
+
+
+#endif  // FILEUTIL_HPP
@@ -0,0 +1,240 @@
+/*!
+ * @brief Brainf**kのプログラムの中間表現
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "bfcompiler.hpp"
+#include "codebuffer.hpp"
+#include "ir.hpp"
+
+
+namespace bfc
+{
+namespace
+{
+/*!
+ * @brief 符号無し整数を可変長で追加する
+ *
+ * @param [in,out] key  追加先
+ * @param [in] x  追加する値
+ */
+inline void
+appendVarint(std::string& key, std::uint64_t x)
+{
+  for (; x >= 0x80; x >>= 7) {
+    key += static_cast<char>((x & 0x7f) | 0x80);
+  }
+  key += static_cast<char>(x);
+}
+
+
+/*!
+ * @brief 符号付き整数を可変長で追加する
+ *
+ * @param [in,out] key  追加先
+ * @param [in] x  追加する値
+ */
+inline void
+appendSignedVarint(std::string& key, std::int64_t x)
+{
+  // 絶対値の小さい負数も短くなるように zigzag 符号化する
+  appendVarint(key, (static_cast<std::uint64_t>(x) << 1) ^ static_cast<std::uint64_t>(x >> 63));
+}
+}  // namespace
+
+
+void
+buildProgram(const NormalizedSource& normalized, Program& program)
+{
+  const auto& source = normalized.commands;
+  auto& ops = program.ops;
+  ops.clear();
+  program.literals.clear();
+  program.operands.clear();
+  program.subroutines.clear();
+
+  std::size_t loopCount = 0;
+  std::size_t depth = 0;
+  // +-<> の連続の中で到達したセルごとの加算量 (連続をまたいで使い回す)
+  std::vector<int> deltas;
+  for (std::string::size_type i = 0; i < source.size(); i++) {
+    const auto c = source[i];
+    switch (c) {
+      case '>':
+      case '<':
+      case '+':
+      case '-':
+        {
+          // +-<> の連続は，セルごとの正味の加算と正味のポインタ移動にまとめる
+          // 先に連続の終わりと到達するセルの範囲を求め，その範囲の加算量を数える
+          const auto first = i;
+          std::int32_t ptr = 0;
+          std::int32_t minPtr = 0;
+          std::int32_t maxPtr = 0;
+          for (; i < source.size(); i++) {
+            const auto d = source[i];
+            if (d == '>') {
+              maxPtr = std::max(maxPtr, ++ptr);
+            } else if (d == '<') {
+              minPtr = std::min(minPtr, --ptr);
+            } else if (d != '+' && d != '-') {
+              break;
+            }
+          }
+          deltas.assign(static_cast<std::size_t>(maxPtr - minPtr) + 1, 0);
+          auto pos = static_cast<std::size_t>(-minPtr);
+          for (auto j = first; j < i; j++) {
+            switch (source[j]) {
+              case '>':
+                pos++;
+                break;
+              case '<':
+                pos--;
+                break;
+              case '+':
+                deltas[pos]++;
+                break;
+              default:
+                deltas[pos]--;
+                break;
+            }
+          }
+          i--;
+          // セルの位置の昇順に出力する
+          for (std::size_t j = 0; j < deltas.size(); j++) {
+            const auto value = deltas[j] % 256;
+            if (value != 0) {
+              ops.push_back({OpCode::Add, static_cast<std::int32_t>(j) + minPtr, value, 0});
+            }
+          }
+          if (ptr != 0) {
+            ops.push_back({OpCode::Move, 0, ptr, 0});
+          }
+        }
+        break;
+      case '.':
+        ops.push_back({OpCode::Output, 0, 0, 0});
+        break;
+      case ',':
+        ops.push_back({OpCode::Input, 0, 0, 0});
+        break;
+      case '[':
+        // [-] または [+] はゼロ代入にする
+        if (i + 2 < source.size()
+            && (source[i + 1] == '+' || source[i + 1] == '-')
+            && source[i + 2] == ']') {
+          ops.push_back({OpCode::Set, 0, 0, 0});
+          i += 2;
+          loopCount++;
+        } else {
+          ops.push_back({OpCode::LoopBegin, 0, 0, loopCount++});
+          depth++;
+        }
+        break;
+      case ']':
+        if (depth == 0) {
+          throw CompileError{"'[' corresponding to ']' is not found."};
+        }
+        depth--;
+        ops.push_back({OpCode::LoopEnd, 0, 0, 0});
+        break;
+      default:
+        break;
+    }
+  }
+  if (depth != 0) {
+    throw CompileError{"']' corresponding to '[' is not found."};
+  }
+}
+
+
+std::uint8_t
+invertOdd(std::uint8_t x) noexcept
+{
+  // Newton 法の各反復で正しいビット数が倍になる (初期値 x は下位3ビットが正しい)
+  std::uint32_t y = x;
+  for (int i = 0; i < 2; i++) {
+    y *= 2 - x * y;
+  }
+  return static_cast<std::uint8_t>(y);
+}
+
+
+std::optional<std::uint32_t>
+computeTripCount(std::uint8_t control, std::uint8_t step) noexcept
+{
+  if (control == 0) {
+    return 0;
+  }
+  if (step == 0) {
+    return std::nullopt;
+  }
+  // step = 2^k * m (m は奇数)
+  int k = 0;
+  while ((step >> k & 1) == 0) {
+    k++;
+  }
+  if ((control & ((1U << k) - 1)) != 0) {
+    return std::nullopt;
+  }
+  const auto inv = invertOdd(static_cast<std::uint8_t>(0U - (static_cast<std::uint32_t>(step) >> k)));
+  return ((static_cast<std::uint32_t>(control) >> k) * inv) & ((1U << (8 - k)) - 1);
+}
+
+
+std::vector<std::size_t>
+matchLoops(const std::vector<Op>& ops)
+{
+  std::vector<std::size_t> matches(ops.size());
+  std::vector<std::size_t> stack;
+  for (std::size_t i = 0; i < ops.size(); i++) {
+    if (ops[i].code == OpCode::LoopBegin) {
+      stack.push_back(i);
+    } else if (ops[i].code == OpCode::LoopEnd) {
+      matches[i] = stack.back();
+      matches[stack.back()] = i;
+      stack.pop_back();
+    }
+  }
+  return matches;
+}
+
+
+void
+serializeOps(
+  const Program& program,
+  std::size_t first,
+  std::size_t last,
+  std::size_t baseLoopIndex,
+  std::string& key)
+{
+  key.clear();
+  for (auto i = first; i < last; i++) {
+    const auto& op = program.ops[i];
+    key += static_cast<char>(op.code);
+    appendSignedVarint(key, op.offset);
+    appendSignedVarint(key, op.value);
+    if (op.code == OpCode::LoopBegin) {
+      appendVarint(key, op.index - baseLoopIndex);
+    } else if (op.code == OpCode::Call) {
+      appendVarint(key, op.index);
+    } else if (op.code == OpCode::Write || op.code == OpCode::AddVector || op.code == OpCode::SetVector) {
+      key.append(program.literals, op.index, static_cast<std::size_t>(op.value));
+    } else if (op.code == OpCode::AddProduct || op.code == OpCode::MulAddProduct) {
+      const auto nFactors = program.operands[op.index];
+      for (std::int32_t j = 0; j <= nFactors; j++) {
+        appendSignedVarint(key, program.operands[op.index + static_cast<std::size_t>(j)]);
+      }
+    }
+  }
+}
+}  // namespace bfc
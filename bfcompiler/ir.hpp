@@ -0,0 +1,174 @@
+/*!
+ * @brief Brainf**kのプログラムの中間表現
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#ifndef IR_HPP
+#define IR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "bfcompiler.hpp"
+#include "source.hpp"
+
+
+namespace bfc
+{
+/*!
+ * @brief 中間表現の命令の種類
+ */
+enum class OpCode : std::uint8_t
+{
+  //! セル [ptr + offset] に value を加算する
+  Add,
+  //! ポインタに value を加算する
+  Move,
+  //! セル [ptr + offset] に value を代入する
+  Set,
+  //! セル [ptr + offset] の値を出力する
+  Output,
+  //! セル [ptr + offset] に1文字入力する
+  Input,
+  //! Program::literals の [index, index + value) を出力する
+  Write,
+  //! セル [ptr] が0になるまでに value を何回加算するか (反復回数) を求める (0にならない場合は停止しない)
+  TripCount,
+  //! セル [ptr + offset] に直前の TripCount で求めた反復回数と value の積を加算する
+  MulAdd,
+  //! セル [ptr + offset] に value と Program::operands が示すセルの値の積を加算する
+  AddProduct,
+  //! セル [ptr + offset] に直前の TripCount で求めた反復回数と value と Program::operands が示すセルの値の積を加算する
+  MulAddProduct,
+  //! セル [ptr + offset, ptr + offset + value) に Program::literals の [index, index + value) をそれぞれ加算する
+  AddVector,
+  //! セル [ptr + offset, ptr + offset + value) に Program::literals の [index, index + value) をそれぞれ代入する
+  SetVector,
+  //! セル [ptr] が0になるまで，セルに0を代入してポインタに value (1 または -1) を加算することを繰り返す
+  ClearScan,
+  //! セル [ptr] が0になるまで，セル [ptr] の値をセル [ptr + offset] に加算して0にし，ポインタに value (1 または -1) を加算することを繰り返す
+  MoveScan,
+  //! ループの開始 (セル [ptr] が0なら対応する LoopEnd の直後へ進む)
+  LoopBegin,
+  //! ループの終了 (対応する LoopBegin へ戻る．value が0以外なら本体は高々1回しか実行されないので戻らない)
+  LoopEnd,
+  //! index 番目のサブルーチンを呼び出す
+  Call,
+  //! サブルーチンから戻る
+  Return
+};
+
+
+/*!
+ * @brief 中間表現の命令
+ */
+struct Op
+{
+  //! 命令の種類
+  OpCode code;
+  //! 対象のセルのポインタからの相対位置
+  std::int32_t offset;
+  //! 命令ごとの値 (Add: 加算値，Move: 移動量，Set: 代入値，Write: 文字列の長さ，TripCount: 1反復の増分，MulAdd: 係数，
+  //! AddVector, SetVector: セルの数，ClearScan, MoveScan: 移動量，LoopEnd: 戻らないかどうか)
+  std::int32_t value;
+  //! 命令ごとの付加情報 (LoopBegin, TripCount: ソース上で何番目の '[' か，Write, AddVector, SetVector: 文字列の開始位置，
+  //! AddProduct, MulAddProduct: Program::operands 上の開始位置，Call: サブルーチンの番号)
+  std::size_t index;
+};
+
+
+/*!
+ * @brief 中間表現のプログラム
+ *
+ * ループは LoopBegin と LoopEnd の組で表し，命令列は平坦に並べる．
+ * サブルーチンの本体は Return で終わる命令列とし，メインの命令列の後ろに番号順に並べる．
+ */
+struct Program
+{
+  //! 命令列
+  std::vector<Op> ops{};
+  //! Write 命令が出力する文字列と AddVector 命令，SetVector 命令の値の列を連結したもの
+  std::string literals{};
+  //! AddProduct 命令と MulAddProduct 命令が積を取るセルの一覧 (因子の数に続けて各セルのポインタからの相対位置を並べる)
+  std::vector<std::int32_t> operands{};
+  //! 各サブルーチンの本体の命令列上での開始位置 (空でなければ先頭の要素がメインの命令列の終了位置になる)
+  std::vector<std::size_t> subroutines{};
+};
+
+
+/*!
+ * @brief 正規化したソースから中間表現を構築する
+ *
+ * +-<> が混在する連続は，セルごとの正味の加算 (位置の昇順) と1回の正味のポインタ移動にまとめ，[-] と [+] はゼロ代入にする．
+ *
+ * @param [in] source  正規化したソースコード
+ * @param [out] program  構築した中間表現 (元の内容は破棄される)
+ * @throw CompileError  括弧の対応に誤りがある場合
+ */
+void
+buildProgram(const NormalizedSource& source, Program& program);
+
+
+/*!
+ * @brief 256を法とする奇数の逆元を求める
+ *
+ * @param [in] x  奇数
+ * @return x * y ≡ 1 (mod 256) となる y
+ */
+BFC_ATTRIBUTE_CONST std::uint8_t
+invertOdd(std::uint8_t x) noexcept;
+
+
+/*!
+ * @brief セルが0になるまでに増分を何回加算するか (TripCount 命令の結果) を求める
+ *
+ * 増分を 2^k * m (m は奇数) とすると，反復回数は制御セルが 2^k で割り切れる場合にのみ存在し，
+ * 2^(8 - k) を法として m の逆元から一意に定まる．
+ *
+ * @param [in] control  制御セルの値
+ * @param [in] step  1反復あたりの制御セルの増分
+ * @return 反復回数 (0にならない場合は std::nullopt)
+ */
+BFC_ATTRIBUTE_CONST std::optional<std::uint32_t>
+computeTripCount(std::uint8_t control, std::uint8_t step) noexcept;
+
+
+/*!
+ * @brief 各 LoopBegin と LoopEnd に対応する命令の位置を求める
+ *
+ * @param [in] ops  命令列 (括弧の対応が取れていること)
+ * @return 各命令に対応する命令の位置 (ループ以外の命令の要素は不定)
+ */
+std::vector<std::size_t>
+matchLoops(const std::vector<Op>& ops);
+
+
+/*!
+ * @brief 命令列の一部を差分コンパイルのキーとなるバイト列に変換する
+ *
+ * ループの通し番号は baseLoopIndex からの相対値とし，Write 命令，AddVector 命令，SetVector 命令は文字列そのものを含める．
+ * これにより，前方の編集で通し番号や文字列の位置がずれても同じキーになる．
+ * Call 命令はサブルーチンの番号を含める．
+ *
+ * @param [in] program  中間表現
+ * @param [in] first  開始位置
+ * @param [in] last  終了位置 (この位置を含まない)
+ * @param [in] baseLoopIndex  ループの通し番号の基準
+ * @param [out] key  キーの書き込み先 (元の内容は破棄される)
+ */
+void
+serializeOps(
+  const Program& program,
+  std::size_t first,
+  std::size_t last,
+  std::size_t baseLoopIndex,
+  std::string& key);
+}  // namespace bfc
+
+
+#endif  // IR_HPP
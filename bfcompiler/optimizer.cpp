@@ -0,0 +1,1691 @@
+/*!
+ * @brief 中間表現の最適化
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bfcompiler.hpp"
+#include "ir.hpp"
+#include "optimizer.hpp"
+
+
+namespace bfc
+{
+namespace
+{
+//! 開いている Write 命令が無いことを表す位置
+constexpr auto kNoWrite = static_cast<std::size_t>(-1);
+//! コンパイル時に反復を模擬するループの本体の命令数の上限
+constexpr std::size_t kMaxSimulatedLoopSize = 256;
+//! コンパイル時に模擬する反復回数の上限 (制御セルの値は256回の反復のうちに必ず繰り返す)
+constexpr int kMaxSimulatedIterations = 256;
+//! 閉じた形の更新に置き換えるループの入れ子の命令数の上限
+constexpr std::size_t kMaxCollapseSize = 512;
+//! 閉じた形の更新に置き換えるループの入れ子の深さの上限
+constexpr std::size_t kMaxCollapseDepth = 4;
+//! 記号的実行で扱う多項式の項数の上限
+constexpr std::size_t kMaxPolynomialTerms = 64;
+//! 記号的実行で扱う多項式の次数の上限
+constexpr std::size_t kMaxPolynomialDegree = 6;
+//! 記号的実行で反復数を表す変数 (セルの相対位置と重ならない値とする)
+constexpr std::int64_t kIterationVariable = std::int64_t{1} << 40;
+//! AddVector 命令にまとめる加算の数の下限
+constexpr int kMinVectorAddSize = 8;
+//! AddVector 命令の範囲に含めてよい，加算しないセルの連続の長さの上限
+constexpr std::int64_t kMaxVectorAddGap = 2;
+//! SetVector 命令にまとめる代入の数の下限
+constexpr std::ptrdiff_t kMinVectorSetSize = 8;
+//! MoveScan 命令にする移動の距離の上限 (移動先を8bitの変位で参照する)
+constexpr std::int32_t kMaxMoveScanDistance = 64;
+//! サブルーチンにまとめるループの命令数の下限
+constexpr std::size_t kMinOutlineSize = 16;
+//! プロファイルで一度も到達しなかった箇所のループをサブルーチンにまとめる命令数の下限
+constexpr std::size_t kMinColdOutlineSize = 4;
+//! サブルーチンにまとめるループの命令数の上限 (キーの構築がループの入れ子の深さに比例して重くなるのを抑える)
+constexpr std::size_t kMaxOutlineSize = 4096;
+//! プロファイルでこの回数以上到達した箇所は，呼び出しのオーバーヘッドを避けてインラインのまま残す
+constexpr std::uint64_t kMinHotCount = 1024;
+//! ループをサブルーチンにまとめないことを表す番号
+constexpr auto kNoOutline = static_cast<std::size_t>(-1);
+//! 反復回数が分かるループを展開した結果の命令数の上限 (ループ1つあたり)
+constexpr std::size_t kMaxUnrolledLoopSize = 1024;
+//! プログラム全体でループの展開により増やす命令数の上限
+constexpr std::size_t kMaxUnrollGrowth = 1 << 16;
+//! 全て展開できないループを部分的に展開するときの展開数の上限
+constexpr std::size_t kMaxUnrollFactor = 8;
+
+
+/*!
+ * @brief コンパイル時に値が分かっているセルの追跡
+ *
+ * セルの位置は追跡を始めたときのポインタからの相対位置で表す．
+ */
+class KnownTape
+{
+public:
+  /*!
+   * @brief 追跡を始める
+   *
+   * @param [in] isZeroed  全てのセルが0であることが分かっているかどうか
+   */
+  explicit KnownTape(bool isZeroed)
+    : isDefaultZero_{isZeroed}
+    , ptr_{0}
+    , cells_{}
+  {}
+
+  /*!
+   * @brief セルの値を返す
+   *
+   * @param [in] offset  ポインタからの相対位置
+   * @return セルの値 (分からない場合は std::nullopt)
+   */
+  std::optional<std::uint8_t>
+  get(std::int64_t offset) const
+  {
+    if (const auto it = cells_.find(ptr_ + offset); it != cells_.end()) {
+      return it->second;
+    }
+    return isDefaultZero_ ? std::optional<std::uint8_t>{0} : std::nullopt;
+  }
+
+  /*!
+   * @brief セルの値を設定する
+   *
+   * @param [in] offset  ポインタからの相対位置
+   * @param [in] value  セルの値 (分からない場合は std::nullopt)
+   */
+  void
+  set(std::int64_t offset, std::optional<std::uint8_t> value)
+  {
+    if (!value && !isDefaultZero_) {
+      cells_.erase(ptr_ + offset);
+    } else {
+      cells_[ptr_ + offset] = value;
+    }
+  }
+
+  /*!
+   * @brief セルに加算する
+   *
+   * @param [in] offset  ポインタからの相対位置
+   * @param [in] delta  加算する値
+   */
+  void
+  add(std::int64_t offset, std::int32_t delta)
+  {
+    const auto value = get(offset);
+    set(offset, value ? std::optional<std::uint8_t>{static_cast<std::uint8_t>(*value + delta)} : std::nullopt);
+  }
+
+  /*!
+   * @brief ポインタを移動する
+   *
+   * @param [in] delta  移動量
+   */
+  void
+  move(std::int64_t delta) noexcept
+  {
+    ptr_ += delta;
+  }
+
+  /*!
+   * @brief 全てのセルの値を分からないものとする
+   */
+  void
+  forgetAll() noexcept
+  {
+    isDefaultZero_ = false;
+    cells_.clear();
+  }
+
+private:
+  //! 記録していないセルが0であることが分かっているかどうか
+  bool isDefaultZero_;
+  //! 追跡を始めたときからのポインタの移動量
+  std::int64_t ptr_;
+  //! 値を記録したセル
+  std::unordered_map<std::int64_t, std::optional<std::uint8_t>> cells_;
+};
+
+
+/*!
+ * @brief ループの解析結果
+ */
+struct LoopEffect
+{
+  //! 各反復の前後でポインタの位置が変わらないかどうか
+  bool isBalanced = false;
+  //! 本体が内側のループと入出力を含まないかどうか
+  bool isSimple = false;
+  //! 値が変わり得るセルのループ開始時のポインタからの相対位置 (isBalanced のときのみ有効)
+  std::vector<std::int64_t> modifiedCells{};
+};
+
+
+/*!
+ * @brief ループ内で値が変わり得るセルを求める
+ *
+ * @param [in] ops  命令列
+ * @param [in] first  LoopBegin の位置
+ * @param [in] last  対応する LoopEnd の位置
+ * @param [out] effect  解析結果
+ */
+inline void
+analyzeLoop(const std::vector<Op>& ops, std::size_t first, std::size_t last, LoopEffect& effect)
+{
+  effect.isBalanced = false;
+  effect.isSimple = true;
+  effect.modifiedCells.clear();
+  std::int64_t ptr = 0;
+  std::vector<std::int64_t> ptrStack;
+  for (auto i = first + 1; i < last; i++) {
+    const auto& op = ops[i];
+    switch (op.code) {
+      case OpCode::Add:
+      case OpCode::Set:
+        effect.modifiedCells.push_back(ptr + op.offset);
+        break;
+      case OpCode::Input:
+      case OpCode::MulAdd:
+      case OpCode::AddProduct:
+      case OpCode::MulAddProduct:
+        effect.isSimple = false;
+        effect.modifiedCells.push_back(ptr + op.offset);
+        break;
+      case OpCode::AddVector:
+      case OpCode::SetVector:
+        effect.isSimple = false;
+        for (std::int32_t j = 0; j < op.value; j++) {
+          effect.modifiedCells.push_back(ptr + op.offset + j);
+        }
+        break;
+      case OpCode::ClearScan:
+      case OpCode::MoveScan:
+      case OpCode::Call:
+      case OpCode::Return:
+        // 停止位置はセルの値によって変わる
+        effect.isSimple = false;
+        return;
+      case OpCode::Move:
+        ptr += op.value;
+        break;
+      case OpCode::LoopBegin:
+        // 内側のループの終了時に制御セルが0と分かるのは，本体を実行した場合のみである
+        effect.isSimple = false;
+        effect.modifiedCells.push_back(ptr);
+        ptrStack.push_back(ptr);
+        break;
+      case OpCode::LoopEnd:
+        // 内側のループの移動量が釣り合っていなければ，反復回数によって位置が変わる
+        if (ptrStack.back() != ptr) {
+          return;
+        }
+        ptrStack.pop_back();
+        break;
+      case OpCode::Output:
+      case OpCode::Write:
+      case OpCode::TripCount:
+      default:
+        effect.isSimple = false;
+        break;
+    }
+  }
+  effect.isBalanced = ptr == 0;
+}
+
+
+/*!
+ * @brief ループで値が変わり得るセルを分からないものとする
+ *
+ * @param [in,out] tape  セルの値の追跡 (ポインタはループ開始時の位置にあること)
+ * @param [in] effect  ループの解析結果
+ */
+inline void
+forgetLoopCells(KnownTape& tape, const LoopEffect& effect)
+{
+  if (!effect.isBalanced) {
+    tape.forgetAll();
+    return;
+  }
+  for (const auto offset : effect.modifiedCells) {
+    tape.set(offset, std::nullopt);
+  }
+}
+
+
+//! 多項式の単項式 (変数の積．変数はセルの相対位置，または kIterationVariable 以降の反復数を表す記号)
+using Monomial = std::vector<std::int64_t>;
+//! 256を法とする多項式 (係数が0の項は持たない)
+using Polynomial = std::map<Monomial, std::uint8_t>;
+
+
+/*!
+ * @brief 多項式に別の多項式の定数倍を加える
+ *
+ * @param [in,out] p  加算先
+ * @param [in] q  加算する多項式
+ * @param [in] scale  q に掛ける係数
+ */
+inline void
+addPolynomial(Polynomial& p, const Polynomial& q, std::uint8_t scale = 1)
+{
+  for (const auto& [monomial, coef] : q) {
+    auto& c = p[monomial];
+    c = static_cast<std::uint8_t>(c + coef * scale);
+    if (c == 0) {
+      p.erase(monomial);
+    }
+  }
+}
+
+
+/*!
+ * @brief 多項式の積を求める
+ *
+ * @param [in] p  多項式
+ * @param [in] q  多項式
+ * @return p と q の積 (項数または次数が上限を超える場合は std::nullopt)
+ */
+inline std::optional<Polynomial>
+multiplyPolynomial(const Polynomial& p, const Polynomial& q)
+{
+  Polynomial r;
+  for (const auto& [m1, c1] : p) {
+    for (const auto& [m2, c2] : q) {
+      if (m1.size() + m2.size() > kMaxPolynomialDegree) {
+        return std::nullopt;
+      }
+      Monomial m;
+      m.reserve(m1.size() + m2.size());
+      std::merge(m1.begin(), m1.end(), m2.begin(), m2.end(), std::back_inserter(m));
+      addPolynomial(r, {{m, static_cast<std::uint8_t>(c1 * c2)}});
+    }
+  }
+  if (r.size() > kMaxPolynomialTerms) {
+    return std::nullopt;
+  }
+  return r;
+}
+
+
+/*!
+ * @brief ループ開始時の各セルの値を変数とした，テープの記号的な状態
+ */
+struct SymbolicTape
+{
+  //! ループ開始時からのポインタの移動量
+  std::int64_t ptr = 0;
+  //! 値が変わり得るセルの値 (記録していないセルはループ開始時の値のまま)
+  std::map<std::int64_t, Polynomial> cells{};
+
+  /*!
+   * @brief セルの値を返す
+   *
+   * @param [in] offset  ループ開始時のポインタからの相対位置
+   * @return セルの値
+   */
+  Polynomial
+  get(std::int64_t offset) const
+  {
+    if (const auto it = cells.find(offset); it != cells.end()) {
+      return it->second;
+    }
+    return {{{offset}, 1}};
+  }
+};
+
+
+/*!
+ * @brief 2つの状態の各セルの値の差を求める
+ *
+ * @param [in] after  後の状態
+ * @param [in] before  前の状態
+ * @return 各セルの値の差 (差が0のセルは含まない)
+ */
+inline std::map<std::int64_t, Polynomial>
+diffTape(const SymbolicTape& after, const SymbolicTape& before)
+{
+  std::map<std::int64_t, Polynomial> delta;
+  const auto addDiff = [&](std::int64_t offset) {
+    auto d = after.get(offset);
+    addPolynomial(d, before.get(offset), 0xff);
+    if (!d.empty()) {
+      delta.emplace(offset, std::move(d));
+    }
+  };
+  for (const auto& cell : after.cells) {
+    addDiff(cell.first);
+  }
+  for (const auto& cell : before.cells) {
+    if (after.cells.find(cell.first) == after.cells.end()) {
+      addDiff(cell.first);
+    }
+  }
+  return delta;
+}
+
+
+/*!
+ * @brief 状態の各セルに差分の多項式倍を加える
+ *
+ * @param [in,out] tape  状態
+ * @param [in] delta  各セルの値の差分
+ * @param [in] factor  差分に掛ける多項式
+ * @return 成功した場合は true (項数または次数が上限を超える場合は false)
+ */
+inline bool
+addScaledDelta(SymbolicTape& tape, const std::map<std::int64_t, Polynomial>& delta, const Polynomial& factor)
+{
+  for (const auto& [offset, d] : delta) {
+    const auto term = multiplyPolynomial(d, factor);
+    if (!term) {
+      return false;
+    }
+    auto value = tape.get(offset);
+    addPolynomial(value, *term);
+    tape.cells[offset] = std::move(value);
+  }
+  return true;
+}
+
+
+/*!
+ * @brief 2つの状態が全てのセルで等しいかどうかを返す
+ *
+ * @param [in] a  状態
+ * @param [in] b  状態
+ * @return 全てのセルの値が多項式として等しい場合は true
+ */
+inline bool
+isSameTape(const SymbolicTape& a, const SymbolicTape& b)
+{
+  return a.ptr == b.ptr && diffTape(a, b).empty();
+}
+
+
+/*!
+ * @brief ループの入れ子を記号的に実行する
+ *
+ * 各セルの値をループ開始時の値を変数とした256を法とする多項式で表して命令を実行する．
+ * 内側のループは，反復ごとの各セルの増分が一定で (一様)，制御セルの増分が奇数の定数である場合のみ扱える．
+ * このとき反復回数 n は制御セルの値の定数倍となり，ループ後の状態は開始時の状態に増分の n 倍を加えたものになる．
+ */
+class SymbolicExecutor
+{
+public:
+  /*!
+   * @brief 命令列を参照する実行器を構築する
+   *
+   * @param [in] ops  命令列
+   * @param [in] matches  各 LoopBegin と LoopEnd に対応する命令の位置
+   */
+  SymbolicExecutor(const std::vector<Op>& ops, const std::vector<std::size_t>& matches)
+    : ops_{ops}
+    , matches_{matches}
+  {}
+
+  /*!
+   * @brief ループの本体を1反復分実行する
+   *
+   * @param [in] first  LoopBegin の位置
+   * @param [in,out] tape  テープの状態
+   * @param [in] depth  ループのネストの深さ (外側のループは0)
+   * @return 実行できた場合は true
+   */
+  bool
+  executeBody(std::size_t first, SymbolicTape& tape, std::size_t depth) const
+  {
+    for (auto i = first + 1; i < matches_[first]; i++) {
+      const auto& op = ops_[i];
+      switch (op.code) {
+        case OpCode::Add:
+          {
+            auto value = tape.get(tape.ptr + op.offset);
+            addPolynomial(value, {{{}, static_cast<std::uint8_t>(op.value)}});
+            tape.cells[tape.ptr + op.offset] = std::move(value);
+          }
+          break;
+        case OpCode::Set:
+          tape.cells[tape.ptr + op.offset] = op.value == 0
+            ? Polynomial{}
+            : Polynomial{{{}, static_cast<std::uint8_t>(op.value)}};
+          break;
+        case OpCode::Move:
+          tape.ptr += op.value;
+          break;
+        case OpCode::LoopBegin:
+          if (depth + 1 >= kMaxCollapseDepth || !executeLoop(i, tape, depth + 1)) {
+            return false;
+          }
+          i = matches_[i];
+          break;
+        case OpCode::LoopEnd:
+        case OpCode::Output:
+        case OpCode::Input:
+        case OpCode::Write:
+        case OpCode::TripCount:
+        case OpCode::MulAdd:
+        case OpCode::AddProduct:
+        case OpCode::MulAddProduct:
+        case OpCode::AddVector:
+        case OpCode::SetVector:
+        case OpCode::ClearScan:
+        case OpCode::MoveScan:
+        case OpCode::Call:
+        case OpCode::Return:
+        default:
+          return false;
+      }
+    }
+    return true;
+  }
+
+  /*!
+   * @brief 反復ごとの各セルの増分が一定であるかどうかを調べる
+   *
+   * base + k * delta から1反復を実行すると base + (k + 1) * delta になることを，
+   * k を記号として多項式の恒等式で確かめる．
+   *
+   * @param [in] first  LoopBegin の位置
+   * @param [in] base  反復の基準となる状態
+   * @param [in] delta  1反復あたりの各セルの増分
+   * @param [in] depth  ループのネストの深さ
+   * @return 増分が一定である場合は true
+   */
+  bool
+  isUniform(
+    std::size_t first,
+    const SymbolicTape& base,
+    const std::map<std::int64_t, Polynomial>& delta,
+    std::size_t depth) const
+  {
+    const Polynomial k{{{kIterationVariable + static_cast<std::int64_t>(depth)}, 1}};
+    auto tape = base;
+    auto expected = base;
+    if (!addScaledDelta(tape, delta, k) || !addScaledDelta(expected, delta, k)
+        || !addScaledDelta(expected, delta, {{{}, 1}})) {
+      return false;
+    }
+    return executeBody(first, tape, depth) && isSameTape(tape, expected);
+  }
+
+private:
+  /*!
+   * @brief 内側のループを実行する
+   *
+   * @param [in] first  LoopBegin の位置
+   * @param [in,out] tape  テープの状態
+   * @param [in] depth  ループのネストの深さ
+   * @return 実行できた場合は true
+   */
+  bool
+  executeLoop(std::size_t first, SymbolicTape& tape, std::size_t depth) const
+  {
+    auto next = tape;
+    if (!executeBody(first, next, depth) || next.ptr != tape.ptr) {
+      return false;
+    }
+    const auto delta = diffTape(next, tape);
+    const auto it = delta.find(tape.ptr);
+    // 制御セルの増分が奇数の定数でなければ，反復回数を多項式で表せない
+    if (it == delta.end() || it->second.size() != 1 || !it->second.begin()->first.empty()
+        || (it->second.begin()->second & 1) == 0) {
+      return false;
+    }
+    const auto step = it->second.begin()->second;
+    if (!isUniform(first, tape, delta, depth)) {
+      return false;
+    }
+    // n = (制御セルの値) * (-step)^-1
+    auto n = tape.get(tape.ptr);
+    for (auto& term : n) {
+      term.second = static_cast<std::uint8_t>(term.second * invertOdd(static_cast<std::uint8_t>(-step)));
+    }
+    return addScaledDelta(tape, delta, n);
+  }
+
+  //! 命令列
+  const std::vector<Op>& ops_;
+  //! 各 LoopBegin と LoopEnd に対応する命令の位置
+  const std::vector<std::size_t>& matches_;
+};
+
+
+/*!
+ * @brief ループの入れ子を反復回数の多項式による更新に置き換える
+ *
+ * ループ後の各セルの値を x + e0 + n * e1 の形 (x は開始時の値，n は反復回数，e0 と e1 は開始時の各セルの値の多項式) で求める．
+ * 最初の反復の後から増分が一定になるループ (内側のループで一時セルを0に戻すもの等) は，
+ * ループの開始で制御セルが0でない場合のみ実行する形 (1回で終わるループ) にして，n >= 1 を前提に更新する．
+ *
+ * @param [in,out] program  中間表現
+ * @param [in] first  LoopBegin の位置
+ * @param [in] executor  記号的実行器
+ * @param [out] result  置き換えた命令列の追加先
+ * @return 置き換えた場合は true
+ */
+inline bool
+collapseLoopNest(Program& program, std::size_t first, const SymbolicExecutor& executor, std::vector<Op>& result)
+{
+  const auto& loopBegin = program.ops[first];
+  const SymbolicTape entry;
+  auto afterFirst = entry;
+  if (!executor.executeBody(first, afterFirst, 0) || afterFirst.ptr != 0) {
+    return false;
+  }
+  auto delta = diffTape(afterFirst, entry);
+  auto isGuarded = false;
+  std::map<std::int64_t, Polynomial> initialDelta;
+  if (!executor.isUniform(first, entry, delta, 0)) {
+    auto afterSecond = afterFirst;
+    if (!executor.executeBody(first, afterSecond, 0)) {
+      return false;
+    }
+    initialDelta = std::move(delta);
+    delta = diffTape(afterSecond, afterFirst);
+    if (delta[0] != initialDelta[0] || !executor.isUniform(first, afterFirst, delta, 0)) {
+      return false;
+    }
+    isGuarded = true;
+  }
+  const auto& stepPolynomial = delta[0];
+  if (stepPolynomial.size() != 1 || !stepPolynomial.begin()->first.empty()) {
+    return false;
+  }
+  const auto step = stepPolynomial.begin()->second;
+
+  // セルごとの e0 (反復回数に依らない増分) と e1 (反復回数に比例する増分)
+  struct Update
+  {
+    std::int64_t offset;
+    Polynomial e0;
+    Polynomial e1;
+    // 更新後の値が定数になる場合は代入にする
+    bool isSet;
+    std::uint8_t value;
+  };
+  std::map<std::int64_t, Update> updateMap;
+  for (const auto* d : {&initialDelta, &delta}) {
+    for (const auto& cell : *d) {
+      if (cell.first != 0) {
+        updateMap.emplace(cell.first, Update{cell.first, {}, {}, false, 0});
+      }
+    }
+  }
+  std::vector<Update> updates;
+  for (auto& [offset, update] : updateMap) {
+    update.e1 = delta[offset];
+    if (isGuarded) {
+      // x + e0 + n * e1 = (最初の反復後の値) + (n - 1) * delta
+      update.e0 = initialDelta[offset];
+      addPolynomial(update.e0, update.e1, 0xff);
+    }
+    auto finalValue = update.e0;
+    addPolynomial(finalValue, {{{offset}, 1}});
+    if (update.e1.empty() && (finalValue.empty() || (finalValue.size() == 1 && finalValue.begin()->first.empty()))) {
+      update = {offset, {}, {}, true, finalValue.empty() ? std::uint8_t{0} : finalValue.begin()->second};
+    }
+    if (update.isSet || !update.e0.empty() || !update.e1.empty()) {
+      updates.push_back(std::move(update));
+    }
+  }
+
+  // 更新は開始時の値を読むので，あるセルを読む更新はそのセルへの書き込みより先に行う (自身を読む更新は扱わない)
+  const auto reads = [](const Update& update, std::int64_t offset) {
+    const auto contains = [offset](const Polynomial& p) {
+      return std::any_of(p.begin(), p.end(), [offset](const Polynomial::value_type& term) {
+        return std::find(term.first.begin(), term.first.end(), offset) != term.first.end();
+      });
+    };
+    return contains(update.e0) || contains(update.e1);
+  };
+  std::vector<Update> ordered;
+  while (!updates.empty()) {
+    const auto it = std::find_if(updates.begin(), updates.end(), [&](const Update& update) {
+      return std::none_of(updates.begin(), updates.end(), [&](const Update& other) {
+        return reads(other, update.offset);
+      });
+    });
+    if (it == updates.end()) {
+      return false;
+    }
+    ordered.push_back(std::move(*it));
+    updates.erase(it);
+  }
+  for (const auto& update : ordered) {
+    if (update.offset < std::numeric_limits<std::int32_t>::min() || std::numeric_limits<std::int32_t>::max() < update.offset) {
+      return false;
+    }
+    for (const auto* p : {&update.e0, &update.e1}) {
+      for (const auto& term : *p) {
+        if (std::any_of(term.first.begin(), term.first.end(), [](std::int64_t v) { return v >= kIterationVariable; })) {
+          return false;
+        }
+      }
+    }
+  }
+
+  if (isGuarded) {
+    result.push_back(loopBegin);
+  }
+  result.push_back({OpCode::TripCount, 0, step, loopBegin.index});
+  for (const auto& update : ordered) {
+    const auto offset = static_cast<std::int32_t>(update.offset);
+    if (update.isSet) {
+      result.push_back({OpCode::Set, offset, update.value, 0});
+      continue;
+    }
+    for (const auto& [p, isScaled] : {std::make_pair(&update.e0, false), std::make_pair(&update.e1, true)}) {
+      for (const auto& [monomial, coef] : *p) {
+        const auto value = static_cast<std::int8_t>(coef);
+        if (monomial.empty()) {
+          result.push_back({isScaled ? OpCode::MulAdd : OpCode::Add, offset, value, 0});
+          continue;
+        }
+        result.push_back({isScaled ? OpCode::MulAddProduct : OpCode::AddProduct, offset, value, program.operands.size()});
+        program.operands.push_back(static_cast<std::int32_t>(monomial.size()));
+        for (const auto variable : monomial) {
+          program.operands.push_back(static_cast<std::int32_t>(variable));
+        }
+      }
+    }
+  }
+  result.push_back({OpCode::Set, 0, 0, 0});
+  if (isGuarded) {
+    result.push_back({OpCode::LoopEnd, 0, 0, 0});
+  }
+  return true;
+}
+
+
+/*!
+ * @brief ループの入れ子を閉じた形の更新に置き換える
+ *
+ * 内側にループを含むループのうち，記号的に実行して反復回数の多項式で表せるもの
+ * (掛け算の表の a[b[c+d+b-]d[b+d-]a-] 等) をループの無い命令列に置き換える．
+ * 内側にループを含まないループは solveLinearLoops() で扱う．
+ *
+ * @param [in,out] program  中間表現
+ */
+inline void
+collapseLoopNests(Program& program)
+{
+  const auto ops = program.ops;
+  const auto matches = matchLoops(ops);
+  const SymbolicExecutor executor{ops, matches};
+  std::vector<Op> result;
+  result.reserve(ops.size());
+  for (std::size_t i = 0; i < ops.size(); i++) {
+    const auto& op = ops[i];
+    if (op.code == OpCode::LoopBegin && matches[i] - i <= kMaxCollapseSize
+        && std::any_of(
+          ops.begin() + static_cast<std::ptrdiff_t>(i + 1),
+          ops.begin() + static_cast<std::ptrdiff_t>(matches[i]),
+          [](const Op& inner) { return inner.code == OpCode::LoopBegin; })
+        && collapseLoopNest(program, i, executor, result)) {
+      i = matches[i];
+    } else {
+      result.push_back(op);
+    }
+  }
+  program.ops = std::move(result);
+}
+
+
+/*!
+ * @brief 線形なループの本体による各セルの増分を求める
+ *
+ * @param [in] ops  命令列
+ * @param [in] first  LoopBegin の位置
+ * @param [in] last  対応する LoopEnd の位置
+ * @param [out] deltas  ループ開始時のポインタからの相対位置と，1反復あたりの増分の対応
+ * @return 本体が加算と移動のみからなり，各反復の前後でポインタの位置が変わらない場合は true
+ */
+inline bool
+collectLinearDeltas(
+  const std::vector<Op>& ops,
+  std::size_t first,
+  std::size_t last,
+  std::map<std::int32_t, std::uint8_t>& deltas)
+{
+  deltas.clear();
+  std::int64_t ptr = 0;
+  for (auto i = first + 1; i < last; i++) {
+    const auto& op = ops[i];
+    if (op.code == OpCode::Move) {
+      ptr += op.value;
+    } else if (op.code == OpCode::Add) {
+      const auto offset = ptr + op.offset;
+      if (offset < std::numeric_limits<std::int32_t>::min() || std::numeric_limits<std::int32_t>::max() < offset) {
+        return false;
+      }
+      auto& delta = deltas[static_cast<std::int32_t>(offset)];
+      delta = static_cast<std::uint8_t>(delta + op.value);
+    } else {
+      return false;
+    }
+  }
+  return ptr == 0;
+}
+
+
+/*!
+ * @brief 線形なループを反復回数の計算と積和に置き換える
+ *
+ * 本体が加算と移動のみからなり，各反復の前後でポインタの位置が変わらないループでは，
+ * 各セルの増分は反復回数に比例する．制御セルの増分が奇数であれば反復回数は常に存在し，
+ * 偶数であれば制御セルの値によっては停止しない．いずれも TripCount 命令が扱う．
+ * 例えば [->+<] は TripCount(255), MulAdd(1, 1), Set(0, 0) となる．
+ *
+ * @param [in,out] program  中間表現
+ */
+inline void
+solveLinearLoops(Program& program)
+{
+  const auto& ops = program.ops;
+  const auto matches = matchLoops(ops);
+  std::vector<Op> result;
+  result.reserve(ops.size());
+  std::map<std::int32_t, std::uint8_t> deltas;
+  for (std::size_t i = 0; i < ops.size(); i++) {
+    const auto& op = ops[i];
+    if (op.code != OpCode::LoopBegin || !collectLinearDeltas(ops, i, matches[i], deltas)) {
+      result.push_back(op);
+      continue;
+    }
+    const auto step = deltas[0];
+    result.push_back({OpCode::TripCount, 0, step, op.index});
+    // 増分が0のループは制御セルが0のときのみ停止し，そのとき他のセルは変化しない
+    if (step != 0) {
+      for (const auto& [offset, delta] : deltas) {
+        if (offset != 0 && delta != 0) {
+          result.push_back({OpCode::MulAdd, offset, static_cast<std::int8_t>(delta), 0});
+        }
+      }
+    }
+    result.push_back({OpCode::Set, 0, 0, 0});
+    i = matches[i];
+  }
+  program.ops = std::move(result);
+}
+
+
+/*!
+ * @brief 単純なループの反復をコンパイル時に模擬し，ループ後のセルの値を求める
+ *
+ * 本体が加算，代入，移動のみからなるループでは，制御セルの値は制御セル自身の値のみで決まる．
+ * ループが終了しなかった場合，tape のうち本体で値が変わり得るセルの内容は不定となる．
+ *
+ * @param [in,out] tape  セルの値の追跡 (ポインタはループ開始時の位置にあること)
+ * @param [in] ops  命令列
+ * @param [in] first  LoopBegin の位置
+ * @param [in] last  対応する LoopEnd の位置
+ * @return ループが終了した場合は true
+ */
+inline bool
+simulateLoop(KnownTape& tape, const std::vector<Op>& ops, std::size_t first, std::size_t last)
+{
+  for (int n = 0; n < kMaxSimulatedIterations; n++) {
+    const auto control = tape.get(0);
+    if (!control) {
+      return false;
+    }
+    if (*control == 0) {
+      return true;
+    }
+    for (auto i = first + 1; i < last; i++) {
+      const auto& op = ops[i];
+      switch (op.code) {
+        case OpCode::Add:
+          tape.add(op.offset, op.value);
+          break;
+        case OpCode::Set:
+          tape.set(op.offset, static_cast<std::uint8_t>(op.value));
+          break;
+        case OpCode::Move:
+          tape.move(op.value);
+          break;
+        case OpCode::Output:
+        case OpCode::Input:
+        case OpCode::Write:
+        case OpCode::TripCount:
+        case OpCode::MulAdd:
+        case OpCode::AddProduct:
+        case OpCode::MulAddProduct:
+        case OpCode::AddVector:
+        case OpCode::SetVector:
+        case OpCode::ClearScan:
+        case OpCode::MoveScan:
+        case OpCode::LoopBegin:
+        case OpCode::LoopEnd:
+        case OpCode::Call:
+        case OpCode::Return:
+        default:
+          break;
+      }
+    }
+  }
+  return false;
+}
+
+
+/*!
+ * @brief ループの1反復あたりの制御セルの増分を求める
+ *
+ * 制御セルを変更する命令が本体のトップレベルの加算のみであれば，反復回数は制御セルの初期値のみで決まる．
+ *
+ * @param [in] program  中間表現
+ * @param [in] first  LoopBegin の位置
+ * @param [in] last  対応する LoopEnd の位置
+ * @return 制御セルの増分 (制御セルが加算以外で変わり得る場合は std::nullopt)
+ */
+inline std::optional<std::uint8_t>
+getControlStep(const Program& program, std::size_t first, std::size_t last)
+{
+  const auto& ops = program.ops;
+  std::uint8_t step = 0;
+  std::int64_t ptr = 0;
+  std::vector<std::int64_t> ptrStack;
+  for (auto i = first + 1; i < last; i++) {
+    const auto& op = ops[i];
+    const auto pos = ptr + op.offset;
+    switch (op.code) {
+      case OpCode::Add:
+        if (pos == 0) {
+          if (!ptrStack.empty()) {
+            return std::nullopt;
+          }
+          step = static_cast<std::uint8_t>(step + op.value);
+        }
+        break;
+      case OpCode::Set:
+      case OpCode::Input:
+      case OpCode::MulAdd:
+      case OpCode::AddProduct:
+      case OpCode::MulAddProduct:
+        if (pos == 0) {
+          return std::nullopt;
+        }
+        break;
+      case OpCode::AddVector:
+      case OpCode::SetVector:
+        if (pos <= 0 && 0 < pos + op.value) {
+          if (op.code == OpCode::SetVector || !ptrStack.empty()) {
+            return std::nullopt;
+          }
+          step = static_cast<std::uint8_t>(step + program.literals[op.index + static_cast<std::size_t>(-pos)]);
+        }
+        break;
+      case OpCode::Move:
+        ptr += op.value;
+        break;
+      case OpCode::LoopBegin:
+        // 制御セルで始まる内側のループは制御セルを0にする
+        if (ptr == 0) {
+          return std::nullopt;
+        }
+        ptrStack.push_back(ptr);
+        break;
+      case OpCode::LoopEnd:
+        if (ptrStack.back() != ptr) {
+          return std::nullopt;
+        }
+        ptrStack.pop_back();
+        break;
+      case OpCode::ClearScan:
+      case OpCode::MoveScan:
+      case OpCode::Call:
+      case OpCode::Return:
+        return std::nullopt;
+      case OpCode::Output:
+      case OpCode::Write:
+      case OpCode::TripCount:
+      default:
+        break;
+    }
+  }
+  return ptr == 0 ? std::optional<std::uint8_t>{step} : std::nullopt;
+}
+
+
+/*!
+ * @brief 値が分かっているセルの出力を文字列の出力にまとめる
+ *
+ * 先頭からセルの値を追跡し，値が分かっているセルの連続する出力を1つの Write 命令に置き換える．
+ * 間にある加算や移動はそのまま残すので，出力後のテープの状態は変わらない．
+ * ループは終了しない可能性があり，入力は対話的な出力の順序に影響するので，これらをまたいではまとめない．
+ * 制御セルの値が分かっている単純なループ (++++++++[>[-]++<-] 等) は反復を模擬して，ループ後の値の代入に置き換える．
+ * それ以外で反復回数が分かるループは，命令数が予算内であれば全て展開し，収まらなければ反復回数を割り切る数だけ
+ * 本体を複製して比較と分岐の回数を減らす．展開した本体も同様に値を追跡するので，出力もまとめられる．
+ * 反復回数が分かる TripCount 命令は取り除き，続く MulAdd 命令を加算に置き換える．
+ * 併せて，開始時のセルが0と分かっている (一度も実行されない) ループを取り除き，
+ * 停止しないことが分かるループを警告する．
+ *
+ * @param [in,out] program  中間表現
+ * @param [in] isTapeZeroed  開始時に全てのセルが0であることが分かっているかどうか
+ * @param [in] loopSrcOffsets  各 '[' のソース上での位置
+ * @param [in] warningHandler  警告メッセージを受け取る関数
+ */
+inline void
+fuseOutputs(
+  Program& program,
+  bool isTapeZeroed,
+  const std::vector<std::size_t>& loopSrcOffsets,
+  const std::function<void(const std::string&)>& warningHandler)
+{
+  // 展開したループの本体は複製されているので，同じループについては1回だけ警告する
+  std::vector<bool> isWarned(loopSrcOffsets.size());
+  const auto warn = [&](std::size_t loopIndex, const char* message) {
+    if (warningHandler && !isWarned[loopIndex]) {
+      isWarned[loopIndex] = true;
+      warningHandler("Loop at offset " + std::to_string(loopSrcOffsets[loopIndex]) + " " + message);
+    }
+  };
+  const auto& ops = program.ops;
+  const auto matches = matchLoops(ops);
+  std::vector<Op> result;
+  result.reserve(ops.size());
+  std::string literals;
+
+  KnownTape tape{isTapeZeroed};
+  // AddProduct 命令と MulAddProduct 命令が積を取るセルの値が全て分かっていれば，その積を返す
+  const auto getProduct = [&](const Op& op) -> std::optional<std::uint32_t> {
+    std::uint32_t product = 1;
+    const auto nFactors = static_cast<std::size_t>(program.operands[op.index]);
+    for (std::size_t j = 1; j <= nFactors; j++) {
+      const auto value = tape.get(program.operands[op.index + j]);
+      if (!value) {
+        return std::nullopt;
+      }
+      product *= *value;
+    }
+    return product;
+  };
+  std::vector<LoopEffect> loopStack;
+  auto openWrite = kNoWrite;
+  // 直前の TripCount 命令の反復回数がコンパイル時に分かるかどうかと，その値
+  auto isTripCountKnown = false;
+  std::uint32_t tripCount = 0;
+  // ループの展開で増やせる命令数の残り
+  auto unrollBudget = kMaxUnrollGrowth;
+  // 全て展開したループの命令列が値の分かるセルへの加算，代入，移動と文字列の出力のみであれば，
+  // 出力をまとめた Write 命令と各セルの最終的な値の代入に置き換える (ポインタは展開の前後で変わらない)
+  const auto compactUnrolledOps = [&](std::size_t first) {
+    std::map<std::int64_t, std::uint8_t> cells;
+    std::int64_t ptr = 0;
+    for (auto j = first; j < result.size(); j++) {
+      const auto& unrolled = result[j];
+      if (unrolled.code == OpCode::Move) {
+        ptr += unrolled.value;
+      } else if (unrolled.code == OpCode::Add || unrolled.code == OpCode::Set) {
+        const auto value = tape.get(ptr + unrolled.offset);
+        if (!value) {
+          return;
+        }
+        cells[ptr + unrolled.offset] = *value;
+      } else if (unrolled.code != OpCode::Write) {
+        return;
+      }
+    }
+    std::vector<Op> compacted;
+    for (auto j = first; j < result.size(); j++) {
+      const auto& unrolled = result[j];
+      if (unrolled.code != OpCode::Write) {
+        continue;
+      }
+      // 文字列は出力順に literals の末尾へ追加しているので，連続する Write 命令の文字列は隣接している
+      if (!compacted.empty() && compacted.back().index + static_cast<std::size_t>(compacted.back().value) == unrolled.index) {
+        compacted.back().value += unrolled.value;
+      } else {
+        compacted.push_back(unrolled);
+      }
+    }
+    if (openWrite != kNoWrite && openWrite >= first) {
+      openWrite = first + compacted.size() - 1;
+    }
+    for (const auto& [offset, value] : cells) {
+      compacted.push_back({OpCode::Set, static_cast<std::int32_t>(offset), value, 0});
+    }
+    result.resize(first);
+    result.insert(result.end(), compacted.begin(), compacted.end());
+  };
+  // i 番目の命令を処理し，次に処理する命令の位置を返す (展開したループの本体は再帰的に処理する)
+  const auto process = [&](const auto& self, std::size_t i) -> std::size_t {
+    const auto& op = ops[i];
+    switch (op.code) {
+      case OpCode::Add:
+        tape.add(op.offset, op.value);
+        result.push_back(op);
+        break;
+      case OpCode::Move:
+        tape.move(op.value);
+        result.push_back(op);
+        break;
+      case OpCode::Set:
+        tape.set(op.offset, static_cast<std::uint8_t>(op.value));
+        result.push_back(op);
+        break;
+      case OpCode::Output:
+        if (const auto value = tape.get(op.offset); value) {
+          if (openWrite == kNoWrite) {
+            openWrite = result.size();
+            result.push_back({OpCode::Write, 0, 0, literals.size()});
+          }
+          literals += static_cast<char>(*value);
+          result[openWrite].value++;
+        } else {
+          openWrite = kNoWrite;
+          result.push_back(op);
+        }
+        break;
+      case OpCode::Input:
+        openWrite = kNoWrite;
+        tape.set(op.offset, std::nullopt);
+        result.push_back(op);
+        break;
+      case OpCode::Write:
+        openWrite = kNoWrite;
+        result.push_back({OpCode::Write, 0, op.value, literals.size()});
+        literals.append(program.literals, op.index, static_cast<std::size_t>(op.value));
+        break;
+      case OpCode::AddVector:
+        for (std::int32_t j = 0; j < op.value; j++) {
+          tape.add(op.offset + j, static_cast<std::uint8_t>(program.literals[op.index + static_cast<std::size_t>(j)]));
+        }
+        result.push_back({OpCode::AddVector, op.offset, op.value, literals.size()});
+        literals.append(program.literals, op.index, static_cast<std::size_t>(op.value));
+        break;
+      case OpCode::SetVector:
+        for (std::int32_t j = 0; j < op.value; j++) {
+          tape.set(op.offset + j, static_cast<std::uint8_t>(program.literals[op.index + static_cast<std::size_t>(j)]));
+        }
+        result.push_back({OpCode::SetVector, op.offset, op.value, literals.size()});
+        literals.append(program.literals, op.index, static_cast<std::size_t>(op.value));
+        break;
+      case OpCode::Call:
+      case OpCode::Return:
+        openWrite = kNoWrite;
+        tape.forgetAll();
+        result.push_back(op);
+        break;
+      case OpCode::ClearScan:
+      case OpCode::MoveScan:
+        openWrite = kNoWrite;
+        if (tape.get(0) == 0) {
+          break;
+        }
+        // 停止位置が分からないので，以降のセルの位置は停止位置からの相対位置になる
+        tape.forgetAll();
+        tape.set(0, 0);
+        result.push_back(op);
+        break;
+      case OpCode::TripCount:
+        isTripCountKnown = false;
+        if (const auto control = tape.get(0); control) {
+          if (const auto n = computeTripCount(*control, static_cast<std::uint8_t>(op.value)); n) {
+            isTripCountKnown = true;
+            tripCount = *n;
+            break;
+          }
+          warn(op.index, "never terminates");
+        } else if (op.value == 0) {
+          warn(op.index, "never terminates once entered");
+        }
+        // 停止しない可能性があるので，後続の出力とはまとめない
+        openWrite = kNoWrite;
+        result.push_back(op);
+        break;
+      case OpCode::MulAdd:
+        if (isTripCountKnown) {
+          const auto value = static_cast<std::uint8_t>(tripCount * static_cast<std::uint32_t>(op.value));
+          if (value != 0) {
+            tape.add(op.offset, value);
+            result.push_back({OpCode::Add, op.offset, value, 0});
+          }
+        } else {
+          tape.set(op.offset, std::nullopt);
+          result.push_back(op);
+        }
+        break;
+      case OpCode::AddProduct:
+      case OpCode::MulAddProduct:
+        if (const auto product = getProduct(op); product && (op.code == OpCode::AddProduct || isTripCountKnown)) {
+          const auto value = static_cast<std::uint8_t>(
+            *product * static_cast<std::uint32_t>(op.value) * (op.code == OpCode::AddProduct ? 1U : tripCount));
+          if (value != 0) {
+            tape.add(op.offset, value);
+            result.push_back({OpCode::Add, op.offset, value, 0});
+          }
+        } else {
+          tape.set(op.offset, std::nullopt);
+          result.push_back(op);
+        }
+        break;
+      case OpCode::LoopBegin:
+        // 一度も実行されないループと展開したループは出力の結合を妨げない
+        if (tape.get(0) == 0) {
+          i = matches[i];
+          break;
+        }
+        loopStack.emplace_back();
+        analyzeLoop(ops, i, matches[i], loopStack.back());
+        if (loopStack.back().isBalanced && loopStack.back().isSimple && matches[i] - i <= kMaxSimulatedLoopSize) {
+          if (simulateLoop(tape, ops, i, matches[i])) {
+            auto& cells = loopStack.back().modifiedCells;
+            std::sort(cells.begin(), cells.end());
+            cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+            if (std::all_of(cells.begin(), cells.end(), [&tape](std::int64_t offset) { return tape.get(offset).has_value(); })) {
+              // 本体が変更するセルの値が全て分かれば，ループを代入に置き換える
+              for (const auto offset : cells) {
+                result.push_back({OpCode::Set, static_cast<std::int32_t>(offset), *tape.get(offset), 0});
+              }
+            } else {
+              // ループ自体はそのまま残す
+              openWrite = kNoWrite;
+              result.insert(
+                result.end(),
+                ops.begin() + static_cast<std::ptrdiff_t>(i),
+                ops.begin() + static_cast<std::ptrdiff_t>(matches[i] + 1));
+            }
+            loopStack.pop_back();
+            i = matches[i];
+            break;
+          }
+        }
+        if (const auto control = tape.get(0); control) {
+          const auto step = getControlStep(program, i, matches[i]);
+          const auto n = step ? computeTripCount(*control, *step) : std::nullopt;
+          const auto bodySize = matches[i] - i - 1;
+          const auto limit = std::min(kMaxUnrolledLoopSize, unrollBudget);
+          if (n && *n * bodySize <= limit) {
+            // 全て展開する (比較と分岐は残らない)
+            unrollBudget -= *n * bodySize;
+            loopStack.pop_back();
+            const auto unrolledFirst = result.size();
+            for (std::uint32_t k = 0; k < *n; k++) {
+              for (auto j = i + 1; j < matches[i];) {
+                j = self(self, j);
+              }
+            }
+            compactUnrolledOps(unrolledFirst);
+            i = matches[i];
+            break;
+          }
+          // 反復回数を割り切る数だけ本体を複製すれば，複製の途中で制御セルが0になることはない
+          auto factor = n ? std::min(kMaxUnrollFactor, limit / std::max<std::size_t>(bodySize, 1)) : 0;
+          while (factor > 1 && *n % factor != 0) {
+            factor--;
+          }
+          if (factor > 1) {
+            unrollBudget -= (factor - 1) * bodySize;
+            openWrite = kNoWrite;
+            forgetLoopCells(tape, loopStack.back());
+            result.push_back(op);
+            for (std::size_t k = 0; k < factor; k++) {
+              for (auto j = i + 1; j < matches[i];) {
+                j = self(self, j);
+              }
+            }
+            // LoopEnd も処理する
+            i = self(self, matches[i]) - 1;
+            break;
+          }
+        }
+        openWrite = kNoWrite;
+        forgetLoopCells(tape, loopStack.back());
+        result.push_back(op);
+        break;
+      case OpCode::LoopEnd:
+        openWrite = kNoWrite;
+        forgetLoopCells(tape, loopStack.back());
+        loopStack.pop_back();
+        tape.set(0, 0);
+        result.push_back(op);
+        break;
+      default:
+        result.push_back(op);
+        break;
+    }
+    return i + 1;
+  };
+  for (std::size_t i = 0; i < ops.size();) {
+    i = process(process, i);
+  }
+  program.ops = std::move(result);
+  program.literals = std::move(literals);
+}
+
+
+/*!
+ * @brief ポインタの移動を後続の命令の相対位置に畳み込む
+ *
+ * 直線的な命令列ではポインタを動かさずに相対位置でセルを参照し，移動はまとめて1回にする．
+ * ループの境界，反復回数の計算 ([ptr] を参照する)，入出力 (ポインタの位置で入出力する) の直前では移動を確定させる．
+ *
+ * @param [in,out] program  中間表現
+ */
+inline void
+foldPointerMoves(Program& program)
+{
+  std::vector<Op> result;
+  result.reserve(program.ops.size());
+  std::int64_t ptr = 0;
+  const auto flush = [&]() {
+    if (ptr != 0) {
+      result.push_back({OpCode::Move, 0, static_cast<std::int32_t>(ptr), 0});
+      ptr = 0;
+    }
+  };
+  // 相対位置が32bitに収まるように，移動量が大きくなったら確定させる
+  const auto rebase = [&](std::int64_t offset) {
+    return offset + ptr < std::numeric_limits<std::int32_t>::min() / 2
+      || std::numeric_limits<std::int32_t>::max() / 2 < offset + ptr;
+  };
+  for (auto op : program.ops) {
+    switch (op.code) {
+      case OpCode::Move:
+        if (rebase(op.value)) {
+          flush();
+        }
+        ptr += op.value;
+        break;
+      case OpCode::Add:
+      case OpCode::Set:
+      case OpCode::MulAdd:
+      case OpCode::AddVector:
+      case OpCode::SetVector:
+        if (rebase(op.offset)) {
+          flush();
+        }
+        op.offset = static_cast<std::int32_t>(op.offset + ptr);
+        result.push_back(op);
+        break;
+      case OpCode::AddProduct:
+      case OpCode::MulAddProduct:
+        {
+          const auto first = program.operands.begin() + static_cast<std::ptrdiff_t>(op.index + 1);
+          const auto last = first + program.operands[op.index];
+          if (rebase(op.offset) || std::any_of(first, last, rebase)) {
+            flush();
+          }
+          op.offset = static_cast<std::int32_t>(op.offset + ptr);
+          for (auto it = first; it != last; ++it) {
+            *it = static_cast<std::int32_t>(*it + ptr);
+          }
+          result.push_back(op);
+        }
+        break;
+      case OpCode::Write:
+        result.push_back(op);
+        break;
+      case OpCode::Output:
+      case OpCode::Input:
+      case OpCode::TripCount:
+      case OpCode::ClearScan:
+      case OpCode::MoveScan:
+      case OpCode::LoopBegin:
+      case OpCode::LoopEnd:
+      case OpCode::Call:
+      case OpCode::Return:
+      default:
+        flush();
+        result.push_back(op);
+        break;
+    }
+  }
+  flush();
+  program.ops = std::move(result);
+}
+
+
+/*!
+ * @brief 0のセルを探しながらセルを処理するループを ClearScan 命令と MoveScan 命令に置き換える
+ *
+ * [[-]>] と [[-]<] は ClearScan 命令に，セルの値を既に通過した側へ移す [[-<+>]>] と [[->+<]<] 等は MoveScan 命令にする．
+ * ポインタの移動は foldPointerMoves() で畳み込まれていること．
+ *
+ * @param [in,out] program  中間表現
+ */
+inline void
+recognizeScanLoops(Program& program)
+{
+  const auto& ops = program.ops;
+  const auto isOp = [&](std::size_t i, OpCode code, std::int32_t offset, std::int32_t value) {
+    return i < ops.size() && ops[i].code == code && ops[i].offset == offset && ops[i].value == value;
+  };
+  // ループの本体の最後にある，1セルの移動と LoopEnd の移動量 (該当しなければ0)
+  const auto getStep = [&](std::size_t i) {
+    if (i + 1 < ops.size() && ops[i].code == OpCode::Move && (ops[i].value == 1 || ops[i].value == -1)
+        && ops[i + 1].code == OpCode::LoopEnd) {
+      return ops[i].value;
+    }
+    return 0;
+  };
+  std::vector<Op> result;
+  result.reserve(ops.size());
+  for (std::size_t i = 0; i < ops.size(); i++) {
+    if (ops[i].code == OpCode::LoopBegin && isOp(i + 1, OpCode::Set, 0, 0) && getStep(i + 2) != 0) {
+      result.push_back({OpCode::ClearScan, 0, ops[i + 2].value, 0});
+      i += 3;
+      continue;
+    }
+    // [-<+>] は solveLinearLoops() で TripCount(255), MulAdd(-1, 1), Set(0, 0) になっている
+    if (ops[i].code == OpCode::LoopBegin && isOp(i + 1, OpCode::TripCount, 0, 0xff) && i + 2 < ops.size()
+        && ops[i + 2].code == OpCode::MulAdd && ops[i + 2].value == 1 && isOp(i + 3, OpCode::Set, 0, 0)) {
+      const auto target = ops[i + 2].offset;
+      const auto step = getStep(i + 4);
+      if (step != 0 && target * step < 0 && -kMaxMoveScanDistance <= target && target <= kMaxMoveScanDistance) {
+        result.push_back({OpCode::MoveScan, target, step, 0});
+        i += 5;
+        continue;
+      }
+    }
+    result.push_back(ops[i]);
+  }
+  program.ops = std::move(result);
+}
+
+
+/*!
+ * @brief ループの本体が終了時に制御セルを必ず0にするかどうかを調べる
+ *
+ * 内側のループは終了時に自身の制御セルが0になるので，ループの制御セルと同じ位置で始まる内側のループの後も0と分かる．
+ *
+ * @param [in] program  中間表現
+ * @param [in] matches  各 LoopBegin と LoopEnd に対応する命令の位置
+ * @param [in] first  LoopBegin の位置
+ * @return 本体の終わりでポインタが開始時の位置に戻り，制御セルが0になっている場合は true
+ */
+inline bool
+isIfLoop(const Program& program, const std::vector<std::size_t>& matches, std::size_t first)
+{
+  const auto& ops = program.ops;
+  std::int64_t ptr = 0;
+  auto isZeroed = false;
+  LoopEffect effect;
+  for (auto i = first + 1; i < matches[first]; i++) {
+    const auto& op = ops[i];
+    const auto position = ptr + op.offset;
+    switch (op.code) {
+      case OpCode::Move:
+        ptr += op.value;
+        break;
+      case OpCode::Add:
+      case OpCode::Input:
+      case OpCode::MulAdd:
+      case OpCode::AddProduct:
+      case OpCode::MulAddProduct:
+        if (position == 0) {
+          isZeroed = false;
+        }
+        break;
+      case OpCode::Set:
+        if (position == 0) {
+          isZeroed = op.value == 0;
+        }
+        break;
+      case OpCode::AddVector:
+      case OpCode::SetVector:
+        if (position <= 0 && 0 < position + op.value) {
+          isZeroed = op.code == OpCode::SetVector && program.literals[op.index + static_cast<std::size_t>(-position)] == '\0';
+        }
+        break;
+      case OpCode::LoopBegin:
+        analyzeLoop(ops, i, matches[i], effect);
+        if (!effect.isBalanced) {
+          return false;
+        }
+        if (std::find(effect.modifiedCells.begin(), effect.modifiedCells.end(), -ptr) != effect.modifiedCells.end()) {
+          isZeroed = false;
+        }
+        if (ptr == 0) {
+          isZeroed = true;
+        }
+        i = matches[i];
+        break;
+      case OpCode::ClearScan:
+      case OpCode::MoveScan:
+      case OpCode::Call:
+      case OpCode::Return:
+        return false;
+      case OpCode::Output:
+      case OpCode::Write:
+      case OpCode::TripCount:
+      case OpCode::LoopEnd:
+      default:
+        break;
+    }
+  }
+  return ptr == 0 && isZeroed;
+}
+
+
+/*!
+ * @brief 本体を高々1回しか実行しないループに印を付ける
+ *
+ * [ ... [-]] のように本体の終わりで制御セルが必ず0になるループは，LoopEnd の value を1にして後方へのジャンプを省く．
+ * 内側の条件分岐も同様に扱うので，入れ子の条件分岐はいずれも前方への条件ジャンプのみになる．
+ *
+ * @param [in,out] program  中間表現
+ */
+inline void
+markIfLoops(Program& program)
+{
+  const auto matches = matchLoops(program.ops);
+  for (std::size_t i = 0; i < program.ops.size(); i++) {
+    if (program.ops[i].code == OpCode::LoopBegin && isIfLoop(program, matches, i)) {
+      program.ops[matches[i]].value = 1;
+    }
+  }
+}
+
+
+/*!
+ * @brief 同じ命令列のループをサブルーチンにまとめる
+ *
+ * ポインタの移動は foldPointerMoves() で畳み込まれ，ループの本体はループ開始時のポインタからの相対位置で表されているので，
+ * 命令列が同じループはポインタの位置によらず同じコードになる．
+ * そのようなループが2箇所以上にあれば，本体を1つのサブルーチンにして各箇所を Call 命令に置き換える．
+ * サブルーチンの中の同じループも再帰的にまとめる．
+ *
+ * 箇所ごとに，ループの命令数が kMinOutlineSize 以上であればサブルーチンにする．
+ * プロファイルがある場合，kMinHotCount 回以上到達した箇所は呼び出しのオーバーヘッドを避けてインラインのまま残し，
+ * 一度も到達しなかった箇所は kMinColdOutlineSize 以上であればサブルーチンにする．
+ *
+ * @param [in,out] program  中間表現
+ * @param [in] loopSrcOffsets  各 '[' のソース上での位置
+ * @param [in] loopProfile  各 '[' のソース上での位置から到達回数への対応 (空のときはプロファイルを用いない)
+ */
+inline void
+outlineLoops(
+  Program& program,
+  const std::vector<std::size_t>& loopSrcOffsets,
+  const std::map<std::string::size_type, std::uint64_t>& loopProfile)
+{
+  const auto& ops = program.ops;
+  const auto matches = matchLoops(ops);
+  // 箇所ごとにサブルーチンにするかどうかを判定する
+  const auto isOutlinable = [&](std::size_t first) {
+    const auto size = matches[first] - first + 1;
+    if (size > kMaxOutlineSize) {
+      return false;
+    }
+    if (loopProfile.empty()) {
+      return size >= kMinOutlineSize;
+    }
+    const auto it = loopProfile.find(loopSrcOffsets[ops[first].index]);
+    const auto count = it == loopProfile.end() ? 0 : it->second;
+    if (count == 0) {
+      return size >= kMinColdOutlineSize;
+    }
+    return count < kMinHotCount && size >= kMinOutlineSize;
+  };
+
+  // 各 LoopBegin の位置に，命令列が同じループに共通の番号を付ける
+  std::unordered_map<std::string, std::size_t> groupIndices;
+  std::vector<std::size_t> groups(ops.size(), kNoOutline);
+  std::vector<std::size_t> groupCounts;
+  std::string key;
+  for (std::size_t i = 0; i < ops.size(); i++) {
+    if (ops[i].code != OpCode::LoopBegin || !isOutlinable(i)) {
+      continue;
+    }
+    serializeOps(program, i, matches[i] + 1, ops[i].index, key);
+    const auto [it, isInserted] = groupIndices.try_emplace(key, groupCounts.size());
+    if (isInserted) {
+      groupCounts.push_back(0);
+    }
+    groupCounts[it->second]++;
+    groups[i] = it->second;
+  }
+  if (std::none_of(groupCounts.begin(), groupCounts.end(), [](std::size_t count) { return count >= 2; })) {
+    return;
+  }
+
+  // 各番号のサブルーチンの番号と本体
+  std::vector<std::size_t> subroutineIndices(groupCounts.size(), kNoOutline);
+  std::vector<std::vector<Op>> bodies;
+  std::function<void(std::size_t, std::size_t, std::vector<Op>&)> rewrite
+    = [&](std::size_t first, std::size_t last, std::vector<Op>& result) {
+    for (auto i = first; i < last; i++) {
+      const auto group = groups[i];
+      if (group == kNoOutline || groupCounts[group] < 2) {
+        result.push_back(ops[i]);
+        continue;
+      }
+      if (subroutineIndices[group] == kNoOutline) {
+        subroutineIndices[group] = bodies.size();
+        bodies.emplace_back();
+        std::vector<Op> body{ops[i]};
+        rewrite(i + 1, matches[i], body);
+        body.push_back(ops[matches[i]]);
+        body.push_back({OpCode::Return, 0, 0, 0});
+        bodies[subroutineIndices[group]] = std::move(body);
+      }
+      result.push_back({OpCode::Call, 0, 0, subroutineIndices[group]});
+      i = matches[i];
+    }
+  };
+  std::vector<Op> result;
+  rewrite(0, ops.size(), result);
+  for (auto& body : bodies) {
+    program.subroutines.push_back(result.size());
+    result.insert(result.end(), body.begin(), body.end());
+  }
+  program.ops = std::move(result);
+}
+
+
+/*!
+ * @brief 隣接するセルへの定数の加算と代入をベクトル命令にまとめる
+ *
+ * 加算と代入のみが続く区間では，同じセルへの命令をまとめると各命令は互いに独立になる．
+ * 加算するセルが連続する (間に触れないセルを少し挟んでもよい) 範囲は，加算値の列を1つの AddVector 命令で加算し，
+ * 代入するセルが連続する範囲 ([-]>[-]>[-] 等) は，代入値の列を1つの SetVector 命令で代入する．
+ * ポインタの移動は foldPointerMoves() で畳み込まれていること．
+ *
+ * @param [in,out] program  中間表現
+ */
+inline void
+vectorizeCellUpdates(Program& program)
+{
+  const auto& ops = program.ops;
+  std::vector<Op> result;
+  result.reserve(ops.size());
+  // 区間内の各セルへの効果 (代入かどうかと値)
+  std::map<std::int32_t, std::pair<bool, std::uint8_t>> effects;
+  const auto flush = [&]() {
+    auto it = effects.begin();
+    while (it != effects.end()) {
+      if (it->second.first) {
+        // 代入するセルが連続する範囲を求める
+        auto last = std::next(it);
+        while (last != effects.end() && last->second.first
+               && static_cast<std::int64_t>(last->first) == std::int64_t{std::prev(last)->first} + 1) {
+          ++last;
+        }
+        const auto size = std::distance(it, last);
+        if (size < kMinVectorSetSize) {
+          for (; it != last; ++it) {
+            result.push_back({OpCode::Set, it->first, it->second.second, 0});
+          }
+          continue;
+        }
+        result.push_back({OpCode::SetVector, it->first, static_cast<std::int32_t>(size), program.literals.size()});
+        for (; it != last; ++it) {
+          program.literals += static_cast<char>(it->second.second);
+        }
+        continue;
+      }
+      // 代入を含まず，加算しないセルの隙間が小さい範囲を求める
+      auto last = std::next(it);
+      auto nAdds = 1;
+      for (auto prev = it; last != effects.end() && !last->second.first
+           && static_cast<std::int64_t>(last->first) - prev->first <= kMaxVectorAddGap + 1; prev = last++) {
+        nAdds++;
+      }
+      const auto first = it->first;
+      const auto size = static_cast<std::int64_t>(std::prev(last)->first) - first + 1;
+      if (nAdds < kMinVectorAddSize) {
+        for (; it != last; ++it) {
+          result.push_back({OpCode::Add, it->first, static_cast<std::int8_t>(it->second.second), 0});
+        }
+        continue;
+      }
+      result.push_back({OpCode::AddVector, first, static_cast<std::int32_t>(size), program.literals.size()});
+      program.literals.append(static_cast<std::size_t>(size), '\0');
+      for (; it != last; ++it) {
+        program.literals[result.back().index + static_cast<std::size_t>(it->first - first)] = static_cast<char>(it->second.second);
+      }
+    }
+    effects.clear();
+  };
+  for (const auto& op : ops) {
+    if (op.code == OpCode::Add) {
+      auto& effect = effects[op.offset];
+      effect.second = static_cast<std::uint8_t>(effect.second + op.value);
+      if (!effect.first && effect.second == 0) {
+        effects.erase(op.offset);
+      }
+    } else if (op.code == OpCode::Set) {
+      effects[op.offset] = {true, static_cast<std::uint8_t>(op.value)};
+    } else {
+      flush();
+      result.push_back(op);
+    }
+  }
+  flush();
+  program.ops = std::move(result);
+}
+}  // namespace
+
+
+void
+optimizeProgram(Program& program, const NormalizedSource& source, const Options& options)
+{
+  collapseLoopNests(program);
+  solveLinearLoops(program);
+  // オブジェクトファイルのテープは呼び出し側が用意するので，初期値を仮定できない
+  fuseOutputs(program, !options.isObject, source.loopSrcOffsets, options.warningHandler);
+  foldPointerMoves(program);
+  recognizeScanLoops(program);
+  vectorizeCellUpdates(program);
+  markIfLoops(program);
+  outlineLoops(program, source.loopSrcOffsets, options.loopProfile);
+}
+}  // namespace bfc
@@ -0,0 +1,31 @@
+/*!
+ * @brief 中間表現の最適化
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+
+#include "bfcompiler.hpp"
+#include "ir.hpp"
+
+
+namespace bfc
+{
+/*!
+ * @brief 中間表現を最適化する
+ *
+ * プログラム全体を先頭から順に解析するので，断片に分割する前に1スレッドで行う．
+ *
+ * @param [in,out] program  中間表現
+ * @param [in] source  中間表現の元にした正規化したソース (警告の位置に用いる)
+ * @param [in] options  コンパイルオプション
+ */
+void
+optimizeProgram(Program& program, const NormalizedSource& source, const Options& options);
+}  // namespace bfc
+
+
+#endif  // OPTIMIZER_HPP
@@ -0,0 +1,604 @@
+/*!
+ * @brief Simple Brainf**k Compiler for PE (x64 / x86)
+ *
+ * x64 と x86 の PE は構造体の型や一部の定数，関数の呼び出し規約が異なるだけなので，
+ * PeTraits で違いを与えて1つのテンプレートから両方を生成する．
+ * 命令のコメントは x64 / x86 の順に併記する．
+ *
+ * @author  koturn
+ * @date    2020 05/31
+ * @version 1.0
+ */
+#include <cstdint>
+#include <ctime>
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <stack>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifndef WIN32_LEAN_AND_MEAN
+#  define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#  define NOMINMAX
+#endif
+#include <windows.h>
+
+#include "bfcompiler.hpp"
+#include "codebuffer.hpp"
+#include "x86encoder.hpp"
+
+
+namespace bfc
+{
+namespace
+{
+//! .textのアドレス
+constexpr ::DWORD kBaseAddr = 0x00400000;
+//! パディング含むPE headerのサイズ
+constexpr ::DWORD kPeHeaderSizeWithPadding = 0x0200;
+//! パディング含む.idataのサイズ
+constexpr ::DWORD kIdataSizeWithPadding = 0x0200;
+//! DOSスタブ
+constexpr char kDosStub[] =
+  "\x0e"  // push cs
+  "\x1f"  // pop ds
+  "\xba\x0e\x00"  // mov dx, 0x000e (Offset to message data from here)
+  "\xb4\x09"  // mov ah, 0x09 (Argument for int 0x21: print)
+  "\xcd\x21"  // int 0x21
+  "\xb8\x01\x4c"  // mov ax, 0x4c01 (Argument for int 0x21: exit)
+  "\xcd\x21"  // int 0x21
+  "This program cannot be run in DOS mode.\r\r\n$\x00\x00\x00\x00\x00\x00";
+
+//! インポートするDLLの名前
+constexpr char kDllName[] = "msvcrt.dll\0\0\0\0\0";
+//! putcharの関数名
+constexpr char kPutcharName[] = "putchar";
+//! getcharの関数名
+constexpr char kGetcharName[] = "getchar";
+//! exitの関数名
+constexpr char kExitName[] = "exit\0\0\0";
+//! コードのアラインメント
+constexpr std::size_t kCodeAlignment = 0x1000;
+
+
+/*!
+ * @brief 命令を実行するモードごとの PE の型と定数
+ *
+ * @tparam kMode  命令を実行するモード
+ */
+template <x86::Mode kMode>
+struct PeTraits;
+
+
+/*!
+ * @brief x64 PE の型と定数
+ */
+template <>
+struct PeTraits<x86::Mode::Bits64>
+{
+  //! オプショナルヘッダ
+  using OptionalHeader = ::IMAGE_OPTIONAL_HEADER64;
+  //! インポート名テーブルとインポートアドレステーブルの要素
+  using ThunkData = ::IMAGE_THUNK_DATA64;
+  //! インポートアドレステーブルに書き込まれる関数のアドレス
+  using FunctionAddress = ::ULONGLONG;
+
+  //! ターゲットのマシン
+  static constexpr ::WORD kMachine = IMAGE_FILE_MACHINE_AMD64;  // 0x8664
+  //! オプショナルヘッダのマジックナンバー
+  static constexpr ::WORD kMagic = IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+  //! ファイルの特性
+  static constexpr ::WORD kCharacteristics = IMAGE_FILE_RELOCS_STRIPPED
+    | IMAGE_FILE_EXECUTABLE_IMAGE
+    | IMAGE_FILE_LINE_NUMS_STRIPPED
+    | IMAGE_FILE_LOCAL_SYMS_STRIPPED
+    | IMAGE_FILE_DEBUG_STRIPPED;
+  //! リンカのマイナーバージョン (14.26は5/31現在のMSVCの最新のリンカのバージョン)
+  static constexpr ::BYTE kMinorLinkerVersion = 26;
+  //! サブシステムのメジャーバージョン (6.0はWindows Vistaを示す)
+  static constexpr ::WORD kMajorSubsystemVersion = 6;
+
+  //! 現在のセルを指すレジスタ
+  static constexpr x86::Reg kCellReg = x86::kRbx;
+  //! putchar() のアドレスを保持するレジスタ
+  static constexpr x86::Reg kPutcharReg = x86::kRsi;
+  //! getchar() のアドレスを保持するレジスタ
+  static constexpr x86::Reg kGetcharReg = x86::kRdi;
+  //! 関数のアドレスのサイズ
+  static constexpr x86::Size kAddressSize = x86::Size::Qword;
+};
+
+
+/*!
+ * @brief x86 PE の型と定数
+ */
+template <>
+struct PeTraits<x86::Mode::Bits32>
+{
+  //! オプショナルヘッダ
+  using OptionalHeader = ::IMAGE_OPTIONAL_HEADER32;
+  //! インポート名テーブルとインポートアドレステーブルの要素
+  using ThunkData = ::IMAGE_THUNK_DATA32;
+  //! インポートアドレステーブルに書き込まれる関数のアドレス
+  using FunctionAddress = ::DWORD;
+
+  //! ターゲットのマシン
+  static constexpr ::WORD kMachine = IMAGE_FILE_MACHINE_I386;  // 0x014c
+  //! オプショナルヘッダのマジックナンバー
+  static constexpr ::WORD kMagic = IMAGE_NT_OPTIONAL_HDR32_MAGIC;
+  //! ファイルの特性
+  static constexpr ::WORD kCharacteristics = IMAGE_FILE_RELOCS_STRIPPED
+    | IMAGE_FILE_EXECUTABLE_IMAGE
+    | IMAGE_FILE_LINE_NUMS_STRIPPED
+    | IMAGE_FILE_LOCAL_SYMS_STRIPPED
+    | IMAGE_FILE_32BIT_MACHINE
+    | IMAGE_FILE_DEBUG_STRIPPED;
+  //! リンカのマイナーバージョン
+  static constexpr ::BYTE kMinorLinkerVersion = 0;
+  //! サブシステムのメジャーバージョン (4.0はWindows 95 / NT 4.0を示す)
+  static constexpr ::WORD kMajorSubsystemVersion = 4;
+
+  //! 現在のセルを指すレジスタ
+  static constexpr x86::Reg kCellReg = x86::kEbx;
+  //! putchar() のアドレスを保持するレジスタ
+  static constexpr x86::Reg kPutcharReg = x86::kEsi;
+  //! getchar() のアドレスを保持するレジスタ
+  static constexpr x86::Reg kGetcharReg = x86::kEdi;
+  //! 関数のアドレスのサイズ
+  static constexpr x86::Size kAddressSize = x86::Size::Dword;
+};
+
+
+/*!
+ * @brief ヘッダを書き込んだ後に埋める，コード中の絶対アドレスの位置
+ */
+struct AddressFixups
+{
+  //! putchar() のインポートアドレステーブルの要素のアドレス
+  std::size_t putcharPos;
+  //! getchar() のインポートアドレステーブルの要素のアドレス
+  std::size_t getcharPos;
+  //! exit() のインポートアドレステーブルの要素のアドレス
+  std::size_t exitPos;
+  //! .bss のアドレス
+  std::size_t bssPos;
+};
+
+
+/*!
+ * @brief アラインメントを考慮したサイズを計算する
+ *
+ * @tparam U サイズの型（整数型であること）
+ * @tparam V アラインメントの型（整数型であること）
+ * @param [in] size  元のサイズ
+ * @param [in] alignment  アラインメント
+ * @return アラインメントを考慮したサイズ
+ */
+template <
+  typename U,
+  typename V
+>
+inline constexpr U
+calcAlignedSize(U size, V alignment) noexcept
+{
+  static_assert(std::is_integral<U>::value, "[calcAlignedSize] The first template parameter must be an integral");
+  static_assert(std::is_integral<V>::value, "[calcAlignedSize] The second template parameter must be an integral");
+  return static_cast<U>(alignment * ((size + alignment - 1) / alignment));
+}
+
+
+/*!
+ * @brief ヘッダ部分の書き込みを行う
+ *
+ * @tparam kMode  命令を実行するモード
+ * @param [in] buf  書き込み先バッファ
+ * @param [in] codeSize  コード部分のサイズ (byte単位)
+ * @param [in] fixups  コード中の絶対アドレスの位置
+ */
+template <x86::Mode kMode>
+inline void
+writeHeader(CodeBuffer& buf, std::size_t codeSize, const AddressFixups& fixups)
+{
+  using Traits = PeTraits<kMode>;
+  const auto codeSizeWithPadding = calcAlignedSize(codeSize, kCodeAlignment);
+
+  // Write DOS header
+  ::IMAGE_DOS_HEADER idh;
+  idh.e_magic = IMAGE_DOS_SIGNATURE;
+  idh.e_cblp = 0x0090;
+  idh.e_cp = 0x0003;
+  idh.e_crlc = 0x0000;
+  idh.e_cparhdr = 0x0004;
+  idh.e_minalloc = 0x0000;
+  idh.e_maxalloc = 0xffff;
+  idh.e_ss = 0x0000;
+  idh.e_sp = 0x00b8;
+  idh.e_csum = 0x0000;
+  idh.e_ip = 0x0000;
+  idh.e_cs = 0x0000;
+  idh.e_lfarlc = 0x0040;
+  idh.e_ovno = 0x0000;
+  std::fill(std::begin(idh.e_res), std::end(idh.e_res), 0x0000);
+  idh.e_oemid = 0x0000;
+  idh.e_oeminfo = 0x0000;
+  std::fill(std::begin(idh.e_res2), std::end(idh.e_res2), 0x0000);
+  idh.e_lfanew = 0x00000080;
+  writeAs(buf, idh);
+
+  // Write DOS stub
+  writeAs(buf, kDosStub);
+
+  writeAs<::DWORD>(buf, IMAGE_NT_SIGNATURE);
+
+  const auto ts = std::time(nullptr);
+
+  // Write image file header
+  ::IMAGE_FILE_HEADER ifh;
+  ifh.Machine = Traits::kMachine;
+  ifh.NumberOfSections = 3;
+  // 格好をつけるためにタイムスタンプを入れているが，0でもよい
+  ifh.TimeDateStamp = ts;
+  ifh.PointerToSymbolTable = 0;
+  ifh.NumberOfSymbols = 0;
+  ifh.SizeOfOptionalHeader = sizeof(typename Traits::OptionalHeader);
+  ifh.Characteristics = Traits::kCharacteristics;
+  writeAs(buf, ifh);
+
+  typename Traits::OptionalHeader ioh;
+  ioh.Magic = Traits::kMagic;
+  // 値は0でもよい
+  ioh.MajorLinkerVersion = 14;
+  ioh.MinorLinkerVersion = Traits::kMinorLinkerVersion;
+  ioh.SizeOfCode = codeSize;
+  ioh.SizeOfInitializedData = 0;
+  ioh.SizeOfUninitializedData = 65536;
+  ioh.AddressOfEntryPoint = 0x1000;
+  ioh.BaseOfCode = 0x1000;
+  if constexpr (kMode == x86::Mode::Bits32) {
+    ioh.BaseOfData = ioh.BaseOfCode + codeSizeWithPadding + 0x1000;
+  }
+  ioh.ImageBase = kBaseAddr;
+  ioh.SectionAlignment = 0x1000;
+  ioh.FileAlignment = 0x0200;
+  // 値は0でもよい
+  // 6.0はWindows Vistaを示す
+  ioh.MajorOperatingSystemVersion = 6;
+  ioh.MinorOperatingSystemVersion = 0;
+  ioh.MajorImageVersion = 0;
+  ioh.MinorImageVersion = 0;
+  // 値は0でもよい
+  ioh.MajorSubsystemVersion = Traits::kMajorSubsystemVersion;
+  ioh.MinorSubsystemVersion = 0;
+  ioh.Win32VersionValue = 0;  // Not used. Always 0
+  ioh.SizeOfImage = 0x10000 + codeSizeWithPadding + ioh.SectionAlignment * 2;
+  ioh.SizeOfHeaders = kPeHeaderSizeWithPadding;
+  ioh.CheckSum = 0;
+  ioh.Subsystem = IMAGE_SUBSYSTEM_WINDOWS_CUI;
+  ioh.DllCharacteristics = 0;
+  ioh.SizeOfStackReserve = 1024 * 1024;
+  ioh.SizeOfStackCommit = 8 * 1024;
+  ioh.SizeOfHeapReserve = 1024 * 1024;
+  ioh.SizeOfHeapCommit = 4 * 1024;
+  ioh.LoaderFlags = 0;
+  ioh.NumberOfRvaAndSizes = 16;
+  std::fill(std::begin(ioh.DataDirectory), std::end(ioh.DataDirectory), ::IMAGE_DATA_DIRECTORY{0, 0});
+  ioh.DataDirectory[1].VirtualAddress = ioh.BaseOfCode + codeSizeWithPadding;  // import table
+  ioh.DataDirectory[1].Size = 100;
+  writeAs(buf, ioh);
+
+  // .text section
+  ::IMAGE_SECTION_HEADER ishText;
+  std::copy_n(".text\0\0", sizeof(ishText.Name), ishText.Name);
+  ishText.Misc.VirtualSize = codeSize;
+  ishText.VirtualAddress = ioh.BaseOfCode;
+  ishText.SizeOfRawData = codeSize;
+  ishText.PointerToRawData = kPeHeaderSizeWithPadding + kIdataSizeWithPadding;
+  ishText.PointerToRelocations = 0x00000000;
+  ishText.PointerToLinenumbers = 0x00000000;
+  ishText.NumberOfRelocations = 0x0000;
+  ishText.NumberOfLinenumbers = 0x0000;
+  ishText.Characteristics = IMAGE_SCN_CNT_CODE
+    | IMAGE_SCN_ALIGN_16BYTES
+    | IMAGE_SCN_MEM_EXECUTE
+    | IMAGE_SCN_MEM_READ;
+  writeAs(buf, ishText);
+
+  // .idata section
+  ::IMAGE_SECTION_HEADER ishIdata;
+  std::copy_n(".idata\0", sizeof(ishIdata.Name), ishIdata.Name);
+  ishIdata.Misc.VirtualSize = 100;
+  ishIdata.VirtualAddress = ishText.VirtualAddress + codeSizeWithPadding;
+  ishIdata.SizeOfRawData = 512;
+  ishIdata.PointerToRawData = kPeHeaderSizeWithPadding;
+  ishIdata.PointerToRelocations = 0x00000000;
+  ishIdata.PointerToLinenumbers = 0x00000000;
+  ishIdata.NumberOfRelocations = 0x0000;
+  ishIdata.NumberOfLinenumbers = 0x00000;
+  ishIdata.Characteristics = IMAGE_SCN_CNT_INITIALIZED_DATA
+    | IMAGE_SCN_ALIGN_4BYTES
+    | IMAGE_SCN_MEM_READ;
+  writeAs(buf, ishIdata);
+
+  // .bss section
+  ::IMAGE_SECTION_HEADER ishBss;
+  std::copy_n(".bss\0\0\0", sizeof(ishBss.Name), ishBss.Name);
+  ishBss.Misc.VirtualSize = 65536;
+  ishBss.VirtualAddress = ishIdata.VirtualAddress + ioh.SectionAlignment;
+  ishBss.SizeOfRawData = 0;
+  ishBss.PointerToRawData = 0;
+  ishBss.PointerToRelocations = 0x00000000;
+  ishBss.PointerToLinenumbers = 0x00000000;
+  ishBss.NumberOfRelocations = 0x0000;
+  ishBss.NumberOfLinenumbers = 0x00000;
+  ishBss.Characteristics = IMAGE_SCN_CNT_UNINITIALIZED_DATA
+    | IMAGE_SCN_ALIGN_8BYTES
+    | IMAGE_SCN_MEM_READ
+    | IMAGE_SCN_MEM_WRITE;
+  writeAs(buf, ishBss);
+
+  buf.seek(kPeHeaderSizeWithPadding);
+
+  std::array<::IMAGE_IMPORT_DESCRIPTOR, 2> iids;
+  std::array<typename Traits::ThunkData, 4> itdInts;
+
+  iids[0].OriginalFirstThunk = static_cast<::DWORD>(ishIdata.VirtualAddress + sizeof(iids));  // int
+  iids[0].TimeDateStamp = ts;
+  iids[0].ForwarderChain = 0x00000000;
+  iids[0].Name = static_cast<::DWORD>(iids[0].OriginalFirstThunk + sizeof(itdInts));  // msvcrt.dll
+  iids[0].FirstThunk = iids[0].Name + 16;  // iat
+  iids[1].Characteristics = 0x00000000;
+  iids[1].TimeDateStamp = ts;
+  iids[1].ForwarderChain = 0x00000000;
+  iids[1].Name = 0x00000000;
+  iids[1].FirstThunk = 0x00000000;
+  writeAs(buf, iids);
+
+  itdInts[0].u1.AddressOfData = ishIdata.VirtualAddress + sizeof(iids) + sizeof(kDllName) + sizeof(itdInts) * 2;  // putchar
+  itdInts[1].u1.AddressOfData = itdInts[0].u1.AddressOfData + sizeof(::WORD) + sizeof(kPutcharName);  // getchar
+  itdInts[2].u1.AddressOfData = itdInts[1].u1.AddressOfData + sizeof(::WORD) + sizeof(kGetcharName);  // exit
+  itdInts[3].u1.AddressOfData = 0x00000000;
+  writeAs(buf, itdInts);  // write INT (Import Name Table)
+  writeAs(buf, kDllName);
+  writeAs(buf, itdInts);  // IAT (Import Address Table) is same as INT
+
+  writeAs<::WORD>(buf, 0x0000);
+  writeAs(buf, kPutcharName);
+  writeAs<::WORD>(buf, 0x0000);
+  writeAs(buf, kGetcharName);
+  writeAs<::WORD>(buf, 0x0000);
+  writeAs(buf, kExitName);
+
+  constexpr auto kFunctionAddressSize = sizeof(typename Traits::FunctionAddress);
+  // Fill putchar() address
+  buf.seek(fixups.putcharPos);
+  writeAs<std::uint32_t>(buf, static_cast<std::uint32_t>(ioh.ImageBase + iids[0].FirstThunk));
+  // Fill getchar() address
+  buf.seek(fixups.getcharPos);
+  writeAs<std::uint32_t>(buf, static_cast<std::uint32_t>(ioh.ImageBase + iids[0].FirstThunk + kFunctionAddressSize));
+  // Fill exit() address
+  buf.seek(fixups.exitPos);
+  writeAs<std::uint32_t>(buf, static_cast<std::uint32_t>(ioh.ImageBase + iids[0].FirstThunk + kFunctionAddressSize * 2));
+  // Fill .bss address
+  buf.seek(fixups.bssPos);
+  writeAs<std::uint32_t>(buf, static_cast<std::uint32_t>(ioh.ImageBase + ishBss.VirtualAddress));
+}
+
+
+/*!
+ * @brief PE にコンパイルする
+ *
+ * @tparam kMode  命令を実行するモード
+ * @param [in] normalized  正規化したBrainf**kのソースコード
+ * @param [out] image  生成したバイナリの書き込み先 (元の内容は破棄される)
+ * @throw CompileError  ソースコードに誤りがある場合
+ */
+template <x86::Mode kMode>
+inline void
+compilePe(const NormalizedSource& normalized, std::vector<std::uint8_t>& image)
+{
+  using Traits = PeTraits<kMode>;
+  constexpr auto kCell = Traits::kCellReg;
+  constexpr auto kIs64 = kMode == x86::Mode::Bits64;
+
+  CodeBuffer buf{image};
+  x86::Encoder<kMode> enc{buf};
+  AddressFixups fixups{};
+
+  // ヘッダ部分は一旦飛ばす（後に書き込む）
+  buf.seek(kPeHeaderSizeWithPadding + kIdataSizeWithPadding);
+
+  if constexpr (kIs64) {
+    // push rsi
+    // push rdi
+    // push rbp
+    enc.push(x86::kRsi);
+    enc.push(x86::kRdi);
+    enc.push(x86::kRbp);
+  }
+  // mov rsi, ds:{0x********} / mov esi, ds:{0x********}  # putchar() address
+  enc.mov(Traits::kPutcharReg, x86::absolutePtr(Traits::kAddressSize, 0x00000000));  // Fill later
+  fixups.putcharPos = buf.tell() - sizeof(std::uint32_t);
+  // mov rdi, ds:{0x********} / mov edi, ds:{0x********}  # getchar() address
+  enc.mov(Traits::kGetcharReg, x86::absolutePtr(Traits::kAddressSize, 0x00000000));  // Fill later
+  fixups.getcharPos = buf.tell() - sizeof(std::uint32_t);
+  // mov rbx, {0x********} / mov ebx, {0x********}  # .bss address
+  fixups.bssPos = enc.movImm32(kCell);  // Fill later
+
+  // 連続文字のカウント等を楽にするために予めBrainfuckに関係しない文字を取り除いてある
+  const auto& source = normalized.commands;
+
+  // ループの先頭と je の変位の位置
+  std::stack<std::pair<std::size_t, std::size_t>> loopStack;
+  for (std::string::size_type i = 0; i < source.size(); i++) {
+    switch (source[i]) {
+      case '>':
+      case '<':
+        {
+          std::string::size_type length;
+          const auto delta = countNetChars(source, '>', '<', i, length);
+          i += length - 1;
+          if (delta == 1) {
+            // inc rbx / inc ebx
+            enc.inc(kCell);
+          } else if (delta == -1) {
+            // dec rbx / dec ebx
+            enc.dec(kCell);
+          } else if (delta > 0) {
+            // add rbx, {delta} / add ebx, {delta}
+            enc.add(kCell, delta);
+          } else if (delta < 0) {
+            // sub rbx, {-delta} / sub ebx, {-delta}
+            enc.sub(kCell, -delta);
+          }
+        }
+        break;
+      case '+':
+      case '-':
+        {
+          std::string::size_type length;
+          const auto delta = countNetChars(source, '+', '-', i, length);
+          i += length - 1;
+          // 256を法とした正味の増分 (0なら何もしない)
+          const auto cnt = static_cast<std::uint8_t>(delta);
+          if (cnt == 1) {
+            // inc byte ptr [rbx] / inc byte ptr [ebx]
+            enc.inc(x86::bytePtr(kCell));
+          } else if (cnt == 0xff) {
+            // dec byte ptr [rbx] / dec byte ptr [ebx]
+            enc.dec(x86::bytePtr(kCell));
+          } else if (cnt != 0) {
+            // add byte ptr [rbx], {cnt} / add byte ptr [ebx], {cnt}
+            enc.add(x86::bytePtr(kCell), cnt);
+          }
+        }
+        break;
+      case '.':
+        if constexpr (kIs64) {
+          // mov rcx, qword ptr [rbx]
+          enc.mov(x86::kRcx, x86::ptr(x86::Size::Qword, kCell));
+          // sub rsp, 0x20
+          enc.sub(x86::kRsp, 0x20);
+          // call rsi
+          enc.call(Traits::kPutcharReg);
+          // add rsp, 0x20
+          enc.add(x86::kRsp, 0x20);
+        } else {
+          // push dword ptr [ebx]
+          enc.push(x86::ptr(x86::Size::Dword, kCell));
+          // call esi (putchar)
+          enc.call(Traits::kPutcharReg);
+          // pop eax
+          enc.pop(x86::kEax);
+        }
+        break;
+      case ',':
+        if constexpr (kIs64) {
+          // sub rsp, 0x20
+          enc.sub(x86::kRsp, 0x20);
+          // call rdi
+          enc.call(Traits::kGetcharReg);
+          // add rsp, 0x20
+          enc.add(x86::kRsp, 0x20);
+        } else {
+          // call edi (getchar)
+          enc.call(Traits::kGetcharReg);
+        }
+        // mov byte ptr [rbx], al / mov byte ptr [ebx], al
+        enc.mov(x86::bytePtr(kCell), x86::kAl);
+        break;
+      case '[':
+        // [-] または [+] はゼロ代入にする
+        if (i + 2 < source.size()
+            && (source[i + 1] == '+' || source[i + 1] == '-')
+            && source[i + 2] == ']') {
+          // mov byte ptr [rbx], 0x00 / mov byte ptr [ebx], 0x00
+          enc.mov(x86::bytePtr(kCell), 0x00);
+          i += 2;
+        } else {
+          const auto pos = buf.tell();
+          // cmp byte ptr [rbx], 0x00 / cmp byte ptr [ebx], 0x00
+          enc.cmp(x86::bytePtr(kCell), 0x00);
+          // je 0x********
+          loopStack.emplace(pos, enc.jccNear(x86::Cond::E));
+        }
+        break;
+      case ']':
+        if (loopStack.empty()) {
+          throw CompileError{"'[' corresponding to ']' is not found."};
+        }
+        {
+          const auto [pos, jumpPos] = loopStack.top();
+          // jmp {pos}  # 届くなら short jump にする
+          enc.jmp(pos);
+          // fill loop start
+          enc.patchRel32(jumpPos, buf.tell());
+          loopStack.pop();
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  if (!loopStack.empty()) {
+    throw CompileError{"']' corresponding to '[' is not found."};
+  }
+
+  if constexpr (kIs64) {
+    // pop rbp
+    // pop rdi
+    // pop rsi
+    enc.pop(x86::kRbp);
+    enc.pop(x86::kRdi);
+    enc.pop(x86::kRsi);
+    // xor ecx, ecx
+    enc.alu(x86::AluOp::Xor, x86::kEcx, x86::kEcx);
+  }
+  // mov rsi, ds:{0x********} / mov esi, ds:{0x********}  # exit
+  enc.mov(Traits::kPutcharReg, x86::absolutePtr(Traits::kAddressSize, 0x00000000));  // Fill later
+  fixups.exitPos = buf.tell() - sizeof(std::uint32_t);
+  if constexpr (kIs64) {
+    // sub rsp, 0x20
+    enc.sub(x86::kRsp, 0x20);
+    // call rsi
+    enc.call(Traits::kPutcharReg);
+  } else {
+    // push 0x00
+    enc.push(0x00);
+    // call esi (exit)
+    enc.call(Traits::kPutcharReg);
+  }
+
+  const auto codeSize = buf.tell() - (kPeHeaderSizeWithPadding + kIdataSizeWithPadding);
+  const auto codeSizeWithPadding = calcAlignedSize(codeSize, kCodeAlignment);
+  // Write padding
+  buf.seek(buf.tell() + codeSizeWithPadding - codeSize - 1);
+  writeAs<std::uint8_t>(buf, 0x00);
+
+  // Write header
+  buf.seek(0);
+  writeHeader<kMode>(buf, codeSize, fixups);
+}
+
+}  // namespace
+
+
+void
+compilePeX64(const NormalizedSource& normalized, const Options& /* options */, std::vector<std::uint8_t>& image)
+{
+  compilePe<x86::Mode::Bits64>(normalized, image);
+}
+
+
+void
+compilePeX86(const NormalizedSource& normalized, const Options& /* options */, std::vector<std::uint8_t>& image)
+{
+  compilePe<x86::Mode::Bits32>(normalized, image);
+}
+}  // namespace bfc
@@ -0,0 +1,196 @@
+/*!
+ * @brief 生成した実行ファイルの実行
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#  include <process.h>
+#else
+#  include <spawn.h>
+#  include <sys/wait.h>
+#  include <unistd.h>
+#endif  // _WIN32
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#endif  // __linux__
+
+#include "fileutil.hpp"
+#include "process.hpp"
+
+
+namespace bfc
+{
+namespace
+{
+#ifndef _WIN32
+/*!
+ * @brief 子プロセスの終了を待ち，終了ステータスを返す
+ *
+ * @param [in] pid  子プロセスのプロセスID
+ * @return 終了ステータス (シグナルで終了した場合は 128 + シグナル番号，待てなかった場合は -1)
+ */
+inline int
+waitProcess(pid_t pid) noexcept
+{
+  int status;
+  while (::waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  }
+  if (WIFSIGNALED(status)) {
+    return 128 + WTERMSIG(status);
+  }
+  return -1;
+}
+#endif  // _WIN32
+
+
+#ifdef __linux__
+/*!
+ * @brief 実行可能な memfd を作成する
+ *
+ * @return memfd のファイルディスクリプタ (作成できなかった場合は -1)
+ */
+inline int
+createExecutableMemoryFile() noexcept
+{
+#ifdef MFD_EXEC
+  // vm.memfd_noexec が設定されたカーネルでは，MFD_EXEC を指定しないと実行できない memfd になる
+  if (const auto fd = ::memfd_create("a.out", MFD_CLOEXEC | MFD_EXEC); fd != -1 || errno != EINVAL) {
+    return fd;
+  }
+  // MFD_EXEC を知らない古いカーネルは EINVAL を返す
+#endif  // MFD_EXEC
+  return ::memfd_create("a.out", MFD_CLOEXEC);
+}
+
+
+/*!
+ * @brief memfd に実行ファイルの内容を書き込み，fexecve で実行する
+ *
+ * 子プロセスは fexecve に失敗すると errno を close-on-exec のパイプに書き込むので，
+ * 起動できなかったことと実行したプログラムが127で終了したことを区別できる．
+ *
+ * @param [in] fd  memfd のファイルディスクリプタ
+ * @param [in] image  実行ファイルの内容
+ * @param [out] status  終了ステータス (シグナルで終了した場合は 128 + シグナル番号，待てなかった場合は -1)
+ * @return 起動できた場合は true
+ */
+inline bool
+runMemoryFile(int fd, const std::vector<std::uint8_t>& image, int& status)
+{
+  for (std::size_t offset = 0; offset < image.size();) {
+    const auto n = ::write(fd, image.data() + offset, image.size() - offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    offset += static_cast<std::size_t>(n);
+  }
+
+  int errorPipe[2];
+  if (::pipe2(errorPipe, O_CLOEXEC) == -1) {
+    return false;
+  }
+  char* const argv[] = {const_cast<char*>("a.out"), nullptr};
+  const auto pid = ::fork();
+  if (pid == -1) {
+    ::close(errorPipe[0]);
+    ::close(errorPipe[1]);
+    return false;
+  }
+  if (pid == 0) {
+    ::close(errorPipe[0]);
+    ::fexecve(fd, argv, environ);
+    const auto error = errno;
+    static_cast<void>(::write(errorPipe[1], &error, sizeof(error)));
+    ::_exit(127);
+  }
+  ::close(errorPipe[1]);
+
+  // 実行に成功するとパイプが閉じられて EOF になる
+  int error;
+  ::ssize_t n;
+  while ((n = ::read(errorPipe[0], &error, sizeof(error))) == -1 && errno == EINTR) {
+  }
+  ::close(errorPipe[0]);
+  status = waitProcess(pid);
+  return n != static_cast<::ssize_t>(sizeof(error));
+}
+#endif  // __linux__
+
+
+/*!
+ * @brief 一時ファイルに実行ファイルの内容を書き込んで実行し，終了後に削除する
+ *
+ * @param [in] image  実行ファイルの内容
+ * @return 終了ステータス (シグナルで終了した場合は 128 + シグナル番号，起動できなかった場合は -1)
+ */
+inline int
+runTemporaryFile(const std::vector<std::uint8_t>& image)
+{
+  std::error_code ec;
+  const auto dir = std::filesystem::temp_directory_path(ec);
+  if (ec) {
+    return -1;
+  }
+  const auto filePath = makeTemporaryPath((dir / "bfcompiler").string());
+  if (!writeImageFile(filePath, image, true)) {
+    return -1;
+  }
+  const auto status = runExecutable(filePath);
+  std::filesystem::remove(filePath, ec);
+  return status;
+}
+}  // namespace
+
+
+int
+runExecutable(const std::string& filePath)
+{
+#ifdef _WIN32
+  return static_cast<int>(::_spawnl(_P_WAIT, filePath.c_str(), filePath.c_str(), nullptr));
+#else
+  char* const argv[] = {const_cast<char*>(filePath.c_str()), nullptr};
+  pid_t pid;
+  if (::posix_spawn(&pid, filePath.c_str(), nullptr, nullptr, argv, environ) != 0) {
+    return -1;
+  }
+  return waitProcess(pid);
+#endif  // _WIN32
+}
+
+
+int
+runImage(const std::vector<std::uint8_t>& image)
+{
+#ifdef __linux__
+  if (const auto fd = createExecutableMemoryFile(); fd != -1) {
+    int status;
+    const auto isStarted = runMemoryFile(fd, image, status);
+    ::close(fd);
+    if (isStarted) {
+      return status;
+    }
+  }
+  // memfd を作成できない古いカーネルや，memfd の実行が禁止されている環境では一時ファイルを用いる
+#endif  // __linux__
+  return runTemporaryFile(image);
+}
+}  // namespace bfc
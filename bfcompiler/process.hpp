@@ -0,0 +1,44 @@
+/*!
+ * @brief 生成した実行ファイルの実行
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#ifndef PROCESS_HPP
+#define PROCESS_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace bfc
+{
+/*!
+ * @brief 実行ファイルをシェルを介さずに実行し，終了を待つ
+ *
+ * パスはコマンドの検索パスから探索せず，そのまま用いる．
+ *
+ * @param [in] filePath  実行ファイルのパス
+ * @return 終了ステータス (シグナルで終了した場合は 128 + シグナル番号，起動できなかった場合は -1)
+ */
+int
+runExecutable(const std::string& filePath);
+
+
+/*!
+ * @brief メモリ上の実行ファイルをファイルに書き出さずに実行し，終了を待つ
+ *
+ * Linux では memfd に書き込んで fexecve で実行する．memfd から起動できない場合やそれ以外の環境では，
+ * 一時ファイルに書き込んで実行し，終了後に削除する．
+ *
+ * @param [in] image  実行ファイルの内容
+ * @return 終了ステータス (シグナルで終了した場合は 128 + シグナル番号，起動できなかった場合は -1)
+ */
+int
+runImage(const std::vector<std::uint8_t>& image);
+}  // namespace bfc
+
+
+#endif  // PROCESS_HPP
@@ -0,0 +1,163 @@
+/*!
+ * @brief コンパイルサーバとクライアントの間の通信規約
+ *
+ * 1つの接続で複数の要求を順に送ってよい．各要求は RequestHeader，出力ファイルのパス，
+ * ソースコードの順に送り，サーバは ResponseHeader とペイロード (生成したバイナリまたは診断メッセージ) を返す．
+ * 成功した場合は，ペイロードに続けて改行区切りの警告メッセージを返す．
+ * 同じ計算機上での通信のみを想定しているので，整数はネイティブのバイトオーダーで送る．
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+#include <unistd.h>
+
+
+namespace bfc
+{
+//! 要求の先頭に置く識別子 ("BFC1")
+constexpr std::uint32_t kProtocolMagic = 0x31434642;
+//! 出力ファイルのパスの長さの上限
+constexpr std::uint32_t kMaxDstPathSize = 4096;
+
+
+/*!
+ * @brief 要求のヘッダ
+ */
+struct RequestHeader
+{
+  //! kProtocolMagic
+  std::uint32_t magic;
+  //! 出力形式 (bfc::Target の値)
+  std::uint8_t target;
+  //! 再配置可能オブジェクトファイルを出力するかどうか
+  std::uint8_t isObject;
+  //! 生成したバイナリを応答として返すかどうか (0のときはサーバが出力ファイルに書き込む)
+  std::uint8_t isReturnImage;
+  //! セクションヘッダ等を省いた最小限の実行ファイルを出力するかどうか (旧版のクライアントは0を送る)
+  std::uint8_t isTiny;
+  //! 出力ファイルのパスの長さ (isReturnImage が 0 のときのみ有効．絶対パスであること)
+  std::uint32_t dstPathSize;
+  //! 予約 (0)
+  std::uint32_t reserved1;
+  //! ソースコードの長さ
+  std::uint64_t sourceSize;
+};
+static_assert(sizeof(RequestHeader) == 24, "Unexpected padding in RequestHeader");
+
+
+/*!
+ * @brief 応答の状態
+ */
+enum class ResponseStatus : std::uint8_t
+{
+  //! 成功 (ペイロードは生成したバイナリ．サーバが書き込んだ場合は空)
+  Succeeded,
+  //! コンパイルまたは書き込みの失敗 (ペイロードは診断メッセージ)
+  Failed,
+  //! 要求の形式の誤り (ペイロードは診断メッセージ．サーバは接続を閉じる)
+  BadRequest
+};
+
+
+/*!
+ * @brief 応答のヘッダ
+ */
+struct ResponseHeader
+{
+  //! 応答の状態 (ResponseStatus の値)
+  std::uint8_t status;
+  //! キャッシュから出力ファイルを配置したかどうか
+  std::uint8_t isCacheHit;
+  //! 予約 (0)
+  std::uint8_t reserved[2];
+  //! ペイロードに続く警告メッセージの長さ
+  std::uint32_t warningsSize;
+  //! ペイロードの長さ
+  std::uint64_t payloadSize;
+};
+static_assert(sizeof(ResponseHeader) == 16, "Unexpected padding in ResponseHeader");
+
+
+/*!
+ * @brief 指定したサイズを読み終えるまで読み込む
+ *
+ * @param [in] fd  ファイルディスクリプタ
+ * @param [out] data  読み込み先
+ * @param [in] size  読み込むサイズ (byte単位)
+ * @return 全て読み込めた場合は true (途中で EOF に達した場合は false)
+ */
+inline bool
+readFully(int fd, void* data, std::size_t size) noexcept
+{
+  auto p = static_cast<char*>(data);
+  while (size > 0) {
+    const auto n = ::read(fd, p, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+
+/*!
+ * @brief 指定したサイズを書き終えるまで書き込む
+ *
+ * @param [in] fd  ファイルディスクリプタ
+ * @param [in] data  書き込むデータ
+ * @param [in] size  書き込むサイズ (byte単位)
+ * @return 全て書き込めた場合は true
+ */
+inline bool
+writeFully(int fd, const void* data, std::size_t size) noexcept
+{
+  auto p = static_cast<const char*>(data);
+  while (size > 0) {
+    const auto n = ::write(fd, p, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+
+/*!
+ * @brief 既定のソケットファイルのパスを返す
+ *
+ * 環境変数 XDG_RUNTIME_DIR があればその下に，無ければ /tmp 下にユーザごとのパスを返す．
+ *
+ * @return 既定のソケットファイルのパス
+ */
+inline std::string
+getDefaultSocketPath()
+{
+  if (const auto dir = std::getenv("XDG_RUNTIME_DIR"); dir != nullptr && *dir != '\0') {
+    return std::string{dir} + "/bfcompiler.sock";
+  }
+  return "/tmp/bfcompiler-" + std::to_string(::getuid()) + ".sock";
+}
+}  // namespace bfc
+
+
+#endif  // PROTOCOL_HPP
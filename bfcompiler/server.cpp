@@ -0,0 +1,467 @@
+/*!
+ * @brief Unix ドメインソケットで要求を受け付けるコンパイルサーバ
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "batch.hpp"
+#include "bfcompiler.hpp"
+#include "protocol.hpp"
+#include "server.hpp"
+#include "source.hpp"
+
+
+namespace bfc
+{
+namespace
+{
+//! ソースコードを受信する単位
+constexpr std::size_t kChunkSize = 64 * 1024;
+//! 要求の途中で受信が途絶えたときに接続を閉じるまでの秒数
+constexpr int kReceiveTimeoutSeconds = 30;
+//! 接続を受け付けられなかったときに再試行するまでの待ち時間
+constexpr auto kAcceptRetryDelay = std::chrono::milliseconds{100};
+
+
+/*!
+ * @brief 要求が届いた接続のキュー
+ *
+ * 待ち受けスレッドが接続を追加し，ワーカースレッドが取り出して要求を1つずつ処理する．
+ */
+class RequestQueue
+{
+public:
+  /*!
+   * @brief 接続を追加する
+   *
+   * @param [in] fd  要求が届いた接続のファイルディスクリプタ
+   */
+  void
+  push(int fd)
+  {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      queue_.push_back(fd);
+    }
+    cv_.notify_one();
+  }
+
+  /*!
+   * @brief 接続を取り出す (空であれば追加されるまで待つ)
+   *
+   * @return 要求が届いた接続のファイルディスクリプタ
+   */
+  int
+  pop()
+  {
+    std::unique_lock<std::mutex> lock{mutex_};
+    cv_.wait(lock, [this] {
+      return !queue_.empty();
+    });
+    const auto fd = queue_.front();
+    queue_.pop_front();
+    return fd;
+  }
+
+private:
+  //! キューを保護するミューテックス
+  std::mutex mutex_{};
+  //! 接続の追加を通知する条件変数
+  std::condition_variable cv_{};
+  //! 要求が届いた接続のキュー
+  std::deque<int> queue_{};
+};
+
+
+/*!
+ * @brief スレッドごとのバッファ (要求をまたいで使い回す)
+ */
+struct WorkerBuffer
+{
+  //! 受信したソースコードの断片
+  std::vector<char> chunk = std::vector<char>(kChunkSize);
+  //! 正規化したソースコード
+  NormalizedSource source{};
+  //! 生成したバイナリ
+  std::vector<std::uint8_t> image{};
+  //! 出力ファイルのパス
+  std::string dstFilePath{};
+  //! 警告メッセージ
+  std::vector<std::string> warnings{};
+  //! 応答として送る改行区切りの警告メッセージ
+  std::string joinedWarnings{};
+};
+
+
+/*!
+ * @brief 応答を送信する
+ *
+ * @param [in] fd  接続のファイルディスクリプタ
+ * @param [in] status  応答の状態
+ * @param [in] isCacheHit  キャッシュから出力ファイルを配置したかどうか
+ * @param [in] payload  ペイロード
+ * @param [in] size  ペイロードのサイズ (byte単位)
+ * @param [in] warnings  ペイロードに続けて送る改行区切りの警告メッセージ
+ * @return 送信できた場合は true
+ */
+inline bool
+sendResponse(
+  int fd,
+  ResponseStatus status,
+  bool isCacheHit,
+  const void* payload,
+  std::size_t size,
+  const std::string& warnings = std::string{})
+{
+  ResponseHeader header{};
+  header.status = static_cast<std::uint8_t>(status);
+  header.isCacheHit = static_cast<std::uint8_t>(isCacheHit);
+  header.warningsSize = static_cast<std::uint32_t>(warnings.size());
+  header.payloadSize = size;
+  return writeFully(fd, &header, sizeof(header))
+    && writeFully(fd, payload, size)
+    && writeFully(fd, warnings.data(), warnings.size());
+}
+
+
+/*!
+ * @brief 診断メッセージを応答として送信する
+ *
+ * @param [in] fd  接続のファイルディスクリプタ
+ * @param [in] status  応答の状態
+ * @param [in] message  診断メッセージ
+ * @return 送信できた場合は true
+ */
+inline bool
+sendMessage(int fd, ResponseStatus status, const std::string& message)
+{
+  return sendResponse(fd, status, false, message.data(), message.size());
+}
+
+
+/*!
+ * @brief ソースコードを受信しながら正規化する
+ *
+ * ソースコード全体をメモリ上に保持しないように，一定の大きさずつ受信して正規化する．
+ *
+ * @param [in] fd  接続のファイルディスクリプタ
+ * @param [in] size  ソースコードのサイズ (byte単位)
+ * @param [in,out] buffer  スレッドごとのバッファ
+ * @return 全て受信できた場合は true
+ */
+inline bool
+receiveSource(int fd, std::uint64_t size, WorkerBuffer& buffer)
+{
+  SourceNormalizer normalizer{buffer.source};
+  while (size > 0) {
+    const auto n = static_cast<std::size_t>(std::min<std::uint64_t>(size, buffer.chunk.size()));
+    if (!readFully(fd, buffer.chunk.data(), n)) {
+      return false;
+    }
+    normalizer.feed(buffer.chunk.data(), n);
+    size -= n;
+  }
+  return true;
+}
+
+
+/*!
+ * @brief 1つの要求を処理する
+ *
+ * @param [in] fd  接続のファイルディスクリプタ
+ * @param [in] cache  キャッシュ (nullptr のときはキャッシュを用いない)
+ * @param [in] isParallel  複数のスレッドで要求を処理しているかどうか
+ * @param [in,out] buffer  スレッドごとのバッファ
+ * @return 同じ接続で次の要求を受け付ける場合は true
+ */
+inline bool
+handleRequest(int fd, const CompileCache* cache, bool isParallel, WorkerBuffer& buffer)
+{
+  RequestHeader header;
+  if (!readFully(fd, &header, sizeof(header))) {
+    return false;
+  }
+  if (header.magic != kProtocolMagic) {
+    sendMessage(fd, ResponseStatus::BadRequest, "Invalid request header");
+    return false;
+  }
+  if (header.dstPathSize > kMaxDstPathSize) {
+    sendMessage(fd, ResponseStatus::BadRequest, "Output path is too long");
+    return false;
+  }
+  auto& dstFilePath = buffer.dstFilePath;
+  dstFilePath.resize(header.dstPathSize);
+  if (!readFully(fd, dstFilePath.data(), dstFilePath.size()) || !receiveSource(fd, header.sourceSize, buffer)) {
+    return false;
+  }
+
+  // 以降の誤りは要求の本体を読み終えているので，接続を維持したまま失敗を返す
+  if (header.target > static_cast<std::uint8_t>(Target::PeX86)) {
+    return sendMessage(fd, ResponseStatus::Failed, "Unknown target");
+  }
+  Options options;
+  options.target = static_cast<Target>(header.target);
+  options.isObject = header.isObject != 0;
+  options.isTiny = header.isTiny != 0;
+  // 要求単位で並列化しているので，各要求のコード生成は1スレッドで行う
+  if (isParallel) {
+    options.nThreads = 1;
+  }
+  if (options.isObject && options.target != Target::ElfX64) {
+    return sendMessage(fd, ResponseStatus::Failed, "Option -c is supported only for x64 ELF");
+  }
+  if (options.isTiny && (options.isObject || (options.target != Target::ElfX64 && options.target != Target::ElfX86))) {
+    return sendMessage(fd, ResponseStatus::Failed, "Option --tiny is supported only for ELF executables");
+  }
+
+  auto& warnings = buffer.warnings;
+  warnings.clear();
+  auto isCacheHit = false;
+  if (header.isReturnImage != 0) {
+    options.warningHandler = [&warnings](const std::string& message) {
+      warnings.push_back(message);
+    };
+    try {
+      compile(buffer.source, options, buffer.image);
+    } catch (const CompileError& e) {
+      return sendMessage(fd, ResponseStatus::Failed, e.what());
+    }
+  } else {
+    // サーバとクライアントの作業ディレクトリは異なるので，相対パスは受け付けない
+    if (dstFilePath.empty() || dstFilePath[0] != '/') {
+      return sendMessage(fd, ResponseStatus::Failed, "Output path must be absolute");
+    }
+    auto result = compileSource(buffer.source, dstFilePath, options, cache, buffer.image);
+    if (!result.isSucceeded) {
+      return sendMessage(fd, ResponseStatus::Failed, result.message);
+    }
+    isCacheHit = result.isCacheHit;
+    warnings = std::move(result.warnings);
+  }
+
+  auto& joinedWarnings = buffer.joinedWarnings;
+  joinedWarnings.clear();
+  for (const auto& warning : warnings) {
+    joinedWarnings += warning;
+    joinedWarnings += '\n';
+  }
+  if (header.isReturnImage != 0) {
+    return sendResponse(fd, ResponseStatus::Succeeded, false, buffer.image.data(), buffer.image.size(), joinedWarnings);
+  }
+  return sendResponse(fd, ResponseStatus::Succeeded, isCacheHit, nullptr, 0, joinedWarnings);
+}
+
+
+/*!
+ * @brief 1つの要求を処理し，予期しない例外も失敗の応答として返す
+ *
+ * @param [in] fd  接続のファイルディスクリプタ
+ * @param [in] cache  キャッシュ (nullptr のときはキャッシュを用いない)
+ * @param [in] isParallel  複数のスレッドで要求を処理しているかどうか
+ * @param [in,out] buffer  スレッドごとのバッファ
+ * @return 同じ接続で次の要求を受け付ける場合は true
+ */
+inline bool
+processRequest(int fd, const CompileCache* cache, bool isParallel, WorkerBuffer& buffer) noexcept
+{
+  try {
+    return handleRequest(fd, cache, isParallel, buffer);
+  } catch (const std::exception& e) {
+    // 要求をどこまで受信したか分からないので，応答を返した後に接続を閉じる．
+    // メモリ不足の場合もあるので，メッセージは新たに確保せずにそのまま送る
+    const auto message = e.what();
+    sendResponse(fd, ResponseStatus::Failed, false, message, std::strlen(message));
+    return false;
+  }
+}
+
+
+/*!
+ * @brief 待ち受けているソケットから接続を受け付けられるだけ受け付ける
+ *
+ * EMFILE 等の資源不足は接続が閉じられるまで続くので，同じ誤りは一度だけ報告し，少し待ってから戻る．
+ *
+ * @param [in] listenFd  待ち受けているソケットのファイルディスクリプタ (ノンブロッキング)
+ * @param [in,out] pollFds  受け付けた接続を追加する監視対象
+ * @param [in,out] lastErrno  直前に報告した accept の誤り (報告していなければ0)
+ */
+inline void
+acceptConnections(int listenFd, std::vector<::pollfd>& pollFds, int& lastErrno)
+{
+  for (;;) {
+    const auto fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd != -1) {
+      // 要求の途中で止まったクライアントがワーカースレッドを占有し続けないようにする
+      ::timeval timeout{};
+      timeout.tv_sec = kReceiveTimeoutSeconds;
+      ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      pollFds.push_back({fd, POLLIN, 0});
+      lastErrno = 0;
+      continue;
+    }
+    if (errno == EINTR || errno == ECONNABORTED) {
+      continue;
+    }
+    if (errno == EAGAIN) {
+      return;
+    }
+    if (errno != lastErrno) {
+      std::cerr << "Failed to accept a connection: " << std::strerror(errno) << std::endl;
+      lastErrno = errno;
+    }
+    std::this_thread::sleep_for(kAcceptRetryDelay);
+    return;
+  }
+}
+
+
+/*!
+ * @brief ソケットファイルを作成して待ち受けを開始する
+ *
+ * ソケットファイルが既に存在する場合，接続できなければ前回のサーバの残骸とみなして削除する．
+ *
+ * @param [in] socketPath  ソケットファイルのパス
+ * @return 待ち受けているソケットのファイルディスクリプタ (失敗した場合は -1)
+ */
+inline int
+listenSocket(const std::string& socketPath)
+{
+  sockaddr_un addr{};
+  if (socketPath.empty() || socketPath.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Invalid socket path: " << socketPath << std::endl;
+    return -1;
+  }
+  addr.sun_family = AF_UNIX;
+  socketPath.copy(addr.sun_path, socketPath.size());
+  const auto sockAddr = reinterpret_cast<const sockaddr*>(&addr);
+
+  struct stat st;
+  if (::lstat(socketPath.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      std::cerr << socketPath << " exists and is not a socket" << std::endl;
+      return -1;
+    }
+    const auto probeFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    const auto isAlive = probeFd != -1 && ::connect(probeFd, sockAddr, sizeof(addr)) == 0;
+    if (probeFd != -1) {
+      ::close(probeFd);
+    }
+    if (isAlive) {
+      std::cerr << "Another server is already listening on " << socketPath << std::endl;
+      return -1;
+    }
+    ::unlink(socketPath.c_str());
+  }
+
+  // 受け付けは poll() で待つので，ノンブロッキングにしておく
+  const auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    std::cerr << "Failed to create a socket: " << std::strerror(errno) << std::endl;
+    return -1;
+  }
+  if (::bind(fd, sockAddr, sizeof(addr)) == -1 || ::listen(fd, SOMAXCONN) == -1) {
+    std::cerr << "Failed to listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+}  // namespace
+
+
+int
+runServer(const std::string& socketPath, const CompileCache* cache, unsigned int nThreads)
+{
+  // 応答の送信中にクライアントが切断しても終了しないようにする
+  std::signal(SIGPIPE, SIG_IGN);
+
+  const auto listenFd = listenSocket(socketPath);
+  if (listenFd == -1) {
+    return 1;
+  }
+  if (nThreads == 0) {
+    nThreads = std::max(std::thread::hardware_concurrency(), 1U);
+  }
+  std::cerr << "Listening on " << socketPath << " with " << nThreads << " threads" << std::endl;
+
+  // ワーカースレッドが処理を終えて維持する接続を待ち受けスレッドに返すパイプ
+  int returnPipe[2];
+  if (::pipe2(returnPipe, O_CLOEXEC) == -1 || ::fcntl(returnPipe[0], F_SETFL, O_NONBLOCK) == -1) {
+    std::cerr << "Failed to create a pipe: " << std::strerror(errno) << std::endl;
+    ::close(listenFd);
+    return 1;
+  }
+
+  // 接続ごとではなく要求ごとにワーカースレッドへ渡すので，アイドル状態の接続がスレッドを占有しない
+  RequestQueue queue;
+  const auto worker = [&queue, returnFd = returnPipe[1], cache, isParallel = nThreads > 1] {
+    WorkerBuffer buffer;
+    for (;;) {
+      const auto fd = queue.pop();
+      // PIPE_BUF 以下の書き込みは分割されないので，複数のスレッドから書き込んでよい
+      if (!processRequest(fd, cache, isParallel, buffer) || !writeFully(returnFd, &fd, sizeof(fd))) {
+        ::close(fd);
+      }
+    }
+  };
+  for (unsigned int i = 0; i < nThreads; i++) {
+    std::thread{worker}.detach();
+  }
+
+  // 先頭の2つは待ち受けているソケットと返却用のパイプで，以降は次の要求を待つ接続
+  std::vector<::pollfd> pollFds{{listenFd, POLLIN, 0}, {returnPipe[0], POLLIN, 0}};
+  int lastAcceptErrno = 0;
+  for (;;) {
+    if (::poll(pollFds.data(), pollFds.size(), -1) == -1) {
+      if (errno != EINTR) {
+        std::cerr << "Failed to wait for requests: " << std::strerror(errno) << std::endl;
+        std::this_thread::sleep_for(kAcceptRetryDelay);
+      }
+      continue;
+    }
+    // 要求が届いた (または切断された) 接続を監視対象から外してワーカースレッドに渡す
+    for (auto i = pollFds.size(); i-- > 2;) {
+      if (pollFds[i].revents != 0) {
+        queue.push(pollFds[i].fd);
+        pollFds[i] = pollFds.back();
+        pollFds.pop_back();
+      }
+    }
+    if (pollFds[1].revents != 0) {
+      int fd;
+      while (::read(returnPipe[0], &fd, sizeof(fd)) == static_cast<::ssize_t>(sizeof(fd))) {
+        pollFds.push_back({fd, POLLIN, 0});
+      }
+    }
+    if (pollFds[0].revents != 0) {
+      acceptConnections(listenFd, pollFds, lastAcceptErrno);
+    }
+  }
+}
+}  // namespace bfc
@@ -0,0 +1,34 @@
+/*!
+ * @brief Unix ドメインソケットで要求を受け付けるコンパイルサーバ
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <string>
+
+#include "cache.hpp"
+
+
+namespace bfc
+{
+/*!
+ * @brief コンパイルサーバを起動する
+ *
+ * ソケットファイルを作成して待ち受け，複数のクライアントからの要求を並行して処理する．
+ * 通信規約は protocol.hpp を参照．終了するにはシグナルで停止させる．
+ *
+ * @param [in] socketPath  ソケットファイルのパス
+ * @param [in] cache  キャッシュ (nullptr のときはキャッシュを用いない．出力ファイルに書き込む要求のみで用いる)
+ * @param [in] nThreads  要求を処理するスレッド数 (0のときはハードウェアのスレッド数)
+ * @return 終了ステータス (待ち受けを開始できなかった場合のみ返る)
+ */
+int
+runServer(const std::string& socketPath, const CompileCache* cache, unsigned int nThreads);
+}  // namespace bfc
+
+
+#endif  // SERVER_HPP
@@ -0,0 +1,172 @@
+/*!
+ * @brief SHA-256 によるハッシュ値の計算
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <string>
+
+#include "sha256.hpp"
+
+
+namespace bfc
+{
+namespace
+{
+//! ラウンド定数
+constexpr std::uint32_t kRoundConstants[] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+/*!
+ * @brief 32bit値を右に回転する
+ *
+ * @param [in] x  回転する値
+ * @param [in] n  回転するビット数
+ * @return 回転した値
+ */
+constexpr std::uint32_t
+rotateRight(std::uint32_t x, int n) noexcept
+{
+  return (x >> n) | (x << (32 - n));
+}
+}  // namespace
+
+
+Sha256::Sha256() noexcept
+  : state_{{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19}}
+  , buffer_{}
+  , bufferSize_{0}
+  , totalSize_{0}
+{}
+
+
+void
+Sha256::update(const void* data, std::size_t size) noexcept
+{
+  auto p = static_cast<const std::uint8_t*>(data);
+  totalSize_ += size;
+  if (bufferSize_ != 0) {
+    const auto n = std::min(buffer_.size() - bufferSize_, size);
+    std::memcpy(buffer_.data() + bufferSize_, p, n);
+    bufferSize_ += n;
+    p += n;
+    size -= n;
+    if (bufferSize_ < buffer_.size()) {
+      return;
+    }
+    processBlock(buffer_.data());
+    bufferSize_ = 0;
+  }
+  for (; size >= buffer_.size(); p += buffer_.size(), size -= buffer_.size()) {
+    processBlock(p);
+  }
+  std::memcpy(buffer_.data(), p, size);
+  bufferSize_ = size;
+}
+
+
+Sha256::Digest
+Sha256::finish() noexcept
+{
+  const auto bitSize = totalSize_ * 8;
+  // 0x80 を付与し，末尾8byteを残して56byte目まで0で埋める
+  buffer_[bufferSize_++] = 0x80;
+  if (bufferSize_ > 56) {
+    std::memset(buffer_.data() + bufferSize_, 0, buffer_.size() - bufferSize_);
+    processBlock(buffer_.data());
+    bufferSize_ = 0;
+  }
+  std::memset(buffer_.data() + bufferSize_, 0, 56 - bufferSize_);
+  for (int i = 0; i < 8; i++) {
+    buffer_[static_cast<std::size_t>(56 + i)] = static_cast<std::uint8_t>(bitSize >> (56 - i * 8));
+  }
+  processBlock(buffer_.data());
+
+  Digest digest;
+  for (std::size_t i = 0; i < state_.size(); i++) {
+    for (std::size_t j = 0; j < 4; j++) {
+      digest[i * 4 + j] = static_cast<std::uint8_t>(state_[i] >> (24 - j * 8));
+    }
+  }
+  return digest;
+}
+
+
+std::string
+Sha256::toHexString(const Digest& digest)
+{
+  constexpr char kHexDigits[] = "0123456789abcdef";
+  std::string str;
+  str.reserve(digest.size() * 2);
+  for (const auto e : digest) {
+    str += kHexDigits[e >> 4];
+    str += kHexDigits[e & 0x0f];
+  }
+  return str;
+}
+
+
+void
+Sha256::processBlock(const std::uint8_t* block) noexcept
+{
+  std::uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+    w[i] = static_cast<std::uint32_t>(block[i * 4]) << 24
+      | static_cast<std::uint32_t>(block[i * 4 + 1]) << 16
+      | static_cast<std::uint32_t>(block[i * 4 + 2]) << 8
+      | static_cast<std::uint32_t>(block[i * 4 + 3]);
+  }
+  for (int i = 16; i < 64; i++) {
+    const auto s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    const auto s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  auto a = state_[0];
+  auto b = state_[1];
+  auto c = state_[2];
+  auto d = state_[3];
+  auto e = state_[4];
+  auto f = state_[5];
+  auto g = state_[6];
+  auto h = state_[7];
+  for (int i = 0; i < 64; i++) {
+    const auto s1 = rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25);
+    const auto ch = (e & f) ^ (~e & g);
+    const auto t1 = h + s1 + ch + kRoundConstants[i] + w[i];
+    const auto s0 = rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22);
+    const auto maj = (a & b) ^ (a & c) ^ (b & c);
+    const auto t2 = s0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+  state_[4] += e;
+  state_[5] += f;
+  state_[6] += g;
+  state_[7] += h;
+}
+}  // namespace bfc
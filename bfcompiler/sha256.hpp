@@ -0,0 +1,82 @@
+/*!
+ * @brief SHA-256 によるハッシュ値の計算
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#ifndef SHA256_HPP
+#define SHA256_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <string>
+
+
+namespace bfc
+{
+/*!
+ * @brief SHA-256 のハッシュ値を逐次的に計算する
+ */
+class Sha256
+{
+public:
+  //! ハッシュ値のサイズ (byte単位)
+  static constexpr std::size_t kDigestSize = 32;
+  //! ハッシュ値
+  using Digest = std::array<std::uint8_t, kDigestSize>;
+
+  /*!
+   * @brief 初期状態で構築する
+   */
+  Sha256() noexcept;
+
+  /*!
+   * @brief データを追加する
+   *
+   * @param [in] data  追加するデータ
+   * @param [in] size  追加するデータのサイズ (byte単位)
+   */
+  void
+  update(const void* data, std::size_t size) noexcept;
+
+  /*!
+   * @brief ハッシュ値を求める (以後，このオブジェクトにデータを追加してはならない)
+   *
+   * @return ハッシュ値
+   */
+  Digest
+  finish() noexcept;
+
+  /*!
+   * @brief ハッシュ値を16進数の文字列に変換する
+   *
+   * @param [in] digest  ハッシュ値
+   * @return 小文字の16進数の文字列
+   */
+  static std::string
+  toHexString(const Digest& digest);
+
+private:
+  /*!
+   * @brief 64byteのブロックを1つ処理する
+   *
+   * @param [in] block  処理するブロック
+   */
+  void
+  processBlock(const std::uint8_t* block) noexcept;
+
+  //! 内部状態
+  std::array<std::uint32_t, 8> state_;
+  //! 処理待ちのデータ
+  std::array<std::uint8_t, 64> buffer_;
+  //! 処理待ちのデータのサイズ
+  std::size_t bufferSize_;
+  //! これまでに追加されたデータの総サイズ (byte単位)
+  std::uint64_t totalSize_;
+};
+}  // namespace bfc
+
+
+#endif  // SHA256_HPP
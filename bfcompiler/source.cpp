@@ -0,0 +1,180 @@
+/*!
+ * @brief Brainf**kのソースコードの正規化
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define HAS_SSE2 1
+#endif
+
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef HAS_SSE2
+#  include <emmintrin.h>
+#endif  // HAS_SSE2
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif  // _MSC_VER
+
+#include "source.hpp"
+
+
+namespace bfc
+{
+namespace
+{
+/*!
+ * @brief 各文字が命令文字かどうかの表を生成する
+ *
+ * @return 各文字が命令文字かどうかの表
+ */
+constexpr std::array<bool, 256>
+makeCommandTable() noexcept
+{
+  std::array<bool, 256> table{};
+  for (const auto c : {'>', '<', '+', '-', '.', ',', '[', ']'}) {
+    table[static_cast<unsigned char>(c)] = true;
+  }
+  return table;
+}
+
+
+//! 各文字が命令文字かどうかの表
+constexpr auto kCommandTable = makeCommandTable();
+
+
+/*!
+ * @brief 1文字ずつ判定して命令文字を取り出す
+ *
+ * @param [in] data  ソースコードの断片
+ * @param [in] size  断片のサイズ (byte単位)
+ * @param [in] srcOffset  断片の先頭のソース上での位置
+ * @param [in,out] normalized  書き込み先
+ */
+inline void
+normalizeScalar(const char* data, std::size_t size, std::size_t srcOffset, NormalizedSource& normalized)
+{
+  for (std::size_t i = 0; i < size; i++) {
+    const auto c = data[i];
+    if (!kCommandTable[static_cast<unsigned char>(c)]) {
+      continue;
+    }
+    normalized.commands += c;
+    if (c == '[') {
+      normalized.loopSrcOffsets.push_back(srcOffset + i);
+    }
+  }
+}
+
+
+#ifdef HAS_SSE2
+/*!
+ * @brief 最下位の立っているビットの位置を返す
+ *
+ * @param [in] x  0以外の値
+ * @return 最下位の立っているビットの位置
+ */
+inline int
+countTrailingZeros(unsigned int x) noexcept
+{
+#ifdef _MSC_VER
+  unsigned long index;
+  ::_BitScanForward(&index, x);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctz(x);
+#endif  // _MSC_VER
+}
+
+
+/*!
+ * @brief SSE2 を用いて16文字ずつ判定して命令文字を取り出す
+ *
+ * @param [in] data  ソースコードの断片
+ * @param [in] size  断片のサイズ (byte単位)
+ * @param [in] srcOffset  断片の先頭のソース上での位置
+ * @param [in,out] normalized  書き込み先
+ * @return 処理したサイズ (16の倍数．残りは呼び出し側で処理する)
+ */
+inline std::size_t
+normalizeSse2(const char* data, std::size_t size, std::size_t srcOffset, NormalizedSource& normalized)
+{
+  auto& commands = normalized.commands;
+  std::size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const auto v = _mm_loadu_si128(static_cast<const __m128i*>(static_cast<const void*>(data + i)));
+    // '+', ',', '-', '.' は連続しているので，'+' を引いた値が符号無しで3以下かどうかで判定する
+    const auto d = _mm_sub_epi8(v, _mm_set1_epi8('+'));
+    const auto isArith = _mm_cmpeq_epi8(_mm_max_epu8(d, _mm_set1_epi8(3)), _mm_set1_epi8(3));
+    // '<' と '>' は1bitだけ異なるので，そのbitを立ててから比較する
+    const auto isShift = _mm_cmpeq_epi8(_mm_or_si128(v, _mm_set1_epi8(0x02)), _mm_set1_epi8('>'));
+    const auto isLoopBegin = _mm_cmpeq_epi8(v, _mm_set1_epi8('['));
+    const auto isLoopEnd = _mm_cmpeq_epi8(v, _mm_set1_epi8(']'));
+    auto mask = static_cast<unsigned int>(_mm_movemask_epi8(
+      _mm_or_si128(_mm_or_si128(isArith, isShift), _mm_or_si128(isLoopBegin, isLoopEnd))));
+    if (mask == 0) {
+      // コメントのみ
+      continue;
+    }
+    if (mask == 0xffff) {
+      // 命令文字のみ
+      commands.append(data + i, 16);
+    } else {
+      const auto pos = commands.size();
+      commands.resize(pos + 16);
+      auto p = &commands[pos];
+      for (; mask != 0; mask &= mask - 1) {
+        *p++ = data[i + static_cast<std::size_t>(countTrailingZeros(mask))];
+      }
+      commands.resize(static_cast<std::size_t>(p - commands.data()));
+    }
+    auto loopMask = static_cast<unsigned int>(_mm_movemask_epi8(isLoopBegin));
+    for (; loopMask != 0; loopMask &= loopMask - 1) {
+      normalized.loopSrcOffsets.push_back(srcOffset + i + static_cast<std::size_t>(countTrailingZeros(loopMask)));
+    }
+  }
+  return i;
+}
+#endif  // HAS_SSE2
+}  // namespace
+
+
+SourceNormalizer::SourceNormalizer(NormalizedSource& normalized) noexcept
+  : normalized_{normalized}
+  , srcOffset_{0}
+{
+  normalized_.commands.clear();
+  normalized_.loopSrcOffsets.clear();
+}
+
+
+void
+SourceNormalizer::feed(const char* data, std::size_t size)
+{
+#ifdef HAS_SSE2
+  const auto n = normalizeSse2(data, size, srcOffset_, normalized_);
+#else
+  const std::size_t n = 0;
+#endif  // HAS_SSE2
+  normalizeScalar(data + n, size - n, srcOffset_ + n, normalized_);
+  srcOffset_ += size;
+}
+
+
+NormalizedSource
+normalizeSource(std::string_view source)
+{
+  NormalizedSource normalized;
+  SourceNormalizer normalizer{normalized};
+  normalizer.feed(source.data(), source.size());
+  return normalized;
+}
+}  // namespace bfc
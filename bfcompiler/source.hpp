@@ -0,0 +1,75 @@
+/*!
+ * @brief Brainf**kのソースコードの正規化
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#ifndef SOURCE_HPP
+#define SOURCE_HPP
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+namespace bfc
+{
+/*!
+ * @brief Brainf**kに関係しない文字を取り除いたソースコード
+ */
+struct NormalizedSource
+{
+  //! Brainf**kの命令文字のみからなる文字列
+  std::string commands{};
+  //! 取り除く前のソース上での各 '[' の位置 (ループのシンボル名に用いる)
+  std::vector<std::size_t> loopSrcOffsets{};
+};
+
+
+/*!
+ * @brief ソースコードを断片ごとに受け取り，Brainf**kに関係しない文字を取り除く
+ *
+ * ソースコード全体を保持する必要が無いので，巨大なソースファイルを一定サイズずつ読み込みながら
+ * 正規化できる．使用するメモリは命令文字の数にのみ比例し，コメントの量には依存しない．
+ */
+class SourceNormalizer
+{
+public:
+  /*!
+   * @brief 書き込み先を指定して構築する
+   *
+   * @param [out] normalized  書き込み先 (元の内容は破棄されるが，確保済みの領域は再利用する)
+   */
+  explicit SourceNormalizer(NormalizedSource& normalized) noexcept;
+
+  /*!
+   * @brief ソースコードの続きの断片を追加する
+   *
+   * @param [in] data  ソースコードの断片
+   * @param [in] size  断片のサイズ (byte単位)
+   */
+  void
+  feed(const char* data, std::size_t size);
+
+private:
+  //! 書き込み先
+  NormalizedSource& normalized_;
+  //! これまでに受け取ったソースコードのサイズ
+  std::size_t srcOffset_;
+};
+
+
+/*!
+ * @brief Brainf**kに関係しない文字を取り除く
+ *
+ * @param [in] source  Brainf**kのソースコード
+ * @return 正規化したソースコード
+ */
+NormalizedSource
+normalizeSource(std::string_view source);
+}  // namespace bfc
+
+
+#endif  // SOURCE_HPP
@@ -0,0 +1,1239 @@
+/*!
+ * @brief x86 / x64 の命令のエンコーダ
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#ifndef X86ENCODER_HPP
+#define X86ENCODER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <type_traits>
+
+#include "codebuffer.hpp"
+
+
+namespace bfc
+{
+namespace x86
+{
+//! 命令を実行するモード
+enum class Mode
+{
+  //! 32bit モード (x86)
+  Bits32,
+  //! 64bit モード (x64)
+  Bits64
+};
+
+
+//! オペランドのサイズ
+enum class Size : std::uint8_t
+{
+  //! 8bit
+  Byte,
+  //! 32bit
+  Dword,
+  //! 64bit (x64 のみ)
+  Qword
+};
+
+
+/*!
+ * @brief 汎用レジスタ
+ */
+struct Reg
+{
+  //! レジスタ番号 (8以上は x64 でのみ使える)
+  std::uint8_t code;
+  //! サイズ
+  Size size;
+  //! ah, ch, dh, bh のいずれかであるかどうか (REX 接頭辞を伴う命令では使えない)
+  bool isHighByte;
+};
+
+constexpr Reg kAl{0, Size::Byte, false};
+constexpr Reg kCl{1, Size::Byte, false};
+constexpr Reg kDh{6, Size::Byte, true};
+constexpr Reg kSil{6, Size::Byte, false};
+constexpr Reg kR8b{8, Size::Byte, false};
+constexpr Reg kEax{0, Size::Dword, false};
+constexpr Reg kEcx{1, Size::Dword, false};
+constexpr Reg kEdx{2, Size::Dword, false};
+constexpr Reg kEbx{3, Size::Dword, false};
+constexpr Reg kEsp{4, Size::Dword, false};
+constexpr Reg kEbp{5, Size::Dword, false};
+constexpr Reg kEsi{6, Size::Dword, false};
+constexpr Reg kEdi{7, Size::Dword, false};
+constexpr Reg kR8d{8, Size::Dword, false};
+constexpr Reg kR9d{9, Size::Dword, false};
+constexpr Reg kRax{0, Size::Qword, false};
+constexpr Reg kRcx{1, Size::Qword, false};
+constexpr Reg kRdx{2, Size::Qword, false};
+constexpr Reg kRbx{3, Size::Qword, false};
+constexpr Reg kRsp{4, Size::Qword, false};
+constexpr Reg kRbp{5, Size::Qword, false};
+constexpr Reg kRsi{6, Size::Qword, false};
+constexpr Reg kRdi{7, Size::Qword, false};
+constexpr Reg kR8{8, Size::Qword, false};
+constexpr Reg kR9{9, Size::Qword, false};
+constexpr Reg kR12{12, Size::Qword, false};
+constexpr Reg kR13{13, Size::Qword, false};
+
+
+/*!
+ * @brief SSE レジスタ
+ */
+struct Xmm
+{
+  //! レジスタ番号
+  std::uint8_t code;
+};
+
+constexpr Xmm kXmm0{0};
+constexpr Xmm kXmm1{1};
+
+
+//! メモリオペランドのアドレスの指定方法
+enum class Addressing : std::uint8_t
+{
+  //! [base + disp]
+  Base,
+  //! [disp] (絶対アドレス)
+  Absolute,
+  //! [rip + disp] (x64 のみ)
+  RipRelative
+};
+
+
+/*!
+ * @brief メモリオペランド
+ */
+struct Mem
+{
+  //! アドレスの指定方法
+  Addressing addressing;
+  //! ベースレジスタの番号 (Addressing::Base のときのみ用いる)
+  std::uint8_t base;
+  //! 変位
+  std::int32_t disp;
+  //! アクセスするサイズ (SSE 命令では用いない)
+  Size size;
+};
+
+
+/*!
+ * @brief [base + disp] を指すメモリオペランドを返す
+ *
+ * @param [in] size  アクセスするサイズ
+ * @param [in] base  ベースレジスタ
+ * @param [in] disp  変位
+ * @return メモリオペランド
+ */
+constexpr Mem
+ptr(Size size, Reg base, std::int32_t disp = 0) noexcept
+{
+  return {Addressing::Base, base.code, disp, size};
+}
+
+
+/*!
+ * @brief byte ptr [base + disp] を返す
+ *
+ * @param [in] base  ベースレジスタ
+ * @param [in] disp  変位
+ * @return メモリオペランド
+ */
+constexpr Mem
+bytePtr(Reg base, std::int32_t disp = 0) noexcept
+{
+  return ptr(Size::Byte, base, disp);
+}
+
+
+/*!
+ * @brief 絶対アドレスを指すメモリオペランドを返す
+ *
+ * 変位は常に32bitで符号化され，命令の末尾に置かれる．
+ *
+ * @param [in] size  アクセスするサイズ
+ * @param [in] addr  アドレス
+ * @return メモリオペランド
+ */
+constexpr Mem
+absolutePtr(Size size, std::int32_t addr) noexcept
+{
+  return {Addressing::Absolute, 0, addr, size};
+}
+
+
+/*!
+ * @brief RIP 相対のメモリオペランドを返す
+ *
+ * 変位は常に32bitで符号化され，命令の末尾に置かれるので，後から書き換えられる．
+ *
+ * @param [in] size  アクセスするサイズ
+ * @param [in] disp  次の命令の先頭からの変位
+ * @return メモリオペランド
+ */
+constexpr Mem
+ripPtr(Size size, std::int32_t disp = 0) noexcept
+{
+  return {Addressing::RipRelative, 0, disp, size};
+}
+
+
+//! 2オペランドの算術命令 (値は ModR/M の reg フィールドで指定する拡張オペコード)
+enum class AluOp : std::uint8_t
+{
+  Add = 0,
+  Or = 1,
+  Adc = 2,
+  Sbb = 3,
+  And = 4,
+  Sub = 5,
+  Xor = 6,
+  Cmp = 7
+};
+
+
+//! シフト命令 (値は ModR/M の reg フィールドで指定する拡張オペコード)
+enum class ShiftOp : std::uint8_t
+{
+  Rol = 0,
+  Ror = 1,
+  Shl = 4,
+  Shr = 5,
+  Sar = 7
+};
+
+
+//! 条件 (値は Jcc / CMOVcc のオペコードの下位4bit)
+enum class Cond : std::uint8_t
+{
+  O, No, B, Ae, E, Ne, Be, A, S, Ns, P, Np, L, Ge, Le, G
+};
+
+
+/*!
+ * @brief ModR/M の reg フィールドでオペコードを拡張する単項演算命令の符号化
+ */
+struct UnaryOp
+{
+  //! 8bit オペランドのオペコード
+  std::uint8_t opcode8;
+  //! 32/64bit オペランドのオペコード
+  std::uint8_t opcode;
+  //! reg フィールドの値
+  std::uint8_t ext;
+};
+
+constexpr UnaryOp kInc{0xfe, 0xff, 0};
+constexpr UnaryOp kDec{0xfe, 0xff, 1};
+constexpr UnaryOp kNot{0xf6, 0xf7, 2};
+constexpr UnaryOp kNeg{0xf6, 0xf7, 3};
+
+
+/*!
+ * @brief SSE 命令の符号化 (0x0f のオペコード空間の命令)
+ *
+ * ModR/M の reg フィールドに SSE レジスタを，r/m フィールドにもう一方のオペランドを指定する．
+ */
+struct SseOp
+{
+  //! 必須接頭辞
+  std::uint8_t prefix;
+  //! 0x0f に続くオペコード
+  std::uint8_t opcode;
+};
+
+constexpr SseOp kMovdqaLoad{0x66, 0x6f};
+constexpr SseOp kMovdqaStore{0x66, 0x7f};
+constexpr SseOp kMovdquLoad{0xf3, 0x6f};
+constexpr SseOp kMovdquStore{0xf3, 0x7f};
+constexpr SseOp kMovqLoad{0xf3, 0x7e};
+constexpr SseOp kMovqStore{0x66, 0xd6};
+constexpr SseOp kPaddb{0x66, 0xfc};
+constexpr SseOp kPcmpeqb{0x66, 0x74};
+constexpr SseOp kPxor{0x66, 0xef};
+
+
+/*!
+ * @brief x86 / x64 の命令を符号化してバッファに書き込む
+ *
+ * 即値や変位の大きさ，レジスタの種類から最も短い形式 (imm8 / disp8，アキュムレータ専用の形式，
+ * x86 の1byteの inc / dec など) を選ぶので，バックエンドは命令の意味だけを指定すればよい．
+ * 後から書き換える即値や変位には，大きさによらず32bitの形式を用いる専用の関数を用いる．
+ *
+ * @tparam kMode  命令を実行するモード
+ */
+template <Mode kMode>
+class Encoder
+{
+public:
+  /*!
+   * @brief 書き込み先のバッファを指定して構築する
+   *
+   * @param [out] buf  書き込み先のバッファ
+   */
+  explicit Encoder(CodeBuffer& buf) noexcept
+    : buf_{buf}
+  {}
+
+  /*!
+   * @brief 現在の書き込み位置を返す
+   *
+   * @return 現在の書き込み位置
+   */
+  std::size_t
+  tell() const noexcept
+  {
+    return buf_.tell();
+  }
+
+  /*!
+   * @brief 2オペランドの算術命令 (op r/m, imm) を書き込む
+   *
+   * @param [in] op  命令の種類
+   * @param [in] dst  演算先
+   * @param [in] imm  即値 (8bit オペランドでは下位8bitのみ用いる)
+   */
+  void
+  alu(AluOp op, Reg dst, std::int32_t imm)
+  {
+    const auto ext = static_cast<std::uint8_t>(op);
+    if (dst.size != Size::Byte && isInt8(imm)) {
+      writeExtOp(0x83, ext, dst.size, dst);
+      writeAs<std::int8_t>(buf_, static_cast<std::int8_t>(imm));
+    } else if (dst.code == 0) {
+      // al / eax / rax 専用の形式は ModR/M が不要
+      writeAccumulatorOp(static_cast<std::uint8_t>(ext << 3 | 0x04), dst.size, imm);
+    } else {
+      writeExtOp(dst.size == Size::Byte ? 0x80 : 0x81, ext, dst.size, dst);
+      writeImm(dst.size, imm);
+    }
+  }
+
+  /*!
+   * @brief 2オペランドの算術命令 (op r/m, imm) を書き込む
+   *
+   * @param [in] op  命令の種類
+   * @param [in] dst  演算先
+   * @param [in] imm  即値 (8bit オペランドでは下位8bitのみ用いる)
+   */
+  void
+  alu(AluOp op, const Mem& dst, std::int32_t imm)
+  {
+    const auto ext = static_cast<std::uint8_t>(op);
+    if (dst.size != Size::Byte && isInt8(imm)) {
+      writeExtOp(0x83, ext, dst.size, dst);
+      writeAs<std::int8_t>(buf_, static_cast<std::int8_t>(imm));
+    } else {
+      writeExtOp(dst.size == Size::Byte ? 0x80 : 0x81, ext, dst.size, dst);
+      writeImm(dst.size, imm);
+    }
+  }
+
+  /*!
+   * @brief 2オペランドの算術命令 (op r/m, reg) を書き込む
+   *
+   * @param [in] op  命令の種類
+   * @param [in] dst  演算先
+   * @param [in] src  演算元
+   */
+  template <typename Rm>
+  void
+  alu(AluOp op, const Rm& dst, Reg src)
+  {
+    writeRegOp(static_cast<std::uint8_t>(static_cast<std::uint8_t>(op) << 3), src, dst);
+  }
+
+  /*!
+   * @brief 2オペランドの算術命令 (op reg, m) を書き込む
+   *
+   * @param [in] op  命令の種類
+   * @param [in] dst  演算先
+   * @param [in] src  演算元
+   */
+  void
+  alu(AluOp op, Reg dst, const Mem& src)
+  {
+    writeRegOp(static_cast<std::uint8_t>(static_cast<std::uint8_t>(op) << 3 | 0x02), dst, src);
+  }
+
+  /*!
+   * @brief add 命令を書き込む
+   *
+   * @param [in] dst  演算先
+   * @param [in] src  演算元 (レジスタ，メモリまたは即値)
+   */
+  template <typename Dst, typename Src>
+  void
+  add(const Dst& dst, const Src& src)
+  {
+    alu(AluOp::Add, dst, src);
+  }
+
+  /*!
+   * @brief sub 命令を書き込む
+   *
+   * @param [in] dst  演算先
+   * @param [in] src  演算元 (レジスタ，メモリまたは即値)
+   */
+  template <typename Dst, typename Src>
+  void
+  sub(const Dst& dst, const Src& src)
+  {
+    alu(AluOp::Sub, dst, src);
+  }
+
+  /*!
+   * @brief cmp 命令を書き込む
+   *
+   * @param [in] lhs  左辺
+   * @param [in] rhs  右辺 (レジスタ，メモリまたは即値)
+   */
+  template <typename Lhs, typename Rhs>
+  void
+  cmp(const Lhs& lhs, const Rhs& rhs)
+  {
+    alu(AluOp::Cmp, lhs, rhs);
+  }
+
+  /*!
+   * @brief test r/m, reg を書き込む
+   *
+   * @param [in] lhs  左辺
+   * @param [in] rhs  右辺
+   */
+  template <typename Rm>
+  void
+  test(const Rm& lhs, Reg rhs)
+  {
+    writeRegOp(0x84, rhs, lhs);
+  }
+
+  /*!
+   * @brief test reg, imm を書き込む
+   *
+   * @param [in] lhs  左辺
+   * @param [in] imm  即値 (8bit オペランドでは下位8bitのみ用いる)
+   */
+  void
+  test(Reg lhs, std::int32_t imm)
+  {
+    if (lhs.code == 0) {
+      writeAccumulatorOp(0xa8, lhs.size, imm);
+    } else {
+      writeExtOp(lhs.size == Size::Byte ? 0xf6 : 0xf7, 0, lhs.size, lhs);
+      writeImm(lhs.size, imm);
+    }
+  }
+
+  /*!
+   * @brief 単項演算命令を書き込む
+   *
+   * @param [in] op  命令の種類
+   * @param [in] dst  演算先
+   */
+  template <typename Rm>
+  void
+  unary(const UnaryOp& op, const Rm& dst)
+  {
+    writeExtOp(dst.size == Size::Byte ? op.opcode8 : op.opcode, op.ext, dst.size, dst);
+  }
+
+  /*!
+   * @brief inc 命令を書き込む
+   *
+   * @param [in] dst  演算先
+   */
+  template <typename Rm>
+  void
+  inc(const Rm& dst)
+  {
+    writeIncDec(kInc, dst);
+  }
+
+  /*!
+   * @brief dec 命令を書き込む
+   *
+   * @param [in] dst  演算先
+   */
+  template <typename Rm>
+  void
+  dec(const Rm& dst)
+  {
+    writeIncDec(kDec, dst);
+  }
+
+  /*!
+   * @brief シフト命令を書き込む
+   *
+   * @param [in] op  命令の種類
+   * @param [in] dst  演算先
+   * @param [in] count  シフト量
+   */
+  void
+  shift(ShiftOp op, Reg dst, std::uint8_t count)
+  {
+    const auto ext = static_cast<std::uint8_t>(op);
+    if (count == 1) {
+      writeExtOp(dst.size == Size::Byte ? 0xd0 : 0xd1, ext, dst.size, dst);
+    } else {
+      writeExtOp(dst.size == Size::Byte ? 0xc0 : 0xc1, ext, dst.size, dst);
+      writeAs<std::uint8_t>(buf_, count);
+    }
+  }
+
+  /*!
+   * @brief imul reg, r/m を書き込む
+   *
+   * @param [in] dst  演算先
+   * @param [in] src  演算元
+   */
+  void
+  imul(Reg dst, Reg src)
+  {
+    writeOp(0x00, {0x0f, 0xaf}, isWide(dst.size), dst.code, false, src);
+  }
+
+  /*!
+   * @brief imul reg, r/m, imm を書き込む
+   *
+   * @param [in] dst  演算先
+   * @param [in] src  演算元
+   * @param [in] imm  即値
+   */
+  void
+  imul(Reg dst, Reg src, std::int32_t imm)
+  {
+    if (isInt8(imm)) {
+      writeOp(0x00, {0x6b}, isWide(dst.size), dst.code, false, src);
+      writeAs<std::int8_t>(buf_, static_cast<std::int8_t>(imm));
+    } else {
+      writeOp(0x00, {0x69}, isWide(dst.size), dst.code, false, src);
+      writeAs<std::int32_t>(buf_, imm);
+    }
+  }
+
+  /*!
+   * @brief レジスタ間またはレジスタからメモリへの mov 命令を書き込む
+   *
+   * @param [in] dst  転送先
+   * @param [in] src  転送元
+   */
+  template <typename Rm>
+  void
+  mov(const Rm& dst, Reg src)
+  {
+    writeRegOp(0x88, src, dst);
+  }
+
+  /*!
+   * @brief メモリからレジスタへの mov 命令を書き込む
+   *
+   * @param [in] dst  転送先
+   * @param [in] src  転送元
+   */
+  void
+  mov(Reg dst, const Mem& src)
+  {
+    if (kMode == Mode::Bits32 && dst.code == 0 && src.addressing == Addressing::Absolute) {
+      // mov al, moffs / mov eax, moffs
+      writeAs<std::uint8_t>(buf_, dst.size == Size::Byte ? 0xa0 : 0xa1);
+      writeAs<std::int32_t>(buf_, src.disp);
+    } else {
+      writeRegOp(0x8a, dst, src);
+    }
+  }
+
+  /*!
+   * @brief 即値をメモリに書き込む mov 命令を書き込む
+   *
+   * @param [in] dst  転送先
+   * @param [in] imm  即値 (8bit オペランドでは下位8bitのみ用いる)
+   */
+  void
+  mov(const Mem& dst, std::int32_t imm)
+  {
+    writeExtOp(dst.size == Size::Byte ? 0xc6 : 0xc7, 0, dst.size, dst);
+    writeImm(dst.size, imm);
+  }
+
+  /*!
+   * @brief 即値をレジスタに書き込む mov 命令を書き込む
+   *
+   * 64bit レジスタへの32bitに収まる非負の値は，32bit レジスタへの転送 (上位32bitは0になる) で書き込む．
+   *
+   * @param [in] dst  転送先
+   * @param [in] imm  即値
+   */
+  void
+  mov(Reg dst, std::int64_t imm)
+  {
+    if (dst.size == Size::Byte) {
+      writeRex(false, 0, dst.code, needsRex(dst));
+      writeAs<std::uint8_t>(buf_, static_cast<std::uint8_t>(0xb0 | (dst.code & 0x07)));
+      writeAs<std::uint8_t>(buf_, static_cast<std::uint8_t>(imm));
+    } else if (dst.size == Size::Dword || (imm >= 0 && imm <= 0xffffffff)) {
+      writeRex(false, 0, dst.code, false);
+      writeAs<std::uint8_t>(buf_, static_cast<std::uint8_t>(0xb8 | (dst.code & 0x07)));
+      writeAs<std::uint32_t>(buf_, static_cast<std::uint32_t>(imm));
+    } else if (isInt32(imm)) {
+      writeExtOp(0xc7, 0, dst.size, dst);
+      writeAs<std::int32_t>(buf_, static_cast<std::int32_t>(imm));
+    } else {
+      // movabs
+      writeRex(true, 0, dst.code, false);
+      writeAs<std::uint8_t>(buf_, static_cast<std::uint8_t>(0xb8 | (dst.code & 0x07)));
+      writeAs<std::int64_t>(buf_, imm);
+    }
+  }
+
+  /*!
+   * @brief 後から書き換える32bitの即値をレジスタに書き込む mov 命令を書き込む
+   *
+   * 64bit レジスタの場合，即値は符号拡張される．
+   *
+   * @param [in] dst  転送先 (32/64bit)
+   * @param [in] imm  即値の初期値
+   * @return 即値の位置
+   */
+  std::size_t
+  movImm32(Reg dst, std::int32_t imm = 0)
+  {
+    if (dst.size == Size::Qword) {
+      writeExtOp(0xc7, 0, dst.size, dst);
+    } else {
+      writeRex(false, 0, dst.code, false);
+      writeAs<std::uint8_t>(buf_, static_cast<std::uint8_t>(0xb8 | (dst.code & 0x07)));
+    }
+    const auto pos = buf_.tell();
+    writeAs<std::int32_t>(buf_, imm);
+    return pos;
+  }
+
+  /*!
+   * @brief movzx reg, byte ptr m を書き込む
+   *
+   * @param [in] dst  転送先 (32/64bit)
+   * @param [in] src  転送元 (8bit)
+   */
+  void
+  movzx(Reg dst, const Mem& src)
+  {
+    writeOp(0x00, {0x0f, 0xb6}, isWide(dst.size), dst.code, false, src);
+  }
+
+  /*!
+   * @brief lea 命令を書き込む
+   *
+   * @param [in] dst  転送先
+   * @param [in] src  アドレスを求めるメモリオペランド
+   */
+  void
+  lea(Reg dst, const Mem& src)
+  {
+    writeOp(0x00, {0x8d}, isWide(dst.size), dst.code, false, src);
+  }
+
+  /*!
+   * @brief cmovcc 命令を書き込む
+   *
+   * @param [in] cond  条件
+   * @param [in] dst  転送先
+   * @param [in] src  転送元
+   */
+  void
+  cmov(Cond cond, Reg dst, Reg src)
+  {
+    writeOp(0x00, {0x0f, static_cast<std::uint8_t>(0x40 | static_cast<std::uint8_t>(cond))}, isWide(dst.size), dst.code, false, src);
+  }
+
+  /*!
+   * @brief push reg を書き込む
+   *
+   * @param [in] src  レジスタ (スタックのサイズのもの)
+   */
+  void
+  push(Reg src)
+  {
+    writeRex(false, 0, src.code, false);
+    writeAs<std::uint8_t>(buf_, static_cast<std::uint8_t>(0x50 | (src.code & 0x07)));
+  }
+
+  /*!
+   * @brief push m を書き込む
+   *
+   * @param [in] src  メモリオペランド (スタックのサイズで読み込まれる)
+   */
+  void
+  push(const Mem& src)
+  {
+    writeExtOp(0xff, 6, Size::Dword, src);
+  }
+
+  /*!
+   * @brief push imm を書き込む
+   *
+   * @param [in] imm  即値
+   */
+  void
+  push(std::int32_t imm)
+  {
+    if (isInt8(imm)) {
+      writeAs<std::uint8_t>(buf_, 0x6a);
+      writeAs<std::int8_t>(buf_, static_cast<std::int8_t>(imm));
+    } else {
+      writeAs<std::uint8_t>(buf_, 0x68);
+      writeAs<std::int32_t>(buf_, imm);
+    }
+  }
+
+  /*!
+   * @brief pop reg を書き込む
+   *
+   * @param [in] dst  レジスタ (スタックのサイズのもの)
+   */
+  void
+  pop(Reg dst)
+  {
+    writeRex(false, 0, dst.code, false);
+    writeAs<std::uint8_t>(buf_, static_cast<std::uint8_t>(0x58 | (dst.code & 0x07)));
+  }
+
+  /*!
+   * @brief 位置の決まっているジャンプ先への jmp 命令を書き込む (届くなら short jump にする)
+   *
+   * @param [in] target  ジャンプ先の位置
+   */
+  void
+  jmp(std::size_t target)
+  {
+    if (const auto disp = distance(target, 2); isInt8(disp)) {
+      writeAs<std::uint8_t>(buf_, 0xeb);
+      writeAs<std::int8_t>(buf_, static_cast<std::int8_t>(disp));
+    } else {
+      const auto nearDisp = static_cast<std::int32_t>(distance(target, 5));
+      writeAs<std::uint8_t>(buf_, 0xe9);
+      writeAs<std::int32_t>(buf_, nearDisp);
+    }
+  }
+
+  /*!
+   * @brief 位置の決まっているジャンプ先への jcc 命令を書き込む (届くなら short jump にする)
+   *
+   * @param [in] cond  条件
+   * @param [in] target  ジャンプ先の位置
+   */
+  void
+  jcc(Cond cond, std::size_t target)
+  {
+    if (const auto disp = distance(target, 2); isInt8(disp)) {
+      writeAs<std::uint8_t>(buf_, static_cast<std::uint8_t>(0x70 | static_cast<std::uint8_t>(cond)));
+      writeAs<std::int8_t>(buf_, static_cast<std::int8_t>(disp));
+    } else {
+      const auto nearDisp = static_cast<std::int32_t>(distance(target, 6));
+      writeBytes(buf_, {0x0f, static_cast<std::uint8_t>(0x80 | static_cast<std::uint8_t>(cond))});
+      writeAs<std::int32_t>(buf_, nearDisp);
+    }
+  }
+
+  /*!
+   * @brief ジャンプ先を後で書き込む short jump (jmp rel8) を書き込む
+   *
+   * @return 変位の位置
+   */
+  std::size_t
+  jmpShort()
+  {
+    writeAs<std::uint8_t>(buf_, 0xeb);
+    return writePlaceholder<std::int8_t>();
+  }
+
+  /*!
+   * @brief ジャンプ先を後で書き込む near jump (jmp rel32) を書き込む
+   *
+   * @return 変位の位置
+   */
+  std::size_t
+  jmpNear()
+  {
+    writeAs<std::uint8_t>(buf_, 0xe9);
+    return writePlaceholder<std::int32_t>();
+  }
+
+  /*!
+   * @brief ジャンプ先を後で書き込む short jump (jcc rel8) を書き込む
+   *
+   * @param [in] cond  条件
+   * @return 変位の位置
+   */
+  std::size_t
+  jccShort(Cond cond)
+  {
+    writeAs<std::uint8_t>(buf_, static_cast<std::uint8_t>(0x70 | static_cast<std::uint8_t>(cond)));
+    return writePlaceholder<std::int8_t>();
+  }
+
+  /*!
+   * @brief ジャンプ先を後で書き込む near jump (jcc rel32) を書き込む
+   *
+   * @param [in] cond  条件
+   * @return 変位の位置
+   */
+  std::size_t
+  jccNear(Cond cond)
+  {
+    writeBytes(buf_, {0x0f, static_cast<std::uint8_t>(0x80 | static_cast<std::uint8_t>(cond))});
+    return writePlaceholder<std::int32_t>();
+  }
+
+  /*!
+   * @brief 呼び出し先を後で書き込む call rel32 を書き込む
+   *
+   * @return 変位の位置
+   */
+  std::size_t
+  callNear()
+  {
+    writeAs<std::uint8_t>(buf_, 0xe8);
+    return writePlaceholder<std::int32_t>();
+  }
+
+  /*!
+   * @brief call r/m を書き込む
+   *
+   * @param [in] target  呼び出し先のアドレスを持つオペランド
+   */
+  template <typename Rm>
+  void
+  call(const Rm& target)
+  {
+    writeExtOp(0xff, 2, Size::Dword, target);
+  }
+
+  /*!
+   * @brief 書き込み済みの rel8 の変位を書き換える
+   *
+   * @param [in] pos  変位の位置
+   * @param [in] target  ジャンプ先の位置
+   */
+  void
+  patchRel8(std::size_t pos, std::size_t target)
+  {
+    patch<std::int8_t>(pos, target);
+  }
+
+  /*!
+   * @brief 書き込み済みの rel32 の変位を書き換える
+   *
+   * @param [in] pos  変位の位置
+   * @param [in] target  ジャンプ先の位置
+   */
+  void
+  patchRel32(std::size_t pos, std::size_t target)
+  {
+    patch<std::int32_t>(pos, target);
+  }
+
+  /*!
+   * @brief SSE 命令 (op xmm, xmm/m) を書き込む
+   *
+   * @param [in] op  命令の種類
+   * @param [in] reg  ModR/M の reg フィールドで指定する SSE レジスタ
+   * @param [in] rm  ModR/M の r/m フィールドで指定するオペランド
+   */
+  template <typename Rm>
+  void
+  sse(const SseOp& op, Xmm reg, const Rm& rm)
+  {
+    writeOp(op.prefix, {0x0f, op.opcode}, false, reg.code, false, rm);
+  }
+
+  /*!
+   * @brief pmovmskb reg, xmm を書き込む
+   *
+   * @param [in] dst  転送先 (32bit)
+   * @param [in] src  SSE レジスタ
+   */
+  void
+  pmovmskb(Reg dst, Xmm src)
+  {
+    writeOp(0x66, {0x0f, 0xd7}, false, dst.code, false, src);
+  }
+
+  /*!
+   * @brief 指定したサイズの nop を書き込む
+   *
+   * 実行される位置にも置くので，Intel のマニュアルで推奨されている複数バイトの nop を用いて命令数を抑える．
+   *
+   * @param [in] size  nop の合計サイズ (byte単位)
+   */
+  void
+  nop(std::size_t size)
+  {
+    static constexpr std::uint8_t kNops[][9] = {
+      {0x90},
+      {0x66, 0x90},
+      {0x0f, 0x1f, 0x00},
+      {0x0f, 0x1f, 0x40, 0x00},
+      {0x0f, 0x1f, 0x44, 0x00, 0x00},
+      {0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00},
+      {0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00},
+      {0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+      {0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00}
+    };
+    constexpr auto kMaxNopSize = std::size(kNops);
+    for (; size > kMaxNopSize; size -= kMaxNopSize) {
+      buf_.write(kNops[kMaxNopSize - 1], kMaxNopSize);
+    }
+    if (size > 0) {
+      buf_.write(kNops[size - 1], size);
+    }
+  }
+
+  //! ret を書き込む
+  void
+  ret()
+  {
+    writeAs<std::uint8_t>(buf_, 0xc3);
+  }
+
+  //! int3 を書き込む
+  void
+  int3()
+  {
+    writeAs<std::uint8_t>(buf_, 0xcc);
+  }
+
+  /*!
+   * @brief int imm8 を書き込む
+   *
+   * @param [in] vector  割り込み番号
+   */
+  void
+  interrupt(std::uint8_t vector)
+  {
+    writeBytes(buf_, {0xcd, vector});
+  }
+
+  //! syscall を書き込む (x64 のみ)
+  void
+  syscall()
+  {
+    writeBytes(buf_, {0x0f, 0x05});
+  }
+
+  //! rep stosb を書き込む
+  void
+  repStosb()
+  {
+    writeBytes(buf_, {0xf3, 0xaa});
+  }
+
+private:
+  //! 書き込み先のバッファ
+  CodeBuffer& buf_;
+
+  /*!
+   * @brief 値が8bitの符号付き整数に収まるかどうかを返す
+   *
+   * @param [in] x  値
+   * @return 収まるなら true
+   */
+  static constexpr bool
+  isInt8(std::int64_t x) noexcept
+  {
+    return x == static_cast<std::int8_t>(x);
+  }
+
+  /*!
+   * @brief 値が32bitの符号付き整数に収まるかどうかを返す
+   *
+   * @param [in] x  値
+   * @return 収まるなら true
+   */
+  static constexpr bool
+  isInt32(std::int64_t x) noexcept
+  {
+    return x == static_cast<std::int32_t>(x);
+  }
+
+  /*!
+   * @brief REX.W が必要なサイズかどうかを返す
+   *
+   * @param [in] size  オペランドのサイズ
+   * @return REX.W が必要なら true
+   */
+  static constexpr bool
+  isWide(Size size) noexcept
+  {
+    return kMode == Mode::Bits64 && size == Size::Qword;
+  }
+
+  /*!
+   * @brief spl, bpl, sil, dil のように，REX 接頭辞がないと指定できないレジスタかどうかを返す
+   *
+   * @param [in] reg  レジスタ
+   * @return REX 接頭辞が必要なら true
+   */
+  static constexpr bool
+  needsRex(Reg reg) noexcept
+  {
+    return reg.size == Size::Byte && !reg.isHighByte && reg.code >= 4 && reg.code < 8;
+  }
+
+  static constexpr bool
+  needsRex(Xmm) noexcept
+  {
+    return false;
+  }
+
+  static constexpr bool
+  needsRex(const Mem&) noexcept
+  {
+    return false;
+  }
+
+  /*!
+   * @brief ModR/M の r/m フィールドに指定するレジスタ番号を返す
+   *
+   * @param [in] rm  オペランド
+   * @return レジスタ番号 (REX.B で拡張する上位bitを含む)
+   */
+  static constexpr std::uint8_t
+  rmCode(Reg rm) noexcept
+  {
+    return rm.code;
+  }
+
+  static constexpr std::uint8_t
+  rmCode(Xmm rm) noexcept
+  {
+    return rm.code;
+  }
+
+  static constexpr std::uint8_t
+  rmCode(const Mem& rm) noexcept
+  {
+    return rm.addressing == Addressing::Base ? rm.base : 0;
+  }
+
+  /*!
+   * @brief 現在の位置に置く命令から指定した位置への変位を返す
+   *
+   * @param [in] target  ジャンプ先の位置
+   * @param [in] size  命令のサイズ
+   * @return 変位
+   */
+  std::int64_t
+  distance(std::size_t target, std::size_t size) const noexcept
+  {
+    return static_cast<std::int64_t>(target) - static_cast<std::int64_t>(buf_.tell() + size);
+  }
+
+  /*!
+   * @brief 後で書き換える0を書き込む
+   *
+   * @return 書き込んだ位置
+   */
+  template <typename T>
+  std::size_t
+  writePlaceholder()
+  {
+    const auto pos = buf_.tell();
+    writeAs<T>(buf_, 0);
+    return pos;
+  }
+
+  /*!
+   * @brief 書き込み済みの変位を書き換える (書き込み位置は元に戻す)
+   *
+   * @param [in] pos  変位の位置
+   * @param [in] target  ジャンプ先の位置
+   */
+  template <typename T>
+  void
+  patch(std::size_t pos, std::size_t target)
+  {
+    const auto end = buf_.tell();
+    buf_.seek(pos);
+    writeAs<T>(buf_, static_cast<T>(static_cast<std::int64_t>(target) - static_cast<std::int64_t>(pos + sizeof(T))));
+    buf_.seek(end);
+  }
+
+  /*!
+   * @brief 必要であれば REX 接頭辞を書き込む
+   *
+   * @param [in] isWide  REX.W を立てるかどうか
+   * @param [in] reg  ModR/M の reg フィールドのレジスタ番号
+   * @param [in] rm  ModR/M の r/m フィールド (またはオペコードに埋め込む) レジスタ番号
+   * @param [in] isForced  拡張するビットがなくても書き込むかどうか
+   */
+  void
+  writeRex(bool isWide, std::uint8_t reg, std::uint8_t rm, bool isForced)
+  {
+    const auto rex = static_cast<std::uint8_t>(0x40 | (isWide ? 0x08 : 0x00) | (reg >> 3) << 2 | rm >> 3);
+    if (rex != 0x40 || isForced) {
+      writeAs<std::uint8_t>(buf_, rex);
+    }
+  }
+
+  /*!
+   * @brief ModR/M (と SIB，変位) を書き込む
+   *
+   * @param [in] reg  reg フィールドの値
+   * @param [in] rm  r/m フィールドで指定するオペランド
+   */
+  template <typename R>
+  void
+  writeModRm(std::uint8_t reg, R rm)
+  {
+    writeAs<std::uint8_t>(buf_, static_cast<std::uint8_t>(0xc0 | (reg & 0x07) << 3 | (rm.code & 0x07)));
+  }
+
+  void
+  writeModRm(std::uint8_t reg, const Mem& rm)
+  {
+    const auto regField = static_cast<std::uint8_t>((reg & 0x07) << 3);
+    if (rm.addressing == Addressing::RipRelative) {
+      writeAs<std::uint8_t>(buf_, static_cast<std::uint8_t>(0x05 | regField));
+    } else if (rm.addressing == Addressing::Absolute) {
+      if constexpr (kMode == Mode::Bits64) {
+        // x64 では mod=00, r/m=101 が RIP 相対になるので，SIB でベースなしを指定する
+        writeBytes(buf_, {static_cast<std::uint8_t>(0x04 | regField), 0x25});
+      } else {
+        writeAs<std::uint8_t>(buf_, static_cast<std::uint8_t>(0x05 | regField));
+      }
+    } else {
+      // ebp / rbp / r13 は変位なしで指定できない
+      const auto base = static_cast<std::uint8_t>(rm.base & 0x07);
+      const std::uint8_t mod = rm.disp == 0 && base != 0x05 ? 0x00 : isInt8(rm.disp) ? 0x40 : 0x80;
+      writeAs<std::uint8_t>(buf_, static_cast<std::uint8_t>(mod | regField | base));
+      if (base == 0x04) {
+        // esp / rsp / r12 は SIB でのみ指定できる
+        writeAs<std::uint8_t>(buf_, 0x24);
+      }
+      if (mod == 0x40) {
+        writeAs<std::int8_t>(buf_, static_cast<std::int8_t>(rm.disp));
+      }
+      if (mod != 0x80) {
+        return;
+      }
+    }
+    writeAs<std::int32_t>(buf_, rm.disp);
+  }
+
+  /*!
+   * @brief 接頭辞，オペコード，ModR/M (と SIB，変位) からなる命令を書き込む
+   *
+   * @param [in] prefix  必須接頭辞 (0なら付けない)
+   * @param [in] opcode  オペコード
+   * @param [in] isWide  REX.W を立てるかどうか
+   * @param [in] reg  ModR/M の reg フィールドの値 (レジスタ番号または拡張オペコード)
+   * @param [in] isRexForced  reg フィールドのレジスタが REX 接頭辞を必要とするかどうか
+   * @param [in] rm  ModR/M の r/m フィールドで指定するオペランド
+   */
+  template <typename Rm>
+  void
+  writeOp(std::uint8_t prefix, std::initializer_list<std::uint8_t> opcode, bool isWide, std::uint8_t reg, bool isRexForced, const Rm& rm)
+  {
+    if (prefix != 0x00) {
+      writeAs<std::uint8_t>(buf_, prefix);
+    }
+    writeRex(isWide, reg, rmCode(rm), isRexForced || needsRex(rm));
+    buf_.write(opcode.begin(), opcode.size());
+    writeModRm(reg, rm);
+  }
+
+  /*!
+   * @brief オペコード (8bit オペランドのもの，他のサイズは +1)，reg フィールドのレジスタ，r/m からなる命令を書き込む
+   *
+   * @param [in] opcode8  8bit オペランドのオペコード
+   * @param [in] reg  reg フィールドのレジスタ (オペランドのサイズを決める)
+   * @param [in] rm  ModR/M の r/m フィールドで指定するオペランド
+   */
+  template <typename Rm>
+  void
+  writeRegOp(std::uint8_t opcode8, Reg reg, const Rm& rm)
+  {
+    const auto opcode = static_cast<std::uint8_t>(reg.size == Size::Byte ? opcode8 : opcode8 + 1);
+    writeOp(0x00, {opcode}, isWide(reg.size), reg.code, needsRex(reg), rm);
+  }
+
+  /*!
+   * @brief reg フィールドでオペコードを拡張する命令を書き込む
+   *
+   * @param [in] opcode  オペコード
+   * @param [in] ext  reg フィールドの値
+   * @param [in] size  オペランドのサイズ
+   * @param [in] rm  ModR/M の r/m フィールドで指定するオペランド
+   */
+  template <typename Rm>
+  void
+  writeExtOp(std::uint8_t opcode, std::uint8_t ext, Size size, const Rm& rm)
+  {
+    writeOp(0x00, {opcode}, isWide(size), ext, false, rm);
+  }
+
+  /*!
+   * @brief al / eax / rax 専用の形式の命令 (op acc, imm) を書き込む
+   *
+   * @param [in] opcode8  8bit オペランドのオペコード (他のサイズは +1)
+   * @param [in] size  オペランドのサイズ
+   * @param [in] imm  即値
+   */
+  void
+  writeAccumulatorOp(std::uint8_t opcode8, Size size, std::int32_t imm)
+  {
+    writeRex(isWide(size), 0, 0, false);
+    writeAs<std::uint8_t>(buf_, static_cast<std::uint8_t>(size == Size::Byte ? opcode8 : opcode8 + 1));
+    writeImm(size, imm);
+  }
+
+  /*!
+   * @brief オペランドのサイズに応じた即値 (8bit または32bit) を書き込む
+   *
+   * @param [in] size  オペランドのサイズ
+   * @param [in] imm  即値
+   */
+  void
+  writeImm(Size size, std::int32_t imm)
+  {
+    if (size == Size::Byte) {
+      writeAs<std::uint8_t>(buf_, static_cast<std::uint8_t>(imm));
+    } else {
+      writeAs<std::int32_t>(buf_, imm);
+    }
+  }
+
+  /*!
+   * @brief inc / dec 命令を書き込む (x86 の32bit レジスタには1byteの形式を用いる)
+   *
+   * @param [in] op  kInc または kDec
+   * @param [in] dst  演算先
+   */
+  template <typename Rm>
+  void
+  writeIncDec(const UnaryOp& op, const Rm& dst)
+  {
+    if constexpr (kMode == Mode::Bits32 && std::is_same_v<Rm, Reg>) {
+      if (dst.size == Size::Dword) {
+        writeAs<std::uint8_t>(buf_, static_cast<std::uint8_t>(0x40 | op.ext << 3 | dst.code));
+        return;
+      }
+    }
+    unary(op, dst);
+  }
+};
+}  // namespace x86
+}  // namespace bfc
+
+
+#endif  // X86ENCODER_HPP
@@ -0,0 +1,209 @@
+/*!
+ * @brief バッチコンパイルのテスト
+ *
+ * 一時ディレクトリにソースファイルを用意して compileBatch() でまとめてコンパイルし，
+ * 各出力が compile() の結果と一致すること，失敗した組のみが診断メッセージ付きで報告されることを確かめる．
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <cstddef>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "batch.hpp"
+#include "bfcompiler.hpp"
+
+
+namespace
+{
+//! バッチコンパイルに用いるスレッド数 (仕事の奪い合いが起きるように組の数より少なくする)
+constexpr unsigned int kNThreads = 3;
+//! コンパイルする組の数
+constexpr std::size_t kNEntries = 16;
+
+
+/*!
+ * @brief ファイル全体を読み込む
+ *
+ * @param [in] filePath  読み込むファイルのパス
+ * @return ファイルの内容 (存在しない場合は空文字列)
+ */
+inline std::string
+readWholeFile(const std::filesystem::path& filePath)
+{
+  std::ifstream ifs{filePath, std::ios::binary};
+  return std::string{std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{}};
+}
+
+
+/*!
+ * @brief ファイルに文字列を書き出す
+ *
+ * @param [in] filePath  書き出すファイルのパス
+ * @param [in] content  書き出す内容
+ */
+inline void
+writeWholeFile(const std::filesystem::path& filePath, const std::string& content)
+{
+  std::ofstream{filePath, std::ios::binary} << content;
+}
+
+
+/*!
+ * @brief i 番目の組のソースコードを返す
+ *
+ * 7番目の組のみ括弧が対応しておらず，コンパイルに失敗する．
+ * 13番目の組のみ停止しないループを含み，警告が出る．
+ *
+ * @param [in] i  組の番号
+ * @return ソースコード
+ */
+inline std::string
+makeSource(std::size_t i)
+{
+  if (i == 7) {
+    return "+[.";
+  }
+  if (i == 13) {
+    return "++++++[----]";
+  }
+  return std::string(i + 1, '+') + "[>" + std::string(i % 5 + 1, '+') + "<-]>.";
+}
+
+
+/*!
+ * @brief 入出力の組の一覧の読み込みを確かめる
+ *
+ * @return 失敗した理由 (成功した場合は空文字列)
+ */
+inline std::string
+testReadBatchList()
+{
+  std::vector<bfc::BatchEntry> entries;
+  std::istringstream iss{"# comment\n\na.bf a.out\n  b.bf\tb.out  \n"};
+  if (bfc::readBatchList(iss, entries) != 0) {
+    return "a well-formed list is rejected";
+  }
+  if (entries.size() != 2 || entries[0].srcFilePath != "a.bf" || entries[0].dstFilePath != "a.out"
+      || entries[1].srcFilePath != "b.bf" || entries[1].dstFilePath != "b.out") {
+    return "entries are not read as written";
+  }
+  std::istringstream malformed{"a.bf a.out\nb.bf\n"};
+  if (bfc::readBatchList(malformed, entries) != 2) {
+    return "the line number of a malformed line is not reported";
+  }
+  std::istringstream extra{"a.bf a.out extra\n"};
+  if (bfc::readBatchList(extra, entries) != 1) {
+    return "a line with an extra field is accepted";
+  }
+  return std::string{};
+}
+
+
+/*!
+ * @brief 複数のソースファイルをまとめてコンパイルした結果を確かめる
+ *
+ * @param [in] tmpDir  ソースファイルと出力を置く一時ディレクトリ
+ * @return 失敗した理由 (成功した場合は空文字列)
+ */
+inline std::string
+testCompileBatch(const std::filesystem::path& tmpDir)
+{
+  bfc::Options options;
+  options.target = bfc::Target::ElfX64;
+
+  std::vector<bfc::BatchEntry> entries;
+  for (std::size_t i = 0; i < kNEntries; i++) {
+    bfc::BatchEntry entry;
+    entry.srcFilePath = (tmpDir / (std::to_string(i) + ".bf")).string();
+    entry.dstFilePath = (tmpDir / (std::to_string(i) + ".out")).string();
+    // 11番目の組のソースファイルは作らずに，読み込みの失敗を確かめる
+    if (i != 11) {
+      writeWholeFile(entry.srcFilePath, makeSource(i));
+    }
+    entries.push_back(std::move(entry));
+  }
+
+  const auto results = bfc::compileBatch(entries, options, nullptr, kNThreads);
+  if (results.size() != entries.size()) {
+    return "the number of results differs from the number of entries";
+  }
+  for (std::size_t i = 0; i < kNEntries; i++) {
+    const auto name = "entry " + std::to_string(i);
+    if (i == 7 || i == 11) {
+      if (results[i].isSucceeded || results[i].message.empty()) {
+        return name + " is expected to fail with a message";
+      }
+      if (std::filesystem::exists(entries[i].dstFilePath)) {
+        return name + " failed but its output exists";
+      }
+      continue;
+    }
+    if (!results[i].isSucceeded) {
+      return name + " failed: " + results[i].message;
+    }
+    std::vector<std::string> warnings;
+    if (i == 13) {
+      warnings.push_back("Loop at offset 6 never terminates");
+    }
+    if (results[i].warnings != warnings) {
+      return name + " has unexpected warnings";
+    }
+    const auto image = bfc::compile(makeSource(i), options);
+    if (readWholeFile(entries[i].dstFilePath) != std::string{image.begin(), image.end()}) {
+      return name + " differs from the output of compile()";
+    }
+  }
+  return std::string{};
+}
+}  // namespace
+
+
+/*!
+ * @brief このプログラムのエントリポイント
+ *
+ * @return  終了ステータス (全てのテストに成功した場合は0)
+ */
+int
+main()
+{
+  const auto tmpDir = std::filesystem::temp_directory_path() / ("bfbatchtest-" + std::to_string(::getpid()));
+  std::filesystem::create_directories(tmpDir);
+
+  struct
+  {
+    const char* name;
+    std::string (*run)(const std::filesystem::path&);
+  } tests[] = {
+    {"readBatchList", [](const std::filesystem::path&) { return testReadBatchList(); }},
+    {"compileBatch", testCompileBatch},
+  };
+  std::size_t nFailed = 0;
+  for (const auto& test : tests) {
+    std::string message;
+    try {
+      message = test.run(tmpDir);
+    } catch (const std::exception& e) {
+      message = e.what();
+    }
+    if (message.empty()) {
+      std::cout << "PASS " << test.name << "\n";
+    } else {
+      std::cout << "FAIL " << test.name << ": " << message << "\n";
+      nFailed++;
+    }
+  }
+  std::filesystem::remove_all(tmpDir);
+  std::cout << nFailed << " failed" << std::endl;
+  return nFailed == 0 ? 0 : 1;
+}
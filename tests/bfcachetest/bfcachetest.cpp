@@ -0,0 +1,219 @@
+/*!
+ * @brief コンパイル結果のキャッシュのテスト
+ *
+ * 一時ディレクトリをキャッシュディレクトリとして compileFile() を繰り返し呼び，
+ * 同じ命令列とオプションの組のみがキャッシュから配置され，その内容がコンパイルした結果と一致することを確かめる．
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "batch.hpp"
+#include "bfcompiler.hpp"
+#include "cache.hpp"
+#include "source.hpp"
+
+
+namespace
+{
+/*!
+ * @brief ファイル全体を読み込む
+ *
+ * @param [in] filePath  読み込むファイルのパス
+ * @return ファイルの内容 (存在しない場合は空文字列)
+ */
+inline std::string
+readWholeFile(const std::filesystem::path& filePath)
+{
+  std::ifstream ifs{filePath, std::ios::binary};
+  return std::string{std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{}};
+}
+
+
+/*!
+ * @brief ファイルに文字列を書き出す
+ *
+ * @param [in] filePath  書き出すファイルのパス
+ * @param [in] content  書き出す内容
+ */
+inline void
+writeWholeFile(const std::filesystem::path& filePath, const std::string& content)
+{
+  std::ofstream{filePath, std::ios::binary} << content;
+}
+
+
+/*!
+ * @brief キャッシュを用いてソースコードをコンパイルする
+ *
+ * @param [in] tmpDir  ソースファイルと出力を置く一時ディレクトリ
+ * @param [in] source  Brainf**kのソースコード
+ * @param [in] options  コンパイルオプション
+ * @param [in] cache  キャッシュ
+ * @param [out] result  結果
+ * @return 失敗した理由 (成功した場合は空文字列)
+ */
+inline std::string
+compileWithCache(
+  const std::filesystem::path& tmpDir,
+  const std::string& source,
+  const bfc::Options& options,
+  const bfc::CompileCache& cache,
+  bfc::BatchResult& result)
+{
+  const bfc::BatchEntry entry{(tmpDir / "source.bf").string(), (tmpDir / "a.out").string()};
+  writeWholeFile(entry.srcFilePath, source);
+  bfc::NormalizedSource sourceBuffer;
+  std::vector<std::uint8_t> image;
+  result = bfc::compileFile(entry, options, &cache, sourceBuffer, image);
+  if (!result.isSucceeded) {
+    return "compileFile() failed: " + result.message;
+  }
+  const auto expected = bfc::compile(source, options);
+  if (readWholeFile(entry.dstFilePath) != std::string{expected.begin(), expected.end()}) {
+    return "the output differs from the output of compile()";
+  }
+  return std::string{};
+}
+
+
+/*!
+ * @brief キャッシュの有無とキーの一致による配置の可否を確かめる
+ *
+ * @param [in] tmpDir  ソースファイルと出力を置く一時ディレクトリ
+ * @return 失敗した理由 (成功した場合は空文字列)
+ */
+inline std::string
+testHitAndMiss(const std::filesystem::path& tmpDir)
+{
+  const bfc::CompileCache cache{(tmpDir / "cache").string()};
+  bfc::Options options;
+  options.target = bfc::Target::ElfX64;
+  const std::string source{"++++++++[>++++++++<-]>+."};
+
+  bfc::BatchResult result;
+  const std::pair<std::string, bool> steps[] = {
+    // 初回はキャッシュに無い
+    {source, false},
+    // 同じソースとオプションなら配置する
+    {source, true},
+    // 命令の後ろのコメントのみが異なる場合も同じ命令列なので配置する
+    {source + " prints 'A'\n", true},
+    // 命令列が異なれば配置しない
+    {source + ".", false},
+  };
+  for (std::size_t i = 0; i < std::size(steps); i++) {
+    if (auto message = compileWithCache(tmpDir, steps[i].first, options, cache, result); !message.empty()) {
+      return "step " + std::to_string(i) + ": " + message;
+    }
+    if (result.isCacheHit != steps[i].second) {
+      return "step " + std::to_string(i) + ": expected a cache " + (steps[i].second ? "hit" : "miss");
+    }
+  }
+
+  // 出力形式が異なれば配置しない
+  options.isObject = true;
+  if (auto message = compileWithCache(tmpDir, source, options, cache, result); !message.empty()) {
+    return "object: " + message;
+  }
+  if (result.isCacheHit) {
+    return "the executable is reused for an object file";
+  }
+  return std::string{};
+}
+
+
+/*!
+ * @brief 警告メッセージがバイナリとともに保存され，配置した際に返されることを確かめる
+ *
+ * @param [in] tmpDir  ソースファイルと出力を置く一時ディレクトリ
+ * @return 失敗した理由 (成功した場合は空文字列)
+ */
+inline std::string
+testWarnings(const std::filesystem::path& tmpDir)
+{
+  const bfc::CompileCache cache{(tmpDir / "cache").string()};
+  bfc::Options options;
+  options.target = bfc::Target::ElfX64;
+  const std::vector<std::uint8_t> image{0x7f, 'E', 'L', 'F'};
+  const std::vector<std::string> warnings{"first warning", "second warning"};
+  const auto dstFilePath = (tmpDir / "warnings.out").string();
+
+  const auto key = cache.makeKey(bfc::normalizeSource("+[-]"), options);
+  if (!cache.store(key, image, false, warnings)) {
+    return "store() failed";
+  }
+  std::vector<std::string> restored{"stale"};
+  if (!cache.restore(key, dstFilePath, false, restored)) {
+    return "restore() failed";
+  }
+  if (restored != warnings) {
+    return "the warnings are not restored as stored";
+  }
+  if (readWholeFile(dstFilePath) != std::string{image.begin(), image.end()}) {
+    return "the restored image differs from the stored one";
+  }
+
+  const auto otherKey = cache.makeKey(bfc::normalizeSource("+[--]"), options);
+  if (!cache.store(otherKey, image, false, {})) {
+    return "store() without warnings failed";
+  }
+  if (!cache.restore(otherKey, dstFilePath, false, restored) || !restored.empty()) {
+    return "warnings are restored for an entry stored without them";
+  }
+  return std::string{};
+}
+}  // namespace
+
+
+/*!
+ * @brief このプログラムのエントリポイント
+ *
+ * @return  終了ステータス (全てのテストに成功した場合は0)
+ */
+int
+main()
+{
+  const auto tmpDir = std::filesystem::temp_directory_path() / ("bfcachetest-" + std::to_string(::getpid()));
+  std::filesystem::create_directories(tmpDir);
+
+  struct
+  {
+    const char* name;
+    std::string (*run)(const std::filesystem::path&);
+  } tests[] = {
+    {"hit and miss", testHitAndMiss},
+    {"warnings", testWarnings},
+  };
+  std::size_t nFailed = 0;
+  for (const auto& test : tests) {
+    std::string message;
+    try {
+      message = test.run(tmpDir);
+    } catch (const std::exception& e) {
+      message = e.what();
+    }
+    if (message.empty()) {
+      std::cout << "PASS " << test.name << "\n";
+    } else {
+      std::cout << "FAIL " << test.name << ": " << message << "\n";
+      nFailed++;
+    }
+  }
+  std::filesystem::remove_all(tmpDir);
+  std::cout << nFailed << " failed" << std::endl;
+  return nFailed == 0 ? 0 : 1;
+}
@@ -0,0 +1,583 @@
+/*!
+ * @brief 生成した実行ファイルの出力を参照インタプリタと比較する差分テスト
+ *
+ * コーパスのディレクトリにある各 *.bf をコンパイルして実行し，標準出力を参照インタプリタの出力と比較する．
+ * 同名の *.in があれば標準入力として与える．
+ * 報告される警告メッセージは，同名の *.warnings に1行に1つずつ書いたものと比較する (無ければ警告が無いこと)．
+ * 参照インタプリタが停止しないと判断したプログラムは，生成した実行ファイルも制限時間内に停止せず，
+ * それまでの出力が参照インタプリタの出力の先頭と一致することを確かめる．
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bfcompiler.hpp"
+
+
+namespace
+{
+//! 参照インタプリタのテープのセル数 (生成コードと同じ)
+constexpr std::size_t kTapeSize = 0x10000;
+//! 参照インタプリタが停止しないと判断するまでの実行命令数
+constexpr std::uint64_t kMaxSteps = 100000000;
+//! 停止するプログラムの実行ファイルの制限時間
+constexpr std::chrono::milliseconds kHaltTimeout{10000};
+//! 停止しないプログラムの実行ファイルを打ち切るまでの時間
+constexpr std::chrono::milliseconds kNonHaltTimeout{1000};
+
+
+/*!
+ * @brief コマンドラインで指定された設定
+ */
+struct TestConfig
+{
+  //! コンパイルオプション
+  bfc::Options options{};
+  //! コーパスのディレクトリ
+  std::string corpusDir{};
+  //! 全てのプログラムで1つの FragmentCache を共有して差分コンパイルするかどうか
+  bool isFragmentCacheUsed = false;
+};
+
+
+/*!
+ * @brief 参照インタプリタの実行結果
+ */
+struct InterpretResult
+{
+  //! 標準出力に書き込んだ内容
+  std::string output{};
+  //! kMaxSteps 以内に停止したかどうか
+  bool isHalted = false;
+};
+
+
+/*!
+ * @brief 実行ファイルの実行結果
+ */
+struct RunResult
+{
+  //! 標準出力に書き込んだ内容
+  std::string output{};
+  //! 制限時間内に停止せず打ち切ったかどうか
+  bool isTimedOut = false;
+  //! 終了させたシグナルの番号 (シグナルで終了しなかった場合は0)
+  int signal = 0;
+};
+
+
+/*!
+ * @brief 使い方を表示する
+ *
+ * @param [in] progName  プログラム名
+ */
+inline void
+showUsage(const char* progName)
+{
+  std::cout << "Usage: " << progName << " [OPTIONS] CORPUS_DIR\n"
+            << "Compile every *.bf in CORPUS_DIR, run it and compare its output with a reference interpreter.\n"
+            << "\n"
+            << "Options:\n"
+            << "  --target=FORMAT  Output format: elf64 or elf32 (default: elf64)\n"
+            << "  --tune=CPU       Lay out code for CPU: generic, intel or amd (x64 ELF only)\n"
+            << "  --tiny           Emit minimal executables\n"
+            << "  -j N             Number of code generation threads\n"
+            << "  --fragment-cache Compile every program twice through one shared fragment cache\n"
+            << "  -h, --help       Show this help and exit\n";
+}
+
+
+/*!
+ * @brief コマンドライン引数を解析する
+ *
+ * @param [in] argc  コマンドライン引数の数
+ * @param [in] argv  コマンドライン引数
+ * @param [out] config  解析結果の格納先
+ * @return 続けてテストを行う場合は -1，そうでなければ終了ステータス
+ */
+inline int
+parseArguments(int argc, char* argv[], TestConfig& config)
+{
+  for (int i = 1; i < argc; i++) {
+    const std::string_view arg{argv[i]};
+    if (arg == "-h" || arg == "--help") {
+      showUsage(argv[0]);
+      return 0;
+    } else if (arg.substr(0, 9) == "--target=") {
+      // 実行して確かめるので，この計算機で実行できる ELF のみを受け付ける
+      const auto name = arg.substr(9);
+      if (name == "elf64") {
+        config.options.target = bfc::Target::ElfX64;
+      } else if (name == "elf32") {
+        config.options.target = bfc::Target::ElfX86;
+      } else {
+        std::cerr << "Unsupported target: " << name << std::endl;
+        return 1;
+      }
+    } else if (arg.substr(0, 7) == "--tune=") {
+      const auto name = arg.substr(7);
+      if (name == "generic") {
+        config.options.tune = bfc::Tune::Generic;
+      } else if (name == "intel") {
+        config.options.tune = bfc::Tune::Intel;
+      } else if (name == "amd") {
+        config.options.tune = bfc::Tune::Amd;
+      } else {
+        std::cerr << "Unknown CPU for --tune: " << name << std::endl;
+        return 1;
+      }
+    } else if (arg == "--tiny") {
+      config.options.isTiny = true;
+    } else if (arg == "-j") {
+      if (++i >= argc) {
+        std::cerr << "Option -j requires an argument" << std::endl;
+        return 1;
+      }
+      config.options.nThreads = static_cast<unsigned int>(std::stoul(argv[i]));
+    } else if (arg == "--fragment-cache") {
+      config.isFragmentCacheUsed = true;
+    } else if (!arg.empty() && arg[0] == '-') {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      return 1;
+    } else {
+      config.corpusDir = arg;
+    }
+  }
+  if (config.corpusDir.empty()) {
+    showUsage(argv[0]);
+    return 1;
+  }
+  return -1;
+}
+
+
+/*!
+ * @brief ファイル全体を読み込む
+ *
+ * @param [in] filePath  読み込むファイルのパス
+ * @return ファイルの内容 (存在しない場合は空文字列)
+ */
+inline std::string
+readWholeFile(const std::filesystem::path& filePath)
+{
+  std::ifstream ifs{filePath, std::ios::binary};
+  return std::string{std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{}};
+}
+
+
+/*!
+ * @brief 1行に1つずつ書かれた警告メッセージを読み込む
+ *
+ * @param [in] filePath  読み込むファイルのパス
+ * @return 警告メッセージ (ファイルが存在しない場合は空)
+ */
+inline std::vector<std::string>
+readWarnings(const std::filesystem::path& filePath)
+{
+  std::vector<std::string> warnings;
+  std::ifstream ifs{filePath};
+  for (std::string line; std::getline(ifs, line);) {
+    if (!line.empty()) {
+      warnings.push_back(line);
+    }
+  }
+  return warnings;
+}
+
+
+/*!
+ * @brief 参照インタプリタでソースコードを実行する
+ *
+ * 生成コードと同じく，セルは8bitで桁あふれし，EOF ではセルの値を変更しない．
+ * 最適化を一切行わず，1命令ずつ素朴に実行する．
+ *
+ * @param [in] source  Brainf**kのソースコード
+ * @param [in] input  標準入力として与える内容
+ * @return 実行結果
+ * @throw std::runtime_error  括弧が対応していない場合，またはテープの範囲外にアクセスした場合
+ */
+inline InterpretResult
+interpret(std::string_view source, std::string_view input)
+{
+  std::vector<std::size_t> jumps(source.size());
+  std::vector<std::size_t> stack;
+  for (std::size_t i = 0; i < source.size(); i++) {
+    if (source[i] == '[') {
+      stack.push_back(i);
+    } else if (source[i] == ']') {
+      if (stack.empty()) {
+        throw std::runtime_error{"Unmatched ']'"};
+      }
+      jumps[i] = stack.back();
+      jumps[stack.back()] = i;
+      stack.pop_back();
+    }
+  }
+  if (!stack.empty()) {
+    throw std::runtime_error{"Unmatched '['"};
+  }
+
+  InterpretResult result;
+  std::vector<std::uint8_t> tape(kTapeSize);
+  std::size_t ptr = 0;
+  std::size_t inputPos = 0;
+  std::uint64_t nSteps = 0;
+  for (std::size_t pc = 0; pc < source.size(); pc++) {
+    if (++nSteps > kMaxSteps) {
+      return result;
+    }
+    switch (source[pc]) {
+      case '+':
+        tape[ptr]++;
+        break;
+      case '-':
+        tape[ptr]--;
+        break;
+      case '>':
+        if (++ptr == tape.size()) {
+          throw std::runtime_error{"Pointer moved past the end of the tape"};
+        }
+        break;
+      case '<':
+        if (ptr == 0) {
+          throw std::runtime_error{"Pointer moved before the start of the tape"};
+        }
+        ptr--;
+        break;
+      case '.':
+        result.output.push_back(static_cast<char>(tape[ptr]));
+        break;
+      case ',':
+        if (inputPos < input.size()) {
+          tape[ptr] = static_cast<std::uint8_t>(input[inputPos++]);
+        }
+        break;
+      case '[':
+        if (tape[ptr] == 0) {
+          pc = jumps[pc];
+        }
+        break;
+      case ']':
+        if (tape[ptr] != 0) {
+          pc = jumps[pc];
+        }
+        break;
+      default:
+        break;
+    }
+  }
+  result.isHalted = true;
+  return result;
+}
+
+
+/*!
+ * @brief 生成したバイナリを実行可能なファイルとして書き出す
+ *
+ * @param [in] filePath  書き出すファイルのパス
+ * @param [in] image  生成したバイナリ
+ * @return 書き出せた場合は true
+ */
+inline bool
+writeExecutable(const std::string& filePath, const std::vector<std::uint8_t>& image) noexcept
+{
+  const auto fd = ::open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0700);
+  if (fd == -1) {
+    return false;
+  }
+  auto p = image.data();
+  auto rest = image.size();
+  while (rest > 0) {
+    const auto n = ::write(fd, p, rest);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    p += n;
+    rest -= static_cast<std::size_t>(n);
+  }
+  return ::close(fd) == 0 && rest == 0;
+}
+
+
+/*!
+ * @brief 子プロセスの終了を待ち，終了させたシグナルの番号を返す
+ *
+ * Brainf**k のプログラムに終了ステータスの規定は無いので，シグナルで終了したかどうかのみを見る．
+ *
+ * @param [in] pid  子プロセスのプロセスID
+ * @return 終了させたシグナルの番号 (シグナルで終了しなかった場合は0，待てなかった場合は -1)
+ */
+inline int
+waitProcess(pid_t pid) noexcept
+{
+  int status;
+  while (::waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  return WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+}
+
+
+/*!
+ * @brief 実行ファイルを実行し，標準出力の内容を受け取る
+ *
+ * 制限時間を過ぎても停止しない場合は SIGKILL で終了させる．
+ *
+ * @param [in] filePath  実行ファイルのパス
+ * @param [in] inputPath  標準入力とするファイルのパス
+ * @param [in] timeout  制限時間
+ * @param [out] result  実行結果の格納先
+ * @return 起動できた場合は true
+ */
+inline bool
+runExecutable(
+  const std::string& filePath,
+  const std::string& inputPath,
+  std::chrono::milliseconds timeout,
+  RunResult& result)
+{
+  int fds[2];
+  if (::pipe2(fds, O_CLOEXEC) == -1) {
+    return false;
+  }
+  ::posix_spawn_file_actions_t actions;
+  ::posix_spawn_file_actions_init(&actions);
+  ::posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, inputPath.c_str(), O_RDONLY, 0);
+  ::posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+  char* const argv[] = {const_cast<char*>(filePath.c_str()), nullptr};
+  pid_t pid;
+  const auto isSpawned = ::posix_spawn(&pid, filePath.c_str(), &actions, nullptr, argv, environ) == 0;
+  ::posix_spawn_file_actions_destroy(&actions);
+  ::close(fds[1]);
+  if (!isSpawned) {
+    ::close(fds[0]);
+    return false;
+  }
+
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  char buffer[4096];
+  for (;;) {
+    const auto rest = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+    if (rest.count() <= 0) {
+      ::kill(pid, SIGKILL);
+      result.isTimedOut = true;
+      break;
+    }
+    ::pollfd pollFd{fds[0], POLLIN, 0};
+    if (::poll(&pollFd, 1, static_cast<int>(rest.count())) == -1 && errno != EINTR) {
+      ::kill(pid, SIGKILL);
+      break;
+    }
+    if (pollFd.revents == 0) {
+      continue;
+    }
+    const auto n = ::read(fds[0], buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    result.output.append(buffer, static_cast<std::size_t>(n));
+  }
+  ::close(fds[0]);
+  result.signal = waitProcess(pid);
+  return true;
+}
+
+
+/*!
+ * @brief 2つの出力が最初に異なる位置を返す
+ *
+ * @param [in] expected  期待する出力
+ * @param [in] actual  実際の出力
+ * @return 最初に異なる位置 (一方が他方の先頭部分であれば短い方の長さ)
+ */
+inline std::size_t
+findMismatch(std::string_view expected, std::string_view actual) noexcept
+{
+  const auto n = std::min(expected.size(), actual.size());
+  return static_cast<std::size_t>(std::mismatch(expected.begin(), expected.begin() + n, actual.begin()).first - expected.begin());
+}
+
+
+/*!
+ * @brief 1つのプログラムについて，生成した実行ファイルと参照インタプリタの結果を比較する
+ *
+ * @param [in] srcFilePath  ソースファイルのパス
+ * @param [in] options  コンパイルオプション
+ * @param [in,out] fragmentCache  差分コンパイルに用いるキャッシュ (nullptr のときは用いない)
+ * @param [in] tmpFilePath  実行ファイルを書き出す一時ファイルのパス
+ * @return 失敗した理由 (一致した場合は空文字列)
+ */
+inline std::string
+testProgram(
+  const std::filesystem::path& srcFilePath,
+  const bfc::Options& options,
+  bfc::FragmentCache* fragmentCache,
+  const std::string& tmpFilePath)
+{
+  auto inputPath = srcFilePath;
+  inputPath.replace_extension(".in");
+  const auto source = readWholeFile(srcFilePath);
+  const auto input = readWholeFile(inputPath);
+
+  auto testOptions = options;
+  std::vector<std::string> warnings;
+  testOptions.warningHandler = [&warnings](const std::string& message) {
+    warnings.push_back(message);
+  };
+  std::vector<std::uint8_t> image;
+  try {
+    bfc::compile(source, testOptions, image);
+  } catch (const bfc::CompileError& e) {
+    return std::string{"compile error: "} + e.what();
+  }
+  // 直前のプログラムの断片が残ったキャッシュで生成し，続けて全ての断片を再利用して同じバイナリになるか確かめる
+  if (fragmentCache != nullptr) {
+    const auto normalizedSource = bfc::normalizeSource(source);
+    std::vector<std::uint8_t> reusedImage;
+    bfc::compile(normalizedSource, testOptions, image, fragmentCache);
+    warnings.clear();
+    bfc::compile(normalizedSource, testOptions, reusedImage, fragmentCache);
+    if (fragmentCache->getReusedCount() != fragmentCache->getFragmentCount()) {
+      return "only " + std::to_string(fragmentCache->getReusedCount()) + " of "
+        + std::to_string(fragmentCache->getFragmentCount()) + " fragments were reused";
+    }
+    if (reusedImage != image) {
+      return "recompiling with all fragments reused changed the binary";
+    }
+  }
+  auto warningsPath = srcFilePath;
+  warningsPath.replace_extension(".warnings");
+  // 警告は現在 x64 ELF のみが報告する
+  if (options.target == bfc::Target::ElfX64 && warnings != readWarnings(warningsPath)) {
+    std::string message = "unexpected warnings:";
+    for (const auto& warning : warnings) {
+      message += "\n    " + warning;
+    }
+    return message;
+  }
+
+  const auto expected = interpret(source, input);
+  if (!writeExecutable(tmpFilePath, image)) {
+    return "failed to write " + tmpFilePath;
+  }
+  RunResult actual;
+  const auto isStarted = runExecutable(
+    tmpFilePath,
+    std::filesystem::exists(inputPath) ? inputPath.string() : "/dev/null",
+    expected.isHalted ? kHaltTimeout : kNonHaltTimeout,
+    actual);
+  std::filesystem::remove(tmpFilePath);
+  if (!isStarted) {
+    return "failed to run the executable";
+  }
+
+  if (expected.isHalted) {
+    if (actual.isTimedOut) {
+      return "the executable did not halt";
+    }
+    if (actual.signal != 0) {
+      return "the executable was killed by signal " + std::to_string(actual.signal);
+    }
+    if (actual.output != expected.output) {
+      return "output differs at byte " + std::to_string(findMismatch(expected.output, actual.output))
+        + " (expected " + std::to_string(expected.output.size()) + " bytes, got "
+        + std::to_string(actual.output.size()) + " bytes)";
+    }
+  } else {
+    // 出力はバッファリングされ得るので，打ち切るまでに書き込まれた分が参照の先頭と一致すればよい
+    if (!actual.isTimedOut) {
+      return "the executable halted although the reference interpreter did not";
+    }
+    if (actual.output.size() > expected.output.size()
+        || findMismatch(expected.output, actual.output) != actual.output.size()) {
+      return "output before the timeout differs at byte " + std::to_string(findMismatch(expected.output, actual.output));
+    }
+  }
+  return std::string{};
+}
+}  // namespace
+
+
+/*!
+ * @brief このプログラムのエントリポイント
+ *
+ * @param [in] argc  コマンドライン引数の数
+ * @param [in] argv  コマンドライン引数
+ * @return  終了ステータス (全てのプログラムが一致した場合は0)
+ */
+int
+main(int argc, char* argv[])
+{
+  TestConfig config;
+  if (const auto status = parseArguments(argc, argv, config); status != -1) {
+    return status;
+  }
+
+  std::vector<std::filesystem::path> srcFilePaths;
+  std::error_code ec;
+  for (const auto& entry : std::filesystem::directory_iterator{config.corpusDir, ec}) {
+    if (entry.path().extension() == ".bf") {
+      srcFilePaths.push_back(entry.path());
+    }
+  }
+  if (ec || srcFilePaths.empty()) {
+    std::cerr << "No *.bf found in " << config.corpusDir << std::endl;
+    return 1;
+  }
+  std::sort(srcFilePaths.begin(), srcFilePaths.end());
+
+  const auto tmpFilePath = (std::filesystem::temp_directory_path() / ("bfdifftest-" + std::to_string(::getpid()))).string();
+  std::unique_ptr<bfc::FragmentCache> fragmentCache;
+  if (config.isFragmentCacheUsed) {
+    fragmentCache = std::make_unique<bfc::FragmentCache>();
+  }
+  std::size_t nFailed = 0;
+  for (const auto& srcFilePath : srcFilePaths) {
+    std::string message;
+    try {
+      message = testProgram(srcFilePath, config.options, fragmentCache.get(), tmpFilePath);
+    } catch (const std::exception& e) {
+      message = e.what();
+    }
+    if (message.empty()) {
+      std::cout << "PASS " << srcFilePath.filename().string() << "\n";
+    } else {
+      std::cout << "FAIL " << srcFilePath.filename().string() << ": " << message << "\n";
+      nFailed++;
+    }
+  }
+  std::cout << srcFilePaths.size() << " programs: " << srcFilePaths.size() - nFailed << " passed, "
+            << nFailed << " failed" << std::endl;
+  return nFailed == 0 ? 0 : 1;
+}
@@ -0,0 +1,204 @@
+/*!
+ * @brief 生成した実行ファイルの実行のテスト
+ *
+ * runExecutable() と runImage() で生成した実行ファイルを実行し，
+ * 標準出力への書き込みと終了ステータスが期待どおりであることを確かめる．
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bfcompiler.hpp"
+#include "fileutil.hpp"
+#include "process.hpp"
+
+
+namespace
+{
+//! 'A' を出力して終了するソースコード
+constexpr char kHelloSource[] = "++++++++[>++++++++<-]>+.";
+//! テープの先頭より前に書き込み続けて異常終了するソースコード
+constexpr char kCrashSource[] = "+[<+]";
+
+
+/*!
+ * @brief ファイル全体を読み込む
+ *
+ * @param [in] filePath  読み込むファイルのパス
+ * @return ファイルの内容 (存在しない場合は空文字列)
+ */
+inline std::string
+readWholeFile(const std::filesystem::path& filePath)
+{
+  std::ifstream ifs{filePath, std::ios::binary};
+  return std::string{std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{}};
+}
+
+
+/*!
+ * @brief 標準出力をファイルに向けた状態で関数を呼び出す
+ *
+ * 子プロセスは標準出力を継承するので，実行したプログラムの出力をファイルに受け取れる．
+ *
+ * @tparam F  呼び出す関数の型
+ * @param [in] outputPath  標準出力とするファイルのパス
+ * @param [in] f  呼び出す関数
+ * @return f の戻り値 (標準出力を切り替えられなかった場合は -2)
+ */
+template<typename F>
+inline int
+callWithStdout(const std::string& outputPath, F&& f)
+{
+  std::fflush(stdout);
+  std::cout.flush();
+  const auto fd = ::open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd == -1) {
+    return -2;
+  }
+  const auto savedFd = ::dup(STDOUT_FILENO);
+  ::dup2(fd, STDOUT_FILENO);
+  ::close(fd);
+  const auto status = f();
+  ::dup2(savedFd, STDOUT_FILENO);
+  ::close(savedFd);
+  return status;
+}
+
+
+/*!
+ * @brief 実行結果を確かめる
+ *
+ * @param [in] name  実行方法の説明
+ * @param [in] status  終了ステータス
+ * @param [in] expectedStatus  期待する終了ステータス
+ * @param [in] output  標準出力に書き込まれた内容
+ * @param [in] expectedOutput  期待する出力
+ * @return 失敗した理由 (成功した場合は空文字列)
+ */
+inline std::string
+checkResult(
+  const std::string& name,
+  int status,
+  int expectedStatus,
+  const std::string& output,
+  const std::string& expectedOutput)
+{
+  if (status != expectedStatus) {
+    return name + ": exit status " + std::to_string(status) + " (expected " + std::to_string(expectedStatus) + ")";
+  }
+  if (output != expectedOutput) {
+    return name + ": unexpected output \"" + output + "\"";
+  }
+  return std::string{};
+}
+
+
+/*!
+ * @brief ファイルに書き出した実行ファイルの実行を確かめる
+ *
+ * @param [in] tmpDir  実行ファイルと出力を置く一時ディレクトリ
+ * @return 失敗した理由 (成功した場合は空文字列)
+ */
+inline std::string
+testRunExecutable(const std::filesystem::path& tmpDir)
+{
+  bfc::Options options;
+  options.target = bfc::Target::ElfX64;
+  const auto filePath = (tmpDir / "hello").string();
+  const auto outputPath = (tmpDir / "stdout").string();
+  if (!bfc::writeImageFile(filePath, bfc::compile(kHelloSource, options), true)) {
+    return "failed to write " + filePath;
+  }
+  const auto status = callWithStdout(outputPath, [&filePath] {
+    return bfc::runExecutable(filePath);
+  });
+  if (auto message = checkResult("hello", status, 0, readWholeFile(outputPath), "A"); !message.empty()) {
+    return message;
+  }
+  if (const auto missing = bfc::runExecutable((tmpDir / "missing").string()); missing != -1) {
+    return "a missing file is started with status " + std::to_string(missing);
+  }
+  return std::string{};
+}
+
+
+/*!
+ * @brief メモリ上の実行ファイルの実行を確かめる
+ *
+ * @param [in] tmpDir  出力を置く一時ディレクトリ
+ * @return 失敗した理由 (成功した場合は空文字列)
+ */
+inline std::string
+testRunImage(const std::filesystem::path& tmpDir)
+{
+  bfc::Options options;
+  options.target = bfc::Target::ElfX64;
+  const auto outputPath = (tmpDir / "stdout").string();
+  const auto hello = bfc::compile(kHelloSource, options);
+  auto status = callWithStdout(outputPath, [&hello] {
+    return bfc::runImage(hello);
+  });
+  if (auto message = checkResult("hello", status, 0, readWholeFile(outputPath), "A"); !message.empty()) {
+    return message;
+  }
+  const auto crash = bfc::compile(kCrashSource, options);
+  status = callWithStdout(outputPath, [&crash] {
+    return bfc::runImage(crash);
+  });
+  return checkResult("crash", status, 128 + SIGSEGV, readWholeFile(outputPath), "");
+}
+}  // namespace
+
+
+/*!
+ * @brief このプログラムのエントリポイント
+ *
+ * @return  終了ステータス (全てのテストに成功した場合は0)
+ */
+int
+main()
+{
+  const auto tmpDir = std::filesystem::temp_directory_path() / ("bfprocesstest-" + std::to_string(::getpid()));
+  std::filesystem::create_directories(tmpDir);
+
+  struct
+  {
+    const char* name;
+    std::string (*run)(const std::filesystem::path&);
+  } tests[] = {
+    {"runExecutable", testRunExecutable},
+    {"runImage", testRunImage},
+  };
+  std::size_t nFailed = 0;
+  for (const auto& test : tests) {
+    std::string message;
+    try {
+      message = test.run(tmpDir);
+    } catch (const std::exception& e) {
+      message = e.what();
+    }
+    if (message.empty()) {
+      std::cout << "PASS " << test.name << "\n";
+    } else {
+      std::cout << "FAIL " << test.name << ": " << message << "\n";
+      nFailed++;
+    }
+  }
+  std::filesystem::remove_all(tmpDir);
+  std::cout << nFailed << " failed" << std::endl;
+  return nFailed == 0 ? 0 : 1;
+}
@@ -0,0 +1,341 @@
+/*!
+ * @brief コンパイルサーバのテスト
+ *
+ * 子プロセスで一時ディレクトリのソケットファイルにサーバを起動し，
+ * 通信規約に従って要求を送って，応答と書き込まれた出力ファイルが compile() の結果と一致することを確かめる．
+ *
+ * @author  koturn
+ * @date    2020 05/30
+ * @version 1.0
+ */
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bfcompiler.hpp"
+#include "cache.hpp"
+#include "protocol.hpp"
+#include "server.hpp"
+
+
+namespace
+{
+//! サーバの待ち受け開始を待つ時間の上限
+constexpr std::chrono::milliseconds kStartTimeout{5000};
+//! テストに用いるソースコード
+constexpr char kSource[] = "++++++++[>++++++++<-]>+. prints 'A'";
+//! 停止しないループの警告が出るソースコード
+constexpr char kWarningSource[] = "++++++[----]";
+//! kWarningSource の警告メッセージ
+constexpr char kWarnings[] = "Loop at offset 6 never terminates\n";
+
+
+/*!
+ * @brief 受信した応答
+ */
+struct Response
+{
+  //! 応答の状態
+  bfc::ResponseStatus status = bfc::ResponseStatus::BadRequest;
+  //! キャッシュから出力ファイルを配置したかどうか
+  bool isCacheHit = false;
+  //! ペイロード
+  std::string payload{};
+  //! 改行区切りの警告メッセージ
+  std::string warnings{};
+};
+
+
+/*!
+ * @brief ファイル全体を読み込む
+ *
+ * @param [in] filePath  読み込むファイルのパス
+ * @return ファイルの内容 (存在しない場合は空文字列)
+ */
+inline std::string
+readWholeFile(const std::filesystem::path& filePath)
+{
+  std::ifstream ifs{filePath, std::ios::binary};
+  return std::string{std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{}};
+}
+
+
+/*!
+ * @brief サーバに接続する
+ *
+ * サーバの待ち受け開始を待つため，接続できるまで kStartTimeout の間再試行する．
+ *
+ * @param [in] socketPath  ソケットファイルのパス
+ * @return 接続のファイルディスクリプタ (接続できなかった場合は -1)
+ */
+inline int
+connectServer(const std::string& socketPath)
+{
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  socketPath.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+  const auto deadline = std::chrono::steady_clock::now() + kStartTimeout;
+  do {
+    const auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+      return -1;
+    }
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0) {
+      return fd;
+    }
+    ::close(fd);
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  } while (std::chrono::steady_clock::now() < deadline);
+  return -1;
+}
+
+
+/*!
+ * @brief 要求を送信する
+ *
+ * @param [in] fd  接続のファイルディスクリプタ
+ * @param [in] header  要求のヘッダ (出力ファイルのパスとソースコードの長さはこの関数で設定する)
+ * @param [in] dstFilePath  出力ファイルのパス
+ * @param [in] source  ソースコード
+ * @return 送信できた場合は true
+ */
+inline bool
+sendRequest(int fd, bfc::RequestHeader header, const std::string& dstFilePath, const std::string& source)
+{
+  header.dstPathSize = static_cast<std::uint32_t>(dstFilePath.size());
+  header.sourceSize = source.size();
+  return bfc::writeFully(fd, &header, sizeof(header))
+    && bfc::writeFully(fd, dstFilePath.data(), dstFilePath.size())
+    && bfc::writeFully(fd, source.data(), source.size());
+}
+
+
+/*!
+ * @brief 応答を受信する
+ *
+ * @param [in] fd  接続のファイルディスクリプタ
+ * @param [out] response  受信した応答
+ * @return 受信できた場合は true
+ */
+inline bool
+receiveResponse(int fd, Response& response)
+{
+  bfc::ResponseHeader header;
+  if (!bfc::readFully(fd, &header, sizeof(header))) {
+    return false;
+  }
+  response.status = static_cast<bfc::ResponseStatus>(header.status);
+  response.isCacheHit = header.isCacheHit != 0;
+  response.payload.resize(header.payloadSize);
+  response.warnings.resize(header.warningsSize);
+  return bfc::readFully(fd, response.payload.data(), response.payload.size())
+    && bfc::readFully(fd, response.warnings.data(), response.warnings.size());
+}
+
+
+/*!
+ * @brief x64 ELF の実行ファイルを要求するヘッダを返す
+ *
+ * @param [in] isReturnImage  生成したバイナリを応答として返させるかどうか
+ * @return 要求のヘッダ
+ */
+inline bfc::RequestHeader
+makeHeader(bool isReturnImage) noexcept
+{
+  bfc::RequestHeader header{};
+  header.magic = bfc::kProtocolMagic;
+  header.target = static_cast<std::uint8_t>(bfc::Target::ElfX64);
+  header.isReturnImage = static_cast<std::uint8_t>(isReturnImage);
+  return header;
+}
+
+
+/*!
+ * @brief 1つの接続で複数の要求を送り，それぞれの応答を確かめる
+ *
+ * @param [in] socketPath  ソケットファイルのパス
+ * @param [in] tmpDir  出力ファイルを置く一時ディレクトリ
+ * @return 失敗した理由 (成功した場合は空文字列)
+ */
+inline std::string
+testRequests(const std::string& socketPath, const std::filesystem::path& tmpDir)
+{
+  const auto fd = connectServer(socketPath);
+  if (fd == -1) {
+    return "failed to connect to the server";
+  }
+  bfc::Options options;
+  options.target = bfc::Target::ElfX64;
+  const auto dstFilePath = (tmpDir / "a.out").string();
+
+  const struct
+  {
+    //! 要求の説明
+    const char* name;
+    //! 生成したバイナリを応答として返させるかどうか
+    bool isReturnImage;
+    //! 出力ファイルのパス
+    std::string dstFilePath;
+    //! ソースコード
+    std::string source;
+    //! 期待する応答の状態
+    bfc::ResponseStatus status;
+    //! キャッシュから配置されることを期待するかどうか
+    bool isCacheHit;
+    //! 期待する警告メッセージ
+    const char* warnings;
+  } requests[] = {
+    {"return image", true, "", kSource, bfc::ResponseStatus::Succeeded, false, ""},
+    {"write output", false, dstFilePath, kSource, bfc::ResponseStatus::Succeeded, false, ""},
+    {"cached output", false, dstFilePath, kSource, bfc::ResponseStatus::Succeeded, true, ""},
+    {"syntax error", true, "", "+[", bfc::ResponseStatus::Failed, false, ""},
+    {"relative path", false, "a.out", kSource, bfc::ResponseStatus::Failed, false, ""},
+    {"return image again", true, "", kSource, bfc::ResponseStatus::Succeeded, false, ""},
+    {"warnings with image", true, "", kWarningSource, bfc::ResponseStatus::Succeeded, false, kWarnings},
+    {"warnings with output", false, dstFilePath, kWarningSource, bfc::ResponseStatus::Succeeded, false, kWarnings},
+    {"warnings from cache", false, dstFilePath, kWarningSource, bfc::ResponseStatus::Succeeded, true, kWarnings},
+  };
+  std::string message;
+  for (const auto& request : requests) {
+    Response response;
+    if (!sendRequest(fd, makeHeader(request.isReturnImage), request.dstFilePath, request.source)
+        || !receiveResponse(fd, response)) {
+      message = std::string{request.name} + ": the connection was closed";
+      break;
+    }
+    if (response.status != request.status) {
+      message = std::string{request.name} + ": unexpected status " + std::to_string(static_cast<int>(response.status))
+        + " (" + response.payload + ")";
+      break;
+    }
+    if (response.status != bfc::ResponseStatus::Succeeded) {
+      if (response.payload.empty()) {
+        message = std::string{request.name} + ": no diagnostic message";
+        break;
+      }
+      continue;
+    }
+    if (response.isCacheHit != request.isCacheHit) {
+      message = std::string{request.name} + ": expected a cache " + (request.isCacheHit ? "hit" : "miss");
+      break;
+    }
+    if (response.warnings != request.warnings) {
+      message = std::string{request.name} + ": unexpected warnings \"" + response.warnings + "\"";
+      break;
+    }
+    const auto image = bfc::compile(request.source, options);
+    if ((request.isReturnImage ? response.payload : readWholeFile(dstFilePath)) != std::string{image.begin(), image.end()}) {
+      message = std::string{request.name} + ": the image differs from the output of compile()";
+      break;
+    }
+  }
+  ::close(fd);
+  return message;
+}
+
+
+/*!
+ * @brief 誤った識別子の要求を拒否して接続を閉じることを確かめる
+ *
+ * @param [in] socketPath  ソケットファイルのパス
+ * @return 失敗した理由 (成功した場合は空文字列)
+ */
+inline std::string
+testBadRequest(const std::string& socketPath, const std::filesystem::path&)
+{
+  const auto fd = connectServer(socketPath);
+  if (fd == -1) {
+    return "failed to connect to the server";
+  }
+  // サーバはヘッダを読んだ時点で拒否するので，ヘッダのみを送る
+  auto header = makeHeader(true);
+  header.magic = 0;
+  Response response;
+  std::string message;
+  if (!bfc::writeFully(fd, &header, sizeof(header)) || !receiveResponse(fd, response)) {
+    message = "no response";
+  } else if (response.status != bfc::ResponseStatus::BadRequest) {
+    message = "the request is not rejected";
+  } else if (char c; ::read(fd, &c, 1) != 0) {
+    message = "the connection is left open";
+  }
+  ::close(fd);
+  return message;
+}
+}  // namespace
+
+
+/*!
+ * @brief このプログラムのエントリポイント
+ *
+ * @return  終了ステータス (全てのテストに成功した場合は0)
+ */
+int
+main()
+{
+  const auto tmpDir = std::filesystem::temp_directory_path() / ("bfservertest-" + std::to_string(::getpid()));
+  std::filesystem::create_directories(tmpDir);
+  const auto socketPath = (tmpDir / "server.sock").string();
+
+  // サーバが接続を閉じた後に書き込んでも終了しないようにする
+  std::signal(SIGPIPE, SIG_IGN);
+  const auto pid = ::fork();
+  if (pid == -1) {
+    std::cerr << "Failed to fork" << std::endl;
+    return 1;
+  }
+  if (pid == 0) {
+    // テストが異常終了してもサーバが残らないようにする
+    ::prctl(PR_SET_PDEATHSIG, SIGKILL);
+    const bfc::CompileCache cache{(tmpDir / "cache").string()};
+    ::_exit(bfc::runServer(socketPath, &cache, 2));
+  }
+
+  struct
+  {
+    const char* name;
+    std::string (*run)(const std::string&, const std::filesystem::path&);
+  } tests[] = {
+    {"requests", testRequests},
+    {"bad request", testBadRequest},
+  };
+  std::size_t nFailed = 0;
+  for (const auto& test : tests) {
+    std::string message;
+    try {
+      message = test.run(socketPath, tmpDir);
+    } catch (const std::exception& e) {
+      message = e.what();
+    }
+    if (message.empty()) {
+      std::cout << "PASS " << test.name << "\n";
+    } else {
+      std::cout << "FAIL " << test.name << ": " << message << "\n";
+      nFailed++;
+    }
+  }
+
+  ::kill(pid, SIGKILL);
+  int status;
+  while (::waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+  }
+  std::filesystem::remove_all(tmpDir);
+  std::cout << nFailed << " failed" << std::endl;
+  return nFailed == 0 ? 0 : 1;
+}
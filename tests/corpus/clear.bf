@@ -0,0 +1,5 @@
+消去と範囲の消去
++>++>+++>++++>+++++<<<<
+[-]>[-]>[-]<<[>+++++++++++++++++++++++++++++++++++++++++++++++++<-]>.>>.>.>.
+>>>>+>+>+>+>+<<<<<[[-]>]>.>.
+<<<<<<<<<<+++++++++++++++++++++++++++++++++++++++++++++++++.  1
@@ -0,0 +1,4 @@
+Brainf**k の命令以外の文字を大量に含むソース
++p(F3gad{+@0f#W_u aHCs1N#"#{m!VA^#+B`gnCRC~BbK"\oz0;xK3Ph^h}=LJsghXs+eE+\}:Tn~U/`|i18jXUf#d%MvsrX+9hC!?mnCYi+qSbH|nu Wi4jo@^'eTpn?h+fS\R lmwvPbt#Cy:nr;/nF$~)*+a++EH2w;RK(98Fk9|HzK+Ogd2#MWQ\=G1Fi@u_"B"X6$8ah~^m+xjaBk{#X~qO|x^+L4A+M))+L8\pF4!o$sApb9wi$V?+0@q~_s=g1}WKhg"OvYJ"8?+p5Q^AH~0VnRlflD(%*59+lAHPthFUQQ+KDuf5rn+O%Z)V6+Q2vsV)qn+p*HTKpl2bI1%K!+}!/Z2%=Ds\82a9D81_VmKnFeN0@{N%#!KtNaXNY+(Ntb+FAwmd|S+;m@M?ET*I/a/{qzQ+WM%O;NrLEP0mvr+/EB"EY)Hn))"y!KSgd70hO)i}::76NM1iuK4@6+$Nw~n@:L_l8&}EF(a_nFm`lb!XQ9Gf#z\q+'+r5s45GIXpY:v/Cf :kNh{`+BDNgeBZQov{IzB&)izU8i@MLLnU9ct*3uiqV:7F^+p&gXyRWi9m%k/+x0H*5v|*`DV_X9O`+wfA3_tlZ+|KIEVo +k`r"#xuEG@:J+m?HMrFa9m+f\3@qW@J1#3p!mK~{5)hUq+_h~SkO 3`aRMmYQqg2z+V@o Iyti?ctjZM9aw}k?Tk ~+r^YQwr(gEy{Kx"Zx7yXH:)u!+GZmL7cGf9ci%Hi0s^(S(|`+9+8/YyIuL@k@DPH()j|Ucio&9L{oHSvCXo+:eGvPBGvE|#wYN_EH=)x9r`r6+Gbk855`TMYD2@M(1CXOg0;%'t"A$gkv`Q|I3v:+BYCgaV+CDJcnrWAaG+gs2A*%! eNWrJ?Y8z7#!W+}m'pVF4*c+!$l'k4%I3_/=#gy4I=|+WPxHGzyEE'ss:R^uoyj'SnZl?l^|+Hv)F+07'@^%&y/id+U0N%4l$`}4Xa#kH/FO*L$W'GN4GV2~L0+Eho@PQiXre14{akorjl#K8?UWjO+ZR4q(%+{lN\LNSHOjh!k37NOOq+aIeb+V*r'5&kfqFEqQTzUYMctQlh+#6FBp52;Zw+0mH+@G(xqk.)Az:i
+																																																																						
+>xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ｘｘｘｘｘｘｘｘｘｘｘｘｘｘｘｘｘｘｘｘ.
@@ -0,0 +1,6 @@
+コンパイル時に値の分かるセルの出力と入力の順序
+++++++++[>++++++++<-]>+.+.+.
+,.
+>++++++++++.<+.
+,.,.
+>.
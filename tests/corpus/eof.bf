@@ -0,0 +1,3 @@
+EOF ではセルの値を変更しない
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++,.  A
+,[.[-],]
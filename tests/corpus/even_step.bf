@@ -0,0 +1,7 @@
+偶数の刻みで制御するループ
+++++++++++[-->+<]>.                     10を2ずつ減らして5回
+>--[++>+<]>.                            254に2ずつ足して1回
+>----[---->+<]>.                        252を4ずつ減らして63回
+>+++[--->++<]>.                         3を3ずつ減らして1回で2
+>+[--->+<]>.                            1を3ずつ減らすと171回で0
+>-[+++++>+<]>.                          255に5ずつ足すと51回で0
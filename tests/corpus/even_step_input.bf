@@ -0,0 +1,5 @@
+入力から読んだ値で偶数の刻みのループを制御する
+,[-->+<]>.                              100を2ずつ減らして50回
+>,[---->++<]>.                          128を4ずつ減らして32回
+>,[--->+<]>.                            7を3ずつ減らすと87回で0
+>,[++++++>+<]>.                         254に6ずつ足すと43回で0
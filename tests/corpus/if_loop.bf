@@ -0,0 +1,4 @@
+高々1回しか実行されないループ
+++++++[>+++++++<-]>[<+>[-]]<.    1回だけ実行される
+>>[<+++>[-]]<.                    実行されない
+>+++++++++++++++++++++++++++++++++++++++++++++++++++++>+[<+>-]<.
@@ -0,0 +1,4 @@
+出力バッファの大きさを超える入出力
+,[.[-],]
+++++++++[>++++++++<-]>+
+>++++++++++++++++++++[>+++++++++++++++++++++++++[>++++++++++[<<<.>>>-]<-]<-]
@@ -0,0 +1,5 @@
+加減算とポインタの移動が混在する連続
++++--+-+>++-->>+-+<<<->-+-+>+++<<>><>
+<<++++++++++++++++++++++++++++++++++++++++++++++++.>.>.>.
++-+-+-<>-+><<>+.
+>>>>>>>>><<<<<<<<<<+-.
@@ -0,0 +1,6 @@
+セルの移動と走査
+>>>+++++>++++>+++>++>+<<<<<<
+>>>[[->>>>>>>>+<<<<<<<<]>]
+>>>>>>>[<]>[+++++++++++++++++++++++++++++++++++++++++++++++++.>]
+<[<]<[<]>.
+>>>>>>>>>>>>>>>>>>>>+>>>>+>>>>+<<<<<<<<[>>>>]<<<<[<<<<]>>>>+++++++++++++++++++++++++++++++++++++++++++++++++.
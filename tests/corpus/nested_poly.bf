@@ -0,0 +1,6 @@
+入れ子のループによる多項式
++++++[>+++++[>+++++[>+<-]<-]<-]>>>.          5の3乗は125
+>++++++++++[>++++++++++[>++++++++++[>+<-]<-]<-]>>>.  10の3乗は1000なので232
+>++++++++++++++++++++++++++++++[[->+>+<<]>>[-<<+>>]<<-]>.  1から30までの和は465なので209
+>>>+++++++[>++++++[>+++++[>++++[>+<-]<-]<-]<-]>>>>.  7かける6かける5かける4は840なので72
+>>+++++++++++[>+++[>--<-]+++++[>+++<-]<-]>>.  11かける (6引く15) は99 なので157
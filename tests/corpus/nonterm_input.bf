@@ -0,0 +1,3 @@
+入力の奇数の値から2ずつ減らすループ (静的には分からない)
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++.  A
+,[-->+<]>.
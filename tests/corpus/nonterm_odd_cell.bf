@@ -0,0 +1,3 @@
+奇数の値から2ずつ減らすループは停止しない
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++.  B
++[--]
@@ -0,0 +1,2 @@
+6から4ずつ減らすループは停止しない
+++++++[----]
@@ -0,0 +1,5 @@
+同じ部分プログラムの繰り返し
+++++++++[>++++++++<-]>+.
+>+++[>+.>+.>+.>+.>+.>+.>+.>+.<<<<<<<<-]
+>>>>>>>>>>>>++[>+.>+.>+.>+.>+.>+.>+.>+.<<<<<<<<-]
+>>>>>>>>>>>>+[>+.>+.>+.>+.>+.>+.>+.>+.<<<<<<<<-]
@@ -0,0 +1,6 @@
+連続するセルの更新
+>+>++>+++>++++>+++++>++++++>+++++++>++++++++<<<<<<<<
+++++++++++++++++++++++++++++++++++++++++++++++++[>+>+>+>+>+>+>+>+<<<<<<<<-]
+>.>.>.>.>.>.>.>.
+<<<<<<<<++++++++++++++++++++++++++++++++++++++++++++++++++.
+>>[-]>[-]+>-->+++<<<<[-]+++++[>>+>+>-<<<<-]>>.>.>.
@@ -0,0 +1,4 @@
+反復回数が静的に分かるループ
++++[>++.<-]
+++++[>>+.<<-]
+>>>++++++++[-<++++>]<.
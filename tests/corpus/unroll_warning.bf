@@ -0,0 +1,2 @@
+展開したループの中の停止しないループは1回だけ警告する
++++[>[-]+[++]<-]
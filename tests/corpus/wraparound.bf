@@ -0,0 +1,9 @@
+セルの値の桁あふれ
+-.                                      0から減らすと255
++.                                      255に足すと0
+++++++++++++++++[>++++++++++++++++<-]>. 16かける16は256なので0
++.                                      1
+>-[>+<-------]>.                        255から7ずつ減らして0になるまでの回数は73
+>+++++[<+++++++++++++++++++++++++++++++++++++++++++++++++++++++++>-]<. 5かける57は285なので29
+>-[-]+.                                 負のセルの消去
+>>+++++++++[<+++++++++++++++++++++++++++++++++++>-]<[>-<-]>.  0から315を引くと197